@@ -79,6 +79,8 @@ domain_info(ipmi_domain_t *domain, void *cb_data)
     ipmi_cmd_info_t *cmd_info = cb_data;
     char            domain_name[IPMI_DOMAIN_NAME_LEN];
     unsigned char   guid[16];
+    unsigned int    i, count;
+    ipmi_time_t     total_time, max_time, wait_time;
 
     ipmi_domain_get_name(domain, domain_name, sizeof(domain_name));
 
@@ -93,6 +95,21 @@ domain_info(ipmi_domain_t *domain, void *cb_data)
 			 ipmi_domain_get_sel_rescan_time(domain));
     ipmi_cmdlang_out_int(cmd_info, "IPMB Rescan Time",
 			 ipmi_domain_get_ipmb_rescan_time(domain));
+    for (i=0; i<IPMI_DOMAIN_NUM_STAGES; i++) {
+	if (ipmi_domain_get_stage_stats(domain, i, &count, &total_time,
+					&max_time, &wait_time))
+	    continue;
+	if (count == 0)
+	    continue;
+	ipmi_cmdlang_out(cmd_info, "Startup Stage", NULL);
+	ipmi_cmdlang_down(cmd_info);
+	ipmi_cmdlang_out(cmd_info, "Name", ipmi_domain_stage_name(i));
+	ipmi_cmdlang_out_int(cmd_info, "Count", count);
+	ipmi_cmdlang_out_timeout(cmd_info, "Total Time", total_time);
+	ipmi_cmdlang_out_timeout(cmd_info, "Max Time", max_time);
+	ipmi_cmdlang_out_timeout(cmd_info, "Wait Time", wait_time);
+	ipmi_cmdlang_up(cmd_info);
+    }
     ipmi_cmdlang_up(cmd_info);
 }
 
@@ -874,6 +874,7 @@ static char *usage_str =
 "  -x <string> - same as --execute\n"
 "  --dlock - turn on lock debugging.\n"
 "  --dmem - turn on memory debugging.\n"
+"  --mpools - use object pools for small memory allocations.\n"
 "  --drawmsg - turn on raw message tracing.\n"
 "  --dmsg - turn on message tracing debugging.\n"
 "  --dmsgerr - turn on printing out low-level message errors.\n"
@@ -939,6 +940,8 @@ main(int argc, char *argv[])
 	    use_debug_os = 1;
 	} else if (strcmp(arg, "--dmem") == 0) {
 	    DEBUG_MALLOC_ENABLE();
+	} else if (strcmp(arg, "--mpools") == 0) {
+	    MALLOC_POOLS_ENABLE();
 	} else if (strcmp(arg, "--drawmsg") == 0) {
 	    DEBUG_RAWMSG_ENABLE();
 	} else if (strcmp(arg, "--dmsg") == 0) {
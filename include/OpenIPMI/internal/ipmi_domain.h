@@ -147,10 +147,20 @@ int ipmi_domain_add_ipmb_ignore_range(ipmi_domain_t *domain,
    user to be deleted. */
 void ipmi_handle_unhandled_event(ipmi_domain_t *domain, ipmi_event_t *event);
 
-/* Handle a new event from something, usually from an SEL. */
-void _ipmi_domain_system_event_handler(ipmi_domain_t *domain,
-				       ipmi_mc_t     *mc,
-				       ipmi_event_t  *event);
+/* Handle a new event from something, usually from an SEL.  Returns
+   1 if the event was passed to the unhandled event handlers, 0 if
+   something else took it. */
+int _ipmi_domain_system_event_handler(ipmi_domain_t *domain,
+				      ipmi_mc_t     *mc,
+				      ipmi_event_t  *event);
+
+/* Deliver a batch of unhandled events to the batch event handlers.
+   The MC code collects these over a SEL fetch; don't bother
+   collecting if there are no batch handlers. */
+int _ipmi_domain_has_event_batch_handlers(ipmi_domain_t *domain);
+void _ipmi_domain_event_batch(ipmi_domain_t *domain,
+			      ipmi_event_t  **events,
+			      unsigned int  count);
 
 /* Returns the main SDR repository for the domain, or NULL if there is
    not one. */
@@ -257,6 +267,39 @@ int _ipmi_domain_in_shutdown(ipmi_domain_t *domain);
 void _ipmi_get_domain_fully_up(ipmi_domain_t *domain, char *name);
 void _ipmi_put_domain_fully_up(ipmi_domain_t *domain, char *name);
 
+/*
+ * The startup work for MCs and FRUs is run in stages through the
+ * domain, so the number of stages in flight can be limited (see
+ * IPMI_OPEN_OPTION_STARTUP_BUDGET) and the time each kind of stage
+ * takes can be measured.  The start function is called right away if
+ * the budget allows, otherwise when a running stage finishes.  The
+ * caller owns the stage structure, it must stay around until
+ * _ipmi_domain_stage_done() is called on it, and that must always be
+ * called once the stage is started, even if it fails.  If the domain
+ * is being destroyed, stages that are still waiting are started with
+ * cancelled set, the start function should just finish the stage.
+ */
+typedef struct ipmi_domain_stage_s ipmi_domain_stage_t;
+typedef void (*ipmi_domain_stage_cb)(ipmi_domain_t       *domain,
+				     ipmi_domain_stage_t *stage);
+struct ipmi_domain_stage_s
+{
+    unsigned int         type; /* IPMI_DOMAIN_STAGE_xxx */
+    ipmi_domain_stage_cb start;
+    void                 *cb_data;
+    int                  cancelled;
+    struct timeval       queued;
+    struct timeval       started;
+    ipmi_domain_stage_t  *next;
+};
+void _ipmi_domain_stage_start(ipmi_domain_t        *domain,
+			      ipmi_domain_stage_t  *stage,
+			      unsigned int         type,
+			      ipmi_domain_stage_cb start,
+			      void                 *cb_data);
+void _ipmi_domain_stage_done(ipmi_domain_t       *domain,
+			     ipmi_domain_stage_t *stage);
+
 /* Return connections for a domain. */
 int _ipmi_domain_get_connection(ipmi_domain_t *domain,
 				int           con_num,
@@ -273,6 +316,9 @@ int ipmi_option_set_sel_time(ipmi_domain_t *domain);
 int ipmi_option_activate_if_possible(ipmi_domain_t *domain);
 int ipmi_option_local_only(ipmi_domain_t *domain);
 int ipmi_option_use_cache(ipmi_domain_t *domain);
+unsigned int ipmi_option_sensor_reading_ttl(ipmi_domain_t *domain);
+unsigned int ipmi_option_startup_budget(ipmi_domain_t *domain);
+int ipmi_option_topology_snapshot(ipmi_domain_t *domain);
 
 void _ipmi_option_set_local_only_if_not_specified(ipmi_domain_t *domain,
 						  int           val);
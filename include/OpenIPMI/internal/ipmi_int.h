@@ -181,6 +181,9 @@ void _ipmi_domain_entity_lock(ipmi_domain_t *domain);
 void _ipmi_domain_entity_unlock(ipmi_domain_t *domain);
 void _ipmi_domain_mc_lock(ipmi_domain_t *domain);
 void _ipmi_domain_mc_unlock(ipmi_domain_t *domain);
+/* Lock/unlock the shared sensor reading state for the given domain. */
+void _ipmi_domain_sensor_reading_lock(ipmi_domain_t *domain);
+void _ipmi_domain_sensor_reading_unlock(ipmi_domain_t *domain);
 
 #ifdef IPMI_CHECK_LOCKS
 /* Various lock-checking information. */
@@ -77,6 +77,33 @@ extern int __ipmi_debug_malloc;
 #define DEBUG_MALLOC	(__ipmi_debug_malloc)
 #define DEBUG_MALLOC_ENABLE() __ipmi_debug_malloc = 1
 
+/* Serve small allocations from pools of fixed-size objects that are
+   kept for reuse when freed, with a small per-thread cache in front
+   of each pool.  This must be enabled before the OS handler is first
+   set up (by ipmi_init() or the like); it has no effect if malloc
+   debugging is on. */
+extern int __ipmi_malloc_pools;
+#define MALLOC_POOLS_ENABLE()	__ipmi_malloc_pools = 1
+
+typedef struct ipmi_mem_pool_stats_s
+{
+    unsigned int  size;   /* Largest allocation the pool serves. */
+    unsigned long total;  /* Objects the pool holds, in use or free. */
+    unsigned long free;   /* Objects on the shared free list.  Each
+			     thread may hold a few more in its cache. */
+    unsigned long hits;   /* Allocations served from a freed object. */
+    unsigned long misses; /* Allocations that had to go to the OS. */
+} ipmi_mem_pool_stats_t;
+
+/* Give all the free objects in the pools and in the calling thread's
+   cache back to the OS.  ipmi_shutdown() calls this; objects still
+   in use can be freed normally afterwards. */
+void ipmi_mem_pool_release(void);
+
+/* Number of pools, zero if pools are not enabled. */
+unsigned int ipmi_mem_pool_count(void);
+int ipmi_mem_pool_get_stats(unsigned int pool, ipmi_mem_pool_stats_t *stats);
+
 /* Used by the malloc code to generate logs.  If not set, logs will go
    nowhere. */
 extern void (*ipmi_malloc_log)(enum ipmi_log_type_e log_type,
@@ -181,6 +181,11 @@ int _ipmi_mc_get_device_id_data_from_rsp(ipmi_mc_t *mc, ipmi_msg_t *rsp);
    not.  Must be called with an error-free message. */
 int _ipmi_mc_device_data_compares(ipmi_mc_t *mc, ipmi_msg_t *rsp);
 
+/* Rebuild the get device id response (including the completion code)
+   the MC's data came from, so it can be saved and later fed back
+   into _ipmi_mc_get_device_id_data_from_rsp(). */
+void _ipmi_mc_get_device_id_rsp(ipmi_mc_t *mc, unsigned char data[16]);
+
 /* Called when a new MC has been added to the system, to kick of
    processing it. */
 int _ipmi_mc_handle_new(ipmi_mc_t *mc);
@@ -101,6 +101,15 @@ int ipmi_sel_set_new_event_handler(ipmi_sel_info_t               *sel,
 				   ipmi_sel_new_event_handler_cb handler,
 				   void                          *cb_data);
 
+/* This callback will be called at the end of every SEL fetch, after
+   the new event handler has been called for all the new events the
+   fetch found (if any), so the user can handle them as a batch. */
+typedef void (*ipmi_sel_new_events_done_cb)(ipmi_sel_info_t *sel,
+					    void            *cb_data);
+int ipmi_sel_set_new_events_done_handler(ipmi_sel_info_t             *sel,
+					 ipmi_sel_new_events_done_cb handler,
+					 void                        *cb_data);
+
 /* Fetch all the sels.  The array size should point to a value that
    holds the number of elements in the passed in array.  The
    array_size will be set to the actual number of elements put into
@@ -181,6 +181,21 @@ typedef struct ipmi_con_option_s
    this is ignored.*/
 #define IPMI_CON_MSG_OPTION_SIDE_EFFECTS	3
 
+/* The priority class of the message (set by ival), one of the
+   IPMI_CON_MSG_PRIORITY_xxx values below.  When a connection has too
+   many messages outstanding and has to queue them, higher priority
+   ones are sent first, though lower ones are not held back forever.
+   If not given, the connection picks one from the netfn and command:
+   chassis control and watchdog commands are interactive, SDR, FRU and
+   SEL reads are bulk, and everything else is normal.  If not
+   implemented, this is ignored. */
+#define IPMI_CON_MSG_OPTION_PRIORITY		4
+
+#define IPMI_CON_MSG_PRIORITY_INTERACTIVE	0
+#define IPMI_CON_MSG_PRIORITY_NORMAL		1
+#define IPMI_CON_MSG_PRIORITY_BULK		2
+#define IPMI_CON_MSG_NUM_PRIORITIES		3
+
 
 /* The data structure representing a connection.  The low-level handler
    fills this out then calls ipmi_init_con() with the connection. */
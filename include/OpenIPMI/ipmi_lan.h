@@ -175,6 +175,24 @@ int ipmi_lanp_setup_con(ipmi_lanp_parm_t *parms,
    5-6 should be enough for anything.  The value is set in parm_val */
 #define IPMI_LANP_MAX_OUTSTANDING_MSG_COUNT	12
 
+/* Turn on hedged requests for connections with two addresses.  If a
+   command without side effects to the BMC has not been answered by
+   the given percentile (1-99) of recent response times, a copy is
+   sent on the other address and the first response is used.  0, the
+   default, turns this off.  The value is set in parm_val. */
+#define IPMI_LANP_HEDGE_PERCENTILE		13
+
+/* Open this many authenticated sessions (1-4) to each address of the
+   BMC and spread independent commands across them, so a BMC that
+   handles sessions in parallel can work on more of them at once.
+   Event and session related commands stay on one primary session.
+   An address is reported up while any of its sessions work.  If
+   IPMI_LANP_MAX_OUTSTANDING_MSG_COUNT is not given, the default is
+   raised by the same factor.  The outstanding message limit is for
+   the whole connection, all the sessions share its 63 sequence
+   numbers.  The default is 1.  The value is set in parm_val. */
+#define IPMI_LANP_NUM_SESSIONS			14
+
 /*
  * Set up an IPMI LAN connection.  The boatload of parameters are:
  *
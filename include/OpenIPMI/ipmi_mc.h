@@ -154,7 +154,9 @@ int ipmi_mc_remove_fully_up_handler_cl(ipmi_mc_t              *mc,
 
    The sideeff version is for commands that have side effects.  This
    is primarily reserve commands, where if a link is slow a retransmit
-   can cause problems. */
+   can cause problems.  The prio version sends the command in the given
+   priority class, one of the IPMI_CON_MSG_PRIORITY_xxx values from
+   ipmi_conn.h; otherwise the connection picks one from the command. */
 typedef void (*ipmi_mc_response_handler_t)(ipmi_mc_t  *src,
 					   ipmi_msg_t *msg,
 					   void       *rsp_data);
@@ -168,6 +170,12 @@ int ipmi_mc_send_command_sideeff(ipmi_mc_t                  *mc,
 				 const ipmi_msg_t           *cmd,
 				 ipmi_mc_response_handler_t rsp_handler,
 				 void                       *rsp_data);
+int ipmi_mc_send_command_prio(ipmi_mc_t                  *mc,
+			      unsigned int               lun,
+			      const ipmi_msg_t           *cmd,
+			      int                        priority,
+			      ipmi_mc_response_handler_t rsp_handler,
+			      void                       *rsp_data);
 
 /* Reset the MC, either a cold or warm reset depending on the type.
    Note that the effects of a reset are not defined by IPMI, so this
@@ -95,5 +95,12 @@ int extcmd_setvals(sys_data_t *sys,
 int extcmd_checkvals(sys_data_t *sys, void *baseloc, const char *cmd,
 		     extcmd_info_t *ts, unsigned int count);
 
+/*
+ * Called when a child process has been reaped, so a co-process that
+ * is already gone is not killed or waited for (its pid may have been
+ * reused).  It is an ipmi_child_quit_t handler.
+ */
+void extcmd_child_quit(void *info, pid_t pid);
+
 
 #endif /* _EXTCMD_H_ */
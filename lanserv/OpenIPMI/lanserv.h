@@ -162,13 +162,22 @@ struct session_s
     unsigned char priv;
     unsigned char max_priv;
 
-    /* The number of seconds left before the session is shut down. */
-    unsigned int time_left;
+    /*
+     * Monotonic time of the last activity, in microseconds.  The
+     * timer goes off when the session should time out, and if there
+     * has been activity since then it is just restarted.
+     */
+    uint64_t last_active;
+    ipmi_timer_t *timer;
+    lanserv_data_t *lan;
 
     /* Address of the message that started the sessions. */
     void *src_addr;
     int  src_len;
 
+    /* Rate limit state for messages in the session, see lan_rate_t. */
+    uint64_t rate_tat;
+
     struct {
 	/* Function to call when the session closes */
 	void (*close_cb)(lmc_data_t *mc, uint32_t session_id, void *cb_data);
@@ -216,6 +225,55 @@ enum lanread_e {
     lanread_len
 };
 
+/*
+ * Stages a LAN message goes through, used to split up where the time
+ * for a message is spent.
+ */
+enum lan_stat_stage_e {
+    LAN_STAT_DECODE = 0,
+    LAN_STAT_INTEG,
+    LAN_STAT_DECRYPT,
+    LAN_STAT_HANDLER,
+    LAN_STAT_ENCRYPT,
+    LAN_STAT_SEND,
+    LAN_STAT_NUM_STAGES
+};
+
+typedef struct lan_stats_s
+{
+    uint64_t packets;
+    uint64_t drops; /* Messages that got no response. */
+    uint64_t auth_failures;
+    uint64_t decrypt_failures;
+    uint64_t sessions_opened;
+    uint64_t sessions_closed;
+    uint64_t sessions_timed_out;
+    uint64_t sessions_reclaimed;
+    uint64_t presession_rate_drops;
+    uint64_t session_rate_drops;
+
+    /* Time per message spent in each stage. */
+    stat_hist_t stage[LAN_STAT_NUM_STAGES];
+
+    /* Tracking for the message being handled, -1 if none. */
+    int cur_stage;
+    uint64_t stage_start;
+    uint64_t msg_ns[LAN_STAT_NUM_STAGES];
+    unsigned int msg_stages; /* Bitmask of stages entered. */
+} lan_stats_t;
+
+/*
+ * A rate limit, in messages per second with bursts of up to "burst"
+ * messages.  A rate of zero means no limit.
+ */
+typedef struct lan_rate_s
+{
+    unsigned int rate;
+    unsigned int burst;
+} lan_rate_t;
+
+typedef struct lan_rate_src_s lan_rate_src_t;
+
 struct lanserv_data_s
 {
     sys_data_t *sysinfo;
@@ -270,6 +328,19 @@ struct lanserv_data_s
     lan_addr_t lan_addr;
     int lan_addr_set;
     uint16_t port;
+
+    lan_stats_t stats;
+
+    /*
+     * Messages that are not part of an established session (session
+     * setup and anything with an unknown session) are limited per
+     * source address, messages in a session are limited per session.
+     * Source addresses are compared as bytes, so the from_addr passed
+     * to ipmi_handle_lan_msg() must not have any garbage in it.
+     */
+    lan_rate_t presession_rate;
+    lan_rate_t session_rate;
+    lan_rate_src_t *rate_srcs;
 };
 
 
@@ -289,6 +360,9 @@ int lanserv_read_config(sys_data_t   *sys,
 
 int ipmi_lan_init(lanserv_data_t *lan);
 
+/* Clear the statistics for the LAN interface. */
+void ipmi_lan_clear_stats(lanserv_data_t *lan);
+
 typedef void (*ipmi_payload_handler_cb)(lanserv_data_t *lan, msg_t *msg);
 
 int ipmi_register_payload(unsigned int payload_id,
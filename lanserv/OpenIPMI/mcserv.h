@@ -56,6 +56,7 @@
 #ifndef __MCSERV_H
 #define __MCSERV_H
 
+#include <sys/socket.h>
 #include <OpenIPMI/msg.h>
 #include <OpenIPMI/os_handler.h>
 
@@ -96,6 +97,9 @@ typedef struct ipmi_sol_s {
     /* History is stored in this file is the program fails. */
     char *backupfile;
 
+    /* If set, the history lives in this memory-mapped file. */
+    char *historyfile;
+
     int use_rtscts;
     int readclear;
 
@@ -136,6 +140,11 @@ int ipmi_mc_add_main_sdr(lmc_data_t    *mc,
 			 unsigned char *data,
 			 unsigned int  data_len);
 
+/* Add all the SDRs from a binary SDR repository image, from sdrcomp -b. */
+int ipmi_mc_add_main_sdr_image(lmc_data_t    *mc,
+			       unsigned char *data,
+			       unsigned int  data_len);
+
 int ipmi_mc_add_device_sdr(lmc_data_t    *mc,
 			   unsigned char lun,
 			   unsigned char *data,
@@ -307,6 +316,21 @@ void ipmi_set_product_id(lmc_data_t *emu, unsigned char product_id[3]);
 void ipmi_get_product_id(lmc_data_t *emu, unsigned char product_id[3]);
 void ipmi_set_chassis_control_prog(lmc_data_t *mc, const char *prog);
 
+/*
+ * PEF alerts are sent as PET traps to this UDP address.  The OEM
+ * handler is called when an event matches filters with the OEM
+ * action set, filters has a bit set for each of those filters.
+ */
+int ipmi_mc_set_pef_alert_dest(lmc_data_t *mc, struct sockaddr *addr,
+			       socklen_t addr_len);
+typedef void (*ipmi_pef_oem_action_cb)(lmc_data_t *mc,
+				       unsigned int filters,
+				       unsigned char event[13],
+				       void *cb_data);
+void ipmi_mc_set_pef_oem_handler(lmc_data_t *mc,
+				 ipmi_pef_oem_action_cb handler,
+				 void *cb_data);
+
 void read_persist_users(sys_data_t *sys);
 int write_persist_users(sys_data_t *sys);
 int read_sol_config(sys_data_t *sys);
@@ -341,6 +365,8 @@ int ipmi_emu_register_oi_iana_handler(uint8_t cmd, cmd_handler_f handler,
 
 #define OPENIPMI_IANA_CMD_SET_HISTORY_RETURN_SIZE	1
 #define OPENIPMI_IANA_CMD_GET_HISTORY_RETURN_SIZE	2
+#define OPENIPMI_IANA_CMD_SET_HISTORY_RETURN_LINES	3
+#define OPENIPMI_IANA_CMD_GET_HISTORY_RETURN_LINES	4
 
 /*
  * SOL handling
@@ -97,4 +97,30 @@ void free_persist_str(char *str);
 /* Can be set to zero to disable persistence. */
 extern int persist_enable;
 
+/*
+ * Start a thread to do the actual writes.  After this write_persist()
+ * queues the data and returns, and the data is written to the file
+ * delay_ms milliseconds later.  Writes of the same persist that come
+ * in while it is waiting are coalesced into one.
+ */
+int persist_start_writer(unsigned int delay_ms);
+void persist_set_delay(unsigned int delay_ms);
+
+/*
+ * Wait for all queued writes to complete.  Returns the last error
+ * from the writer since the previous flush, or 0 if none.
+ */
+int persist_flush(void);
+
+typedef struct persist_stats_s {
+    unsigned int write_behind; /* Writer thread is running. */
+    unsigned int delay_ms;
+    unsigned long pending;     /* Persists waiting to be written. */
+    unsigned long queued;      /* Calls to write_persist(). */
+    unsigned long coalesced;   /* Queued writes replaced by a newer one. */
+    unsigned long written;
+    unsigned long errors;
+} persist_stats_t;
+void persist_get_stats(persist_stats_t *stats);
+
 #endif /* __PERSIST_H__ */
@@ -56,6 +56,7 @@
 #ifndef __SERSERV_H
 #define __SERSERV_H
 
+#include <sys/uio.h>
 #include <OpenIPMI/serv.h>
 #include <OpenIPMI/os_handler.h>
 
@@ -68,6 +69,13 @@ typedef struct ser_codec_s {
     int (*setup)(serserv_data_t *si);
     void (*connected)(serserv_data_t *si);
     void (*disconnected)(serserv_data_t *si);
+
+    /*
+     * Decode a block of received data.  Optional, if not supplied
+     * handle_char is called for each byte.
+     */
+    void (*handle_data)(unsigned char *data, unsigned int len,
+			serserv_data_t *si);
 } ser_codec_t;
 
 typedef struct ser_oem_handler_s {
@@ -93,8 +101,9 @@ struct serserv_data_s {
 
     int connected;
 
-    void (*send_out)(serserv_data_t *si, unsigned char *data,
-		     unsigned int data_len);
+    /* A whole frame is always passed in one call. */
+    void (*send_out)(serserv_data_t *si, struct iovec *data,
+		     unsigned int vecs);
 
     ser_codec_t *codec;
     void *codec_info;
@@ -116,5 +125,6 @@ struct serserv_data_s {
 int serserv_read_config(char **tokptr, sys_data_t *sys, const char **errstr);
 int serserv_init(serserv_data_t *ser);
 void serserv_handle_data(serserv_data_t *ser, uint8_t *data, unsigned int len);
+ser_codec_t *ser_lookup_codec(const char *name);
 
 #endif /* __SERSERV_H */
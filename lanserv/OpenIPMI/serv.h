@@ -350,6 +350,10 @@ struct sys_data_s {
     socklen_t console_addr_len;
     int console_fd;
 
+    /* Port for statistics in Prometheus format, length zero if unset. */
+    sockaddr_ip_t metrics_addr;
+    socklen_t metrics_addr_len;
+
     unsigned char bmc_ipmb;
     int sol_present;
 
@@ -368,6 +372,20 @@ struct sys_data_s {
     lmc_data_t *mc;
     unsigned char clear_sel_event;
 
+    /*
+     * How to run the external LAN config and chassis control
+     * programs, see extcmd.c.  The cache time is in milliseconds,
+     * zero means don't cache.
+     */
+    unsigned int extcmd_coprocess;
+    unsigned int extcmd_cache_ttl;
+
+    /*
+     * If set, persistent data is written by a separate thread this
+     * many milliseconds after it changes, see persist.c.
+     */
+    unsigned int persist_delay;
+
     void *(*alloc)(sys_data_t *sys, int size);
     void (*free)(sys_data_t *sys, void *data);
 
@@ -441,6 +459,14 @@ typedef struct ipmi_child_quit_s {
 
 void ipmi_register_child_quit_handler(ipmi_child_quit_t *handler);
 
+/*
+ * Called when the simulator exits.  sig is 0 on a normal exit.  After
+ * ipmi_shutdown_in_main_loop() SIGINT, SIGQUIT and SIGTERM are handed
+ * to the main loop and the handlers called from there.  Otherwise, and
+ * for any other (fatal) signal, the handlers are called from the
+ * signal handler, so they must not take locks or wait on other
+ * threads for those.
+ */
 typedef struct ipmi_shutdown_s {
     void (*handler)(void *info, int sig);
     void *info;
@@ -449,6 +475,33 @@ typedef struct ipmi_shutdown_s {
 
 void ipmi_register_shutdown_handler(ipmi_shutdown_t *handler);
 
+/*
+ * Have SIGINT, SIGQUIT and SIGTERM run the shutdown handlers from the
+ * main loop, for handlers that need to flush data or join threads.
+ * Returns 0 or an errno.
+ */
+int ipmi_shutdown_in_main_loop(void);
+
+/*
+ * Latency histogram used for the simulator statistics.  Bucket i
+ * counts samples that took less than 2^i microseconds, the last
+ * bucket counts everything slower than that.
+ */
+#define STAT_HIST_BUCKETS 20
+typedef struct stat_hist_s {
+    uint64_t count;
+    uint64_t sum_ns;
+    uint64_t buckets[STAT_HIST_BUCKETS];
+} stat_hist_t;
+
+/* Monotonic time in nanoseconds, for timing. */
+uint64_t stat_time_ns(void);
+
+void stat_hist_add(stat_hist_t *hist, uint64_t ns);
+
+/* Upper bound of bucket i in microseconds, 0 for the last bucket. */
+uint64_t stat_hist_bucket_us(unsigned int i);
+
 /* A helper function to allow OEM code to send messages. */
 int ipmi_oem_send_msg(channel_t     *chan,
 		      unsigned char netfn,
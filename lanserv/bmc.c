@@ -36,6 +36,7 @@
 #include <stdlib.h>
 #include <sys/time.h>
 #include <stdio.h>
+#include <unistd.h>
 
 #include <OpenIPMI/ipmi_err.h>
 #include <OpenIPMI/ipmi_msgbits.h>
@@ -296,6 +297,7 @@ ipmi_emu_handle_msg(emu_data_t    *emu,
     unsigned char *data = NULL;
     unsigned char *rdata;
     unsigned int  *rdata_len;
+    uint64_t      start;
 
     if (emu->sysinfo->debug & DEBUG_MSG)
 	emu->sysinfo->log(emu->sysinfo, DEBUG, omsg, "Receive message:");
@@ -379,6 +381,7 @@ ipmi_emu_handle_msg(emu_data_t    *emu,
 	msg = omsg;
     }
 
+    start = stat_time_ns();
     if (netfn_handlers[msg->netfn >> 1].check_capable &&
 	!netfn_handlers[msg->netfn >> 1].check_capable(mc))
 	handle_invalid_cmd(mc, rdata, rdata_len);
@@ -394,6 +397,8 @@ ipmi_emu_handle_msg(emu_data_t    *emu,
 		 rdata_len, cb_data);
     } else
 	handle_invalid_cmd(mc, rdata, rdata_len);
+    ipmi_emu_stat_cmd(msg->netfn, msg->cmd, *rdata_len ? rdata[0] : 0,
+		      stat_time_ns() - start);
 
     if (omsg->netfn == IPMI_APP_NETFN && omsg->cmd == IPMI_SEND_MSG_CMD) {
 	/* An encapsulated command, put the response into the receive q. */
@@ -520,6 +525,8 @@ ipmi_mc_destroy(lmc_data_t *mc)
 	free(entry);
 	entry = n_entry;
     }
+    if (mc->pef_engine.alert_fd != -1)
+	close(mc->pef_engine.alert_fd);
     free(mc);
 }
 
@@ -751,6 +758,7 @@ ipmi_mc_alloc_unconfigured(sys_data_t *sys, unsigned char ipmb,
     for (i=0; i<MAX_ALERT_STRINGS; i++) {
 	mc->pef.alert_string_keys[i][0] = i;
     }
+    mc->pef_engine.alert_fd = -1;
 
     mc->ipmb_channel.medium_type = IPMI_CHANNEL_MEDIUM_IPMB;
     mc->ipmb_channel.channel_num = 0;
@@ -212,6 +212,68 @@ struct i2c_slave_s
     i2c_slave_t *next;
 };
 
+/*
+ * The enabled PEF event filters compiled into match tables, see
+ * bmc_pef.c.  Each table is indexed by one byte of the event and
+ * holds a bit for every filter that accepts that value, so an event
+ * is matched by ANDing one entry from each table.
+ */
+#define PEF_MATCH_GEN1		0 /* Generator ID byte 1, event[4] */
+#define PEF_MATCH_GEN2		1 /* Generator ID byte 2, event[5] */
+#define PEF_MATCH_SENSOR_TYPE	2 /* event[7] */
+#define PEF_MATCH_SENSOR_NUM	3 /* event[8] */
+#define PEF_MATCH_TRIGGER	4 /* event[9], the direction is ignored */
+#define PEF_MATCH_DATA1		5 /* event[10], offset mask and data1 */
+#define PEF_MATCH_DATA2		6 /* event[11] */
+#define PEF_MATCH_DATA3		7 /* event[12] */
+#define PEF_NUM_MATCH		8
+
+/* Filter and global action bits. */
+#define PEF_ACTION_ALERT	(1 << 0)
+#define PEF_ACTION_POWER_DOWN	(1 << 1)
+#define PEF_ACTION_RESET	(1 << 2)
+#define PEF_ACTION_POWER_CYCLE	(1 << 3)
+#define PEF_ACTION_OEM		(1 << 4)
+#define PEF_ACTION_DIAG_INT	(1 << 5)
+
+typedef struct pef_stats_s
+{
+    unsigned long events;
+    unsigned long matches;
+    unsigned long alerts_sent;
+    unsigned long alerts_failed;
+    unsigned long power_actions;
+    unsigned long diag_interrupts;
+    unsigned long oem_actions;
+} pef_stats_t;
+
+typedef struct pef_engine_s
+{
+    uint16_t      match[PEF_NUM_MATCH][256];
+    uint16_t      enabled;
+    unsigned char actions[MAX_EVENT_FILTERS];
+    unsigned char policy[MAX_EVENT_FILTERS];
+    unsigned char severity[MAX_EVENT_FILTERS];
+
+    /* Enabled alert policy entries for each policy number, in order. */
+    unsigned char policy_entries[16][MAX_ALERT_POLICIES];
+    unsigned char num_policy_entries[16];
+
+    /* Where PET traps go, alert_fd is -1 until the first one is sent. */
+    sockaddr_ip_t alert_dest;
+    socklen_t     alert_dest_len;
+    int           alert_fd;
+    uint16_t      pet_seq;
+
+    ipmi_pef_oem_action_cb oem_handler;
+    void          *oem_cb_data;
+
+    /* Count power, diag and OEM actions but don't do them. */
+    int           dry_run;
+
+    pef_stats_t   stats;
+} pef_engine_t;
+
 struct lmc_data_s
 {
     emu_data_t *emu;
@@ -234,6 +296,7 @@ struct lmc_data_s
 
     pef_data_t pef;
     pef_data_t pef_rollback;
+    pef_engine_t pef_engine;
 
     ipmi_tick_handler_t tick_handler;
     ipmi_child_quit_t child_quit_handler;
@@ -437,6 +500,12 @@ void set_sensor_bit(lmc_data_t *mc, sensor_t *sensor, unsigned char bit,
 
 void watchdog_timeout(void *cb_data);
 
+/* In bmc_pef.c */
+void pef_compile(lmc_data_t *mc);
+void pef_handle_event(lmc_data_t *mc,
+		      unsigned char record_type,
+		      unsigned char event[13]);
+
 extern cmd_handler_f storage_netfn_handlers[256];
 extern cmd_handler_f app_netfn_handlers[256];
 extern cmd_handler_f chassis_netfn_handlers[256];
@@ -0,0 +1,662 @@
+/*
+ * bmc_pef.c
+ *
+ * MontaVista IPMI code for emulating a MC.
+ *
+ * Author: MontaVista Software, Inc.
+ *         Corey Minyard <minyard@mvista.com>
+ *         source@mvista.com
+ *
+ * Copyright 2012 MontaVista Software Inc.
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2 of
+ *  the License, or (at your option) any later version.
+ *
+ *
+ *  THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ *  WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ *  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ *  OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ *  TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ *  USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this program; if not, write to the Free
+ *  Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.  */
+
+/*
+ * Platform Event Filtering.  When the PEF configuration is committed
+ * the enabled event filters are compiled into one 256 entry table per
+ * event byte the filters look at (see pef_engine_t), so matching an
+ * event against all the filters is eight lookups and ANDs no matter
+ * how the filters are set up.  The actions of the matching filters
+ * are then run: alerts are sent as PET traps (SNMPv1) to a UDP
+ * destination set with "pef_alert_dest" in the config file, power
+ * actions go through chassis control and OEM actions call a handler
+ * a loadable module can register.
+ */
+
+#include "bmc.h"
+#include "emu.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+
+#include <OpenIPMI/ipmi_msgbits.h>
+
+/* Severities above this are not valid PET severities. */
+#define PEF_MAX_SEVERITY	0x20
+
+/* Seconds between 1970 and 1998, PET time starts in 1998. */
+#define PET_EPOCH_OFFSET	883612800
+
+static void
+pef_match_any(uint16_t *table, uint16_t bit)
+{
+    unsigned int v;
+
+    for (v = 0; v < 256; v++)
+	table[v] |= bit;
+}
+
+/* 0xff in a filter byte matches any value, otherwise it must be equal. */
+static void
+pef_match_byte(uint16_t *table, unsigned char fval, uint16_t bit)
+{
+    if (fval == 0xff)
+	pef_match_any(table, bit);
+    else
+	table[fval] |= bit;
+}
+
+/*
+ * The event data compare from the spec.  Only the bits in the AND
+ * mask are looked at.  Bits set in compare 1 must be equal to the bit
+ * in compare 2, and if there are any other bits at least one of them
+ * must be equal to its bit in compare 2.
+ */
+static int
+pef_data_match(unsigned char v, unsigned char *f)
+{
+    unsigned char and = f[0], exact = f[0] & f[1], any = f[0] & ~f[1];
+    unsigned char same = ~((v & and) ^ f[2]);
+
+    if ((same & exact) != exact)
+	return 0;
+    if (any && !(same & any))
+	return 0;
+    return 1;
+}
+
+void
+pef_compile(lmc_data_t *mc)
+{
+    pef_engine_t  *pe = &mc->pef_engine;
+    pef_data_t    *pef = &mc->pef;
+    unsigned int  i, v, p;
+    unsigned char *f;
+    uint16_t      bit, offset_mask;
+
+    memset(pe->match, 0, sizeof(pe->match));
+    pe->enabled = 0;
+
+    /* Set 0 is not a valid filter. */
+    for (i = 1; i < pef->num_event_filters; i++) {
+	f = pef->event_filter_table[i];
+	if (!(f[1] & 0x80))
+	    continue;
+
+	bit = 1 << i;
+	pe->enabled |= bit;
+	pe->actions[i] = f[2] & 0x3f;
+	pe->policy[i] = f[3] & 0x0f;
+	pe->severity[i] = f[4];
+
+	pef_match_byte(pe->match[PEF_MATCH_GEN1], f[5], bit);
+	pef_match_byte(pe->match[PEF_MATCH_GEN2], f[6], bit);
+	pef_match_byte(pe->match[PEF_MATCH_SENSOR_TYPE], f[7], bit);
+	pef_match_byte(pe->match[PEF_MATCH_SENSOR_NUM], f[8], bit);
+	if (f[9] == 0xff)
+	    pef_match_any(pe->match[PEF_MATCH_TRIGGER], bit);
+	else {
+	    pe->match[PEF_MATCH_TRIGGER][f[9] & 0x7f] |= bit;
+	    pe->match[PEF_MATCH_TRIGGER][f[9] | 0x80] |= bit;
+	}
+
+	/* An empty offset mask does not filter on the offset. */
+	offset_mask = f[10] | (f[11] << 8);
+	for (v = 0; v < 256; v++) {
+	    if ((!offset_mask || (offset_mask & (1 << (v & 0xf))))
+		&& pef_data_match(v, f + 12))
+		pe->match[PEF_MATCH_DATA1][v] |= bit;
+	    if (pef_data_match(v, f + 15))
+		pe->match[PEF_MATCH_DATA2][v] |= bit;
+	    if (pef_data_match(v, f + 18))
+		pe->match[PEF_MATCH_DATA3][v] |= bit;
+	}
+    }
+
+    memset(pe->num_policy_entries, 0, sizeof(pe->num_policy_entries));
+    for (i = 1; i < pef->num_alert_policies; i++) {
+	f = pef->alert_policy_table[i];
+	if (!(f[1] & 0x08))
+	    continue;
+	p = f[1] >> 4;
+	pe->policy_entries[p][pe->num_policy_entries[p]++] = i;
+    }
+}
+
+static unsigned int
+ber_put_len_tag(unsigned char *d, unsigned char tag, unsigned int len)
+{
+    /* Everything in a PET trap is less than 128 bytes. */
+    d[0] = tag;
+    d[1] = len;
+    return 2;
+}
+
+static unsigned int
+ber_put_uint(unsigned char *d, unsigned char tag, uint32_t val)
+{
+    unsigned char tmp[5];
+    unsigned int  len = 0, i;
+
+    do {
+	tmp[len++] = val & 0xff;
+	val >>= 8;
+    } while (val);
+    /* Keep it positive. */
+    if (tmp[len - 1] & 0x80)
+	tmp[len++] = 0;
+    d[0] = tag;
+    d[1] = len;
+    for (i = 0; i < len; i++)
+	d[2 + i] = tmp[len - i - 1];
+    return 2 + len;
+}
+
+/* 1.3.6.1.4.1.3183.1.1, the PET enterprise */
+static unsigned char pet_enterprise[] = {
+    0x2b, 0x06, 0x01, 0x04, 0x01, 0x98, 0x6f, 0x01, 0x01
+};
+
+#define PET_DATA_LEN	47
+
+static unsigned int
+pef_format_pet(lmc_data_t *mc, unsigned char *d, unsigned char event[13],
+	       unsigned char severity)
+{
+    pef_engine_t   *pe = &mc->pef_engine;
+    sys_data_t     *sys = mc->sysinfo;
+    unsigned char  pet[PET_DATA_LEN];
+    unsigned char  varbind[64], trap[128];
+    unsigned int   vlen = 0, tlen = 0, len = 0;
+    struct timeval now, uptime;
+    uint32_t       t;
+
+    if (mc->pef.system_guid[0] & 1)
+	memcpy(pet, mc->pef.system_guid + 1, 16);
+    else if (mc->guid_set)
+	memcpy(pet, mc->guid, 16);
+    else
+	memset(pet, 0, 16);
+    pet[16] = pe->pet_seq >> 8; /* PET is big endian. */
+    pet[17] = pe->pet_seq & 0xff;
+    pe->pet_seq++;
+    sys->get_real_time(sys, &now);
+    t = 0;
+    if (now.tv_sec > PET_EPOCH_OFFSET)
+	t = now.tv_sec - PET_EPOCH_OFFSET;
+    pet[18] = t >> 24;
+    pet[19] = t >> 16;
+    pet[20] = t >> 8;
+    pet[21] = t;
+    pet[22] = 0xff; /* UTC offset unspecified */
+    pet[23] = 0xff;
+    pet[24] = 0x20; /* Trap source type: IPMI */
+    pet[25] = 0x20; /* Event source type: IPMI */
+    pet[26] = severity;
+    pet[27] = event[4]; /* Sensor device */
+    pet[28] = event[8]; /* Sensor number */
+    pet[29] = 0; /* Entity and instance unspecified */
+    pet[30] = 0;
+    memcpy(pet + 31, event + 10, 3);
+    memset(pet + 34, 0xff, 5);
+    pet[39] = 0x19; /* Language code: English */
+    pet[40] = 0;
+    pet[41] = mc->mfg_id[2];
+    pet[42] = mc->mfg_id[1];
+    pet[43] = mc->mfg_id[0];
+    pet[44] = mc->product_id[1];
+    pet[45] = mc->product_id[0];
+    pet[46] = 0xc1; /* No OEM fields */
+
+    /* The one variable binding, 1.3.6.1.4.1.3183.1.1.1 with the data. */
+    vlen += ber_put_len_tag(varbind + vlen, 0x06, sizeof(pet_enterprise) + 1);
+    memcpy(varbind + vlen, pet_enterprise, sizeof(pet_enterprise));
+    vlen += sizeof(pet_enterprise);
+    varbind[vlen++] = 0x01;
+    vlen += ber_put_len_tag(varbind + vlen, 0x04, sizeof(pet));
+    memcpy(varbind + vlen, pet, sizeof(pet));
+    vlen += sizeof(pet);
+
+    /* The Trap-PDU */
+    tlen += ber_put_len_tag(trap + tlen, 0x06, sizeof(pet_enterprise));
+    memcpy(trap + tlen, pet_enterprise, sizeof(pet_enterprise));
+    tlen += sizeof(pet_enterprise);
+    tlen += ber_put_len_tag(trap + tlen, 0x40, 4); /* agent-addr */
+    memset(trap + tlen, 0, 4);
+    tlen += 4;
+    tlen += ber_put_uint(trap + tlen, 0x02, 6); /* enterpriseSpecific */
+    tlen += ber_put_uint(trap + tlen, 0x02,
+			 (event[7] << 16) | ((event[9] & 0x7f) << 8)
+			 | (event[9] & 0x80) | (event[10] & 0x0f));
+    sys->get_monotonic_time(sys, &uptime);
+    tlen += ber_put_uint(trap + tlen, 0x43,
+			 uptime.tv_sec * 100 + uptime.tv_usec / 10000);
+    tlen += ber_put_len_tag(trap + tlen, 0x30, vlen + 2);
+    tlen += ber_put_len_tag(trap + tlen, 0x30, vlen);
+    memcpy(trap + tlen, varbind, vlen);
+    tlen += vlen;
+
+    /* The message: version 1, community and the trap. */
+    len += ber_put_len_tag(d + len, 0x30, tlen + 13);
+    len += ber_put_uint(d + len, 0x02, 0);
+    len += ber_put_len_tag(d + len, 0x04, 6);
+    memcpy(d + len, "public", 6);
+    len += 6;
+    len += ber_put_len_tag(d + len, 0xa4, tlen);
+    memcpy(d + len, trap, tlen);
+    len += tlen;
+
+    return len;
+}
+
+static int
+pef_send_alert(lmc_data_t *mc, unsigned char event[13],
+	       unsigned char severity)
+{
+    pef_engine_t  *pe = &mc->pef_engine;
+    unsigned char d[256];
+    unsigned int  len;
+
+    if (!pe->alert_dest_len)
+	return ENXIO;
+
+    if (pe->dry_run)
+	/* Just count it as sent. */
+	return 0;
+
+    if (pe->alert_fd == -1) {
+	pe->alert_fd = socket(pe->alert_dest.s_ipsock.s_addr.sa_family,
+			      SOCK_DGRAM, 0);
+	if (pe->alert_fd == -1)
+	    return errno;
+	fcntl(pe->alert_fd, F_SETFD, FD_CLOEXEC);
+	fcntl(pe->alert_fd, F_SETFL, O_NONBLOCK);
+    }
+
+    len = pef_format_pet(mc, d, event, severity);
+    if (sendto(pe->alert_fd, d, len, 0, &pe->alert_dest.s_ipsock.s_addr,
+	       pe->alert_dest_len) != (ssize_t) len)
+	return errno;
+    return 0;
+}
+
+/*
+ * The destination type (LAN parameter 18) of an alert destination.
+ * The simulator has one destination, a PET trap, so every entry is
+ * the same type.
+ */
+static unsigned int
+pef_dest_type(lmc_data_t *mc, unsigned int chan, unsigned int dest)
+{
+    return 0;
+}
+
+/*
+ * Run the alert policy entries in order.  The policy type of an entry
+ * says what to do when the alert to the previous destination worked:
+ *  0 - send the alert anyway,
+ *  1 - skip this entry, go on to the next one,
+ *  2 - skip this entry and stop,
+ *  3 - skip this entry and the ones after it on the same channel,
+ *  4 - skip this entry and the ones after it with the same
+ *      destination type.
+ * Reserved types are treated as 0.
+ */
+static void
+pef_run_policy(lmc_data_t *mc, unsigned int p, unsigned char event[13],
+	       unsigned char severity)
+{
+    pef_engine_t  *pe = &mc->pef_engine;
+    unsigned int  i, type, chan, dtype;
+    unsigned int  prev_chan = 0, prev_dtype = 0;
+    int           prev_ok = 0, skip_chan = -1, skip_dtype = -1;
+    unsigned char *ent;
+
+    for (i = 0; i < pe->num_policy_entries[p]; i++) {
+	ent = mc->pef.alert_policy_table[pe->policy_entries[p][i]];
+	type = ent[1] & 0x7;
+	chan = ent[2] >> 4;
+	dtype = pef_dest_type(mc, chan, ent[2] & 0xf);
+
+	if ((int) chan == skip_chan || (int) dtype == skip_dtype)
+	    continue;
+	skip_chan = -1;
+	skip_dtype = -1;
+
+	if (prev_ok) {
+	    switch (type) {
+	    case 1:
+		continue;
+	    case 2:
+		return;
+	    case 3:
+		skip_chan = prev_chan;
+		continue;
+	    case 4:
+		skip_dtype = prev_dtype;
+		continue;
+	    }
+	}
+
+	prev_chan = chan;
+	prev_dtype = dtype;
+	prev_ok = !pef_send_alert(mc, event, severity);
+	if (prev_ok)
+	    pe->stats.alerts_sent++;
+	else
+	    pe->stats.alerts_failed++;
+    }
+}
+
+static void
+pef_chassis_control(lmc_data_t *mc, unsigned char op)
+{
+    msg_t         msg;
+    unsigned char rdata[IPMI_SIM_MAX_MSG_LENGTH];
+    unsigned int  rdata_len;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.netfn = IPMI_CHASSIS_NETFN;
+    msg.cmd = IPMI_CHASSIS_CONTROL_CMD;
+    msg.data = &op;
+    msg.len = 1;
+    chassis_netfn_handlers[IPMI_CHASSIS_CONTROL_CMD](mc, &msg, rdata,
+						     &rdata_len, NULL);
+}
+
+static void
+pef_process(lmc_data_t *mc, unsigned char event[13])
+{
+    pef_engine_t  *pe = &mc->pef_engine;
+    channel_t     *bchan = mc->channels[15];
+    uint16_t      m, alert_policies = 0, oem_filters = 0;
+    unsigned char actions = 0, severity = 0;
+    unsigned int  i;
+
+    pe->stats.events++;
+    m = (pe->enabled
+	 & pe->match[PEF_MATCH_GEN1][event[4]]
+	 & pe->match[PEF_MATCH_GEN2][event[5]]
+	 & pe->match[PEF_MATCH_SENSOR_TYPE][event[7]]
+	 & pe->match[PEF_MATCH_SENSOR_NUM][event[8]]
+	 & pe->match[PEF_MATCH_TRIGGER][event[9]]
+	 & pe->match[PEF_MATCH_DATA1][event[10]]
+	 & pe->match[PEF_MATCH_DATA2][event[11]]
+	 & pe->match[PEF_MATCH_DATA3][event[12]]);
+    if (!m)
+	return;
+    pe->stats.matches++;
+
+    for (i = 1; m >> i; i++) {
+	if (!(m & (1 << i)))
+	    continue;
+	actions |= pe->actions[i];
+	if (pe->actions[i] & PEF_ACTION_ALERT) {
+	    alert_policies |= 1 << pe->policy[i];
+	    if ((pe->severity[i] > severity)
+		&& (pe->severity[i] <= PEF_MAX_SEVERITY))
+		severity = pe->severity[i];
+	}
+	if (pe->actions[i] & PEF_ACTION_OEM)
+	    oem_filters |= 1 << i;
+    }
+    actions &= mc->pef.pef_action_global_control;
+
+    if (actions & PEF_ACTION_ALERT) {
+	for (i = 0; alert_policies >> i; i++) {
+	    if (alert_policies & (1 << i))
+		pef_run_policy(mc, i, event, severity);
+	}
+    }
+
+    /* Only one power action is done, the most drastic one. */
+    if (actions & (PEF_ACTION_POWER_DOWN | PEF_ACTION_POWER_CYCLE
+		   | PEF_ACTION_RESET)) {
+	pe->stats.power_actions++;
+	if (pe->dry_run || !bchan)
+	    ;
+	else if (actions & PEF_ACTION_POWER_DOWN)
+	    pef_chassis_control(mc, 0);
+	else if (actions & PEF_ACTION_POWER_CYCLE)
+	    pef_chassis_control(mc, 2);
+	else
+	    pef_chassis_control(mc, 3);
+    }
+
+    if (actions & PEF_ACTION_DIAG_INT) {
+	pe->stats.diag_interrupts++;
+	if (!pe->dry_run && bchan && bchan->hw_op && HW_OP_CAN_NMI(bchan))
+	    bchan->hw_op(bchan, HW_OP_SEND_NMI);
+    }
+
+    if (actions & PEF_ACTION_OEM) {
+	pe->stats.oem_actions++;
+	if (!pe->dry_run && pe->oem_handler)
+	    pe->oem_handler(mc, oem_filters, event, pe->oem_cb_data);
+    }
+}
+
+void
+pef_handle_event(lmc_data_t *mc,
+		 unsigned char record_type,
+		 unsigned char event[13])
+{
+    /* Only system events are filtered, and only if PEF is enabled. */
+    if (record_type != 0x02 || !(mc->pef.pef_control & 1))
+	return;
+    pef_process(mc, event);
+}
+
+int
+ipmi_mc_set_pef_alert_dest(lmc_data_t *mc, struct sockaddr *addr,
+			   socklen_t addr_len)
+{
+    pef_engine_t *pe = &mc->pef_engine;
+
+    if (addr_len > sizeof(pe->alert_dest))
+	return EINVAL;
+    if (pe->alert_fd != -1) {
+	close(pe->alert_fd);
+	pe->alert_fd = -1;
+    }
+    memcpy(&pe->alert_dest, addr, addr_len);
+    pe->alert_dest_len = addr_len;
+    return 0;
+}
+
+void
+ipmi_mc_set_pef_oem_handler(lmc_data_t *mc,
+			    ipmi_pef_oem_action_cb handler,
+			    void *cb_data)
+{
+    mc->pef_engine.oem_handler = handler;
+    mc->pef_engine.oem_cb_data = cb_data;
+}
+
+static void
+pef_print_stats(emu_out_t *out, pef_stats_t *s)
+{
+    out->printf(out, "events %lu, matched %lu, alerts sent %lu, "
+		"alerts failed %lu\n", s->events, s->matches, s->alerts_sent,
+		s->alerts_failed);
+    out->printf(out, "power actions %lu, diag interrupts %lu, "
+		"OEM actions %lu\n", s->power_actions, s->diag_interrupts,
+		s->oem_actions);
+}
+
+/*
+ * pef_stats <mc> [clear]
+ */
+int
+pef_stats_cmd(emu_out_t *out, emu_data_t *emu, lmc_data_t *mc, char **toks)
+{
+    pef_engine_t *pe = &mc->pef_engine;
+    const char   *tok;
+    unsigned int i, nfilters = 0;
+
+    tok = mystrtok(NULL, " \t\n", toks);
+    if (tok && strcmp(tok, "clear") != 0) {
+	out->printf(out, "**Invalid option: %s\n", tok);
+	return EINVAL;
+    }
+
+    for (i = 0; i < MAX_EVENT_FILTERS; i++) {
+	if (pe->enabled & (1 << i))
+	    nfilters++;
+    }
+    out->printf(out, "PEF %s, %u filters enabled\n",
+		(mc->pef.pef_control & 1) ? "enabled" : "disabled", nfilters);
+    pef_print_stats(out, &pe->stats);
+
+    if (tok)
+	memset(&pe->stats, 0, sizeof(pe->stats));
+    return 0;
+}
+
+static uint64_t
+pef_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+#define BENCH_NUM_EVENTS	256
+
+/*
+ * pef_bench <mc> [<seconds> [<rate>]]
+ *
+ * Run a stream of different events through the PEF engine with the
+ * current configuration, as fast as possible or at the given number
+ * of events per second.  No actions are done, alerts included, they
+ * are only counted.  The statistics from the run are printed and the
+ * ones from pef_stats are left alone.  This runs in the main loop, so
+ * nothing else in the simulator happens until it is done.
+ */
+int
+pef_bench_cmd(emu_out_t *out, emu_data_t *emu, lmc_data_t *mc, char **toks)
+{
+    pef_engine_t  *pe = &mc->pef_engine;
+    pef_stats_t   saved;
+    const char    *tok;
+    char          *endp;
+    double        secs = 1.0, rate = 0;
+    unsigned char events[BENCH_NUM_EVENTS][13];
+    unsigned int  i;
+    unsigned long count = 0;
+    uint64_t      start, end, next, interval = 0, t, busy = 0;
+
+    tok = mystrtok(NULL, " \t\n", toks);
+    if (tok) {
+	secs = strtod(tok, &endp);
+	if ((*endp != '\0') || (secs <= 0)) {
+	    out->printf(out, "**Invalid time: %s\n", tok);
+	    return EINVAL;
+	}
+	tok = mystrtok(NULL, " \t\n", toks);
+    }
+    if (tok) {
+	rate = strtod(tok, &endp);
+	if ((*endp != '\0') || (rate < 0)) {
+	    out->printf(out, "**Invalid rate: %s\n", tok);
+	    return EINVAL;
+	}
+	if (rate > 0)
+	    interval = 1000000000 / rate;
+    }
+
+    /* Threshold and discrete events from a spread of sensors. */
+    for (i = 0; i < BENCH_NUM_EVENTS; i++) {
+	unsigned char *e = events[i];
+
+	memset(e, 0, 13);
+	e[4] = mc->ipmb;
+	e[6] = 0x04;
+	e[7] = 1 + ((i >> 1) % 8);
+	e[8] = i % 32;
+	if (i & 1) {
+	    e[9] = 0x01 | ((i & 2) << 6);
+	    e[10] = 0x50 | ((i >> 2) % 12);
+	    e[11] = i;
+	    e[12] = 0x80;
+	} else {
+	    e[9] = 0x6f;
+	    e[10] = (i >> 1) % 15;
+	    e[11] = 0xff;
+	    e[12] = 0xff;
+	}
+    }
+
+    saved = pe->stats;
+    memset(&pe->stats, 0, sizeof(pe->stats));
+    pe->dry_run = 1;
+
+    start = pef_now_ns();
+    end = start + secs * 1000000000;
+    next = start;
+    do {
+	if (interval) {
+	    t = pef_now_ns();
+	    if (t < next) {
+		struct timespec ts;
+
+		ts.tv_sec = (next - t) / 1000000000;
+		ts.tv_nsec = (next - t) % 1000000000;
+		nanosleep(&ts, NULL);
+	    }
+	    next += interval;
+	}
+	t = pef_now_ns();
+	for (i = 0; i < BENCH_NUM_EVENTS && (!interval || i == 0); i++)
+	    pef_process(mc, events[(count + i) % BENCH_NUM_EVENTS]);
+	count += i;
+	t = pef_now_ns() - t;
+	busy += t;
+    } while (pef_now_ns() < end);
+    t = pef_now_ns() - start;
+
+    pe->dry_run = 0;
+
+    out->printf(out, "%lu events in %.2f seconds, %.0f events/s, "
+		"%.0f ns/event\n", count, t / 1e9, count / (t / 1e9),
+		(double) busy / count);
+    pef_print_stats(out, &pe->stats);
+
+    pe->stats = saved;
+    return 0;
+}
@@ -1761,6 +1761,13 @@ handle_ipmi_set_pef_config_parms(lmc_data_t    *mc,
 	err = 0x80; /* Parm not supported */
     }
 
+    /*
+     * Changes take effect right away unless set in progress is being
+     * used, then the filters are recompiled on the commit or rollback.
+     */
+    if (!err && (!mc->pef.set_in_progress || (msg->data[0] & 0x7f) == 0))
+	pef_compile(mc);
+
     rdata[0] = err;
     *rdata_len = 1;
 }
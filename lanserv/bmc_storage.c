@@ -31,6 +31,7 @@
  *  Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.  */
 
 #include "bmc.h"
+#include "sdrimage.h"
 
 #include <errno.h>
 #include <malloc.h>
@@ -283,6 +284,7 @@ mc_new_event(lmc_data_t *mc,
 	if (chan->set_atn)
 	    chan->set_atn(chan, 1, IPMI_MC_EVBUF_FULL_INT_ENABLED(mc));
     }
+    pef_handle_event(mc, record_type, event);
 }
 
 static void
@@ -876,6 +878,138 @@ ipmi_mc_add_main_sdr(lmc_data_t    *mc,
     return 0;
 }
 
+/*
+ * Load a whole binary SDR repository image (see sdrimage.h) into the
+ * main SDRs.  The records are built off to the side, appended in one
+ * go, and the persistent copy is only written once.  Record ids from
+ * the image are kept unless they collide with an existing record.
+ */
+int
+ipmi_mc_add_main_sdr_image(lmc_data_t    *mc,
+			   unsigned char *data,
+			   unsigned int  data_len)
+{
+    sdrs_t         *sdrs = &mc->main_sdrs;
+    sdr_t          *head = NULL, *tail = NULL, *entry, *p;
+    unsigned char  *used = NULL, *sdr_data;
+    unsigned int   num_sdrs, sdr_data_len, i;
+    struct timeval t;
+    int            rv = EINVAL;
+
+    if (!(mc->device_support & IPMI_DEVID_SDR_REPOSITORY_DEV))
+	return ENOSYS;
+
+    if ((data_len < SDR_IMAGE_HDR_LEN)
+	|| (memcmp(data, SDR_IMAGE_MAGIC, SDR_IMAGE_MAGIC_LEN) != 0)
+	|| (ipmi_get_uint32(data + SDR_IMAGE_HDR_VERSION) != SDR_IMAGE_VERSION))
+	return EINVAL;
+
+    num_sdrs = ipmi_get_uint32(data + SDR_IMAGE_HDR_NUM_SDRS);
+    sdr_data_len = ipmi_get_uint32(data + SDR_IMAGE_HDR_DATA_LEN);
+    if ((num_sdrs > MAX_NUM_SDRS)
+	|| (sdrs->sdr_count + num_sdrs > MAX_NUM_SDRS))
+	return ENOSPC;
+    if ((data_len - SDR_IMAGE_HDR_LEN) / SDR_IMAGE_IDX_LEN < num_sdrs)
+	return EINVAL;
+    sdr_data = data + SDR_IMAGE_HDR_LEN + (num_sdrs * SDR_IMAGE_IDX_LEN);
+    if ((unsigned int) (data + data_len - sdr_data) < sdr_data_len)
+	return EINVAL;
+
+    /* One bit per record id, to keep ids unique without list walks. */
+    used = malloc(65536 / 8);
+    if (!used)
+	return ENOMEM;
+    memset(used, 0, 65536 / 8);
+    used[0] |= 1; /* Record id 0 is not valid. */
+    used[0xffff / 8] |= 1 << (0xffff % 8);
+    for (p = sdrs->sdrs; p; p = p->next) {
+	used[p->record_id / 8] |= 1 << (p->record_id % 8);
+	tail = p;
+    }
+    p = tail;
+    tail = NULL;
+
+    for (i = 0; i < num_sdrs; i++) {
+	unsigned char *idx = data + SDR_IMAGE_HDR_LEN + (i * SDR_IMAGE_IDX_LEN);
+	unsigned int  recid = ipmi_get_uint16(idx + SDR_IMAGE_IDX_RECID);
+	unsigned int  length = ipmi_get_uint16(idx + SDR_IMAGE_IDX_LENGTH);
+	unsigned int  offset = ipmi_get_uint32(idx + SDR_IMAGE_IDX_OFFSET);
+
+	if ((length < 5) || (offset > sdr_data_len)
+	    || (length > sdr_data_len - offset)
+	    || (length != ((unsigned int) sdr_data[offset + 4]) + 5))
+	    goto out_err;
+
+	if (used[recid / 8] & (1 << (recid % 8))) {
+	    uint16_t start_recid = sdrs->next_entry;
+
+	    while (used[sdrs->next_entry / 8] & (1 << (sdrs->next_entry % 8))) {
+		sdrs->next_entry++;
+		if (sdrs->next_entry == 0xffff)
+		    sdrs->next_entry = 1;
+		if (sdrs->next_entry == start_recid) {
+		    rv = ENOSPC;
+		    goto out_err;
+		}
+	    }
+	    recid = sdrs->next_entry;
+	}
+	used[recid / 8] |= 1 << (recid % 8);
+
+	entry = malloc(sizeof(*entry));
+	if (!entry) {
+	    rv = ENOMEM;
+	    goto out_err;
+	}
+	entry->data = malloc(length);
+	if (!entry->data) {
+	    free(entry);
+	    rv = ENOMEM;
+	    goto out_err;
+	}
+	memcpy(entry->data, sdr_data + offset, length);
+	ipmi_set_uint16(entry->data, recid);
+	entry->record_id = recid;
+	entry->length = length;
+	entry->next = NULL;
+	if (tail)
+	    tail->next = entry;
+	else
+	    head = entry;
+	tail = entry;
+    }
+
+    /* Continue allocating after the highest id in use. */
+    for (i = 0xfffe; i > 0; i--) {
+	if (used[i / 8] & (1 << (i % 8)))
+	    break;
+    }
+    if (i + 1 > sdrs->next_entry && i + 1 < 0xffff)
+	sdrs->next_entry = i + 1;
+
+    if (p)
+	p->next = head;
+    else
+	sdrs->sdrs = head;
+    sdrs->sdr_count += num_sdrs;
+
+    mc->emu->sysinfo->get_monotonic_time(mc->emu->sysinfo, &t);
+    sdrs->last_add_time = t.tv_sec + sdrs->time_offset;
+
+    free(used);
+    rewrite_sdrs(mc, sdrs);
+    return 0;
+
+  out_err:
+    while (head) {
+	entry = head;
+	head = head->next;
+	free_sdr(entry);
+    }
+    free(used);
+    return rv;
+}
+
 int
 ipmi_mc_add_device_sdr(lmc_data_t    *mc,
 		       unsigned char lun,
@@ -828,6 +828,17 @@ read_config(sys_data_t *sys,
 	    err = get_delim_str(&tokptr, &prog, &errstr);
 	    if (!err)
 		ipmi_set_chassis_control_prog(sys->mc, prog);
+	} else if (strcmp(tok, "pef_alert_dest") == 0) {
+	    sockaddr_ip_t addr;
+	    socklen_t     addr_len;
+	    err = get_sock_addr(&tokptr, &addr, &addr_len, "162", SOCK_DGRAM,
+				&errstr);
+	    if (!err && ipmi_mc_set_pef_alert_dest(sys->mc,
+						   &addr.s_ipsock.s_addr,
+						   addr_len)) {
+		errstr = "Invalid PEF alert destination";
+		err = -1;
+	    }
 	} else if (strcmp(tok, "name") == 0) {
 	    err = get_delim_str(&tokptr, &sys->name, &errstr);
 	} else if (strcmp(tok, "startcmd") == 0) {
@@ -868,8 +879,18 @@ read_config(sys_data_t *sys,
 	    err = get_sock_addr(&tokptr,
 				&sys->console_addr, &sys->console_addr_len,
 				NULL, SOCK_STREAM, &errstr);
+	} else if (strcmp(tok, "metrics") == 0) {
+	    err = get_sock_addr(&tokptr,
+				&sys->metrics_addr, &sys->metrics_addr_len,
+				NULL, SOCK_STREAM, &errstr);
     } else if (strcmp(tok, "clear_sel_event") == 0) {
 	    err = get_bool(&tokptr, &sys->clear_sel_event, &errstr);
+	} else if (strcmp(tok, "extcmd_coprocess") == 0) {
+	    err = get_bool(&tokptr, &sys->extcmd_coprocess, &errstr);
+	} else if (strcmp(tok, "extcmd_cache_ttl") == 0) {
+	    err = get_uint(&tokptr, &sys->extcmd_cache_ttl, &errstr);
+	} else if (strcmp(tok, "persist_delay") == 0) {
+	    err = get_uint(&tokptr, &sys->persist_delay, &errstr);
 	} else {
 	    errstr = "Invalid configuration option";
 	    err = -1;
@@ -120,4 +120,66 @@ int read_command_file(emu_out_t *out, emu_data_t *emu,
 
 void emu_set_debug_level(emu_data_t *emu, unsigned int debug_level);
 
+/* In emu_image.c */
+
+/*
+ * Run the given command file from a compiled image.  If the image
+ * does not exist or any file it was built from has changed, run the
+ * command file normally and write a new image.  The config file, if
+ * given, is added as a dependency of the image since it can define
+ * variables used by the commands.
+ */
+int read_command_image(emu_out_t *out, emu_data_t *emu,
+		       const char *command_file, const char *image_file,
+		       const char *config_file);
+
+/* Record types in a command image. */
+#define EMU_IMG_TEXT		0 /* A command line to run as-is. */
+#define EMU_IMG_MC_ADD		1
+#define EMU_IMG_MC_SETBMC	2
+#define EMU_IMG_MAIN_SDR	3
+#define EMU_IMG_DEVICE_SDR	4
+#define EMU_IMG_SENSOR		5
+#define EMU_IMG_FRU_DATA	6
+
+/* Used by the command handlers while an image is being compiled. */
+int emu_image_recording(void);
+void emu_image_cmd_start(void);
+int emu_image_cmd_recorded(void);
+void emu_image_add_dep(const char *filename);
+void emu_image_record(unsigned int type, const void *data, unsigned int len);
+
+/* In bmc_pef.c */
+int pef_stats_cmd(emu_out_t *out, emu_data_t *emu, lmc_data_t *mc,
+		  char **toks);
+int pef_bench_cmd(emu_out_t *out, emu_data_t *emu, lmc_data_t *mc,
+		  char **toks);
+
+/* In lan_capture.c */
+int lan_capture_start(const char *filename);
+void lan_capture_stop(void);
+void lan_capture_packet(struct sockaddr *src, socklen_t src_len,
+			struct sockaddr *dst, socklen_t dst_len,
+			struct iovec *data, int vecs);
+int lan_capture_cmd(emu_out_t *out, emu_data_t *emu, lmc_data_t *mc,
+		    char **toks);
+
+/* In sensor_gen.c */
+int sensor_gen_cmd(emu_out_t *out, emu_data_t *emu, lmc_data_t *mc,
+		   char **toks);
+int sensor_gen_stop_cmd(emu_out_t *out, emu_data_t *emu, lmc_data_t *mc,
+			char **toks);
+int sensor_gen_stats_cmd(emu_out_t *out, emu_data_t *emu, lmc_data_t *mc,
+			 char **toks);
+
+/* In stats.c */
+void ipmi_emu_stat_cmd(unsigned char netfn, unsigned char cmd,
+		       unsigned char cc, uint64_t ns);
+void ipmi_emu_stats_prometheus(emu_data_t *emu, emu_out_t *out);
+int stats_cmd(emu_out_t *out, emu_data_t *emu, lmc_data_t *mc, char **toks);
+
+/* In serial_bench.c */
+int serial_bench_cmd(emu_out_t *out, emu_data_t *emu, lmc_data_t *mc,
+		     char **toks);
+
 #endif /* __EMU_IPMI_ */
@@ -4,6 +4,7 @@
 #include <errno.h>
 #include <stdlib.h>
 #include <stdarg.h>
+#include <sys/stat.h>
 #include <OpenIPMI/serv.h>
 #include "emu.h"
 #include <OpenIPMI/persist.h>
@@ -213,6 +214,7 @@ read_command_file(emu_out_t *out, emu_data_t *emu, const char *command_file)
 	    rv = ENOMEM;
 	    goto out;
 	}
+	emu_image_add_dep(command_file);
 	while (fgets(buffer+pos, INPUT_BUFFER_SIZE-pos, f)) {
 	    out->printf(out, "%s", buffer+pos);
 	    if (buffer[pos] == '#')
@@ -323,6 +325,61 @@ main_sdr_add(emu_out_t *out, emu_data_t *emu, lmc_data_t *mc, char **toks)
     rv = ipmi_mc_add_main_sdr(mc, data, i);
     if (rv)
 	out->printf(out, "**Unable to add to sdr, error 0x%x\n", rv);
+    else if (emu_image_recording()) {
+	unsigned char rec[257];
+
+	rec[0] = ipmi_mc_get_ipmb(mc);
+	memcpy(rec + 1, data, i);
+	emu_image_record(EMU_IMG_MAIN_SDR, rec, i + 1);
+    }
+    return rv;
+}
+
+static int
+main_sdr_load(emu_out_t *out, emu_data_t *emu, lmc_data_t *mc, char **toks)
+{
+    const char    *filename, *errstr;
+    unsigned char *data = NULL;
+    struct stat   st;
+    FILE          *f = NULL;
+    int           rv;
+
+    rv = get_delim_str(toks, &filename, &errstr);
+    if (rv) {
+	out->printf(out, "**Could not get SDR image filename: %s\n", errstr);
+	return rv;
+    }
+
+    f = fopen(filename, "r");
+    if (!f || fstat(fileno(f), &st) != 0) {
+	rv = errno;
+	out->printf(out, "**Unable to open SDR image %s: %s\n", filename,
+		    strerror(rv));
+	goto out;
+    }
+    data = malloc(st.st_size);
+    if (!data) {
+	rv = ENOMEM;
+	out->printf(out, "**Out of memory reading SDR image %s\n", filename);
+	goto out;
+    }
+    if (fread(data, 1, st.st_size, f) != (size_t) st.st_size) {
+	rv = EIO;
+	out->printf(out, "**Unable to read SDR image %s\n", filename);
+	goto out;
+    }
+
+    rv = ipmi_mc_add_main_sdr_image(mc, data, st.st_size);
+    if (rv)
+	out->printf(out, "**Unable to load SDR image %s, error 0x%x\n",
+		    filename, rv);
+
+  out:
+    if (f)
+	fclose(f);
+    if (data)
+	free(data);
+    free((char *) filename);
     return rv;
 }
 
@@ -351,6 +408,14 @@ device_sdr_add(emu_out_t *out, emu_data_t *emu, lmc_data_t *mc, char **toks)
     rv = ipmi_mc_add_device_sdr(mc, lun, data, i);
     if (rv)
 	out->printf(out, "**Unable to add to sdr, error 0x%x\n", rv);
+    else if (emu_image_recording()) {
+	unsigned char rec[258];
+
+	rec[0] = ipmi_mc_get_ipmb(mc);
+	rec[1] = lun;
+	memcpy(rec + 2, data, i);
+	emu_image_record(EMU_IMG_DEVICE_SDR, rec, i + 2);
+    }
     return rv;
 }
 
@@ -448,6 +513,18 @@ sensor_add(emu_out_t *out, emu_data_t *emu, lmc_data_t *mc, char **toks)
 	}
     } else {
 	rv = ipmi_mc_add_sensor(mc, lun, num, type, code, event_only);
+	if (!rv && emu_image_recording()) {
+	    /* Polled sensors are kept as text, their handlers parse it. */
+	    unsigned char rec[6];
+
+	    rec[0] = ipmi_mc_get_ipmb(mc);
+	    rec[1] = lun;
+	    rec[2] = num;
+	    rec[3] = type;
+	    rec[4] = code;
+	    rec[5] = event_only;
+	    emu_image_record(EMU_IMG_SENSOR, rec, 6);
+	}
     }
     if (rv)
 	out->printf(out, "**Unable to add to sensor, error 0x%x\n", rv);
@@ -788,6 +865,21 @@ mc_add(emu_out_t *out, emu_data_t *emu, lmc_data_t *mc, char **toks)
 			 device_support, mfg_id, product_id, flags);
     if (rv)
 	out->printf(out, "**Unable to add the MC, error 0x%x\n", rv);
+    else if (emu_image_recording()) {
+	unsigned char rec[16];
+
+	rec[0] = ipmb;
+	rec[1] = device_id;
+	rec[2] = has_device_sdrs;
+	rec[3] = device_revision;
+	rec[4] = major_fw_rev;
+	rec[5] = minor_fw_rev;
+	rec[6] = device_support;
+	memcpy(rec + 7, mfg_id, 3);
+	memcpy(rec + 10, product_id, 2);
+	ipmi_set_uint32(rec + 12, flags);
+	emu_image_record(EMU_IMG_MC_ADD, rec, 16);
+    }
     return rv;
 }
 
@@ -911,6 +1003,18 @@ mc_add_fru_data(emu_out_t *out, emu_data_t *emu, lmc_data_t *mc, char **toks)
 	rv = ipmi_mc_add_fru_data(mc, devid, length, NULL, data);
 	if (rv)
 	    out->printf(out, "**Unable to add FRU data, error 0x%x\n", rv);
+	else if (emu_image_recording()) {
+	    unsigned char *rec = malloc(length + 6);
+
+	    if (rec) {
+		rec[0] = ipmi_mc_get_ipmb(mc);
+		rec[1] = devid;
+		ipmi_set_uint32(rec + 2, length);
+		memcpy(rec + 6, data, length);
+		emu_image_record(EMU_IMG_FRU_DATA, rec, length + 6);
+		free(rec);
+	    }
+	}
     } else {
 	out->printf(out, "**FRU type not given, need file or data\n");
 	rv = EINVAL;
@@ -974,6 +1078,8 @@ mc_setbmc(emu_out_t *out, emu_data_t *emu, lmc_data_t *mc, char **toks)
     rv = ipmi_emu_set_bmc_mc(emu, ipmb);
     if (rv)
 	out->printf(out, "**Invalid IPMB address\n");
+    else if (emu_image_recording())
+	emu_image_record(EMU_IMG_MC_SETBMC, &ipmb, 1);
     return rv;
 }
 
@@ -1110,18 +1216,47 @@ static int
 persist_cmd(emu_out_t *out, emu_data_t *emu, lmc_data_t *mc, char **toks)
 {
     const char *tok;
+    persist_stats_t st;
+    unsigned int delay;
+    int rv;
 
-    while ((tok = mystrtok(NULL, " \t\n", toks))) {
+    tok = mystrtok(NULL, " \t\n", toks);
+    if (!tok) {
+	persist_get_stats(&st);
+	out->printf(out, "persist: %s, %s\n",
+		    persist_enable ? "on" : "off",
+		    st.write_behind ? "write-behind" : "synchronous");
+	if (st.write_behind)
+	    out->printf(out, "  delay %ums pending %lu queued %lu"
+			" coalesced %lu written %lu errors %lu\n",
+			st.delay_ms, st.pending, st.queued, st.coalesced,
+			st.written, st.errors);
+	return 0;
+    }
+
+    do {
 	if (strcmp(tok, "on") == 0) {
 	    persist_enable = 1;
 	} else if (strcmp(tok, "off") == 0) {
 	    persist_enable = 0;
+	} else if (strcmp(tok, "flush") == 0) {
+	    rv = persist_flush();
+	    if (rv) {
+		out->printf(out, "**Error writing persist data: %s\n",
+			    strerror(rv));
+		return rv;
+	    }
+	} else if (strcmp(tok, "delay") == 0) {
+	    rv = emu_get_uint(out, toks, &delay, "delay");
+	    if (rv)
+		return rv;
+	    persist_set_delay(delay);
 	} else {
-	    out->printf(out, "Invalid persist vale '%s', options are 'on' and 'off'\n",
-		   tok);
+	    out->printf(out, "Invalid persist vale '%s', options are 'on',"
+			" 'off', 'flush', and 'delay <ms>'\n", tok);
 	    return EINVAL;
 	}
-    }
+    } while ((tok = mystrtok(NULL, " \t\n", toks)));
     return 0;
 }
 
@@ -1294,7 +1429,8 @@ static struct emu_cmd_info cmds[] =
     { "sel_list",	MC,		sel_list,		&cmds[30] },
     { "mc_add_i2c_data", MC, mc_add_i2c_data, &cmds[31] },
     { "get_user_password", MC, mc_get_user_password, &cmds[32] },
-    { "persist",	NOMC,		persist_cmd,		 NULL },
+    { "persist",	NOMC,		persist_cmd,		 &cmds[33] },
+    { "main_sdr_load",	MC,		main_sdr_load,		 NULL },
     { NULL }
 };
 
@@ -1329,12 +1465,22 @@ ipmi_emu_cmd(emu_out_t *out, emu_data_t *emu, char *cmd_str)
     int        rv = EINVAL;
     lmc_data_t *mc = NULL;
     struct emu_cmd_info *mcmd;
+    char       *rec_str = NULL;
+
+    if (emu_image_recording()) {
+	/* The tokenizer modifies the string, keep a copy to record. */
+	rec_str = strdup(cmd_str);
+	if (!rec_str) {
+	    out->printf(out, "**Out of memory recording command\n");
+	    return ENOMEM;
+	}
+    }
 
     cmd = mystrtok(cmd_str, " \t\n", &toks);
-    if (!cmd)
-	return 0;
-    if (cmd[0] == '#')
-	return 0;
+    if (!cmd || cmd[0] == '#') {
+	rv = 0;
+	goto out;
+    }
 
     
     for (mcmd = cmdlist; mcmd; mcmd = mcmd->next) {
@@ -1343,16 +1489,23 @@ ipmi_emu_cmd(emu_out_t *out, emu_data_t *emu, char *cmd_str)
 		unsigned char ipmb;
 		rv = emu_get_uchar(out, &toks, &ipmb, "MC address", 0);
 		if (rv)
-		    return rv;
+		    goto out;
 		rv = ipmi_emu_get_mc_by_addr(emu, ipmb, &mc);
 		if (rv) {
 		    out->printf(out, "**Invalid MC address\n");
-		    return rv;
+		    goto out;
 		}
 	    }
+	    if (rec_str)
+		emu_image_cmd_start();
 	    rv = mcmd->handler(out, emu, mc, &toks);
-	    if (rv)
-		return rv;
+	    /*
+	     * Includes are flattened into the image, anything that
+	     * didn't record itself in binary form is kept as text.
+	     */
+	    if (!rv && rec_str && mcmd->handler != read_cmds
+		&& !emu_image_cmd_recorded())
+		emu_image_record(EMU_IMG_TEXT, rec_str, strlen(rec_str) + 1);
 	    goto out;
 	}
     }
@@ -1360,5 +1513,7 @@ ipmi_emu_cmd(emu_out_t *out, emu_data_t *emu, char *cmd_str)
     out->printf(out, "**Unknown command: %s\n", cmd);
 
  out:
+    if (rec_str)
+	free(rec_str);
     return rv;
 }
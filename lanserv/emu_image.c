@@ -0,0 +1,481 @@
+/*
+ * emu_image.c
+ *
+ * MontaVista IPMI code for compiled emulator command images.
+ *
+ * Author: MontaVista Software, Inc.
+ *         Corey Minyard <minyard@mvista.com>
+ *         source@mvista.com
+ *
+ * Copyright 2012 MontaVista Software Inc.
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2 of
+ *  the License, or (at your option) any later version.
+ *
+ *
+ *  THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ *  WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ *  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ *  OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ *  TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ *  USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this program; if not, write to the Free
+ *  Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.  */
+
+/*
+ * A command image is the result of running an emulator command file
+ * (with all its includes flattened) stored in a binary form that can
+ * be mapped and replayed in a single pass.  The bulky commands (MCs,
+ * SDRs, sensors and FRU data) are stored pre-parsed, with any
+ * variables already evaluated, and are handed directly to the MC
+ * code.  Anything else is stored as the original command line, "$"
+ * variable references and all, and run through the normal command
+ * interpreter.  "define" commands are stored that way too, so the
+ * variables have the same values when the image is replayed.
+ *
+ * The image records every file that went into it along with its
+ * size and modification time.  If any of those change the image is
+ * considered stale, and it is rebuilt from the command file.
+ *
+ * The image is in host byte order, it is not meant to be moved
+ * between machines.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include <OpenIPMI/serv.h>
+#include <OpenIPMI/mcserv.h>
+#include "emu.h"
+
+#define EMU_IMAGE_MAGIC		"IPMIEMUI"
+#define EMU_IMAGE_VERSION	1
+#define EMU_IMAGE_BYTE_ORDER	0x01020304
+
+struct emu_image_hdr {
+    char     magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t num_deps;
+    uint32_t num_recs;
+    uint64_t length; /* Total length of the image, including this header. */
+};
+
+struct emu_image_dep {
+    uint64_t size;
+    int64_t  mtime_sec;
+    int64_t  mtime_nsec;
+    uint32_t name_len; /* Includes the nil terminator. */
+    uint32_t pad;
+    /* Followed by the name, padded out to 8 bytes. */
+};
+
+struct emu_image_rec {
+    uint16_t type;
+    uint16_t pad;
+    uint32_t len; /* Length of the data after this header, unpadded. */
+};
+
+#define EMU_IMAGE_ALIGN(v)	(((v) + 7) & ~((uint64_t) 7))
+
+/*
+ * State used while a command file is being compiled.
+ */
+static struct {
+    int           active;
+    int           recorded;
+    unsigned char *deps;
+    unsigned int  deps_len;
+    unsigned int  deps_size;
+    unsigned int  num_deps;
+    unsigned char *recs;
+    unsigned int  recs_len;
+    unsigned int  recs_size;
+    unsigned int  num_recs;
+    int           err;
+} comp;
+
+static int
+comp_append(unsigned char **buf, unsigned int *len, unsigned int *size,
+	    const void *data, unsigned int data_len)
+{
+    unsigned int newlen = EMU_IMAGE_ALIGN(*len + data_len);
+
+    if (newlen > *size) {
+	unsigned int newsize = *size ? *size : 4096;
+	unsigned char *nbuf;
+
+	while (newsize < newlen)
+	    newsize *= 2;
+	nbuf = realloc(*buf, newsize);
+	if (!nbuf)
+	    return ENOMEM;
+	*buf = nbuf;
+	*size = newsize;
+    }
+    memcpy(*buf + *len, data, data_len);
+    memset(*buf + *len + data_len, 0, newlen - (*len + data_len));
+    *len = newlen;
+    return 0;
+}
+
+int
+emu_image_recording(void)
+{
+    return comp.active;
+}
+
+void
+emu_image_cmd_start(void)
+{
+    comp.recorded = 0;
+}
+
+int
+emu_image_cmd_recorded(void)
+{
+    return comp.recorded;
+}
+
+void
+emu_image_add_dep(const char *filename)
+{
+    struct emu_image_dep dep;
+    struct stat st;
+    int rv;
+
+    if (!comp.active || comp.err)
+	return;
+
+    if (stat(filename, &st) != 0) {
+	comp.err = errno;
+	return;
+    }
+
+    memset(&dep, 0, sizeof(dep));
+    dep.size = st.st_size;
+    dep.mtime_sec = st.st_mtim.tv_sec;
+    dep.mtime_nsec = st.st_mtim.tv_nsec;
+    dep.name_len = strlen(filename) + 1;
+    rv = comp_append(&comp.deps, &comp.deps_len, &comp.deps_size,
+		     &dep, sizeof(dep));
+    if (!rv)
+	rv = comp_append(&comp.deps, &comp.deps_len, &comp.deps_size,
+			 filename, dep.name_len);
+    if (rv)
+	comp.err = rv;
+    else
+	comp.num_deps++;
+}
+
+void
+emu_image_record(unsigned int type, const void *data, unsigned int len)
+{
+    struct emu_image_rec rec;
+    int rv;
+
+    if (!comp.active || comp.err)
+	return;
+
+    memset(&rec, 0, sizeof(rec));
+    rec.type = type;
+    rec.len = len;
+    rv = comp_append(&comp.recs, &comp.recs_len, &comp.recs_size,
+		     &rec, sizeof(rec));
+    if (!rv)
+	rv = comp_append(&comp.recs, &comp.recs_len, &comp.recs_size,
+			 data, len);
+    if (rv)
+	comp.err = rv;
+    else
+	comp.num_recs++;
+    comp.recorded = 1;
+}
+
+static void
+comp_free(void)
+{
+    if (comp.deps)
+	free(comp.deps);
+    if (comp.recs)
+	free(comp.recs);
+    memset(&comp, 0, sizeof(comp));
+}
+
+static int
+write_image(const char *image_file)
+{
+    struct emu_image_hdr hdr;
+    char *tmpname;
+    FILE *f;
+    int rv = 0;
+
+    tmpname = malloc(strlen(image_file) + 5);
+    if (!tmpname)
+	return ENOMEM;
+    strcpy(tmpname, image_file);
+    strcat(tmpname, ".tmp");
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, EMU_IMAGE_MAGIC, sizeof(hdr.magic));
+    hdr.version = EMU_IMAGE_VERSION;
+    hdr.byte_order = EMU_IMAGE_BYTE_ORDER;
+    hdr.num_deps = comp.num_deps;
+    hdr.num_recs = comp.num_recs;
+    hdr.length = sizeof(hdr) + comp.deps_len + comp.recs_len;
+
+    f = fopen(tmpname, "w");
+    if (!f) {
+	rv = errno;
+	goto out;
+    }
+    if ((fwrite(&hdr, sizeof(hdr), 1, f) != 1)
+	|| (comp.deps_len &&
+	    fwrite(comp.deps, comp.deps_len, 1, f) != 1)
+	|| (comp.recs_len &&
+	    fwrite(comp.recs, comp.recs_len, 1, f) != 1))
+	rv = EIO;
+    if (fclose(f) != 0 && !rv)
+	rv = errno;
+    if (!rv && rename(tmpname, image_file) != 0)
+	rv = errno;
+    if (rv)
+	unlink(tmpname);
+  out:
+    free(tmpname);
+    return rv;
+}
+
+/*
+ * Validate the header and dependencies of a mapped image.  Returns a
+ * pointer to the first record, or NULL if the image is unusable.
+ */
+static unsigned char *
+check_image(unsigned char *img, uint64_t img_len, const char *command_file)
+{
+    struct emu_image_hdr *hdr = (struct emu_image_hdr *) img;
+    unsigned char *pos, *end;
+    unsigned int i;
+
+    if (img_len < sizeof(*hdr))
+	return NULL;
+    if (memcmp(hdr->magic, EMU_IMAGE_MAGIC, sizeof(hdr->magic)) != 0
+	|| hdr->version != EMU_IMAGE_VERSION
+	|| hdr->byte_order != EMU_IMAGE_BYTE_ORDER
+	|| hdr->length != img_len)
+	return NULL;
+
+    pos = img + sizeof(*hdr);
+    end = img + img_len;
+    for (i = 0; i < hdr->num_deps; i++) {
+	struct emu_image_dep *dep = (struct emu_image_dep *) pos;
+	const char *name;
+	struct stat st;
+
+	if ((uint64_t) (end - pos) < sizeof(*dep))
+	    return NULL;
+	pos += sizeof(*dep);
+	if ((uint64_t) (end - pos) < EMU_IMAGE_ALIGN(dep->name_len)
+	    || dep->name_len == 0)
+	    return NULL;
+	name = (char *) pos;
+	if (name[dep->name_len - 1] != '\0')
+	    return NULL;
+	pos += EMU_IMAGE_ALIGN(dep->name_len);
+
+	/* The first dependency is always the main command file. */
+	if (i == 0 && strcmp(name, command_file) != 0)
+	    return NULL;
+
+	if (stat(name, &st) != 0
+	    || (uint64_t) st.st_size != dep->size
+	    || st.st_mtim.tv_sec != dep->mtime_sec
+	    || st.st_mtim.tv_nsec != dep->mtime_nsec)
+	    return NULL;
+    }
+
+    return pos;
+}
+
+static int
+get_mc(emu_out_t *out, emu_data_t *emu, unsigned char ipmb, lmc_data_t **mc)
+{
+    int rv = ipmi_emu_get_mc_by_addr(emu, ipmb, mc);
+
+    if (rv)
+	out->printf(out, "**Invalid MC address in command image: 0x%x\n",
+		    ipmb);
+    return rv;
+}
+
+static int
+replay_rec(emu_out_t *out, emu_data_t *emu, unsigned int type,
+	   unsigned char *d, unsigned int len)
+{
+    lmc_data_t *mc;
+    int rv;
+
+    switch (type) {
+    case EMU_IMG_TEXT:
+	if (len == 0 || d[len - 1] != '\0')
+	    return EINVAL;
+	/* The image is mapped privately, so the tokenizer may write it. */
+	return ipmi_emu_cmd(out, emu, (char *) d);
+
+    case EMU_IMG_MC_ADD:
+	if (len != 16)
+	    return EINVAL;
+	return ipmi_emu_add_mc(emu, d[0], d[1], d[2], d[3], d[4], d[5], d[6],
+			       d + 7, d + 10, ipmi_get_uint32(d + 12));
+
+    case EMU_IMG_MC_SETBMC:
+	if (len != 1)
+	    return EINVAL;
+	return ipmi_emu_set_bmc_mc(emu, d[0]);
+
+    case EMU_IMG_MAIN_SDR:
+	if (len < 1)
+	    return EINVAL;
+	rv = get_mc(out, emu, d[0], &mc);
+	if (!rv)
+	    rv = ipmi_mc_add_main_sdr(mc, d + 1, len - 1);
+	return rv;
+
+    case EMU_IMG_DEVICE_SDR:
+	if (len < 2)
+	    return EINVAL;
+	rv = get_mc(out, emu, d[0], &mc);
+	if (!rv)
+	    rv = ipmi_mc_add_device_sdr(mc, d[1], d + 2, len - 2);
+	return rv;
+
+    case EMU_IMG_SENSOR:
+	if (len != 6)
+	    return EINVAL;
+	rv = get_mc(out, emu, d[0], &mc);
+	if (!rv)
+	    rv = ipmi_mc_add_sensor(mc, d[1], d[2], d[3], d[4], d[5]);
+	return rv;
+
+    case EMU_IMG_FRU_DATA:
+	if (len < 6)
+	    return EINVAL;
+	rv = get_mc(out, emu, d[0], &mc);
+	if (!rv) {
+	    unsigned int length = ipmi_get_uint32(d + 2);
+
+	    if (length != len - 6)
+		return EINVAL;
+	    rv = ipmi_mc_add_fru_data(mc, d[1], length, NULL, d + 6);
+	}
+	return rv;
+
+    default:
+	out->printf(out, "**Unknown record type %u in command image\n", type);
+	return EINVAL;
+    }
+}
+
+static int
+load_image(emu_out_t *out, emu_data_t *emu, const char *command_file,
+	   const char *image_file, int *stale)
+{
+    struct emu_image_hdr *hdr;
+    unsigned char *img, *pos, *end;
+    struct stat st;
+    unsigned int i;
+    int fd, rv = 0;
+
+    *stale = 1;
+    fd = open(image_file, O_RDONLY);
+    if (fd == -1)
+	return 0;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t) sizeof(*hdr)) {
+	close(fd);
+	return 0;
+    }
+    img = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (img == MAP_FAILED)
+	return 0;
+
+    pos = check_image(img, st.st_size, command_file);
+    if (!pos)
+	goto out;
+    *stale = 0;
+
+    hdr = (struct emu_image_hdr *) img;
+    end = img + st.st_size;
+    for (i = 0; i < hdr->num_recs; i++) {
+	struct emu_image_rec *rec = (struct emu_image_rec *) pos;
+
+	if ((uint64_t) (end - pos) < sizeof(*rec)
+	    || (uint64_t) (end - pos - sizeof(*rec)) < rec->len) {
+	    out->printf(out, "**Command image %s is truncated\n", image_file);
+	    rv = EINVAL;
+	    break;
+	}
+	pos += sizeof(*rec);
+	rv = replay_rec(out, emu, rec->type, pos, rec->len);
+	if (rv) {
+	    out->printf(out, "**Error 0x%x in command image %s record %u\n",
+			rv, image_file, i);
+	    break;
+	}
+	pos += EMU_IMAGE_ALIGN(rec->len);
+    }
+    if (!rv)
+	out->printf(out, "Loaded command image %s, %u records\n",
+		    image_file, hdr->num_recs);
+
+  out:
+    munmap(img, st.st_size);
+    return rv;
+}
+
+int
+read_command_image(emu_out_t *out, emu_data_t *emu, const char *command_file,
+		   const char *image_file, const char *config_file)
+{
+    int rv, stale;
+
+    rv = load_image(out, emu, command_file, image_file, &stale);
+    if (!stale)
+	return rv;
+
+    comp_free();
+    comp.active = 1;
+    /* read_command_file() adds the command file, it must come first. */
+    rv = read_command_file(out, emu, command_file);
+    if (config_file)
+	emu_image_add_dep(config_file);
+    comp.active = 0;
+
+    if (!rv && comp.err)
+	out->printf(out, "**Unable to compile command image %s: %s\n",
+		    image_file, strerror(comp.err));
+    else if (!rv) {
+	int err = write_image(image_file);
+	if (err)
+	    out->printf(out, "**Unable to write command image %s: %s\n",
+			image_file, strerror(err));
+    }
+    comp_free();
+    return rv;
+}
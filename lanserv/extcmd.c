@@ -62,10 +62,413 @@
 #include <stdio.h>
 #include <malloc.h>
 #include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/wait.h>
 
 #include <OpenIPMI/serv.h>
 #include <OpenIPMI/extcmd.h>
 
+/*
+ * The external program can be run for each operation, or (if
+ * extcmd_coprocess is set) run once as "<cmd> coprocess" and left
+ * running.  A co-process reads one operation per line, in the same
+ * form as the command line arguments ("get parm ...", "set parm val
+ * ...", "check parm val ..."), and writes the same output the command
+ * would, followed by a line that is "OK" if the operation worked or
+ * starts with "ERROR" if it did not.  If the program doesn't handle
+ * that, it just runs the program for each operation.  If the
+ * co-process dies it is restarted.
+ *
+ * Values read are cached for extcmd_cache_ttl milliseconds, a set
+ * throws away the cache for that program.
+ */
+#define EXTCMD_COPROC_TIMEOUT	5000 /* milliseconds */
+
+typedef struct extcmd_cache_s {
+    char *name;
+    char *value;
+    struct timeval time;
+    struct extcmd_cache_s *next;
+} extcmd_cache_t;
+
+typedef struct extcmd_prog_s {
+    char *cmd;
+
+    pid_t pid; /* 0 if the co-process has been reaped. */
+    int fd; /* -1 if the co-process is not running. */
+    int coproc_worked; /* The co-process has done at least one op. */
+    int coproc_failed; /* Don't use a co-process for this program. */
+
+    extcmd_cache_t *cache;
+
+    struct extcmd_prog_s *next;
+} extcmd_prog_t;
+
+static extcmd_prog_t *extcmd_progs;
+
+static extcmd_prog_t *
+extcmd_find_prog(const char *cmd)
+{
+    extcmd_prog_t *prog;
+
+    for (prog = extcmd_progs; prog; prog = prog->next) {
+	if (strcmp(prog->cmd, cmd) == 0)
+	    return prog;
+    }
+
+    prog = malloc(sizeof(*prog));
+    if (!prog)
+	return NULL;
+    memset(prog, 0, sizeof(*prog));
+    prog->cmd = strdup(cmd);
+    if (!prog->cmd) {
+	free(prog);
+	return NULL;
+    }
+    prog->fd = -1;
+    prog->next = extcmd_progs;
+    extcmd_progs = prog;
+    return prog;
+}
+
+static void
+extcmd_cache_clear(extcmd_prog_t *prog)
+{
+    extcmd_cache_t *c;
+
+    while (prog->cache) {
+	c = prog->cache;
+	prog->cache = c->next;
+	free(c->name);
+	free(c->value);
+	free(c);
+    }
+}
+
+static extcmd_cache_t *
+extcmd_cache_find(extcmd_prog_t *prog, const char *name)
+{
+    extcmd_cache_t *c;
+
+    for (c = prog->cache; c; c = c->next) {
+	if (strcmp(c->name, name) == 0)
+	    return c;
+    }
+    return NULL;
+}
+
+/*
+ * Build the output of a get from the cache.  Returns 0 unless all
+ * the values are in the cache and are not too old.
+ */
+static int
+extcmd_cache_get(sys_data_t *sys, extcmd_prog_t *prog,
+		 extcmd_info_t *ts, unsigned int count,
+		 char *buf, unsigned int buflen)
+{
+    struct timeval now;
+    extcmd_cache_t *c;
+    unsigned int i, len = 0, vlen;
+    long age;
+
+    sys->get_monotonic_time(sys, &now);
+    buf[0] = '\0';
+    for (i = 0; i < count; i++) {
+	c = extcmd_cache_find(prog, ts[i].name);
+	if (!c)
+	    return 0;
+	age = ((now.tv_sec - c->time.tv_sec) * 1000
+	       + (now.tv_usec - c->time.tv_usec) / 1000);
+	if (age >= (long) sys->extcmd_cache_ttl)
+	    return 0;
+	vlen = strlen(c->name) + strlen(c->value) + 2;
+	if (len + vlen >= buflen)
+	    return 0;
+	sprintf(buf + len, "%s:%s\n", c->name, c->value);
+	len += vlen;
+    }
+    return 1;
+}
+
+static char *
+find_extcmd_value(char *buf, const char *name)
+{
+    unsigned int len = strlen(name);
+
+    while (buf) {
+	if ((strncmp(buf, name, len) == 0) && buf[len] == ':')
+	    return buf + len + 1;
+	buf = strchr(buf, '\n');
+	if (buf)
+	    buf++;
+    }
+    return NULL;
+}
+
+static void
+extcmd_cache_put(sys_data_t *sys, extcmd_prog_t *prog,
+		 extcmd_info_t *ts, unsigned int count, char *buf)
+{
+    struct timeval now;
+    extcmd_cache_t *c;
+    unsigned int i;
+    char *val, *end, *nval;
+
+    sys->get_monotonic_time(sys, &now);
+    for (i = 0; i < count; i++) {
+	val = find_extcmd_value(buf, ts[i].name);
+	if (!val)
+	    continue;
+	end = strchr(val, '\n');
+	if (!end)
+	    end = val + strlen(val);
+	nval = strndup(val, end - val);
+	if (!nval)
+	    continue;
+	c = extcmd_cache_find(prog, ts[i].name);
+	if (!c) {
+	    c = malloc(sizeof(*c));
+	    if (!c) {
+		free(nval);
+		continue;
+	    }
+	    c->name = strdup(ts[i].name);
+	    if (!c->name) {
+		free(c);
+		free(nval);
+		continue;
+	    }
+	    c->value = NULL;
+	    c->next = prog->cache;
+	    prog->cache = c;
+	}
+	free(c->value);
+	c->value = nval;
+	c->time = now;
+    }
+}
+
+void
+extcmd_child_quit(void *info, pid_t pid)
+{
+    extcmd_prog_t *prog;
+
+    for (prog = extcmd_progs; prog; prog = prog->next) {
+	if (prog->pid == pid)
+	    prog->pid = 0;
+    }
+}
+
+static void
+coproc_stop(extcmd_prog_t *prog)
+{
+    if (prog->fd == -1)
+	return;
+    close(prog->fd);
+    prog->fd = -1;
+    if (prog->pid) {
+	/* Not reaped yet, so the pid can't have been reused. */
+	kill(prog->pid, SIGKILL);
+	waitpid(prog->pid, NULL, 0);
+	prog->pid = 0;
+    }
+}
+
+static int
+coproc_start(sys_data_t *sys, extcmd_prog_t *prog)
+{
+    int sv[2];
+    char *cmd;
+    pid_t pid;
+
+    /*
+     * A socket instead of pipes so writing to a dead co-process
+     * doesn't raise SIGPIPE.
+     */
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == -1)
+	return errno;
+
+    cmd = malloc(strlen(prog->cmd) + 11);
+    if (!cmd) {
+	close(sv[0]);
+	close(sv[1]);
+	return ENOMEM;
+    }
+    strcpy(cmd, prog->cmd);
+    strcat(cmd, " coprocess");
+
+    pid = fork();
+    if (pid == -1) {
+	int err = errno;
+	free(cmd);
+	close(sv[0]);
+	close(sv[1]);
+	return err;
+    }
+    if (pid == 0) {
+	close(sv[0]);
+	dup2(sv[1], 0);
+	dup2(sv[1], 1);
+	if (sv[1] > 1)
+	    close(sv[1]);
+	execl("/bin/sh", "sh", "-c", cmd, NULL);
+	_exit(127);
+    }
+
+    free(cmd);
+    close(sv[1]);
+    fcntl(sv[0], F_SETFD, FD_CLOEXEC);
+    prog->fd = sv[0];
+    prog->pid = pid;
+    prog->coproc_worked = 0;
+    return 0;
+}
+
+/*
+ * Do one operation on a running co-process.  Returns EPIPE if the
+ * co-process is gone or didn't respond, E2BIG if the output didn't
+ * fit.  Otherwise the output is in buf and status is set to non-zero
+ * if the operation failed.
+ */
+static int
+coproc_op(extcmd_prog_t *prog, const char *op, char *buf,
+	  unsigned int buflen, int *status)
+{
+    unsigned int len = strlen(op), pos = 0;
+    struct pollfd pfd;
+    char *line;
+    ssize_t rv;
+
+    while (pos < len) {
+	rv = send(prog->fd, op + pos, len - pos, MSG_NOSIGNAL);
+	if (rv == -1 && errno == EINTR)
+	    continue;
+	if (rv <= 0)
+	    return EPIPE;
+	pos += rv;
+    }
+    rv = send(prog->fd, "\n", 1, MSG_NOSIGNAL);
+    if (rv != 1)
+	return EPIPE;
+
+    pos = 0;
+    for (;;) {
+	pfd.fd = prog->fd;
+	pfd.events = POLLIN;
+	rv = poll(&pfd, 1, EXTCMD_COPROC_TIMEOUT);
+	if (rv == -1 && errno == EINTR)
+	    continue;
+	if (rv <= 0)
+	    return EPIPE;
+	if (pos >= buflen - 1)
+	    return E2BIG;
+	rv = read(prog->fd, buf + pos, buflen - 1 - pos);
+	if (rv == -1 && errno == EINTR)
+	    continue;
+	if (rv <= 0)
+	    return EPIPE;
+	pos += rv;
+	buf[pos] = '\0';
+
+	/* Look for the status line at the end. */
+	if (buf[pos - 1] != '\n')
+	    continue;
+	buf[pos - 1] = '\0';
+	line = strrchr(buf, '\n');
+	if (line)
+	    line++;
+	else
+	    line = buf;
+	if (strcmp(line, "OK") == 0) {
+	    /* Just leave the output. */
+	    *status = 0;
+	    *line = '\0';
+	} else if (strncmp(line, "ERROR", 5) == 0) {
+	    /* Leave the error line, too, for logging. */
+	    *status = 1;
+	} else {
+	    buf[pos - 1] = '\n';
+	    continue;
+	}
+	return 0;
+    }
+}
+
+/*
+ * Run the operation in cmd, which is the program followed by the
+ * operation and its arguments.  The output goes into buf, status is
+ * set to non-zero if the program said the operation failed.
+ */
+static int
+run_extcmd(sys_data_t *sys, extcmd_prog_t *prog, const char *opname,
+	   char *cmd, char *buf, unsigned int buflen, int *status)
+{
+    FILE *f;
+    int rv;
+
+    if (sys->extcmd_coprocess && prog && !prog->coproc_failed) {
+	const char *op = cmd + strlen(prog->cmd) + 1;
+	int tries;
+
+	for (tries = 0; tries < 2; tries++) {
+	    if (prog->fd == -1) {
+		rv = coproc_start(sys, prog);
+		if (rv) {
+		    sys->log(sys, OS_ERROR, NULL,
+			     "Unable to start extcmd co-process (%s): %s\n",
+			     prog->cmd, strerror(rv));
+		    break;
+		}
+	    }
+	    rv = coproc_op(prog, op, buf, buflen, status);
+	    if (rv == 0) {
+		prog->coproc_worked = 1;
+		return 0;
+	    }
+	    coproc_stop(prog);
+	    if (rv == E2BIG) {
+		sys->log(sys, OS_ERROR, NULL,
+			 "Output of extcmd config %s command (%s) is too big",
+			 opname, cmd);
+		return EINVAL;
+	    }
+	    if (!prog->coproc_worked)
+		/* Never worked, don't bother restarting it. */
+		break;
+	    sys->log(sys, INFO, NULL,
+		     "extcmd co-process (%s) died, restarting\n", prog->cmd);
+	}
+	sys->log(sys, INFO, NULL,
+		 "extcmd co-process (%s) not working, running the command"
+		 " for each operation\n", prog->cmd);
+	prog->coproc_failed = 1;
+    }
+
+    f = popen(cmd, "r");
+    if (!f) {
+	sys->log(sys, OS_ERROR, NULL,
+		 "Unable to execute extcmd %s command (%s): %s\n",
+		 opname, cmd, strerror(errno));
+	return errno;
+    }
+
+    rv = fread(buf, 1, buflen - 1, f);
+    if ((unsigned int) rv == buflen - 1) {
+	sys->log(sys, OS_ERROR, NULL,
+		 "Output of extcmd config %s command (%s) is too big",
+		 opname, cmd);
+	pclose(f);
+	return EINVAL;
+    }
+    buf[rv] = '\0';
+
+    *status = pclose(f);
+    return 0;
+}
+
 static int
 extcmd_getval(void *baseloc, extcmd_info_t *t, char *val)
 {
@@ -220,14 +623,30 @@ extcmd_setval(void *baseloc, extcmd_info_t *t)
 static int
 process_extcmd_value(void *baseloc, extcmd_info_t *t, char *buf)
 {
-    while (buf) {
-	unsigned int len = strlen(t->name);
+    char *val = find_extcmd_value(buf, t->name);
+
+    if (!val)
+	return EEXIST;
+    return extcmd_getval(baseloc, t, val);
+}
+
+static int
+process_extcmd_values(sys_data_t *sys, void *baseloc,
+		      extcmd_info_t *ts, unsigned int count, char *buf)
+{
+    unsigned int i;
+    int rv;
 
-	if ((strncmp(buf, t->name, len) == 0) && buf[len] == ':')
-	    return extcmd_getval(baseloc, t, buf + len + 1);
-	buf = strchr(buf, '\n') + 1;
+    for (i = 0; i < count; i++) {
+	rv = process_extcmd_value(baseloc, ts + i, buf);
+	if (rv) {
+	    sys->log(sys, OS_ERROR, NULL,
+		     "Setting extern command value of %s failed: %s",
+		     ts[i].name, strerror(rv));
+	    return rv;
+	}
     }
-    return EEXIST;
+    return 0;
 }
 
 static int
@@ -277,14 +696,20 @@ extcmd_getvals(sys_data_t *sys,
 {
     int rv;
     char *cmd;
-    FILE *f;
     unsigned int i;
     char buf[2048];
     unsigned int buflen = sizeof(buf);
+    extcmd_prog_t *prog;
+    int status;
 
     if (!incmd)
 	return 0;
 
+    prog = extcmd_find_prog(incmd);
+    if (prog && sys->extcmd_cache_ttl
+	&& extcmd_cache_get(sys, prog, ts, count, buf, buflen))
+	return process_extcmd_values(sys, baseloc, ts, count, buf);
+
     cmd = malloc(strlen(incmd) + 5);
     if (!cmd)
 	return ENOMEM;
@@ -300,40 +725,19 @@ extcmd_getvals(sys_data_t *sys,
 	}
     }
 
-    f = popen(cmd, "r");
-    if (!f) {
-	sys->log(sys, OS_ERROR, NULL,
-		 "Unable to execute extcmd read command (%s): %s\n",
-		 cmd, strerror(errno));
-	rv = errno;
-	goto out;
-    }
-
-    rv = fread(buf, 1, buflen - 1, f);
-    if ((unsigned int) rv == buflen - 1) {
-	sys->log(sys, OS_ERROR, NULL,
-		 "Output of extcmd config read command (%s) is too big", cmd);
-	rv = EINVAL;
+    rv = run_extcmd(sys, prog, "read", cmd, buf, buflen, &status);
+    if (rv)
 	goto out;
-    }
-    buf[rv] = '\0';
-
-    rv = pclose(f);
-    if (rv) {
+    if (status) {
+	rv = status;
 	sys->log(sys, OS_ERROR, NULL, 
 		 "extcmd read command (%s) failed: %x: %s", cmd, rv, buf);
 	goto out;
     }
 
-    for (i = 0; i < count; i++) {
-	rv = process_extcmd_value(baseloc, ts + i, buf);
-	if (rv) {
-	    sys->log(sys, OS_ERROR, NULL,
-		     "Setting extern command value of %s failed: %s",
-		     ts[i].name, strerror(rv));
-	    goto out;
-	}
-    }
+    rv = process_extcmd_values(sys, baseloc, ts, count, buf);
+    if (!rv && prog && sys->extcmd_cache_ttl)
+	extcmd_cache_put(sys, prog, ts, count, buf);
   out:
     free(cmd);
     return rv;
@@ -346,11 +750,12 @@ extcmd_setvals(sys_data_t *sys,
 {
     int rv = 0;
     char *cmd;
-    FILE *f;
     unsigned int i;
     char buf[2048];
     unsigned int buflen = sizeof(buf);
     int oneset = 0;
+    extcmd_prog_t *prog;
+    int status;
 
     if (!incmd)
 	return 0;
@@ -376,26 +781,16 @@ extcmd_setvals(sys_data_t *sys,
     if (!oneset)
 	goto out;
 
-    f = popen(cmd, "r");
-    if (!f) {
-	sys->log(sys, OS_ERROR, NULL,
-		 "Unable to execute extcmd write command (%s): %s\n",
-		 cmd, strerror(errno));
-	rv = errno;
-	goto out;
-    }
+    prog = extcmd_find_prog(incmd);
+    /* Setting one value may change others, so just drop them all. */
+    if (prog)
+	extcmd_cache_clear(prog);
 
-    rv = fread(buf, 1, buflen - 1, f);
-    if ((unsigned int) rv == buflen - 1) {
-	sys->log(sys, OS_ERROR, NULL,
-		 "Output of extcmd config write command (%s) is too big", cmd);
-	rv = EINVAL;
+    rv = run_extcmd(sys, prog, "write", cmd, buf, buflen, &status);
+    if (rv)
 	goto out;
-    }
-    buf[rv] = '\0';
-
-    rv = pclose(f);
-    if (rv) {
+    if (status) {
+	rv = status;
 	sys->log(sys, OS_ERROR, NULL, 
 		 "extcmd write command (%s) failed: %x: %s", cmd, rv, buf);
 	goto out;
@@ -413,10 +808,10 @@ extcmd_checkvals(sys_data_t *sys,
 {
     int rv = 0;
     char *cmd;
-    FILE *f;
     unsigned int i;
     char buf[2048];
     unsigned int buflen = sizeof(buf);
+    int status;
 
     if (!incmd)
 	return 0;
@@ -441,26 +836,13 @@ extcmd_checkvals(sys_data_t *sys,
 	}
     }
 
-    f = popen(cmd, "r");
-    if (!f) {
-	sys->log(sys, OS_ERROR, NULL,
-		 "Unable to execute extcmd check command (%s): %s\n",
-		 cmd, strerror(errno));
-	rv = errno;
-	goto out;
-    }
-
-    rv = fread(buf, 1, buflen - 1, f);
-    if ((unsigned int) rv == buflen - 1) {
-	sys->log(sys, OS_ERROR, NULL,
-		 "Output of extcmd config check command (%s) is too big", cmd);
-	rv = EINVAL;
+    rv = run_extcmd(sys, extcmd_find_prog(incmd), "check", cmd, buf, buflen,
+		    &status);
+    if (rv)
 	goto out;
-    }
-    buf[rv] = '\0';
 
     /* Return value should tell us if it's ok. */
-    rv = pclose(f);
+    rv = status;
 
   out:
     free(cmd);
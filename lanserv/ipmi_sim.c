@@ -93,6 +93,7 @@
 
 #include "emu.h"
 #include <OpenIPMI/persist.h>
+#include <OpenIPMI/extcmd.h>
 
 #define MAX_ADDR 4
 
@@ -101,8 +102,11 @@ static char *config_file = BASE_CONF_STR "/lan.conf";
 static const char *statedir = STATEDIR;
 static char *command_string = NULL;
 static char *command_file = NULL;
+static char *command_image = NULL;
 static int debug = 0;
 static int nostdio = 0;
+static char *time_scale = NULL;
+static char *capture_file = NULL;
 
 /*
  * Keep track of open sockets so we can close them on exec().
@@ -166,6 +170,7 @@ struct misc_data
     os_handler_t *os_hnd;
     os_handler_waiter_factory_t *waiter_factory;
     os_hnd_timer_id_t *timer;
+    ipmi_timer_t *tick_timer;
     console_info_t *consoles;
 };
 
@@ -257,6 +262,11 @@ lan_send(lanserv_data_t *lan,
     msg.msg_controllen = 0;
     msg.msg_flags = 0;
 
+    lan_capture_packet(&lan->lan_addr.addr.s_ipsock.s_addr,
+		       lan->lan_addr.addr_len,
+		       (struct sockaddr *) &l->addr, l->addr_len,
+		       data, vecs);
+
     rv = sendmsg(l->xmit_fd, &msg, 0);
     if (rv) {
 	/* FIXME - log an error. */
@@ -270,7 +280,10 @@ lan_data_ready(int lan_fd, void *cb_data, os_hnd_fd_id_t *id)
     int           len;
     sim_addr_t    l;
     unsigned char msgd[256];
+    struct iovec  vec;
 
+    /* The address is used as a rate limit key, don't leave garbage. */
+    memset(&l, 0, sizeof(l));
     l.addr_len = sizeof(l.addr);
     len = recvfrom(lan_fd, msgd, sizeof(msgd), 0,
 		   (struct sockaddr *) &(l.addr), &(l.addr_len));
@@ -283,6 +296,12 @@ lan_data_ready(int lan_fd, void *cb_data, os_hnd_fd_id_t *id)
     }
     l.xmit_fd = lan_fd;
 
+    vec.iov_base = msgd;
+    vec.iov_len = len;
+    lan_capture_packet((struct sockaddr *) &l.addr, l.addr_len,
+		       &lan->lan_addr.addr.s_ipsock.s_addr,
+		       lan->lan_addr.addr_len, &vec, 1);
+
     if (lan->sysinfo->debug & DEBUG_RAW_MSG) {
 	debug_log_raw_msg(lan->sysinfo, (void *) &l.addr, l.addr_len,
 			  "Raw LAN receive from:");
@@ -397,7 +416,7 @@ lan_channel_init(void *info, channel_t *chan)
 }
 
 static void
-ser_send(serserv_data_t *ser, unsigned char *data, unsigned int data_len)
+ser_send(serserv_data_t *ser, struct iovec *data, unsigned int vecs)
 {
     int rv;
 
@@ -405,7 +424,7 @@ ser_send(serserv_data_t *ser, unsigned char *data, unsigned int data_len)
 	/* Not connected */
 	return;
 
-    rv = write(ser->con_fd, data, data_len);
+    rv = writev(ser->con_fd, data, vecs);
     if (rv) {
 	/* FIXME - log an error. */
     }
@@ -416,7 +435,7 @@ ser_data_ready(int fd, void *cb_data, os_hnd_fd_id_t *id)
 {
     serserv_data_t *ser = cb_data;
     int           len;
-    unsigned char msgd[256];
+    unsigned char msgd[4096];
 
     len = read(fd, msgd, sizeof(msgd));
     if (len <= 0) {
@@ -681,6 +700,15 @@ static struct poptOption poptOpts[]=
 	"command file",
 	""
     },
+    {
+	"command-image",
+	'i',
+	POPT_ARG_STRING,
+	&command_image,
+	'i',
+	"compiled command image",
+	""
+    },
     {
 	"state-dir",
 	's',
@@ -717,6 +745,24 @@ static struct poptOption poptOpts[]=
 	"nostdio",
 	""
     },
+    {
+	"time-scale",
+	't',
+	POPT_ARG_STRING,
+	&time_scale,
+	't',
+	"run the simulated clock at this multiple of real time",
+	""
+    },
+    {
+	"capture",
+	'p',
+	POPT_ARG_STRING,
+	&capture_file,
+	'p',
+	"capture LAN traffic to this pcap file",
+	""
+    },
     POPT_AUTOHELP
     {
 	NULL,
@@ -989,6 +1035,253 @@ console_bind_ready(int fd, void *cb_data, os_hnd_fd_id_t *id)
     err = write(rv, "> ", 2);
 }
 
+/*
+ * A minimal HTTP server for the metrics port.  Each connection sends
+ * one request, gets the statistics in Prometheus text format back,
+ * and is closed.  The socket is non-blocking and the response is
+ * sent as the socket takes it, so a slow client doesn't hold up the
+ * simulator.  Connections that make no progress for
+ * METRICS_IDLE_TIMEOUT seconds are closed.
+ */
+#define METRICS_IDLE_TIMEOUT 10
+
+typedef struct metrics_con_s
+{
+    misc_data_t *data;
+    int fd;
+    os_hnd_fd_id_t *id;
+    os_hnd_timer_id_t *timer;
+    char buffer[1024];
+    unsigned int pos;
+    char *out;
+    unsigned int out_len;
+    unsigned int out_size;
+    unsigned int out_pos;
+} metrics_con_t;
+
+static void
+metrics_printf(emu_out_t *out, char *format, ...)
+{
+    metrics_con_t *con = out->data;
+    va_list ap;
+    int len;
+    char *nout;
+
+    for (;;) {
+	va_start(ap, format);
+	len = vsnprintf(con->out + con->out_len, con->out_size - con->out_len,
+			format, ap);
+	va_end(ap);
+	if (len < 0)
+	    return;
+	if (con->out_len + len < con->out_size)
+	    break;
+	nout = realloc(con->out, con->out_size * 2 + len);
+	if (!nout)
+	    return;
+	con->out = nout;
+	con->out_size = con->out_size * 2 + len;
+    }
+    con->out_len += len;
+}
+
+static void
+metrics_close(metrics_con_t *con)
+{
+    os_handler_t *os_hnd = con->data->os_hnd;
+
+    os_hnd->stop_timer(os_hnd, con->timer);
+    os_hnd->free_timer(os_hnd, con->timer);
+    os_hnd->remove_fd_to_wait_for(os_hnd, con->id);
+    close(con->fd);
+    free(con->out);
+    free(con);
+}
+
+static void
+metrics_timeout(void *cb_data, os_hnd_timer_id_t *id)
+{
+    metrics_con_t *con = cb_data;
+
+    metrics_close(con);
+}
+
+static void
+metrics_restart_timer(metrics_con_t *con)
+{
+    os_handler_t *os_hnd = con->data->os_hnd;
+    struct timeval tv;
+
+    os_hnd->stop_timer(os_hnd, con->timer);
+    tv.tv_sec = METRICS_IDLE_TIMEOUT;
+    tv.tv_usec = 0;
+    os_hnd->start_timer(os_hnd, con->timer, &tv, metrics_timeout, con);
+}
+
+static void
+metrics_write_ready(int fd, void *cb_data, os_hnd_fd_id_t *id)
+{
+    metrics_con_t *con = cb_data;
+    int rv;
+
+    rv = write(fd, con->out + con->out_pos, con->out_len - con->out_pos);
+    if (rv < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+	return;
+    if (rv <= 0) {
+	metrics_close(con);
+	return;
+    }
+    con->out_pos += rv;
+    if (con->out_pos >= con->out_len)
+	metrics_close(con);
+    else
+	metrics_restart_timer(con);
+}
+
+static void
+metrics_data_ready(int fd, void *cb_data, os_hnd_fd_id_t *id)
+{
+    metrics_con_t *con = cb_data;
+    os_handler_t *os_hnd = con->data->os_hnd;
+    emu_out_t out;
+    int rv;
+
+    rv = read(fd, con->buffer + con->pos, sizeof(con->buffer) - 1 - con->pos);
+    if (rv < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+	return;
+    if (rv <= 0) {
+	metrics_close(con);
+	return;
+    }
+    metrics_restart_timer(con);
+    con->pos += rv;
+    con->buffer[con->pos] = '\0';
+    if (!strstr(con->buffer, "\r\n\r\n") && !strstr(con->buffer, "\n\n")
+	&& con->pos < sizeof(con->buffer) - 1)
+	return; /* Wait for the rest of the request. */
+
+    con->out_size = 65536;
+    con->out = malloc(con->out_size);
+    if (!con->out) {
+	metrics_close(con);
+	return;
+    }
+    con->out_len = 0;
+    con->out_pos = 0;
+    out.printf = metrics_printf;
+    out.data = con;
+    if (strncmp(con->buffer, "GET ", 4) == 0) {
+	out.printf(&out, "HTTP/1.0 200 OK\r\n"
+		   "Content-Type: text/plain; version=0.0.4\r\n"
+		   "Connection: close\r\n\r\n");
+	ipmi_emu_stats_prometheus(con->data->emu, &out);
+    } else {
+	out.printf(&out, "HTTP/1.0 405 Method Not Allowed\r\n"
+		   "Connection: close\r\n\r\n");
+    }
+
+    /* Done reading, send the response as the socket allows. */
+    os_hnd->set_fd_handlers(os_hnd, con->id, metrics_write_ready, NULL);
+    os_hnd->set_fd_enables(os_hnd, con->id, 0, 1, 0);
+}
+
+static void
+metrics_bind_ready(int fd, void *cb_data, os_hnd_fd_id_t *id)
+{
+    misc_data_t *misc = cb_data;
+    metrics_con_t *con;
+    int rv;
+    int err;
+
+    rv = accept(fd, NULL, NULL);
+    if (rv < 0) {
+	perror("Error from metrics accept");
+	return;
+    }
+
+    fcntl(rv, F_SETFL, fcntl(rv, F_GETFL) | O_NONBLOCK);
+    fcntl(rv, F_SETFD, FD_CLOEXEC);
+
+    con = malloc(sizeof(*con));
+    if (!con) {
+	close(rv);
+	return;
+    }
+    memset(con, 0, sizeof(*con));
+    con->data = misc;
+    con->fd = rv;
+
+    err = misc->os_hnd->alloc_timer(misc->os_hnd, &con->timer);
+    if (err) {
+	close(rv);
+	free(con);
+	return;
+    }
+
+    err = misc->os_hnd->add_fd_to_wait_for(misc->os_hnd, rv,
+					   metrics_data_ready, con,
+					   NULL, &con->id);
+    if (err) {
+	misc->os_hnd->free_timer(misc->os_hnd, con->timer);
+	close(rv);
+	free(con);
+	return;
+    }
+    metrics_restart_timer(con);
+}
+
+static int
+metrics_init(misc_data_t *data)
+{
+    sys_data_t *sys = data->sys;
+    os_hnd_fd_id_t *id;
+    int nfd;
+    int val;
+    int err;
+
+    nfd = socket(sys->metrics_addr.s_ipsock.s_addr.sa_family,
+		 SOCK_STREAM, IPPROTO_TCP);
+    if (nfd == -1) {
+	perror("Metrics socket open");
+	return errno;
+    }
+    fcntl(nfd, F_SETFD, FD_CLOEXEC);
+    val = 1;
+    err = setsockopt(nfd, SOL_SOCKET, SO_REUSEADDR,
+		     (char *)&val, sizeof(val));
+    if (err) {
+	perror("metrics setsockopt reuseaddr");
+	goto out_err;
+    }
+    err = bind(nfd, (struct sockaddr *) &sys->metrics_addr,
+	       sys->metrics_addr_len);
+    if (err) {
+	perror("bind to metrics socket");
+	goto out_err;
+    }
+    err = listen(nfd, 4);
+    if (err == -1) {
+	perror("listen to metrics socket");
+	goto out_err;
+    }
+
+    err = data->os_hnd->add_fd_to_wait_for(data->os_hnd, nfd,
+					   metrics_bind_ready, data,
+					   NULL, &id);
+    if (err) {
+	fprintf(stderr, "Unable to add metrics wait: 0x%x\n", err);
+	close(nfd);
+	return err;
+    }
+    isim_add_fd(nfd);
+    return 0;
+
+ out_err:
+    err = errno;
+    close(nfd);
+    return err;
+}
+
 struct termios old_termios;
 int old_flags;
 
@@ -1029,23 +1322,6 @@ ipmi_emu_shutdown(emu_data_t *emu)
     exit(0);
 }
 
-/* Sleep and don't take any user input. */
-static void
-sleeper(emu_data_t *emu, struct timeval *time)
-{
-    misc_data_t    *data = ipmi_emu_get_user_data(emu);
-    os_handler_waiter_t *waiter;
-
-    waiter = os_handler_alloc_waiter(data->waiter_factory);
-    if (!waiter) {
-	fprintf(stderr, "Unable to allocate waiter\n");
-	exit(1);
-    }
-
-    os_handler_waiter_wait(waiter, time);
-    os_handler_waiter_release(waiter);
-}
-
 struct ipmi_io_s
 {
     os_hnd_fd_id_t *id;
@@ -1129,64 +1405,379 @@ ipmi_remove_io_hnd(ipmi_io_t *io)
     io->data->os_hnd->remove_fd_to_wait_for(io->data->os_hnd, io->id);
 }
 
+/*
+ * Simulated time.  Everything in the simulator gets the time and runs
+ * timers through the sys_data_t functions below, so they all run off
+ * one clock.  Normally that is the OS clock, but it can be made to
+ * run at a multiple of real time, or stopped so it only moves when
+ * stepped from the console.  Timers are kept in a list sorted by
+ * when they expire in simulated time, one OS timer is run for the
+ * first one.  Times here are in microseconds.
+ *
+ * A timer started from a timer callback with no timeout is due at
+ * once.  To keep that from running forever, each pass over the list
+ * only runs timers started before the pass began (see start_seq).
+ */
 struct ipmi_timer_s
 {
-    os_hnd_timer_id_t *id;
     misc_data_t *data;
     void (*cb)(void *cb_data);
     void *cb_data;
+    int running;
+    uint64_t expiry;
+    uint64_t start_seq;
+    ipmi_timer_t *next;
+    ipmi_timer_t *prev;
 };
 
+static double clock_scale = 1.0; /* 0 means the clock is stopped. */
+static int clock_virtual;	/* Set once the clock is not the OS clock. */
+static uint64_t clock_base_real; /* OS monotonic time at the last change */
+static uint64_t clock_base_sim;	/* Simulated time at the last change */
+static int64_t clock_wall_offset; /* Simulated wall time - monotonic time */
+static ipmi_timer_t *timer_list;
+static int os_timer_running;
+static int in_timer_run;
+static uint64_t timer_start_seq;
+
+static uint64_t
+tv_to_usec(struct timeval *tv)
+{
+    return ((uint64_t) tv->tv_sec) * 1000000 + tv->tv_usec;
+}
+
+static void
+usec_to_tv(uint64_t usec, struct timeval *tv)
+{
+    tv->tv_sec = usec / 1000000;
+    tv->tv_usec = usec % 1000000;
+}
+
+static uint64_t
+os_monotonic_usec(misc_data_t *data)
+{
+    struct timeval tv;
+
+    data->os_hnd->get_monotonic_time(data->os_hnd, &tv);
+    return tv_to_usec(&tv);
+}
+
+static uint64_t
+sim_now(misc_data_t *data)
+{
+    if (!clock_virtual)
+	return os_monotonic_usec(data);
+    if (clock_scale == 0)
+	return clock_base_sim;
+    return clock_base_sim + (uint64_t) ((os_monotonic_usec(data)
+					  - clock_base_real) * clock_scale);
+}
+
+/* Start measuring the clock from now, done before changing it. */
+static void
+clock_rebase(misc_data_t *data)
+{
+    uint64_t now = sim_now(data);
+
+    if (!clock_virtual) {
+	struct timeval tv;
+
+	data->os_hnd->get_real_time(data->os_hnd, &tv);
+	clock_wall_offset = tv_to_usec(&tv) - now;
+	clock_virtual = 1;
+    }
+    clock_base_sim = now;
+    clock_base_real = os_monotonic_usec(data);
+}
+
+static void timer_os_cb(void *cb_data, os_hnd_timer_id_t *id);
+
+/* Run the OS timer for the first timer in the list. */
+static void
+timer_arm(misc_data_t *data)
+{
+    struct timeval tv;
+    uint64_t now, delay = 0;
+
+    if (in_timer_run)
+	return;
+    if (os_timer_running) {
+	data->os_hnd->stop_timer(data->os_hnd, data->timer);
+	os_timer_running = 0;
+    }
+    if (!timer_list || clock_scale == 0)
+	return;
+
+    now = sim_now(data);
+    if (timer_list->expiry > now)
+	/* Round up so the timer is never early. */
+	delay = (uint64_t) ((timer_list->expiry - now) / clock_scale) + 1;
+    usec_to_tv(delay, &tv);
+    if (data->os_hnd->start_timer(data->os_hnd, data->timer, &tv,
+				  timer_os_cb, data) == 0)
+	os_timer_running = 1;
+}
+
+static void
+timer_remove(ipmi_timer_t *timer)
+{
+    if (timer->prev)
+	timer->prev->next = timer->next;
+    else
+	timer_list = timer->next;
+    if (timer->next)
+	timer->next->prev = timer->prev;
+    timer->running = 0;
+}
+
+static void
+timer_run(ipmi_timer_t *timer)
+{
+    timer_remove(timer);
+    timer->cb(timer->cb_data);
+}
+
+static void
+timer_os_cb(void *cb_data, os_hnd_timer_id_t *id)
+{
+    misc_data_t *data = cb_data;
+    uint64_t now = sim_now(data);
+    uint64_t seq = timer_start_seq;
+
+    os_timer_running = 0;
+    in_timer_run = 1;
+    /*
+     * Timers started in here expire at or after now, so they sort
+     * after all the ones that were due and stop the loop.
+     */
+    while (timer_list && timer_list->expiry <= now
+	   && timer_list->start_seq <= seq)
+	timer_run(timer_list);
+    in_timer_run = 0;
+    timer_arm(data);
+}
+
 static int
 ipmi_alloc_timer(sys_data_t *sys, void (*cb)(void *cb_data),
 		 void *cb_data, ipmi_timer_t **rtimer)
 {
     misc_data_t *data = sys->info;
     ipmi_timer_t *timer;
-    int err;
 
     timer = malloc(sizeof(ipmi_timer_t));
     if (!timer)
 	return ENOMEM;
+    memset(timer, 0, sizeof(*timer));
 
     timer->cb = cb;
     timer->cb_data = cb_data;
     timer->data = data;
-    err = data->os_hnd->alloc_timer(data->os_hnd, &timer->id);
-    if (err) {
-	free(timer);
-	return err;
-    }
 
     *rtimer = timer;
     return 0;
 }
 
+static int
+ipmi_start_timer(ipmi_timer_t *timer, struct timeval *timeout)
+{
+    ipmi_timer_t *prev = NULL, *next = timer_list;
+
+    if (timer->running)
+	return EBUSY;
+
+    timer->expiry = sim_now(timer->data) + tv_to_usec(timeout);
+    timer->start_seq = ++timer_start_seq;
+    /* Timers that expire at the same time run in the order started. */
+    while (next && next->expiry <= timer->expiry) {
+	prev = next;
+	next = next->next;
+    }
+    timer->prev = prev;
+    timer->next = next;
+    if (prev)
+	prev->next = timer;
+    else
+	timer_list = timer;
+    if (next)
+	next->prev = timer;
+    timer->running = 1;
+
+    if (timer_list == timer)
+	timer_arm(timer->data);
+    return 0;
+}
+
+static int
+ipmi_stop_timer(ipmi_timer_t *timer)
+{
+    int first = timer_list == timer;
+
+    if (!timer->running)
+	return ETIMEDOUT;
+    timer_remove(timer);
+    if (first)
+	timer_arm(timer->data);
+    return 0;
+}
+
 static void
-timer_cb(void *cb_data, os_hnd_timer_id_t *id)
+ipmi_free_timer(ipmi_timer_t *timer)
 {
-    ipmi_timer_t *timer = cb_data;
+    if (timer->running)
+	ipmi_stop_timer(timer);
+    free(timer);
+}
 
-    timer->cb(timer->cb_data);
+static void
+clock_set_scale(misc_data_t *data, double scale)
+{
+    clock_rebase(data);
+    clock_scale = scale;
+    timer_arm(data);
+}
+
+/*
+ * Move the clock forward, running the timers that expire on the way
+ * with the clock set to their expiry time.
+ */
+static void
+clock_step(misc_data_t *data, uint64_t usec)
+{
+    uint64_t target, seq;
+    ipmi_timer_t *next;
+
+    clock_rebase(data);
+    target = clock_base_sim + usec;
+    seq = timer_start_seq;
+    in_timer_run = 1;
+    while (timer_list && timer_list->expiry <= target) {
+	if (timer_list->expiry > clock_base_sim) {
+	    clock_base_sim = timer_list->expiry;
+	    seq = timer_start_seq;
+	} else if (timer_list->start_seq > seq) {
+	    /*
+	     * Restarted with no timeout at this time, so it waits for
+	     * the clock to move to the next timer that is due.
+	     */
+	    for (next = timer_list; next; next = next->next) {
+		if (next->expiry > clock_base_sim)
+		    break;
+	    }
+	    if (!next || next->expiry > target)
+		break;
+	    clock_base_sim = next->expiry;
+	    seq = timer_start_seq;
+	}
+	clock_base_real = os_monotonic_usec(data);
+	timer_run(timer_list);
+    }
+    in_timer_run = 0;
+    clock_rebase(data);
+    if (clock_base_sim < target)
+	clock_base_sim = target;
+    timer_arm(data);
 }
 
 static int
-ipmi_start_timer(ipmi_timer_t *timer, struct timeval *timeout)
+ipmi_get_monotonic_time(sys_data_t *sys, struct timeval *tv)
 {
-    return timer->data->os_hnd->start_timer(timer->data->os_hnd, timer->id,
-					    timeout, timer_cb, timer);
+    usec_to_tv(sim_now(sys->info), tv);
+    return 0;
 }
 
 static int
-ipmi_stop_timer(ipmi_timer_t *timer)
+ipmi_get_real_time(sys_data_t *sys, struct timeval *tv)
 {
-    return timer->data->os_hnd->stop_timer(timer->data->os_hnd, timer->id);
+    misc_data_t *data = sys->info;
+
+    if (!clock_virtual)
+	return data->os_hnd->get_real_time(data->os_hnd, tv);
+    usec_to_tv(sim_now(data) + clock_wall_offset, tv);
+    return 0;
 }
 
+/* Sleep and don't take any user input. */
 static void
-ipmi_free_timer(ipmi_timer_t *timer)
+sleeper(emu_data_t *emu, struct timeval *time)
+{
+    misc_data_t    *data = ipmi_emu_get_user_data(emu);
+    os_handler_waiter_t *waiter;
+    struct timeval tv;
+
+    /* Sleeping is simulated time passing, too. */
+    if (clock_scale == 0) {
+	clock_step(data, tv_to_usec(time));
+	return;
+    }
+    usec_to_tv(tv_to_usec(time) / clock_scale, &tv);
+    time = &tv;
+
+    waiter = os_handler_alloc_waiter(data->waiter_factory);
+    if (!waiter) {
+	fprintf(stderr, "Unable to allocate waiter\n");
+	exit(1);
+    }
+
+    os_handler_waiter_wait(waiter, time);
+    os_handler_waiter_release(waiter);
+}
+
+/*
+ * time_scale [<factor>]
+ */
+static int
+time_scale_cmd(emu_out_t *out, emu_data_t *emu, lmc_data_t *mc, char **toks)
+{
+    misc_data_t *data = ipmi_emu_get_user_data(emu);
+    const char *tok;
+    char *end;
+    double scale;
+    struct timeval tv;
+
+    tok = mystrtok(NULL, " \t\n", toks);
+    if (tok) {
+	scale = strtod(tok, &end);
+	if (*end != '\0' || scale < 0) {
+	    out->printf(out, "**Invalid time scale: %s\n", tok);
+	    return EINVAL;
+	}
+	clock_set_scale(data, scale);
+	return 0;
+    }
+
+    usec_to_tv(sim_now(data), &tv);
+    if (clock_scale == 0)
+	out->printf(out, "time %ld.%6.6ld, stopped\n",
+		    (long) tv.tv_sec, (long) tv.tv_usec);
+    else
+	out->printf(out, "time %ld.%6.6ld, scale %g\n",
+		    (long) tv.tv_sec, (long) tv.tv_usec, clock_scale);
+    return 0;
+}
+
+/*
+ * time_step <seconds>
+ */
+static int
+time_step_cmd(emu_out_t *out, emu_data_t *emu, lmc_data_t *mc, char **toks)
 {
-    timer->data->os_hnd->free_timer(timer->data->os_hnd, timer->id);
+    misc_data_t *data = ipmi_emu_get_user_data(emu);
+    const char *tok;
+    char *end;
+    double secs;
+
+    tok = mystrtok(NULL, " \t\n", toks);
+    if (!tok) {
+	out->printf(out, "**No time given\n");
+	return EINVAL;
+    }
+    secs = strtod(tok, &end);
+    if (*end != '\0' || secs < 0) {
+	out->printf(out, "**Invalid time: %s\n", tok);
+	return EINVAL;
+    }
+    clock_step(data, secs * 1000000);
+    return 0;
 }
 
 static ipmi_tick_handler_t *tick_handlers;
@@ -1199,7 +1790,7 @@ ipmi_register_tick_handler(ipmi_tick_handler_t *handler)
 }
 
 static void
-tick(void *cb_data, os_hnd_timer_id_t *id)
+tick(void *cb_data)
 {
     misc_data_t *data = cb_data;
     struct timeval tv;
@@ -1216,7 +1807,7 @@ tick(void *cb_data, os_hnd_timer_id_t *id)
 
     tv.tv_sec = 1;
     tv.tv_usec = 0;
-    err = data->os_hnd->start_timer(data->os_hnd, data->timer, &tv, tick, data);
+    err = ipmi_start_timer(data->tick_timer, &tv);
     if (err) {
 	fprintf(stderr, "Unable to start timer: 0x%x\n", err);
 	exit(1);
@@ -1246,6 +1837,7 @@ handle_sigchld(int sig)
 }
 
 static ipmi_child_quit_t *child_quit_handlers;
+static ipmi_child_quit_t extcmd_child_quit_hnd;
 
 void
 ipmi_register_child_quit_handler(ipmi_child_quit_t *handler)
@@ -1283,8 +1875,27 @@ ipmi_register_shutdown_handler(ipmi_shutdown_t *handler)
     shutdown_handlers = handler;
 }
 
+static void
+persist_shutdown(void *info, int sig)
+{
+    /*
+     * Only wait for the writer on a clean shutdown, the main thread
+     * may be holding the queue lock if it crashed.
+     */
+    if (sig == 0 || sig == SIGINT || sig == SIGTERM || sig == SIGQUIT)
+	persist_flush();
+}
+
+static ipmi_shutdown_t persist_shutdown_hnd;
+
+/* These are passed to the main loop, so shutdown can be done normally. */
+static int term_sigs[] = {
+    SIGINT, SIGQUIT, SIGTERM,
+    0
+};
+
 static int shutdown_sigs[] = {
-    SIGINT, SIGQUIT, SIGILL, SIGABRT, SIGFPE, SIGSEGV, SIGTERM, SIGBUS,
+    SIGILL, SIGABRT, SIGFPE, SIGSEGV, SIGBUS,
     0
 };
 
@@ -1301,6 +1912,63 @@ shutdown_handler(int sig)
 	raise(sig);
 }
 
+static int termpipeh[2] = {-1, -1};
+static os_hnd_fd_id_t *termpipe_id;
+
+static void
+handle_termsig(int sig)
+{
+    unsigned char c = sig;
+
+    if (termpipeh[1] == -1)
+	shutdown_handler(sig);
+    else
+	(void) write(termpipeh[1], &c, 1);
+}
+
+static void
+termsig_ready(int fd, void *cb_data, os_hnd_fd_id_t *id)
+{
+    unsigned char c;
+
+    if (read(fd, &c, 1) != 1)
+	return;
+
+    /* The handler was reset, so the raise() in here will kill us. */
+    shutdown_handler(c);
+}
+
+int
+ipmi_shutdown_in_main_loop(void)
+{
+    os_handler_t *os_hnd = global_misc_data->os_hnd;
+    int fds[2];
+    int i, rv;
+
+    if (termpipeh[0] != -1)
+	return 0;
+
+    if (pipe(fds) == -1)
+	return errno;
+    for (i = 0; i < 2; i++) {
+	fcntl(fds[i], F_SETFL, fcntl(fds[i], F_GETFL) | O_NONBLOCK);
+	fcntl(fds[i], F_SETFD, FD_CLOEXEC);
+    }
+
+    rv = os_hnd->add_fd_to_wait_for(os_hnd, fds[0], termsig_ready, NULL,
+				    NULL, &termpipe_id);
+    if (rv) {
+	close(fds[0]);
+	close(fds[1]);
+	return rv;
+    }
+
+    /* The write end is set last, the signal handler looks at it. */
+    termpipeh[0] = fds[0];
+    termpipeh[1] = fds[1];
+    return 0;
+}
+
 void
 ipmi_do_start_cmd(startcmd_t *startcmd)
 {
@@ -1339,20 +2007,6 @@ ipmi_do_kill(startcmd_t *startcmd, int noblock)
 	kill(startcmd->vmpid, SIGTERM);
 }
 
-static int ipmi_get_monotonic_time(sys_data_t *sys, struct timeval *tv)
-{
-    misc_data_t *data = sys->info;
-    os_handler_t *os_hnd = data->os_hnd;
-    return os_hnd->get_monotonic_time(os_hnd, tv);
-}
-
-static int ipmi_get_real_time(sys_data_t *sys, struct timeval *tv)
-{
-    misc_data_t *data = sys->info;
-    os_handler_t *os_hnd = data->os_hnd;
-    return os_hnd->get_real_time(os_hnd, tv);
-}
-
 int
 main(int argc, const char *argv[])
 {
@@ -1433,6 +2087,32 @@ main(int argc, const char *argv[])
     sysinfo.clear_sel_event = 1;
     data.sys = &sysinfo;
 
+    err = ipmi_alloc_timer(&sysinfo, tick, &data, &data.tick_timer);
+    if (err) {
+	fprintf(stderr, "Unable to allocate timer: 0x%x\n", err);
+	exit(1);
+    }
+
+    if (time_scale) {
+	char *end;
+	double scale = strtod(time_scale, &end);
+
+	if (*end != '\0' || scale < 0) {
+	    fprintf(stderr, "Invalid time scale: %s\n", time_scale);
+	    exit(1);
+	}
+	clock_set_scale(&data, scale);
+    }
+
+    if (capture_file) {
+	err = lan_capture_start(capture_file);
+	if (err) {
+	    fprintf(stderr, "Unable to capture to %s: %s\n", capture_file,
+		    strerror(err));
+	    exit(1);
+	}
+    }
+
     err = pipe(sigpipeh);
     if (err) {
 	perror("Creating signal handling pipe");
@@ -1457,6 +2137,10 @@ main(int argc, const char *argv[])
 	exit(1);
     }
 
+    extcmd_child_quit_hnd.handler = extcmd_child_quit;
+    extcmd_child_quit_hnd.info = NULL;
+    ipmi_register_child_quit_handler(&extcmd_child_quit_hnd);
+
     data.emu = ipmi_emu_alloc(&data, sleeper, &sysinfo);
 
     /* Set this up for console I/O, even if we don't use it. */
@@ -1509,6 +2193,24 @@ main(int argc, const char *argv[])
 	exit(1);
     }
 
+    if (sysinfo.persist_delay) {
+	err = persist_start_writer(sysinfo.persist_delay);
+	if (err) {
+	    fprintf(stderr, "Unable to start persist writer: %s\n",
+		    strerror(err));
+	    exit(1);
+	}
+	err = ipmi_shutdown_in_main_loop();
+	if (err) {
+	    fprintf(stderr, "Unable to set up shutdown handling: %s\n",
+		    strerror(err));
+	    exit(1);
+	}
+	persist_shutdown_hnd.handler = persist_shutdown;
+	persist_shutdown_hnd.info = NULL;
+	ipmi_register_shutdown_handler(&persist_shutdown_hnd);
+    }
+
     read_persist_users(&sysinfo);
 
     err = sol_init(&sysinfo);
@@ -1518,6 +2220,56 @@ main(int argc, const char *argv[])
 	goto out;
     }
 
+    err = ipmi_emu_add_cmd("time_scale", NOMC, time_scale_cmd);
+    if (!err)
+	err = ipmi_emu_add_cmd("time_step", NOMC, time_step_cmd);
+    if (err) {
+	fprintf(stderr, "Unable to add time commands: %s\n",
+		strerror(err));
+	goto out;
+    }
+
+    err = ipmi_emu_add_cmd("serial_bench", NOMC, serial_bench_cmd);
+    if (err) {
+	fprintf(stderr, "Unable to add serial_bench command: %s\n",
+		strerror(err));
+	goto out;
+    }
+
+    err = ipmi_emu_add_cmd("pef_stats", MC, pef_stats_cmd);
+    if (!err)
+	err = ipmi_emu_add_cmd("pef_bench", MC, pef_bench_cmd);
+    if (err) {
+	fprintf(stderr, "Unable to add PEF commands: %s\n",
+		strerror(err));
+	goto out;
+    }
+
+    err = ipmi_emu_add_cmd("lan_capture", NOMC, lan_capture_cmd);
+    if (err) {
+	fprintf(stderr, "Unable to add lan_capture command: %s\n",
+		strerror(err));
+	goto out;
+    }
+
+    err = ipmi_emu_add_cmd("stats", NOMC, stats_cmd);
+    if (err) {
+	fprintf(stderr, "Unable to add stats command: %s\n",
+		strerror(err));
+	goto out;
+    }
+
+    err = ipmi_emu_add_cmd("sensor_gen", MC, sensor_gen_cmd);
+    if (!err)
+	err = ipmi_emu_add_cmd("sensor_gen_stop", MC, sensor_gen_stop_cmd);
+    if (!err)
+	err = ipmi_emu_add_cmd("sensor_gen_stats", MC, sensor_gen_stats_cmd);
+    if (err) {
+	fprintf(stderr, "Unable to add sensor generator commands: %s\n",
+		strerror(err));
+	goto out;
+    }
+
     err = read_sol_config(&sysinfo);
     if (err) {
 	fprintf(stderr, "Unable to read SOL configs: %s\n",
@@ -1549,7 +2301,17 @@ main(int argc, const char *argv[])
 	}
     }
 
-    if (command_file)
+    if (command_image && !command_file) {
+	fprintf(stderr, "A command image needs a command file, %s/%s.emu"
+		" does not exist and -f was not given\n", BASE_CONF_STR,
+		sysinfo.name);
+	goto out;
+    }
+
+    if (command_file && command_image)
+	read_command_image(&stdio_console.out, data.emu, command_file,
+			   command_image, config_file);
+    else if (command_file)
 	read_command_file(&stdio_console.out, data.emu, command_file);
 
     if (command_string)
@@ -1603,6 +2365,12 @@ main(int argc, const char *argv[])
 	}
     }
 
+    if (sysinfo.metrics_addr_len) {
+	err = metrics_init(&data);
+	if (err)
+	    goto out;
+    }
+
     if (!nostdio) {
 	init_term();
 
@@ -1618,6 +2386,20 @@ main(int argc, const char *argv[])
 
     post_init_dynamic_libs(&sysinfo);
 
+    /*
+     * A second termination signal gets the default action, in case
+     * the main loop is stuck.
+     */
+    act.sa_handler = handle_termsig;
+    act.sa_flags = SA_RESETHAND;
+    for (i = 0; term_sigs[i]; i++) {
+	err = sigaction(term_sigs[i], &act, NULL);
+	if (err) {
+	    fprintf(stderr, "Unable to register shutdown signal %d: %s\n",
+		    term_sigs[i], strerror(errno));
+	}
+    }
+
     act.sa_handler = shutdown_handler;
     act.sa_flags = SA_RESETHAND;
     for (i = 0; shutdown_sigs[i]; i++) {
@@ -1630,7 +2412,7 @@ main(int argc, const char *argv[])
 
     tv.tv_sec = 1;
     tv.tv_usec = 0;
-    err = data.os_hnd->start_timer(data.os_hnd, data.timer, &tv, tick, &data);
+    err = ipmi_start_timer(data.tick_timer, &tv);
     if (err) {
 	fprintf(stderr, "Unable to start timer: 0x%x\n", err);
 	goto out;
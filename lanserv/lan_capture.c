@@ -0,0 +1,462 @@
+/*
+ * lan_capture.c
+ *
+ * Capture the LAN traffic of the IPMI simulator to a pcap file.
+ *
+ * Author: MontaVista Software, Inc.
+ *         Corey Minyard <minyard@mvista.com>
+ *         source@mvista.com
+ *
+ * Copyright 2012 MontaVista Software Inc.
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2 of
+ *  the License, or (at your option) any later version.
+ *
+ *
+ *  THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ *  WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ *  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ *  OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ *  TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ *  USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this program; if not, write to the Free
+ *  Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * Every datagram received or sent on a LAN channel is copied into a
+ * ring along with the time and the addresses.  Only the main thread
+ * puts things into the ring and only the writer thread takes them
+ * out, so the ring needs no locks, just ordered loads and stores of
+ * the head and tail.  The writer thread adds IP and UDP headers and
+ * writes the packets to a pcap file (raw IP link type), so the file
+ * can be read by wireshark or tcpdump and replayed with lan_replay.
+ * If the writer falls behind and the ring fills, packets are dropped
+ * and counted rather than holding up the simulator.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include <OpenIPMI/serv.h>
+
+#include "emu.h"
+
+/* Must be a power of two. */
+#define CAP_SLOTS	4096
+
+/* Bytes of each packet saved, the rest is truncated. */
+#define CAP_SNAPLEN	1024
+
+#define PCAP_MAGIC		0xa1b2c3d4
+#define PCAP_LINKTYPE_RAW	101
+
+/* The pcap file header, written in host order. */
+typedef struct pcap_hdr_s
+{
+    uint32_t magic;
+    uint16_t version_major;
+    uint16_t version_minor;
+    int32_t  thiszone;
+    uint32_t sigfigs;
+    uint32_t snaplen;
+    uint32_t network;
+} pcap_hdr_t;
+
+typedef struct cap_addr_s
+{
+    int           family;
+    unsigned char addr[16];
+    unsigned char port[2];	/* Network order */
+} cap_addr_t;
+
+typedef struct cap_rec_s
+{
+    struct timeval ts;
+    cap_addr_t     src;
+    cap_addr_t     dst;
+    unsigned int   len;
+    unsigned int   caplen;
+    unsigned char  data[CAP_SNAPLEN];
+} cap_rec_t;
+
+typedef struct lan_capture_s
+{
+    char         *filename;
+    FILE         *f;
+    pthread_t    thread;
+    int          stop;
+
+    /* Written by the main thread, read by the writer. */
+    unsigned long tail;
+    /* Written by the writer, read by the main thread. */
+    unsigned long head;
+
+    unsigned long packets;
+    unsigned long dropped;
+    unsigned long bad_addr;
+
+    cap_rec_t    ring[CAP_SLOTS];
+} lan_capture_t;
+
+static lan_capture_t *cap;
+
+static ipmi_shutdown_t cap_shutdown;
+static int cap_shutdown_registered;
+
+static int
+cap_set_addr(cap_addr_t *ca, struct sockaddr *addr, socklen_t addr_len)
+{
+    if (addr->sa_family == AF_INET
+	&& addr_len >= sizeof(struct sockaddr_in))
+    {
+	struct sockaddr_in *a = (struct sockaddr_in *) addr;
+
+	ca->family = AF_INET;
+	memcpy(ca->addr, &a->sin_addr, 4);
+	memcpy(ca->port, &a->sin_port, 2);
+	return 0;
+    }
+#ifdef PF_INET6
+    if (addr->sa_family == AF_INET6
+	&& addr_len >= sizeof(struct sockaddr_in6))
+    {
+	struct sockaddr_in6 *a = (struct sockaddr_in6 *) addr;
+
+	ca->family = AF_INET6;
+	memcpy(ca->addr, &a->sin6_addr, 16);
+	memcpy(ca->port, &a->sin6_port, 2);
+	return 0;
+    }
+#endif
+    return EINVAL;
+}
+
+void
+lan_capture_packet(struct sockaddr *src, socklen_t src_len,
+		   struct sockaddr *dst, socklen_t dst_len,
+		   struct iovec *data, int vecs)
+{
+    lan_capture_t *c = cap;
+    cap_rec_t     *r;
+    unsigned long tail;
+    unsigned int  left, n;
+    int           i;
+
+    if (!c)
+	return;
+
+    tail = c->tail;
+    if (tail - __atomic_load_n(&c->head, __ATOMIC_ACQUIRE) >= CAP_SLOTS) {
+	c->dropped++;
+	return;
+    }
+    r = &c->ring[tail & (CAP_SLOTS - 1)];
+
+    if (cap_set_addr(&r->src, src, src_len)
+	|| cap_set_addr(&r->dst, dst, dst_len)
+	|| r->src.family != r->dst.family)
+    {
+	c->bad_addr++;
+	return;
+    }
+
+    gettimeofday(&r->ts, NULL);
+    r->len = 0;
+    r->caplen = 0;
+    for (i = 0; i < vecs; i++) {
+	r->len += data[i].iov_len;
+	left = CAP_SNAPLEN - r->caplen;
+	n = data[i].iov_len;
+	if (n > left)
+	    n = left;
+	memcpy(r->data + r->caplen, data[i].iov_base, n);
+	r->caplen += n;
+    }
+
+    c->packets++;
+    __atomic_store_n(&c->tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+static uint32_t
+csum_add(uint32_t sum, const unsigned char *d, unsigned int len)
+{
+    unsigned int i;
+
+    for (i = 0; i + 1 < len; i += 2)
+	sum += (d[i] << 8) | d[i + 1];
+    if (len & 1)
+	sum += d[len - 1] << 8;
+    return sum;
+}
+
+static uint16_t
+csum_fold(uint32_t sum)
+{
+    while (sum >> 16)
+	sum = (sum & 0xffff) + (sum >> 16);
+    return ~sum & 0xffff;
+}
+
+static void
+put16(unsigned char *d, unsigned int v)
+{
+    d[0] = v >> 8;
+    d[1] = v & 0xff;
+}
+
+/*
+ * Write one packet with its IP and UDP headers.  The UDP checksum
+ * covers the whole datagram, so it is left zero on IPv4 if the packet
+ * was truncated.
+ */
+static void
+cap_write_rec(FILE *f, cap_rec_t *r)
+{
+    unsigned char hdr[48];
+    unsigned int  hlen, udplen = r->len + 8;
+    unsigned char *udp;
+    uint32_t      ph[4], sum;
+
+    memset(hdr, 0, sizeof(hdr));
+    if (r->src.family == AF_INET) {
+	hlen = 28;
+	hdr[0] = 0x45;
+	put16(hdr + 2, 20 + udplen);
+	hdr[6] = 0x40; /* Don't fragment */
+	hdr[8] = 64;
+	hdr[9] = IPPROTO_UDP;
+	memcpy(hdr + 12, r->src.addr, 4);
+	memcpy(hdr + 16, r->dst.addr, 4);
+	put16(hdr + 10, csum_fold(csum_add(0, hdr, 20)));
+	udp = hdr + 20;
+	sum = csum_add(0, hdr + 12, 8);
+    } else {
+	hlen = 48;
+	hdr[0] = 0x60;
+	put16(hdr + 4, udplen);
+	hdr[6] = IPPROTO_UDP;
+	hdr[7] = 64;
+	memcpy(hdr + 8, r->src.addr, 16);
+	memcpy(hdr + 24, r->dst.addr, 16);
+	udp = hdr + 40;
+	sum = csum_add(0, hdr + 8, 32);
+    }
+    memcpy(udp, r->src.port, 2);
+    memcpy(udp + 2, r->dst.port, 2);
+    put16(udp + 4, udplen);
+    if (r->caplen == r->len) {
+	sum += IPPROTO_UDP + udplen;
+	sum = csum_add(sum, udp, 8);
+	sum = csum_add(sum, r->data, r->caplen);
+	sum = csum_fold(sum);
+	if (sum == 0)
+	    sum = 0xffff;
+	put16(udp + 6, sum);
+    }
+
+    ph[0] = r->ts.tv_sec;
+    ph[1] = r->ts.tv_usec;
+    ph[2] = hlen + r->caplen;
+    ph[3] = hlen + r->len;
+    fwrite(ph, sizeof(ph), 1, f);
+    fwrite(hdr, hlen, 1, f);
+    fwrite(r->data, r->caplen, 1, f);
+}
+
+static void *
+cap_writer(void *cb_data)
+{
+    lan_capture_t   *c = cb_data;
+    unsigned long   head = c->head, tail;
+    struct timespec ts;
+
+    for (;;) {
+	tail = __atomic_load_n(&c->tail, __ATOMIC_ACQUIRE);
+	if (head == tail) {
+	    if (__atomic_load_n(&c->stop, __ATOMIC_ACQUIRE)) {
+		/* Catch anything added before the stop was seen. */
+		tail = __atomic_load_n(&c->tail, __ATOMIC_ACQUIRE);
+		if (head == tail)
+		    break;
+		continue;
+	    }
+	    fflush(c->f);
+	    ts.tv_sec = 0;
+	    ts.tv_nsec = 5000000;
+	    nanosleep(&ts, NULL);
+	    continue;
+	}
+	while (head != tail) {
+	    cap_write_rec(c->f, &c->ring[head & (CAP_SLOTS - 1)]);
+	    head++;
+	}
+	__atomic_store_n(&c->head, head, __ATOMIC_RELEASE);
+    }
+    fflush(c->f);
+    return NULL;
+}
+
+void
+lan_capture_stop(void)
+{
+    lan_capture_t *c = cap;
+
+    if (!c)
+	return;
+    cap = NULL;
+    __atomic_store_n(&c->stop, 1, __ATOMIC_RELEASE);
+    pthread_join(c->thread, NULL);
+    fclose(c->f);
+    free(c->filename);
+    free(c);
+}
+
+static void
+cap_shutdown_handler(void *info, int sig)
+{
+    lan_capture_t *c = cap;
+
+    if (sig == 0 || sig == SIGINT || sig == SIGTERM || sig == SIGQUIT) {
+	lan_capture_stop();
+	return;
+    }
+
+    /*
+     * A fatal signal, called from the signal handler.  Don't join or
+     * free anything, just tell the writer to finish up.
+     */
+    if (c)
+	__atomic_store_n(&c->stop, 1, __ATOMIC_RELEASE);
+}
+
+int
+lan_capture_start(const char *filename)
+{
+    lan_capture_t *c;
+    pcap_hdr_t    fh;
+    sigset_t      sigs, old_sigs;
+    int           rv;
+
+    if (cap)
+	return EBUSY;
+
+    c = malloc(sizeof(*c));
+    if (!c)
+	return ENOMEM;
+    memset(c, 0, sizeof(*c));
+
+    c->filename = strdup(filename);
+    if (!c->filename) {
+	rv = ENOMEM;
+	goto out_err;
+    }
+    c->f = fopen(filename, "w");
+    if (!c->f) {
+	rv = errno;
+	goto out_err;
+    }
+
+    fh.magic = PCAP_MAGIC;
+    fh.version_major = 2;
+    fh.version_minor = 4;
+    fh.thiszone = 0; /* GMT */
+    fh.sigfigs = 0; /* Timestamp accuracy */
+    fh.snaplen = 65535;
+    fh.network = PCAP_LINKTYPE_RAW;
+    if (fwrite(&fh, sizeof(fh), 1, c->f) != 1) {
+	rv = errno;
+	goto out_err;
+    }
+
+    /* The writer is joined on SIGTERM and friends, that can't be done
+       in a signal handler. */
+    rv = ipmi_shutdown_in_main_loop();
+    if (rv)
+	goto out_err;
+
+    /* Signals are handled by the main thread, the writer never takes any. */
+    sigfillset(&sigs);
+    pthread_sigmask(SIG_SETMASK, &sigs, &old_sigs);
+    rv = pthread_create(&c->thread, NULL, cap_writer, c);
+    pthread_sigmask(SIG_SETMASK, &old_sigs, NULL);
+    if (rv)
+	goto out_err;
+
+    if (!cap_shutdown_registered) {
+	cap_shutdown.handler = cap_shutdown_handler;
+	cap_shutdown.info = NULL;
+	ipmi_register_shutdown_handler(&cap_shutdown);
+	cap_shutdown_registered = 1;
+    }
+
+    cap = c;
+    return 0;
+
+ out_err:
+    if (c->f)
+	fclose(c->f);
+    if (c->filename)
+	free(c->filename);
+    free(c);
+    return rv;
+}
+
+/*
+ * lan_capture [<file>|stop]
+ */
+int
+lan_capture_cmd(emu_out_t *out, emu_data_t *emu, lmc_data_t *mc, char **toks)
+{
+    const char *tok;
+    int        rv;
+
+    tok = mystrtok(NULL, " \t\n", toks);
+    if (!tok) {
+	if (!cap) {
+	    out->printf(out, "Not capturing\n");
+	    return 0;
+	}
+	out->printf(out, "Capturing to %s: %lu packets, %lu dropped",
+		    cap->filename, cap->packets, cap->dropped);
+	if (cap->bad_addr)
+	    out->printf(out, ", %lu with bad addresses", cap->bad_addr);
+	out->printf(out, "\n");
+	return 0;
+    }
+
+    if (strcmp(tok, "stop") == 0) {
+	if (!cap) {
+	    out->printf(out, "**Not capturing\n");
+	    return EINVAL;
+	}
+	lan_capture_stop();
+	return 0;
+    }
+
+    rv = lan_capture_start(tok);
+    if (rv) {
+	out->printf(out, "**Unable to capture to %s: %s\n", tok,
+		    strerror(rv));
+	return rv;
+    }
+    return 0;
+}
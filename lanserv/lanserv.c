@@ -94,6 +94,9 @@ static int daemonize = 1;
 
 #define MAX_ADDR 4
 
+/* The most responses pulled from the IPMI driver on one wakeup. */
+#define MAX_IPMI_DEV_DRAIN 32
+
 static void lanserv_log(sys_data_t *sys, int logtype, msg_t *msg,
 			const char *format, ...);
 
@@ -255,10 +258,15 @@ gen_rand(lanserv_data_t *lan, void *data, int len)
     return rv;
 }
 
-static void
-handle_msg_ipmi_dev(int smi_fd, void *cb_data, os_hnd_fd_id_t *id)
+/*
+ * Get one response from the driver and pass it on.  Returns an errno
+ * from the receive (EAGAIN if nothing is waiting, EINTR means try
+ * again later) or 0 if a message was pulled from the driver, whether
+ * it was used or not.
+ */
+static int
+recv_msg_ipmi_dev(int smi_fd, misc_data_t *info)
 {
-    misc_data_t      *info = cb_data;
     struct ipmi_recv rsp;
     char             addr_data[sizeof(struct ipmi_addr)];
     struct ipmi_addr *addr = (struct ipmi_addr *) addr_data;
@@ -274,15 +282,15 @@ handle_msg_ipmi_dev(int smi_fd, void *cb_data, os_hnd_fd_id_t *id)
 
     rv = ioctl(smi_fd, IPMICTL_RECEIVE_MSG_TRUNC, &rsp);
     if (rv == -1) {
-	if (errno == EINTR)
-	    return; /* Try again later. */
 	if (errno == EMSGSIZE) {
 	    rdata[0] = IPMI_REQUEST_DATA_TRUNCATED_CC;
 	    rsp.msg.data_len = sizeof(rdata);
 	} else {
-	    lanserv_log(NULL, DEBUG, NULL, "Error receiving message: %s\n",
-			strerror(errno));
-	    return;
+	    rv = errno;
+	    if ((rv != EINTR) && (rv != EAGAIN))
+		lanserv_log(NULL, DEBUG, NULL,
+			    "Error receiving message: %s\n", strerror(rv));
+	    return rv;
 	}
     }
 
@@ -291,13 +299,13 @@ handle_msg_ipmi_dev(int smi_fd, void *cb_data, os_hnd_fd_id_t *id)
     if (rdata[0] == IPMI_TIMEOUT_CC) {
 	/* Ignore timeouts, we let the LAN code do the timeouts. */
 	free(msg);
-	return;
+	return 0;
     }
 
     /* We only handle responses. */
     if (rsp.recv_type != IPMI_RESPONSE_RECV_TYPE) {
 	free(msg);
-	return;
+	return 0;
     }
 
     if (addr->addr_type == IPMI_SYSTEM_INTERFACE_ADDR_TYPE) {
@@ -319,11 +327,29 @@ handle_msg_ipmi_dev(int smi_fd, void *cb_data, os_hnd_fd_id_t *id)
 						  0);
     } else {
 	lanserv_log(NULL, DEBUG, NULL, "Error!\n");
-	return;
+	return 0;
     }
 
     ipmi_handle_smi_rsp(info->sys->chan_set[msg->channel], msg,
 			rsp.msg.data, rsp.msg.data_len);
+    return 0;
+}
+
+static void
+handle_msg_ipmi_dev(int smi_fd, void *cb_data, os_hnd_fd_id_t *id)
+{
+    misc_data_t *info = cb_data;
+    int         i;
+
+    /*
+     * Receives on the driver never block, so take everything that is
+     * waiting up to a limit, the selector will call us again if more
+     * is left.
+     */
+    for (i = 0; i < MAX_IPMI_DEV_DRAIN; i++) {
+	if (recv_msg_ipmi_dev(smi_fd, info))
+	    break;
+    }
 }
 
 static void
@@ -334,6 +360,8 @@ lan_data_ready(int lan_fd, void *cb_data, os_hnd_fd_id_t *id)
     lanserv_addr_t     l;
     unsigned char      data[256];
 
+    /* The address is used as a rate limit key, don't leave garbage. */
+    memset(&l, 0, sizeof(l));
     l.addr_len = sizeof(l.addr);
     len = recvfrom(lan_fd, data, sizeof(data), 0, 
 		    (struct sockaddr *)&(l.addr), &(l.addr_len));
@@ -622,6 +650,13 @@ ipmi_set_chassis_control_prog(lmc_data_t *mc, const char *prog)
 {
 }
 
+int
+ipmi_mc_set_pef_alert_dest(lmc_data_t *mc, struct sockaddr *addr,
+			   socklen_t addr_len)
+{
+    return 0;
+}
+
 int
 ipmi_mc_set_frudata_handler(lmc_data_t *mc, unsigned int fru,
 			    get_frudata_f handler, free_frudata_f freefunc)
@@ -68,6 +68,36 @@
 #define IPMI_LAN_STD_PORT_STR	"623"
 #endif
 
+/* Read "<rate> [<burst>]", the burst defaults to one second's worth. */
+static int
+get_rate(char **tokptr, lan_rate_t *rate, const char **errstr)
+{
+    const char *tok;
+    char *end;
+    int err;
+
+    err = get_uint(tokptr, &rate->rate, errstr);
+    if (err)
+	return err;
+    tok = mystrtok(NULL, " \t\n", tokptr);
+    if (tok) {
+	rate->burst = strtoul(tok, &end, 0);
+	if (*end != '\0') {
+	    *errstr = "Invalid burst value";
+	    return -1;
+	}
+    } else {
+	rate->burst = rate->rate;
+    }
+    if (rate->rate > 1000000000) {
+	*errstr = "Rate limit must be at most 1000000000";
+	return -1;
+    }
+    if (rate->burst == 0)
+	rate->burst = 1;
+    return 0;
+}
+
 int
 lanserv_read_config(sys_data_t    *sys,
 		    FILE          *f,
@@ -172,6 +202,10 @@ lanserv_read_config(sys_data_t    *sys,
 	    err = read_bytes(&tokptr, lan->bmc_key, &errstr, 20);
 	    if (err)
 		goto out_err;
+	} else if (strcmp(tok, "presession_rate_limit") == 0) {
+	    err = get_rate(&tokptr, &lan->presession_rate, &errstr);
+	} else if (strcmp(tok, "session_rate_limit") == 0) {
+	    err = get_rate(&tokptr, &lan->session_rate, &errstr);
 	} else if (strcmp(tok, "lan_config_program") == 0) {
 	    err = get_delim_str(&tokptr, &lan->config_prog, &errstr);
 	    if (err)
@@ -124,6 +124,66 @@ sid_to_session(lanserv_data_t *lan, unsigned int sid)
     return session;
 }
 
+/*
+ * Charge the time since the last stage change to the current stage
+ * and switch to a new stage.  This only does anything while a
+ * received message is being handled.  Returns the old stage so the
+ * caller can switch back to it.
+ */
+static int
+lan_stat_stage(lanserv_data_t *lan, int stage)
+{
+    lan_stats_t *st = &lan->stats;
+    int old = st->cur_stage;
+    uint64_t now;
+
+    if (old < 0)
+	return old;
+    now = stat_time_ns();
+    st->msg_ns[old] += now - st->stage_start;
+    st->stage_start = now;
+    st->cur_stage = stage;
+    st->msg_stages |= 1 << stage;
+    return old;
+}
+
+static void
+lan_stat_msg_start(lanserv_data_t *lan)
+{
+    lan_stats_t *st = &lan->stats;
+
+    st->packets++;
+    memset(st->msg_ns, 0, sizeof(st->msg_ns));
+    st->msg_stages = 1 << LAN_STAT_DECODE;
+    st->cur_stage = LAN_STAT_DECODE;
+    st->stage_start = stat_time_ns();
+}
+
+static void
+lan_stat_msg_done(lanserv_data_t *lan)
+{
+    lan_stats_t *st = &lan->stats;
+    unsigned int i;
+
+    lan_stat_stage(lan, LAN_STAT_DECODE);
+    st->cur_stage = -1;
+    for (i = 0; i < LAN_STAT_NUM_STAGES; i++) {
+	if (st->msg_stages & (1 << i))
+	    stat_hist_add(&st->stage[i], st->msg_ns[i]);
+    }
+    if (!(st->msg_stages & (1 << LAN_STAT_SEND)))
+	st->drops++;
+}
+
+void
+ipmi_lan_clear_stats(lanserv_data_t *lan)
+{
+    int cur_stage = lan->stats.cur_stage;
+
+    memset(&lan->stats, 0, sizeof(lan->stats));
+    lan->stats.cur_stage = cur_stage;
+}
+
 static void
 close_session(lanserv_data_t *lan, session_t *session)
 {
@@ -140,6 +200,8 @@ close_session(lanserv_data_t *lan, session_t *session)
     }
 
     session->active = 0;
+    if (session->timer)
+	lan->sysinfo->stop_timer(session->timer);
     if (session->authtype <= 4)
 	ipmi_auths[session->authtype].authcode_cleanup(session->authdata);
     if (session->integh)
@@ -147,12 +209,121 @@ close_session(lanserv_data_t *lan, session_t *session)
     if (session->confh)
 	session->confh->cleanup(lan, session);
     lan->channel.active_sessions--;
+    lan->stats.sessions_closed++;
     if (session->src_addr) {
 	lan->channel.free(&lan->channel, session->src_addr);
 	session->src_addr = NULL;
     }
 }
 
+static session_t *
+find_free_session(lanserv_data_t *lan)
+{
+    int i;
+    /* Find a free session.  Session 0 is invalid. */
+    for (i=1; i<=MAX_SESSIONS; i++) {
+	if (! lan->sessions[i].active)
+	    return &(lan->sessions[i]);
+    }
+    return NULL;
+}
+
+static uint64_t
+lan_now(lanserv_data_t *lan)
+{
+    struct timeval tv;
+
+    lan->sysinfo->get_monotonic_time(lan->sysinfo, &tv);
+    return ((uint64_t) tv.tv_sec) * 1000000 + tv.tv_usec;
+}
+
+static void
+session_start_timer(lanserv_data_t *lan, session_t *session, uint64_t usec)
+{
+    struct timeval tv;
+
+    tv.tv_sec = usec / 1000000;
+    tv.tv_usec = usec % 1000000;
+    lan->sysinfo->start_timer(session->timer, &tv);
+}
+
+/* Start timing a new session out. */
+static void
+session_timer_init(lanserv_data_t *lan, session_t *session)
+{
+    session->last_active = lan_now(lan);
+    if (session->timer)
+	session_start_timer(lan, session,
+			    lan->default_session_timeout * 1000000ULL);
+}
+
+static void
+session_timeout(void *cb_data)
+{
+    session_t *session = cb_data;
+    lanserv_data_t *lan = session->lan;
+    uint64_t expiry, now;
+    msg_t msg = { 0 }; /* A fake message to hold the address. */
+
+    if (!session->active)
+	return;
+
+    expiry = session->last_active + lan->default_session_timeout * 1000000ULL;
+    now = lan_now(lan);
+    if (expiry > now) {
+	if (session->timer)
+	    session_start_timer(lan, session, expiry - now);
+	return;
+    }
+
+    msg.src_addr = session->src_addr;
+    msg.src_len = session->src_len;
+    lan->sysinfo->log(lan->sysinfo, SESSION_CLOSED, &msg,
+		      "Session closed: Closed due to timeout");
+    lan->stats.sessions_timed_out++;
+    close_session(lan, session);
+}
+
+/*
+ * Sessions that have been idle for less than this are never
+ * reclaimed, so a flood of new sessions can't push out a client
+ * that is in the middle of setting one up.
+ */
+#define LAN_RECLAIM_MIN_IDLE 1000000 /* microseconds */
+
+/*
+ * Called when the session table is full.  Close the RMCP+ session
+ * that has not finished authenticating and has been idle the longest,
+ * so clients that start sessions and never finish them don't lock
+ * everyone else out until they time out.  Returns true if a session
+ * was closed.
+ */
+static int
+reclaim_session(lanserv_data_t *lan)
+{
+    session_t *session, *oldest = NULL;
+    msg_t msg = { 0 };
+    int i;
+
+    for (i=1; i<=MAX_SESSIONS; i++) {
+	session = &lan->sessions[i];
+	if (!session->active || !session->in_startup)
+	    continue;
+	if (!oldest || session->last_active < oldest->last_active)
+	    oldest = session;
+    }
+    if (!oldest || lan_now(lan) - oldest->last_active < LAN_RECLAIM_MIN_IDLE)
+	return 0;
+
+    msg.src_addr = oldest->src_addr;
+    msg.src_len = oldest->src_len;
+    lan->sysinfo->log(lan->sysinfo, SESSION_CLOSED, &msg,
+		      "Session closed: Reclaimed idle unauthenticated session");
+    lan->stats.sessions_reclaimed++;
+    close_session(lan, oldest);
+    return 1;
+}
+
 static int
 auth_gen(session_t *ses,
 	 uint8_t   *out,
@@ -267,6 +438,7 @@ raw_send(lanserv_data_t *lan,
 	free(str);
     }
  send:
+    lan_stat_stage(lan, LAN_STAT_SEND);
     lan->send_out(lan, vec, vecs, addr, addr_len);
 }
 
@@ -314,8 +486,11 @@ return_rmcpp_rsp(lanserv_data_t *lan, session_t *session, msg_t *msg,
 
     if (session && !session->in_startup) {
 	if (session->conf) {
+	    int old_stage = lan_stat_stage(lan, LAN_STAT_ENCRYPT);
+
 	    rv = session->confh->encrypt(lan, session,
 					 &pos, &hdr_left, &len, &dlen);
+	    lan_stat_stage(lan, old_stage);
 	    if (rv) {
 		lan->sysinfo->log(lan->sysinfo, INVALID_MSG, msg,
 			 "Message failure:"
@@ -398,8 +573,11 @@ return_rmcpp_rsp(lanserv_data_t *lan, session_t *session, msg_t *msg,
     ipmi_set_uint16(tpos, len);
 
     if (session && !session->in_startup && session->integ) {
+	int old_stage = lan_stat_stage(lan, LAN_STAT_INTEG);
+
 	rv = session->integh->add(lan, session,
 				  pos, &mlen, dlen);
+	lan_stat_stage(lan, old_stage);
 	if (rv) {
 	    lan->sysinfo->log(lan->sysinfo, INVALID_MSG, msg,
 		     "Message failure:"
@@ -482,11 +660,14 @@ return_rsp(lanserv_data_t *lan, msg_t *msg, session_t *session, rsp_msg_t *rsp)
     if (session->authtype == IPMI_AUTHTYPE_NONE)
 	vec[0].iov_len = 14 + 6;
     else {
+	int old_stage = lan_stat_stage(lan, LAN_STAT_INTEG);
+
 	rv = auth_gen(session, data+13,
 		      data+9, data+5,
 		      pos, 6,
 		      rsp->data, rsp->data_len,
 		      &csum, 1);
+	lan_stat_stage(lan, old_stage);
 	if (rv) {
 	    /* FIXME - what to do? */
 	    return;
@@ -672,7 +853,8 @@ handle_get_session_challenge(lanserv_data_t *lan, msg_t *msg)
 	return;
     }
 
-    if (lan->channel.active_sessions >= MAX_SESSIONS) {
+    if ((lan->channel.active_sessions >= MAX_SESSIONS)
+	&& !reclaim_session(lan)) {
 	lan->sysinfo->log(lan->sysinfo, SESSION_CHALLENGE_FAILED, msg,
 		 "Session challenge failed: To many open sessions");
 	return_err(lan, msg, NULL, IPMI_OUT_OF_SPACE_CC);
@@ -835,18 +1017,6 @@ ifree(void *info, void *data)
     lan->channel.free(&lan->channel, data);
 }
 
-static session_t *
-find_free_session(lanserv_data_t *lan)
-{
-    int i;
-    /* Find a free session.  Session 0 is invalid. */
-    for (i=1; i<=MAX_SESSIONS; i++) {
-	if (! lan->sessions[i].active)
-	    return &(lan->sessions[i]);
-    }
-    return NULL;
-}
-
 static void
 handle_temp_session(lanserv_data_t *lan, msg_t *msg)
 {
@@ -910,7 +1080,8 @@ handle_temp_session(lanserv_data_t *lan, msg_t *msg)
 	return;
     }
 
-    if (lan->channel.active_sessions >= MAX_SESSIONS) {
+    if ((lan->channel.active_sessions >= MAX_SESSIONS)
+	&& !reclaim_session(lan)) {
 	lan->sysinfo->log(lan->sysinfo, NEW_SESSION_FAILED, msg,
 		 "Session challenge failed: To many open sessions");
 	return;
@@ -929,6 +1100,7 @@ handle_temp_session(lanserv_data_t *lan, msg_t *msg)
 						 lan,
 						 ialloc, ifree);
     if (rv) {
+	lan->stats.auth_failures++;
 	lan->sysinfo->log(lan->sysinfo, AUTH_FAILED, msg,
 		 "Activate session failed: Message auth init failed");
 	return;
@@ -941,6 +1113,7 @@ handle_temp_session(lanserv_data_t *lan, msg_t *msg)
     rv = auth_check(&dummy_session, tsid, tseq, msg->data-6, msg->len+7,
 		    msg->rmcp.authcode);
     if (rv) {
+	lan->stats.auth_failures++;
 	lan->sysinfo->log(lan->sysinfo, AUTH_FAILED, msg,
 		 "Activate session failed: Message auth failed");
 	goto out_free;
@@ -1015,9 +1188,11 @@ handle_temp_session(lanserv_data_t *lan, msg_t *msg)
     session->max_priv = priv;
     session->priv = IPMI_PRIVILEGE_USER; /* Start at user privilege. */
     session->userid = user->idx;
-    session->time_left = lan->default_session_timeout;
+    session_timer_init(lan, session);
+    session->rate_tat = 0;
 
     lan->channel.active_sessions++;
+    lan->stats.sessions_opened++;
     lan->sysinfo->log(lan->sysinfo, NEW_SESSION, msg,
 	     "Activate session: Session opened for user 0x%x, max priv %d",
 	     user_idx, priv);
@@ -1049,8 +1224,11 @@ static void
 handle_smi_msg(lanserv_data_t *lan, session_t *session, msg_t *msg)
 {
     int   rv;
+    int   old_stage;
 
+    old_stage = lan_stat_stage(lan, LAN_STAT_HANDLER);
     rv = channel_smi_send(&lan->channel, msg);
+    lan_stat_stage(lan, old_stage);
     if (rv == ENOMEM)
 	return_err(lan, msg, NULL, IPMI_UNKNOWN_ERR_CC);
     else if (rv == EMSGSIZE)
@@ -1780,7 +1958,7 @@ handle_normal_session(lanserv_data_t *lan, msg_t *msg)
 	return;
     }
 
-    session->time_left = lan->default_session_timeout;
+    session->last_active = lan_now(lan);
 
     if (lan->channel.oem.oem_handle_msg &&
 	lan->channel.oem.oem_handle_msg(&lan->channel, msg))
@@ -2511,6 +2689,8 @@ handle_open_session_payload(lanserv_data_t *lan, msg_t *msg)
     }
 
     session = find_free_session(lan);
+    if (!session && reclaim_session(lan))
+	session = find_free_session(lan);
     if (!session) {
 	lan->sysinfo->log(lan->sysinfo, NEW_SESSION_FAILED, msg,
 		 "Activate session failed: out of free sessions");
@@ -2555,7 +2735,8 @@ handle_open_session_payload(lanserv_data_t *lan, msg_t *msg)
     session->confh = confs[conf];
 
     session->userid = 0;
-    session->time_left = lan->default_session_timeout;
+    session_timer_init(lan, session);
+    session->rate_tat = 0;
 
     session->sid = ((lan->sid_seq << (SESSION_BITS_REQ+1))
 		    | (session->handle << 1));
@@ -2581,6 +2762,7 @@ handle_open_session_payload(lanserv_data_t *lan, msg_t *msg)
     data[32] = conf;
 
     lan->channel.active_sessions++;
+    lan->stats.sessions_opened++;
 
     return_rmcpp_rsp(lan, session, msg, 0x11, data, 36, NULL, 0);
     return;
@@ -2617,6 +2799,8 @@ handle_rakp1_payload(lanserv_data_t *lan, msg_t *msg)
     session = sid_to_session(lan, sid);
     if (!session)
 	return;
+    /* Still setting up, don't reclaim it. */
+    session->last_active = lan_now(lan);
 
     memcpy(session->auth_data.rem_rand, msg->data+8, 16);
     session->auth_data.role = msg->data[24];
@@ -2719,11 +2903,13 @@ handle_rakp3_payload(lanserv_data_t *lan, msg_t *msg)
     session = sid_to_session(lan, sid);
     if (!session)
 	return;
+    session->last_active = lan_now(lan);
 
     if (session->authh) {
 	int rv;
 	rv = session->authh->check3(lan, session, msg->data, &msg->len);
 	if (rv) {
+	    lan->stats.auth_failures++;
 	    lan->sysinfo->log(lan->sysinfo, NEW_SESSION_FAILED, msg,
 		     "RAKP msg: check3 failed: 0x%x", rv);
 	    err = 0x0f; /* Invalid integrity check */
@@ -2875,6 +3061,7 @@ ipmi_handle_rmcpp_msg(lanserv_data_t *lan, msg_t *msg)
 	session_t    *session = sid_to_session(lan, msg->sid);
 	int          rv;
 	int          diff;
+	int          old_stage;
 
 	if (session == NULL) {
 	    lan->sysinfo->log(lan->sysinfo, INVALID_MSG, msg,
@@ -2892,16 +3079,22 @@ ipmi_handle_rmcpp_msg(lanserv_data_t *lan, msg_t *msg)
 	imsg.rmcpp.encrypted = msg->rmcpp.encrypted;
 	imsg.rmcpp.authenticated = msg->rmcpp.authenticated;
 
+	old_stage = lan_stat_stage(lan, LAN_STAT_INTEG);
 	rv = check_message_integrity(lan, session, &imsg);
+	lan_stat_stage(lan, old_stage);
 	if (rv) {
+	    lan->stats.auth_failures++;
 	    lan->sysinfo->log(lan->sysinfo, LAN_ERR, msg,
 		     "LAN msg failure:"
 		     " Message integrity failed");
 	    return;
 	}
 
+	old_stage = lan_stat_stage(lan, LAN_STAT_DECRYPT);
 	rv = decrypt_message(lan, session, msg);
+	lan_stat_stage(lan, old_stage);
 	if (rv) {
+	    lan->stats.decrypt_failures++;
 	    lan->sysinfo->log(lan->sysinfo, LAN_ERR, msg,
 		     "LAN msg failure:"
 		     " Message decryption failed");
@@ -2982,6 +3175,7 @@ ipmi_handle_rmcp_msg(lanserv_data_t *lan, msg_t *msg)
 	session_t *session = sid_to_session(lan, msg->sid);
 	int       rv;
 	int       diff;
+	int       old_stage;
 
 	if (session == NULL) {
 	    lan->sysinfo->log(lan->sysinfo, INVALID_MSG, msg,
@@ -2996,9 +3190,12 @@ ipmi_handle_rmcp_msg(lanserv_data_t *lan, msg_t *msg)
 	    return;
 	}
 
+	old_stage = lan_stat_stage(lan, LAN_STAT_INTEG);
 	rv = auth_check(session, tsid, tseq, msg->data, msg->len,
 			msg->rmcp.authcode);
+	lan_stat_stage(lan, old_stage);
 	if (rv) {
+	    lan->stats.auth_failures++;
 	    lan->sysinfo->log(lan->sysinfo, AUTH_FAILED, msg,
 		     "Normal session message failure: auth failure");
 	    return;
@@ -3023,6 +3220,125 @@ ipmi_handle_rmcp_msg(lanserv_data_t *lan, msg_t *msg)
     handle_ipmi_payload(lan, msg);
 }
 
+/*
+ * Rate limiting.  Each bucket is a token bucket kept as the time it
+ * will be full again (the generic cell rate algorithm), so it is a
+ * single number.  Each message moves that time 1/rate seconds later,
+ * and a message is refused if that would put it more than burst/rate
+ * seconds in the future.
+ */
+#define LAN_RATE_SRCS		256
+#define LAN_RATE_SRC_PROBE	4
+#define LAN_RATE_ADDR_MAX	160
+
+struct lan_rate_src_s
+{
+    uint64_t tat;
+    unsigned int len;
+    unsigned char addr[LAN_RATE_ADDR_MAX];
+};
+
+static int
+rate_allow(lan_rate_t *r, uint64_t *tat, uint64_t now)
+{
+    uint64_t interval = 1000000000ULL / r->rate;
+    uint64_t t = *tat;
+
+    if (t < now)
+	t = now;
+    if (t + interval > now + interval * r->burst)
+	return 0;
+    *tat = t + interval;
+    return 1;
+}
+
+/*
+ * Find the bucket for a source address.  The table is a small hash
+ * table, if the address is not in the slots it can go in, the one
+ * that has been idle the longest is taken over.
+ */
+static lan_rate_src_t *
+rate_find_src(lanserv_data_t *lan, void *addr, int addr_len)
+{
+    unsigned char *a = addr;
+    uint32_t hash = 2166136261U;
+    lan_rate_src_t *src, *oldest = NULL;
+    unsigned int i;
+
+    if (addr_len > LAN_RATE_ADDR_MAX)
+	addr_len = LAN_RATE_ADDR_MAX;
+    for (i = 0; i < (unsigned int) addr_len; i++)
+	hash = (hash ^ a[i]) * 16777619;
+
+    for (i = 0; i < LAN_RATE_SRC_PROBE; i++) {
+	src = &lan->rate_srcs[(hash + i) % LAN_RATE_SRCS];
+	if (src->len == (unsigned int) addr_len
+	    && memcmp(src->addr, addr, addr_len) == 0)
+	    return src;
+	if (!oldest || src->tat < oldest->tat)
+	    oldest = src;
+    }
+
+    oldest->tat = 0;
+    oldest->len = addr_len;
+    memcpy(oldest->addr, addr, addr_len);
+    return oldest;
+}
+
+/* Pull the session id out of the raw message, zero if there is none. */
+static uint32_t
+rate_msg_sid(uint8_t *data, int len)
+{
+    int pos;
+
+    if (data[4] != IPMI_AUTHTYPE_RMCP_PLUS)
+	pos = 9;
+    else if ((len > 5) && ((data[5] & 0x3f) == 2))
+	pos = 12;
+    else
+	pos = 6;
+    if (len < pos + 4)
+	return 0;
+    return ipmi_get_uint32(data + pos);
+}
+
+/* Returns true if the message may be handled. */
+static int
+rate_check(lanserv_data_t *lan, uint8_t *data, int len,
+	   void *from_addr, int from_len)
+{
+    session_t *session = NULL;
+    uint32_t sid;
+    uint64_t now;
+
+    if (!lan->presession_rate.rate && !lan->session_rate.rate)
+	return 1;
+
+    sid = rate_msg_sid(data, len);
+    if (sid)
+	session = sid_to_session(lan, sid);
+    /* Only charge the session if it's from the session's address, so
+       spoofed messages can't use up a real session's budget. */
+    if (session && (session->src_len != from_len
+		    || memcmp(session->src_addr, from_addr, from_len) != 0))
+	session = NULL;
+
+    now = stat_time_ns();
+    if (session) {
+	if (!lan->session_rate.rate
+	    || rate_allow(&lan->session_rate, &session->rate_tat, now))
+	    return 1;
+	lan->stats.session_rate_drops++;
+    } else {
+	if (!lan->presession_rate.rate
+	    || rate_allow(&lan->presession_rate,
+			  &rate_find_src(lan, from_addr, from_len)->tat, now))
+	    return 1;
+	lan->stats.presession_rate_drops++;
+    }
+    return 0;
+}
+
 void
 ipmi_handle_lan_msg(lanserv_data_t *lan,
 		    uint8_t *data, int len,
@@ -3035,18 +3351,23 @@ ipmi_handle_lan_msg(lanserv_data_t *lan,
 
     msg.oem_data = 0;
 
+    lan_stat_msg_start(lan);
+
     if (len < 5) {
 	lan->sysinfo->log(lan->sysinfo, LAN_ERR, &msg,
 		 "LAN msg failure: message too short");
-	return;
+	goto out;
     }
 
     if (data[2] != 0xff) {
 	lan->sysinfo->log(lan->sysinfo, LAN_ERR, &msg,
 		 "LAN msg failure: seq not ff");
-	return; /* Sequence # must be ff (no ack) */
+	goto out; /* Sequence # must be ff (no ack) */
     }
 
+    if (!rate_check(lan, data, len, from_addr, from_len))
+	goto out;
+
     msg.authtype = data[4];
     msg.data = data+5;
     msg.len = len - 5;
@@ -3059,8 +3380,14 @@ ipmi_handle_lan_msg(lanserv_data_t *lan,
 	ipmi_handle_rmcp_msg(lan, &msg);
     }
 
+ out:
+    lan_stat_msg_done(lan);
 }
 
+/*
+ * Only used if the system doesn't supply timers, otherwise each
+ * session has its own timer.
+ */
 static void
 ipmi_lan_tick(void *info, unsigned int time_since_last)
 {
@@ -3068,19 +3395,8 @@ ipmi_lan_tick(void *info, unsigned int time_since_last)
     int i;
 
     for (i=1; i<=MAX_SESSIONS; i++) {
-	if (lan->sessions[i].active) {
-	    if (lan->sessions[i].time_left <= time_since_last) {
-		msg_t msg = { 0 }; /* A fake message to hold the address. */
-
-		msg.src_addr = lan->sessions[i].src_addr;
-		msg.src_len = lan->sessions[i].src_len;
-		lan->sysinfo->log(lan->sysinfo, SESSION_CLOSED, &msg,
-			 "Session closed: Closed due to timeout");
-		close_session(lan, &(lan->sessions[i]));
-	    } else {
-		lan->sessions[i].time_left -= time_since_last;
-	    }
-	}
+	if (lan->sessions[i].active)
+	    session_timeout(&lan->sessions[i]);
     }
 }
 
@@ -3172,11 +3488,19 @@ ipmi_lan_init(lanserv_data_t *lan)
 
     for (i=0; i<=MAX_SESSIONS; i++) {
 	lan->sessions[i].handle = i;
+	lan->sessions[i].lan = lan;
+	if (i > 0 && lan->sysinfo->alloc_timer) {
+	    rv = lan->sysinfo->alloc_timer(lan->sysinfo, session_timeout,
+					   &lan->sessions[i],
+					   &lan->sessions[i].timer);
+	    if (rv)
+		goto out;
+	}
     }
 
     rv = read_lan_config(lan);
     if (rv)
-	return rv;
+	goto out;
 
     lan->lanparm.num_destinations = 0; /* LAN alerts not supported */
 
@@ -3205,6 +3529,17 @@ ipmi_lan_init(lanserv_data_t *lan)
 
     lan->sid_seq = 0;
     lan->next_challenge_seq = 0;
+    lan->stats.cur_stage = -1;
+
+    if (lan->presession_rate.rate) {
+	lan->rate_srcs = lan->channel.alloc(&lan->channel,
+				LAN_RATE_SRCS * sizeof(lan_rate_src_t));
+	if (!lan->rate_srcs) {
+	    rv = ENOMEM;
+	    goto out;
+	}
+	memset(lan->rate_srcs, 0, LAN_RATE_SRCS * sizeof(lan_rate_src_t));
+    }
 
     /* Default the timeout to 30 seconds. */
     if (lan->default_session_timeout == 0)
@@ -3212,10 +3547,20 @@ ipmi_lan_init(lanserv_data_t *lan)
 
     chan_init(&lan->channel);
 
-    lan->tick_handler.handler = ipmi_lan_tick;
-    lan->tick_handler.info = lan;
-    ipmi_register_tick_handler(&lan->tick_handler);
+    if (!lan->sysinfo->alloc_timer) {
+	lan->tick_handler.handler = ipmi_lan_tick;
+	lan->tick_handler.info = lan;
+	ipmi_register_tick_handler(&lan->tick_handler);
+    }
 
  out:
+    if (rv) {
+	for (i=1; i<=MAX_SESSIONS; i++) {
+	    if (lan->sessions[i].timer) {
+		lan->sysinfo->free_timer(lan->sessions[i].timer);
+		lan->sessions[i].timer = NULL;
+	    }
+	}
+    }
     return rv;
 }
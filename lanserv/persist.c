@@ -61,6 +61,11 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <stdarg.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <signal.h>
 #include <OpenIPMI/persist.h>
 
 enum pitem_type {
@@ -181,9 +186,9 @@ alloc_persist(const char *name, ...)
 }
 
 static char *
-get_fname(persist_t *p, char *sfx)
+get_fname(const char *name, char *sfx)
 {
-    int len = (strlen(basedir) + strlen(app) + strlen(p->name)
+    int len = (strlen(basedir) + strlen(app) + strlen(name)
 	       + strlen(sfx) + 3);
     char *fname = malloc(len);
 
@@ -193,12 +198,282 @@ get_fname(persist_t *p, char *sfx)
     strcat(fname, "/");
     strcat(fname, app);
     strcat(fname, "/");
-    strcat(fname, p->name);
+    strcat(fname, name);
     strcat(fname, sfx);
 
     return fname;
 }
 
+/*
+ * Write-behind.  Once persist_start_writer() has been called,
+ * write_persist() only formats the data into memory and queues it by
+ * name, and a separate thread writes it to the file.  If an object is
+ * written again before the thread gets to it, the new data replaces
+ * the queued data, so a burst of updates turns into one write.  Each
+ * object is written the given delay after it was first queued, to let
+ * updates coalesce.
+ */
+struct pending {
+    char *name;
+    char *data;
+    size_t len;
+    uint64_t due; /* In milliseconds, monotonic. */
+    struct pending *next;
+};
+
+static pthread_mutex_t pend_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pend_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t idle_cond = PTHREAD_COND_INITIALIZER;
+static struct pending *pend_head, *pend_tail;
+static int writer_started;
+static int writer_busy;
+static unsigned int flush_waiters;
+static unsigned int write_delay;
+static int last_err;
+static persist_stats_t pstats;
+
+static uint64_t
+now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t) ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* Write the file through a temporary and rename it into place. */
+static int
+write_fdata(const char *name, const char *data, size_t len, int sync)
+{
+    char *fname, *fname2;
+    int rv = 0;
+    FILE *f;
+
+    fname = get_fname(name, ".tmp");
+    if (!fname)
+	return ENOMEM;
+
+    fname2 = get_fname(name, "");
+    if (!fname2) {
+	free(fname);
+	return ENOMEM;
+    }
+
+    f = fopen(fname, "w");
+    if (!f) {
+	rv = errno;
+	goto out;
+    }
+    if (len && fwrite(data, len, 1, f) != 1)
+	rv = errno;
+    if (!rv && fflush(f) != 0)
+	rv = errno;
+    if (!rv && sync && fsync(fileno(f)) != 0)
+	rv = errno;
+    fclose(f);
+
+    if (!rv && rename(fname, fname2) != 0)
+	rv = errno;
+
+ out:
+    free(fname);
+    free(fname2);
+    return rv;
+}
+
+static void
+free_pending(struct pending *pd)
+{
+    free(pd->name);
+    free(pd->data);
+    free(pd);
+}
+
+static void *
+persist_writer(void *arg)
+{
+    struct pending *pd;
+    struct timespec ts;
+    uint64_t now;
+    int rv;
+
+    pthread_mutex_lock(&pend_lock);
+    for (;;) {
+	if (!pend_head) {
+	    pthread_cond_broadcast(&idle_cond);
+	    pthread_cond_wait(&pend_cond, &pend_lock);
+	    continue;
+	}
+
+	pd = pend_head;
+	now = now_ms();
+	if (!flush_waiters && pd->due > now) {
+	    clock_gettime(CLOCK_REALTIME, &ts);
+	    ts.tv_sec += (pd->due - now) / 1000;
+	    ts.tv_nsec += ((pd->due - now) % 1000) * 1000000;
+	    if (ts.tv_nsec >= 1000000000) {
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000;
+	    }
+	    pthread_cond_timedwait(&pend_cond, &pend_lock, &ts);
+	    continue;
+	}
+
+	pend_head = pd->next;
+	if (!pend_head)
+	    pend_tail = NULL;
+	writer_busy = 1;
+	pthread_mutex_unlock(&pend_lock);
+
+	rv = write_fdata(pd->name, pd->data, pd->len, 1);
+	free_pending(pd);
+
+	pthread_mutex_lock(&pend_lock);
+	writer_busy = 0;
+	pstats.pending--;
+	if (rv) {
+	    pstats.errors++;
+	    last_err = rv;
+	} else {
+	    pstats.written++;
+	}
+    }
+    return NULL;
+}
+
+/* Put the contents of the persist file in memory. */
+static int
+format_persist(persist_t *p, char **rdata, size_t *rlen)
+{
+    char *data = NULL;
+    size_t len = 0;
+    FILE *f;
+
+    f = open_memstream(&data, &len);
+    if (!f)
+	return errno;
+    write_persist_file(p, f);
+    if (fclose(f) != 0) {
+	free(data);
+	return ENOMEM;
+    }
+    *rdata = data;
+    *rlen = len;
+    return 0;
+}
+
+static int
+queue_persist(persist_t *p)
+{
+    struct pending *pd;
+    char *data;
+    size_t len;
+    int rv;
+
+    rv = format_persist(p, &data, &len);
+    if (rv)
+	return rv;
+
+    pthread_mutex_lock(&pend_lock);
+    pstats.queued++;
+    for (pd = pend_head; pd; pd = pd->next) {
+	if (strcmp(pd->name, p->name) == 0) {
+	    /* Already waiting to be written, just use the new data. */
+	    free(pd->data);
+	    pd->data = data;
+	    pd->len = len;
+	    pstats.coalesced++;
+	    pthread_mutex_unlock(&pend_lock);
+	    return 0;
+	}
+    }
+
+    pd = malloc(sizeof(*pd));
+    if (pd)
+	pd->name = strdup(p->name);
+    if (!pd || !pd->name) {
+	pthread_mutex_unlock(&pend_lock);
+	if (pd)
+	    free(pd);
+	free(data);
+	return ENOMEM;
+    }
+    pd->data = data;
+    pd->len = len;
+    pd->due = now_ms() + write_delay;
+    pd->next = NULL;
+    if (pend_tail)
+	pend_tail->next = pd;
+    else
+	pend_head = pd;
+    pend_tail = pd;
+    pstats.pending++;
+    pthread_cond_signal(&pend_cond);
+    pthread_mutex_unlock(&pend_lock);
+    return 0;
+}
+
+int
+persist_start_writer(unsigned int delay_ms)
+{
+    pthread_t thread;
+    sigset_t sigs, old_sigs;
+    int rv;
+
+    if (writer_started)
+	return EBUSY;
+    write_delay = delay_ms;
+
+    /* Signals are handled by the main thread, the writer never takes any. */
+    sigfillset(&sigs);
+    pthread_sigmask(SIG_SETMASK, &sigs, &old_sigs);
+    rv = pthread_create(&thread, NULL, persist_writer, NULL);
+    pthread_sigmask(SIG_SETMASK, &old_sigs, NULL);
+    if (rv)
+	return rv;
+    pthread_detach(thread);
+    writer_started = 1;
+    return 0;
+}
+
+void
+persist_set_delay(unsigned int delay_ms)
+{
+    pthread_mutex_lock(&pend_lock);
+    write_delay = delay_ms;
+    pthread_mutex_unlock(&pend_lock);
+}
+
+int
+persist_flush(void)
+{
+    int rv;
+
+    if (!writer_started)
+	return 0;
+
+    pthread_mutex_lock(&pend_lock);
+    flush_waiters++;
+    pthread_cond_signal(&pend_cond);
+    while (pend_head || writer_busy)
+	pthread_cond_wait(&idle_cond, &pend_lock);
+    flush_waiters--;
+    rv = last_err;
+    last_err = 0;
+    pthread_mutex_unlock(&pend_lock);
+    return rv;
+}
+
+void
+persist_get_stats(persist_stats_t *stats)
+{
+    pthread_mutex_lock(&pend_lock);
+    *stats = pstats;
+    stats->delay_ms = write_delay;
+    stats->write_behind = writer_started;
+    pthread_mutex_unlock(&pend_lock);
+}
+
 static unsigned char
 fromhex(char c)
 {
@@ -277,7 +552,11 @@ read_persist(const char *name, ...)
     p = alloc_vpersist(name, ap);
     if (!p)
 	return NULL;
-    fname = get_fname(p, "");
+    if (writer_started)
+	/* Make sure anything queued for the file is there to read. */
+	persist_flush();
+
+    fname = get_fname(p->name, "");
     if (!fname) {
 	free_persist(p);
 	return NULL;
@@ -373,40 +652,21 @@ write_persist_file(persist_t *p, FILE *f)
 int
 write_persist(persist_t *p)
 {
-    char *fname, *fname2;
-    int rv = 0;
-    FILE *f;
+    char *data;
+    size_t len;
+    int rv;
 
     if (!persist_enable)
 	return 0;
 
-    fname = get_fname(p, ".tmp");
-    if (!fname) {
-	return ENOMEM;
-    }
-
-    fname2 = get_fname(p, "");
-    if (!fname2) {
-	free(fname);
-	return ENOMEM;
-    }
-
-    f = fopen(fname, "w");
-    if (!f) {
-	free(fname);
-	free(fname2);
-	return ENOMEM;
-    }
-
-    write_persist_file(p, f);
-    fclose(f);
-
-    if (rename(fname, fname2) != 0)
-	rv = errno;
-
-    free(fname);
-    free(fname2);
+    if (writer_started)
+	return queue_persist(p);
 
+    rv = format_persist(p, &data, &len);
+    if (rv)
+	return rv;
+    rv = write_fdata(p->name, data, len, 0);
+    free(data);
     return rv;
 }
 
@@ -38,11 +38,17 @@
 #include <malloc.h>
 #include <math.h>
 #include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
 
 /* Primarily to get string handling routines */
 #include <OpenIPMI/ipmi_string.h>
 
 #include "persist.c"
+#include "sdrimage.h"
 
 #define MAX_SDR_LINE 256
 
@@ -1522,18 +1528,119 @@ static char *progname;
 
 static void help(void)
 {
-    fprintf(stderr, "%s [-r] <input file>\n", progname);
+    fprintf(stderr,
+	    "%s [-r | -b] [-o <outdir>] [-j <jobs>] <input file> [...]\n",
+	    progname);
     exit(1);
 }
 
+/*
+ * The SDRs compiled from an input file, held until the whole file has
+ * been parsed so they can be written out in any of the output formats.
+ */
+struct sdr_set {
+    unsigned int  count;
+    unsigned int  size;
+    unsigned char **sdrs;
+    unsigned int  *lens;
+};
+
 static void
-parse_file(const char *filename, FILE *f, persist_t *p, int outraw,
+add_sdr(struct sdr_set *set, unsigned char *sdr, unsigned int sdrlen)
+{
+    if (set->count == set->size) {
+	unsigned int newsize = set->size ? set->size * 2 : 64;
+
+	set->sdrs = realloc(set->sdrs, newsize * sizeof(*set->sdrs));
+	set->lens = realloc(set->lens, newsize * sizeof(*set->lens));
+	if (!set->sdrs || !set->lens) {
+	    fprintf(stderr, "Out of memory\n");
+	    exit(1);
+	}
+	set->size = newsize;
+    }
+    set->sdrs[set->count] = sdr;
+    set->lens[set->count] = sdrlen;
+    set->count++;
+}
+
+/*
+ * Every file read while compiling an input, with a hash of its
+ * contents.  This is stored beside the output so that a later run can
+ * tell that nothing has changed and skip the input.
+ */
+struct input_file {
+    char *name;
+    uint64_t hash;
+    struct input_file *next;
+};
+static struct input_file *inputs, *last_input;
+
+static int
+hash_file(const char *filename, uint64_t *rhash)
+{
+    /* FNV-1a, this only has to notice changes. */
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    unsigned char buf[4096];
+    size_t len, i;
+    FILE *f;
+
+    f = fopen(filename, "r");
+    if (!f)
+	return errno;
+    while ((len = fread(buf, 1, sizeof(buf), f)) > 0) {
+	for (i = 0; i < len; i++) {
+	    hash ^= buf[i];
+	    hash *= 0x100000001b3ULL;
+	}
+    }
+    fclose(f);
+    *rhash = hash;
+    return 0;
+}
+
+static void
+note_input(const char *filename)
+{
+    struct input_file *in;
+
+    for (in = inputs; in; in = in->next) {
+	if (strcmp(in->name, filename) == 0)
+	    return;
+    }
+
+    in = malloc(sizeof(*in));
+    if (!in) {
+	fprintf(stderr, "Out of memory\n");
+	exit(1);
+    }
+    in->name = strdup(filename);
+    if (!in->name) {
+	fprintf(stderr, "Out of memory\n");
+	exit(1);
+    }
+    if (hash_file(filename, &in->hash)) {
+	fprintf(stderr, "Unable to read input file %s\n", filename);
+	exit(1);
+    }
+    in->next = NULL;
+    if (last_input)
+	last_input->next = in;
+    else
+	inputs = in;
+    last_input = in;
+}
+
+static void
+parse_file(const char *filename, FILE *f, struct sdr_set *set,
 	   unsigned int *sdrnum)
 {
     char buf[MAX_SDR_LINE];
     char *s;
     unsigned int line = 0;
 
+    note_input(filename);
+
     while ((s = fgets(buf, sizeof(buf), f))) {
 	int err;
 	unsigned int sdrtype;
@@ -1580,17 +1687,8 @@ parse_file(const char *filename, FILE *f, persist_t *p, int outraw,
 	    sdr[0] = *sdrnum & 0xff;
 	    sdr[1] = (*sdrnum >> 8) & 0xff;
 
-	    if (outraw) {
-		fwrite(sdr, sdrlen, 1, stdout);
-	    } else {
-		err = add_persist_data(p, sdr, sdrlen, "%d", *sdrnum);
-		if (err) {
-		    fprintf(stderr, "Out of memory\n");
-		    exit(1);
-		}
-	    }
+	    add_sdr(set, sdr, sdrlen);
 	    (*sdrnum)++;
-	    free(sdr);
 	} else if (strcmp(tok, "define") == 0) {
 	    const char *name;
 	    const char *value;
@@ -1632,7 +1730,7 @@ parse_file(const char *filename, FILE *f, persist_t *p, int outraw,
 		exit(1);
 	    }
 
-	    parse_file(nfilename, f2, p, outraw, sdrnum);
+	    parse_file(nfilename, f2, set, sdrnum);
 	    
 	    fclose(f2);
 	} else {
@@ -1645,24 +1743,369 @@ parse_file(const char *filename, FILE *f, persist_t *p, int outraw,
 
 }
 
+enum out_mode { OUT_PERSIST, OUT_RAW, OUT_IMAGE };
+static const char *out_suffix[] = { ".main", ".raw", ".img" };
+static const char *out_mode_name[] = { "persist", "raw", "image" };
+
+static void
+set_le16(unsigned char *d, unsigned int v)
+{
+    d[0] = v & 0xff;
+    d[1] = (v >> 8) & 0xff;
+}
+
+static void
+set_le32(unsigned char *d, uint32_t v)
+{
+    d[0] = v & 0xff;
+    d[1] = (v >> 8) & 0xff;
+    d[2] = (v >> 16) & 0xff;
+    d[3] = (v >> 24) & 0xff;
+}
+
+static int
+write_image(struct sdr_set *set, FILE *out)
+{
+    unsigned char hdr[SDR_IMAGE_HDR_LEN];
+    unsigned char idx[SDR_IMAGE_IDX_LEN];
+    uint32_t offset = 0;
+    unsigned int i;
+
+    for (i = 0; i < set->count; i++)
+	offset += set->lens[i];
+
+    memcpy(hdr, SDR_IMAGE_MAGIC, SDR_IMAGE_MAGIC_LEN);
+    set_le32(hdr + SDR_IMAGE_HDR_VERSION, SDR_IMAGE_VERSION);
+    set_le32(hdr + SDR_IMAGE_HDR_NUM_SDRS, set->count);
+    set_le32(hdr + SDR_IMAGE_HDR_ADD_TIME, time(NULL));
+    set_le32(hdr + SDR_IMAGE_HDR_DATA_LEN, offset);
+    if (fwrite(hdr, sizeof(hdr), 1, out) != 1)
+	return -1;
+
+    offset = 0;
+    for (i = 0; i < set->count; i++) {
+	set_le16(idx + SDR_IMAGE_IDX_RECID,
+		 set->sdrs[i][0] | (set->sdrs[i][1] << 8));
+	set_le16(idx + SDR_IMAGE_IDX_LENGTH, set->lens[i]);
+	set_le32(idx + SDR_IMAGE_IDX_OFFSET, offset);
+	if (fwrite(idx, sizeof(idx), 1, out) != 1)
+	    return -1;
+	offset += set->lens[i];
+    }
+
+    for (i = 0; i < set->count; i++) {
+	if (fwrite(set->sdrs[i], set->lens[i], 1, out) != 1)
+	    return -1;
+    }
+    return 0;
+}
+
+static int
+write_output(struct sdr_set *set, enum out_mode mode, FILE *out)
+{
+    persist_t *p;
+    unsigned int i;
+    int rv = 0;
+
+    switch (mode) {
+    case OUT_RAW:
+	for (i = 0; i < set->count; i++) {
+	    if (fwrite(set->sdrs[i], set->lens[i], 1, out) != 1)
+		return -1;
+	}
+	break;
+
+    case OUT_IMAGE:
+	rv = write_image(set, out);
+	break;
+
+    case OUT_PERSIST:
+	p = alloc_persist("");
+	if (!p) {
+	    fprintf(stderr, "Out of memory\n");
+	    exit(1);
+	}
+	for (i = 0; i < set->count; i++) {
+	    unsigned int recid = set->sdrs[i][0] | (set->sdrs[i][1] << 8);
+
+	    if (add_persist_data(p, set->sdrs[i], set->lens[i], "%d", recid)) {
+		fprintf(stderr, "Out of memory\n");
+		exit(1);
+	    }
+	}
+	add_persist_int(p, time(NULL), "last_add_time");
+	write_persist_file(p, out);
+	free_persist(p);
+	break;
+    }
+    return rv;
+}
+
+static void
+compile_file(const char *filename, struct sdr_set *set)
+{
+    unsigned int sdrnum = 1;
+    FILE *f;
+
+    f = fopen(filename, "r");
+    if (!f) {
+	fprintf(stderr, "Unable to open input file %s\n", filename);
+	exit(1);
+    }
+    parse_file(filename, f, set, &sdrnum);
+    fclose(f);
+}
+
+/*
+ * With an output directory, every input goes to its own file there,
+ * named after the input with the directory and suffix removed.  The
+ * list of files that went into it (with their hashes) is kept in a
+ * ".dep" file next to it.
+ */
+static char *
+output_name(const char *outdir, const char *input, enum out_mode mode,
+	    const char *extra)
+{
+    const char *base = strrchr(input, '/');
+    const char *dot;
+    unsigned int baselen;
+    char *name;
+
+    base = base ? base + 1 : input;
+    dot = strrchr(base, '.');
+    baselen = dot && dot != base ? (unsigned int) (dot - base) : strlen(base);
+    name = malloc(strlen(outdir) + baselen + strlen(out_suffix[mode])
+		  + strlen(extra) + 2);
+    if (!name) {
+	fprintf(stderr, "Out of memory\n");
+	exit(1);
+    }
+    sprintf(name, "%s/%.*s%s%s", outdir, baselen, base, out_suffix[mode],
+	    extra);
+    return name;
+}
+
+static int
+output_current(const char *outfile, const char *depfile, enum out_mode mode)
+{
+    char line[MAX_SDR_LINE + 32];
+    char expect[32];
+    struct stat st;
+    int current = 0;
+    FILE *f;
+
+    if (stat(outfile, &st) != 0)
+	return 0;
+    f = fopen(depfile, "r");
+    if (!f)
+	return 0;
+
+    sprintf(expect, "sdrcomp %s\n", out_mode_name[mode]);
+    if (!fgets(line, sizeof(line), f) || strcmp(line, expect) != 0)
+	goto out;
+
+    while (fgets(line, sizeof(line), f)) {
+	unsigned long long hash;
+	uint64_t chash;
+	char *name, *end;
+
+	hash = strtoull(line, &name, 16);
+	if (*name != ' ')
+	    goto out;
+	name++;
+	end = strchr(name, '\n');
+	if (end)
+	    *end = '\0';
+	if (hash_file(name, &chash) || chash != hash)
+	    goto out;
+    }
+    current = 1;
+
+  out:
+    fclose(f);
+    return current;
+}
+
+static int
+write_deps(const char *depfile, enum out_mode mode)
+{
+    struct input_file *in;
+    FILE *f;
+
+    f = fopen(depfile, "w");
+    if (!f)
+	return -1;
+    fprintf(f, "sdrcomp %s\n", out_mode_name[mode]);
+    for (in = inputs; in; in = in->next)
+	fprintf(f, "%16.16llx %s\n", (unsigned long long) in->hash, in->name);
+    return fclose(f);
+}
+
+/*
+ * Compile one input into the output directory.  This runs in a child
+ * process, the SDR parser keeps global state and exits on errors.
+ */
+static int
+compile_to_dir(const char *input, const char *outdir, enum out_mode mode)
+{
+    struct sdr_set set;
+    char *outfile, *tmpfile, *depfile;
+    FILE *out;
+
+    outfile = output_name(outdir, input, mode, "");
+    tmpfile = output_name(outdir, input, mode, ".tmp");
+    depfile = output_name(outdir, input, mode, ".dep");
+
+    memset(&set, 0, sizeof(set));
+    compile_file(input, &set);
+
+    out = fopen(tmpfile, "w");
+    if (!out) {
+	fprintf(stderr, "Unable to open output file %s: %s\n", tmpfile,
+		strerror(errno));
+	return 1;
+    }
+    if (write_output(&set, mode, out) || fclose(out)) {
+	fprintf(stderr, "Error writing output file %s\n", tmpfile);
+	unlink(tmpfile);
+	return 1;
+    }
+    if (rename(tmpfile, outfile) != 0) {
+	fprintf(stderr, "Unable to rename %s: %s\n", tmpfile, strerror(errno));
+	unlink(tmpfile);
+	return 1;
+    }
+    if (write_deps(depfile, mode)) {
+	fprintf(stderr, "Unable to write %s\n", depfile);
+	unlink(depfile);
+	return 1;
+    }
+    return 0;
+}
+
+/*
+ * Compile all the inputs into the output directory, running up to
+ * "jobs" compiles at a time.  Inputs whose files have not changed since
+ * the last run are skipped.  Inputs that would go to the same output
+ * file (the same name in different directories) are rejected before
+ * anything is compiled.
+ */
+static int
+compile_all(char **input, int ninputs, const char *outdir,
+	    enum out_mode mode, int jobs)
+{
+    pid_t *pids;
+    char **outfiles;
+    int running = 0, next = 0, failed = 0, skipped = 0;
+    int i, j, status;
+
+    pids = calloc(ninputs, sizeof(*pids));
+    outfiles = calloc(ninputs, sizeof(*outfiles));
+    if (!pids || !outfiles) {
+	fprintf(stderr, "Out of memory\n");
+	exit(1);
+    }
+
+    for (i = 0; i < ninputs; i++) {
+	outfiles[i] = output_name(outdir, input[i], mode, "");
+	for (j = 0; j < i; j++) {
+	    if (strcmp(outfiles[i], outfiles[j]) == 0) {
+		fprintf(stderr, "%s and %s would both be compiled to %s\n",
+			input[j], input[i], outfiles[i]);
+		exit(1);
+	    }
+	}
+    }
+
+    while (next < ninputs || running > 0) {
+	pid_t pid;
+
+	while (next < ninputs && running < jobs) {
+	    char *depfile = output_name(outdir, input[next], mode, ".dep");
+	    int current = output_current(outfiles[next], depfile, mode);
+
+	    free(depfile);
+	    if (current) {
+		skipped++;
+		next++;
+		continue;
+	    }
+
+	    fflush(stderr);
+	    pid = fork();
+	    if (pid == -1) {
+		fprintf(stderr, "Unable to fork: %s\n", strerror(errno));
+		exit(1);
+	    }
+	    if (pid == 0)
+		exit(compile_to_dir(input[next], outdir, mode));
+	    pids[next] = pid;
+	    running++;
+	    next++;
+	}
+	if (running == 0)
+	    break;
+
+	pid = wait(&status);
+	if (pid == -1) {
+	    fprintf(stderr, "Error waiting for compile: %s\n", strerror(errno));
+	    exit(1);
+	}
+	running--;
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+	    for (i = 0; i < ninputs; i++) {
+		if (pids[i] == pid)
+		    fprintf(stderr, "Compile of %s failed\n", input[i]);
+	    }
+	    failed++;
+	}
+    }
+    for (i = 0; i < ninputs; i++)
+	free(outfiles[i]);
+    free(outfiles);
+    free(pids);
+
+    if (skipped)
+	fprintf(stderr, "%d of %d inputs unchanged\n", skipped, ninputs);
+    return failed ? 1 : 0;
+}
+
 int
 main(int argc, char *argv[])
 {
-    FILE *f;
-    persist_t *p = NULL;
-    unsigned int sdrnum = 1;
+    struct sdr_set set;
+    enum out_mode mode = OUT_PERSIST;
+    const char *outdir = NULL;
+    int jobs = 0;
     int argn;
-    int outraw = 0;
 
     progname = argv[0];
 
     for (argn = 1; argn < argc; argn++) {
 	if (argv[argn][0] != '-')
 	    break;
-	if (strcmp(argv[argn], "--") == 0)
+	if (strcmp(argv[argn], "--") == 0) {
+	    argn++;
 	    break;
+	}
 	if (strcmp(argv[argn], "-r") == 0) {
-	    outraw = 1;
+	    mode = OUT_RAW;
+	} else if (strcmp(argv[argn], "-b") == 0) {
+	    mode = OUT_IMAGE;
+	} else if (strcmp(argv[argn], "-o") == 0) {
+	    argn++;
+	    if (argn >= argc)
+		help();
+	    outdir = argv[argn];
+	} else if (strcmp(argv[argn], "-j") == 0) {
+	    argn++;
+	    if (argn >= argc)
+		help();
+	    jobs = atoi(argv[argn]);
+	    if (jobs <= 0) {
+		fprintf(stderr, "Invalid job count: %s\n", argv[argn]);
+		exit(1);
+	    }
 	} else {
 	    fprintf(stderr, "Invalid option: %s\n", argv[argn]);
 	    exit(1);
@@ -1674,28 +2117,24 @@ main(int argc, char *argv[])
 	help();
     }
 
-    f = fopen(argv[1], "r");
-    if (!f) {
-	fprintf(stderr, "Unable to open input file %s\n", argv[1]);
-	exit(1);
-    }
-
-    if (!outraw) {
-	p = alloc_persist("");
-	if (!p) {
-	    fprintf(stderr, "Out of memory\n");
-	    exit(1);
+    if (outdir) {
+	if (jobs == 0) {
+	    long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+	    jobs = ncpus > 0 ? ncpus : 1;
 	}
+	return compile_all(argv + argn, argc - argn, outdir, mode, jobs);
     }
 
-    parse_file(argv[1], f, p, outraw, &sdrnum);
-
-    fclose(f);
+    if ((argc - argn) > 1) {
+	fprintf(stderr, "Multiple input files require an output directory\n");
+	help();
+    }
 
-    if (!outraw) {
-	add_persist_int(p, time(NULL), "last_add_time");
-	write_persist_file(p, stdout);
-	free_persist(p);
+    memset(&set, 0, sizeof(set));
+    compile_file(argv[argn], &set);
+    if (write_output(&set, mode, stdout)) {
+	fprintf(stderr, "Error writing output\n");
+	exit(1);
     }
 
     return 0;
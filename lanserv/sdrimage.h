@@ -0,0 +1,65 @@
+/*
+ * sdrimage.h
+ *
+ * MontaVista IPMI binary SDR repository image format
+ *
+ * Author: MontaVista Software, Inc.
+ *         Corey Minyard <minyard@mvista.com>
+ *         source@mvista.com
+ *
+ * Copyright 2012 MontaVista Software Inc.
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2 of
+ *  the License, or (at your option) any later version.
+ *
+ *
+ *  THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ *  WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ *  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ *  OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ *  TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ *  USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this program; if not, write to the Free
+ *  Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.  */
+
+#ifndef __SDRIMAGE_H_
+#define __SDRIMAGE_H_
+
+/*
+ * A binary SDR repository image, as written by "sdrcomp -b" and read
+ * by ipmi_mc_add_main_sdr_image().  All values are little endian.
+ *
+ *   header:  8 bytes magic, then 32-bit version, number of SDRs,
+ *            last add time and length of the SDR data area.
+ *   index:   one entry per SDR: 16-bit record id, 16-bit length and
+ *            32-bit offset of the SDR in the data area.
+ *   data:    the SDRs, back to back.
+ *
+ * The index lets the loader size and place everything up front
+ * instead of inserting the records one at a time.
+ */
+
+#define SDR_IMAGE_MAGIC		"IPMISDRI"
+#define SDR_IMAGE_MAGIC_LEN	8
+#define SDR_IMAGE_VERSION	1
+#define SDR_IMAGE_HDR_LEN	24
+#define SDR_IMAGE_IDX_LEN	8
+
+#define SDR_IMAGE_HDR_VERSION	8
+#define SDR_IMAGE_HDR_NUM_SDRS	12
+#define SDR_IMAGE_HDR_ADD_TIME	16
+#define SDR_IMAGE_HDR_DATA_LEN	20
+
+#define SDR_IMAGE_IDX_RECID	0
+#define SDR_IMAGE_IDX_LENGTH	2
+#define SDR_IMAGE_IDX_OFFSET	4
+
+#endif /* __SDRIMAGE_H_ */
@@ -0,0 +1,624 @@
+/*
+ * sensor_gen.c
+ *
+ * Sensor value generators for the IPMI simulator.
+ *
+ * Author: MontaVista Software, Inc.
+ *         Corey Minyard <minyard@mvista.com>
+ *         source@mvista.com
+ *
+ * Copyright 2012 MontaVista Software Inc.
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2 of
+ *  the License, or (at your option) any later version.
+ *
+ *
+ *  THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ *  WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ *  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ *  OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ *  TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ *  USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this program; if not, write to the Free
+ *  Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * A generator sets a sensor's value over and over at a fixed rate,
+ * following a ramp, a sine wave, a random walk or a list of values
+ * from a file.  Each one runs off its own simulator timer, so it
+ * follows the simulated clock.  The number of updates that should
+ * have happened is worked out from the start time and the rate, and
+ * every timer run catches up to that, so the rate stays exact even
+ * when it is faster than the timers can run.  If the simulator falls
+ * too far behind, updates are skipped and counted instead of being
+ * done in one big burst.
+ */
+
+#include "bmc.h"
+#include "emu.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+
+#define GEN_RAMP	0
+#define GEN_SINE	1
+#define GEN_WALK	2
+#define GEN_FILE	3
+
+static const char *gen_names[] = { "ramp", "sine", "walk", "file" };
+
+/* Don't run a generator's timer more often than this (microseconds). */
+#define GEN_MIN_INTERVAL	1000
+
+/* Catch up at most this many seconds worth of updates at once. */
+#define GEN_MAX_CATCHUP		0.1
+
+typedef struct sensor_gen_s sensor_gen_t;
+struct sensor_gen_s
+{
+    emu_data_t    *emu;
+    sys_data_t    *sys;
+    unsigned char ipmb;
+    unsigned char lun;
+    unsigned char num;
+    int           gen_event;
+
+    unsigned int  type;
+    double        rate;
+    int           min, max, step;	/* ramp and walk */
+    double        mid, amplitude, period; /* sine */
+    int           value;		/* ramp and walk */
+    uint32_t      seed;			/* walk */
+    unsigned char *values;		/* file */
+    unsigned int  num_values;
+
+    ipmi_timer_t  *timer;
+    int           running;
+    uint64_t      start;		/* Simulated usecs */
+    uint64_t      stop;
+    uint64_t      stats_start;
+    uint64_t      sample;		/* Next sample number */
+    uint64_t      limit;		/* Stop after this many, 0 is forever */
+    uint64_t      updates;
+    uint64_t      skipped;
+
+    sensor_gen_t  *next;
+};
+
+static sensor_gen_t *generators;
+
+static uint64_t
+gen_now(sys_data_t *sys)
+{
+    struct timeval tv;
+
+    sys->get_monotonic_time(sys, &tv);
+    return ((uint64_t) tv.tv_sec) * 1000000 + tv.tv_usec;
+}
+
+static unsigned char
+gen_next_value(sensor_gen_t *gen)
+{
+    int v = 0;
+
+    switch (gen->type) {
+    case GEN_RAMP:
+	v = gen->value;
+	gen->value += gen->step;
+	if (gen->step > 0 && gen->value > gen->max)
+	    gen->value = gen->min;
+	else if (gen->step < 0 && gen->value < gen->min)
+	    gen->value = gen->max;
+	break;
+
+    case GEN_SINE:
+	v = lround(gen->mid + gen->amplitude
+		   * sin(2 * M_PI * gen->sample / (gen->rate * gen->period)));
+	break;
+
+    case GEN_WALK:
+	/* xorshift32, so a seed always gives the same walk. */
+	gen->seed ^= gen->seed << 13;
+	gen->seed ^= gen->seed >> 17;
+	gen->seed ^= gen->seed << 5;
+	gen->value += (int) (gen->seed % (2 * gen->step + 1)) - gen->step;
+	if (gen->value < gen->min)
+	    gen->value = gen->min;
+	else if (gen->value > gen->max)
+	    gen->value = gen->max;
+	v = gen->value;
+	break;
+
+    case GEN_FILE:
+	v = gen->values[gen->sample % gen->num_values];
+	break;
+    }
+
+    if (v < 0)
+	v = 0;
+    else if (v > 255)
+	v = 255;
+    return v;
+}
+
+static void
+gen_halt(sensor_gen_t *gen, sys_data_t *sys)
+{
+    if (!gen->running)
+	return;
+    sys->stop_timer(gen->timer);
+    gen->stop = gen_now(sys);
+    gen->running = 0;
+}
+
+static void
+gen_timeout(void *cb_data)
+{
+    sensor_gen_t   *gen = cb_data;
+    sys_data_t     *sys = gen->sys;
+    lmc_data_t     *mc;
+    uint64_t       now, due, max_batch, next;
+    struct timeval tv;
+
+    now = gen_now(sys);
+    due = (uint64_t) ((now - gen->start) * gen->rate / 1000000) + 1;
+    if (gen->limit && due > gen->limit)
+	due = gen->limit;
+
+    max_batch = gen->rate * GEN_MAX_CATCHUP + 1;
+    if (due - gen->sample > max_batch) {
+	gen->skipped += due - gen->sample - max_batch;
+	gen->sample = due - max_batch;
+    }
+
+    /* The MC or sensor may have gone away. */
+    if (ipmi_emu_get_mc_by_addr(gen->emu, gen->ipmb, &mc)) {
+	gen->running = 0;
+	gen->stop = now;
+	return;
+    }
+    while (gen->sample < due) {
+	if (ipmi_mc_sensor_set_value(mc, gen->lun, gen->num,
+				     gen_next_value(gen), gen->gen_event)) {
+	    gen->running = 0;
+	    gen->stop = now;
+	    return;
+	}
+	gen->sample++;
+	gen->updates++;
+    }
+
+    if (gen->limit && gen->sample >= gen->limit) {
+	gen->running = 0;
+	gen->stop = now;
+	return;
+    }
+
+    next = gen->start + (uint64_t) (gen->sample * 1000000 / gen->rate);
+    if (next < now + GEN_MIN_INTERVAL)
+	next = now + GEN_MIN_INTERVAL;
+    tv.tv_sec = (next - now) / 1000000;
+    tv.tv_usec = (next - now) % 1000000;
+    sys->start_timer(gen->timer, &tv);
+}
+
+static sensor_gen_t *
+gen_find(lmc_data_t *mc, unsigned char lun, unsigned char num)
+{
+    sensor_gen_t *gen;
+
+    for (gen = generators; gen; gen = gen->next) {
+	if (gen->ipmb == ipmi_mc_get_ipmb(mc) && gen->lun == lun
+	    && gen->num == num)
+	    return gen;
+    }
+    return NULL;
+}
+
+static void
+gen_free(sensor_gen_t *gen, sys_data_t *sys)
+{
+    sensor_gen_t **p;
+
+    for (p = &generators; *p; p = &(*p)->next) {
+	if (*p == gen) {
+	    *p = gen->next;
+	    break;
+	}
+    }
+    gen_halt(gen, sys);
+    if (gen->timer)
+	sys->free_timer(gen->timer);
+    if (gen->values)
+	free(gen->values);
+    free(gen);
+}
+
+static int
+gen_get_int(emu_out_t *out, char **toks, int *val, const char *name)
+{
+    const char *str;
+    char *end;
+
+    str = mystrtok(NULL, " \t\n", toks);
+    if (!str) {
+	out->printf(out, "**No %s given\n", name);
+	return EINVAL;
+    }
+    *val = strtol(str, &end, 0);
+    if (*end != '\0') {
+	out->printf(out, "**Invalid %s given\n", name);
+	return EINVAL;
+    }
+    return 0;
+}
+
+static int
+gen_get_double(emu_out_t *out, char **toks, double *val, const char *name)
+{
+    const char *str;
+    char *end;
+
+    str = mystrtok(NULL, " \t\n", toks);
+    if (!str) {
+	out->printf(out, "**No %s given\n", name);
+	return EINVAL;
+    }
+    *val = strtod(str, &end);
+    if (*end != '\0') {
+	out->printf(out, "**Invalid %s given\n", name);
+	return EINVAL;
+    }
+    return 0;
+}
+
+/*
+ * Read the values for a file generator.  Values are numbers between
+ * 0 and 255 separated by white space or commas, anything after a '#'
+ * on a line is ignored.
+ */
+static int
+gen_read_file(emu_out_t *out, sensor_gen_t *gen, const char *filename)
+{
+    FILE          *f;
+    char          buf[256], *s, *end, *c;
+    unsigned int  size = 0;
+    unsigned char *nv;
+    unsigned long v;
+    int           rv = 0;
+
+    f = fopen(filename, "r");
+    if (!f) {
+	out->printf(out, "**Unable to open %s\n", filename);
+	return errno;
+    }
+
+    while (fgets(buf, sizeof(buf), f)) {
+	c = strchr(buf, '#');
+	if (c)
+	    *c = '\0';
+	for (s = strtok(buf, " \t\n\r,"); s; s = strtok(NULL, " \t\n\r,")) {
+	    v = strtoul(s, &end, 0);
+	    if (*end != '\0' || v > 255) {
+		out->printf(out, "**Invalid value in %s: %s\n", filename, s);
+		rv = EINVAL;
+		goto out;
+	    }
+	    if (gen->num_values >= size) {
+		size = size ? size * 2 : 64;
+		nv = realloc(gen->values, size);
+		if (!nv) {
+		    out->printf(out, "**Out of memory\n");
+		    rv = ENOMEM;
+		    goto out;
+		}
+		gen->values = nv;
+	    }
+	    gen->values[gen->num_values++] = v;
+	}
+    }
+    if (gen->num_values == 0) {
+	out->printf(out, "**No values in %s\n", filename);
+	rv = EINVAL;
+    }
+ out:
+    fclose(f);
+    return rv;
+}
+
+/*
+ * sensor_gen <mc> <lun> <num> <rate> <type> <parms> [count <n>] [noevent]
+ *   ramp <start> <end> <step>
+ *   sine <mid> <amplitude> <period>
+ *   walk <start> <min> <max> <maxstep> [seed <n>]
+ *   file <filename>
+ */
+int
+sensor_gen_cmd(emu_out_t *out, emu_data_t *emu, lmc_data_t *mc, char **toks)
+{
+    sys_data_t    *sys = mc->sysinfo;
+    sensor_gen_t  *gen, *old;
+    const char    *tok;
+    char          *end;
+    int           lun, num, rv;
+    unsigned int  i;
+
+    gen = malloc(sizeof(*gen));
+    if (!gen) {
+	out->printf(out, "**Out of memory\n");
+	return ENOMEM;
+    }
+    memset(gen, 0, sizeof(*gen));
+    gen->emu = emu;
+    gen->sys = sys;
+    gen->ipmb = ipmi_mc_get_ipmb(mc);
+    gen->gen_event = 1;
+
+    rv = gen_get_int(out, toks, &lun, "LUN");
+    if (rv)
+	goto out_err;
+    rv = gen_get_int(out, toks, &num, "sensor num");
+    if (rv)
+	goto out_err;
+    if (lun < 0 || lun >= 4 || num < 0 || num >= 255
+	|| !mc->sensors[lun][num]) {
+	out->printf(out, "**Invalid sensor given\n");
+	rv = EINVAL;
+	goto out_err;
+    }
+    gen->lun = lun;
+    gen->num = num;
+
+    rv = gen_get_double(out, toks, &gen->rate, "rate");
+    if (rv)
+	goto out_err;
+    if (gen->rate <= 0) {
+	out->printf(out, "**Invalid rate given\n");
+	rv = EINVAL;
+	goto out_err;
+    }
+
+    tok = mystrtok(NULL, " \t\n", toks);
+    if (!tok) {
+	out->printf(out, "**No generator type given\n");
+	rv = EINVAL;
+	goto out_err;
+    }
+    for (i = 0; i < 4; i++) {
+	if (strcmp(tok, gen_names[i]) == 0)
+	    break;
+    }
+    gen->type = i;
+
+    switch (gen->type) {
+    case GEN_RAMP:
+	rv = gen_get_int(out, toks, &gen->value, "start");
+	if (!rv)
+	    rv = gen_get_int(out, toks, &gen->max, "end");
+	if (!rv)
+	    rv = gen_get_int(out, toks, &gen->step, "step");
+	if (rv)
+	    goto out_err;
+	gen->min = gen->value;
+	if (gen->min > gen->max) {
+	    gen->min = gen->max;
+	    gen->max = gen->value;
+	}
+	if (gen->step == 0) {
+	    out->printf(out, "**Invalid step given\n");
+	    rv = EINVAL;
+	    goto out_err;
+	}
+	break;
+
+    case GEN_SINE:
+	rv = gen_get_double(out, toks, &gen->mid, "mid");
+	if (!rv)
+	    rv = gen_get_double(out, toks, &gen->amplitude, "amplitude");
+	if (!rv)
+	    rv = gen_get_double(out, toks, &gen->period, "period");
+	if (rv)
+	    goto out_err;
+	if (gen->period <= 0) {
+	    out->printf(out, "**Invalid period given\n");
+	    rv = EINVAL;
+	    goto out_err;
+	}
+	break;
+
+    case GEN_WALK:
+	rv = gen_get_int(out, toks, &gen->value, "start");
+	if (!rv)
+	    rv = gen_get_int(out, toks, &gen->min, "min");
+	if (!rv)
+	    rv = gen_get_int(out, toks, &gen->max, "max");
+	if (!rv)
+	    rv = gen_get_int(out, toks, &gen->step, "maxstep");
+	if (rv)
+	    goto out_err;
+	if (gen->step < 0 || gen->min > gen->max) {
+	    out->printf(out, "**Invalid walk given\n");
+	    rv = EINVAL;
+	    goto out_err;
+	}
+	gen->seed = 1;
+	break;
+
+    case GEN_FILE:
+	tok = mystrtok(NULL, " \t\n", toks);
+	if (!tok) {
+	    out->printf(out, "**No filename given\n");
+	    rv = EINVAL;
+	    goto out_err;
+	}
+	rv = gen_read_file(out, gen, tok);
+	if (rv)
+	    goto out_err;
+	break;
+
+    default:
+	out->printf(out, "**Invalid generator type: %s\n", tok);
+	rv = EINVAL;
+	goto out_err;
+    }
+
+    while ((tok = mystrtok(NULL, " \t\n", toks))) {
+	if (strcmp(tok, "noevent") == 0) {
+	    gen->gen_event = 0;
+	} else if (strcmp(tok, "count") == 0) {
+	    tok = mystrtok(NULL, " \t\n", toks);
+	    if (tok)
+		gen->limit = strtoull(tok, &end, 0);
+	    if (!tok || *end != '\0' || gen->limit == 0) {
+		out->printf(out, "**Invalid count given\n");
+		rv = EINVAL;
+		goto out_err;
+	    }
+	} else if (strcmp(tok, "seed") == 0 && gen->type == GEN_WALK) {
+	    tok = mystrtok(NULL, " \t\n", toks);
+	    if (tok)
+		gen->seed = strtoul(tok, &end, 0);
+	    if (!tok || *end != '\0' || gen->seed == 0) {
+		out->printf(out, "**Invalid seed given\n");
+		rv = EINVAL;
+		goto out_err;
+	    }
+	} else {
+	    out->printf(out, "**Invalid option: %s\n", tok);
+	    rv = EINVAL;
+	    goto out_err;
+	}
+    }
+
+    rv = sys->alloc_timer(sys, gen_timeout, gen, &gen->timer);
+    if (rv) {
+	out->printf(out, "**Unable to allocate timer\n");
+	goto out_err;
+    }
+
+    /* A new generator on a sensor replaces the old one. */
+    old = gen_find(mc, gen->lun, gen->num);
+    if (old)
+	gen_free(old, sys);
+    gen->next = generators;
+    generators = gen;
+
+    gen->start = gen_now(sys);
+    gen->stats_start = gen->start;
+    gen->running = 1;
+    gen_timeout(gen);
+    return 0;
+
+ out_err:
+    if (gen->values)
+	free(gen->values);
+    free(gen);
+    return rv;
+}
+
+/*
+ * sensor_gen_stop <mc> [<lun> <num>]
+ */
+int
+sensor_gen_stop_cmd(emu_out_t *out, emu_data_t *emu, lmc_data_t *mc,
+		    char **toks)
+{
+    sys_data_t   *sys = mc->sysinfo;
+    sensor_gen_t *gen;
+    const char   *tok;
+    char         *end;
+    int          lun, num, rv;
+
+    tok = mystrtok(NULL, " \t\n", toks);
+    if (!tok) {
+	for (gen = generators; gen; gen = gen->next) {
+	    if (gen->ipmb == ipmi_mc_get_ipmb(mc))
+		gen_halt(gen, sys);
+	}
+	return 0;
+    }
+
+    lun = strtol(tok, &end, 0);
+    if (*end != '\0') {
+	out->printf(out, "**Invalid LUN given\n");
+	return EINVAL;
+    }
+    rv = gen_get_int(out, toks, &num, "sensor num");
+    if (rv)
+	return rv;
+    if (lun < 0 || lun >= 4 || num < 0 || num >= 255) {
+	out->printf(out, "**Invalid sensor given\n");
+	return EINVAL;
+    }
+    gen = gen_find(mc, lun, num);
+    if (!gen) {
+	out->printf(out, "**No generator on sensor %d %d\n", lun, num);
+	return ENOENT;
+    }
+    gen_halt(gen, sys);
+    return 0;
+}
+
+/*
+ * sensor_gen_stats <mc> [clear]
+ */
+int
+sensor_gen_stats_cmd(emu_out_t *out, emu_data_t *emu, lmc_data_t *mc,
+		     char **toks)
+{
+    sys_data_t   *sys = mc->sysinfo;
+    sensor_gen_t *gen, *next;
+    const char   *tok;
+    int          clear = 0;
+    uint64_t     now, elapsed;
+    double       secs;
+
+    tok = mystrtok(NULL, " \t\n", toks);
+    if (tok) {
+	if (strcmp(tok, "clear") != 0) {
+	    out->printf(out, "**Invalid option: %s\n", tok);
+	    return EINVAL;
+	}
+	clear = 1;
+    }
+
+    now = gen_now(sys);
+    for (gen = generators; gen; gen = next) {
+	next = gen->next;
+	if (gen->ipmb != ipmi_mc_get_ipmb(mc))
+	    continue;
+	elapsed = (gen->running ? now : gen->stop) - gen->stats_start;
+	secs = elapsed / 1000000.0;
+	out->printf(out, "sensor %d %d: %s %s, rate %g/s\n",
+		    gen->lun, gen->num, gen_names[gen->type],
+		    gen->running ? "running" : "stopped", gen->rate);
+	out->printf(out, "  updates %llu in %.3fs (%.1f/s), skipped %llu\n",
+		    (unsigned long long) gen->updates, secs,
+		    secs > 0 ? gen->updates / secs : 0.0,
+		    (unsigned long long) gen->skipped);
+
+	if (!clear)
+	    continue;
+	/* Throw away stopped generators, restart the counts on the rest. */
+	if (!gen->running) {
+	    gen_free(gen, sys);
+	} else {
+	    gen->stats_start = now;
+	    gen->updates = 0;
+	    gen->skipped = 0;
+	}
+    }
+    return 0;
+}
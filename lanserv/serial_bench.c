@@ -0,0 +1,263 @@
+/*
+ * serial_bench.c
+ *
+ * Measure the message rate of the serial IPMI codecs.
+ *
+ * Author: MontaVista Software, Inc.
+ *         Corey Minyard <minyard@mvista.com>
+ *         source@mvista.com
+ *
+ * Copyright 2012 MontaVista Software Inc.
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2 of
+ *  the License, or (at your option) any later version.
+ *
+ *
+ *  THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ *  WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ *  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ *  OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ *  TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ *  USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this program; if not, write to the Free
+ *  Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.  */
+
+/*
+ * This runs each serial codec in memory, with no file descriptors
+ * involved.  A stream of request frames is fed to the codec the same
+ * way the serial port code does, every request gets a response
+ * immediately and the encoded response is thrown away.  The block
+ * decoder and the old character at a time decoder are both measured
+ * so they can be compared.  This is run from the "serial_bench"
+ * command.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/time.h>
+#include <OpenIPMI/ipmi_msgbits.h>
+#include <OpenIPMI/serserv.h>
+#include "emu.h"
+
+#define BENCH_READ_SIZE		4096
+#define BENCH_STREAM_SIZE	65536
+
+static unsigned char frame[256];
+static unsigned int frame_len;
+static unsigned long msg_count;
+
+static void
+capture_send(serserv_data_t *si, struct iovec *data, unsigned int vecs)
+{
+    unsigned int i;
+
+    frame_len = 0;
+    for (i = 0; i < vecs; i++) {
+	if (data[i].iov_len > sizeof(frame) - frame_len)
+	    break;
+	memcpy(frame + frame_len, data[i].iov_base, data[i].iov_len);
+	frame_len += data[i].iov_len;
+    }
+}
+
+static void
+sink_send(serserv_data_t *si, struct iovec *data, unsigned int vecs)
+{
+}
+
+static int
+bench_smi_send(channel_t *chan, msg_t *msg)
+{
+    static unsigned char rsp[] = { 0x00, 0x40, 0xc0, 0x00 };
+
+    msg_count++;
+    ipmi_handle_smi_rsp(chan, msg, rsp, sizeof(rsp));
+    return 0;
+}
+
+static void *
+bench_alloc(channel_t *chan, int size)
+{
+    return malloc(size);
+}
+
+static void
+bench_free(channel_t *chan, void *data)
+{
+    free(data);
+}
+
+static void
+bench_log(channel_t *chan, int logtype, msg_t *msg, const char *format, ...)
+{
+}
+
+static int
+bench_oem_handle_rsp(channel_t *chan, msg_t *msg, rsp_msg_t *rsp)
+{
+    return 0;
+}
+
+static double
+now(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + (tv.tv_usec / 1000000.0);
+}
+
+/*
+ * Feed the stream to the codec for the given time and return the
+ * number of messages handled per second.
+ */
+static double
+run_codec(serserv_data_t *ser, unsigned char *stream, unsigned int len,
+	  double secs)
+{
+    double start, elapsed;
+    unsigned int pos, n;
+
+    msg_count = 0;
+    start = now();
+    do {
+	for (pos = 0; pos < len; pos += n) {
+	    n = len - pos;
+	    if (n > BENCH_READ_SIZE)
+		n = BENCH_READ_SIZE;
+	    serserv_handle_data(ser, stream + pos, n);
+	}
+	elapsed = now() - start;
+    } while (elapsed < secs);
+
+    return msg_count / elapsed;
+}
+
+static int
+bench_codec(emu_out_t *out, const char *name, double secs)
+{
+    sys_data_t     sys;
+    serserv_data_t ser;
+    ser_codec_t    codec, *c;
+    msg_t          msg;
+    unsigned char  data[16];
+    unsigned char  *stream;
+    unsigned int   len, nmsgs;
+    double         block_rate, char_rate;
+
+    c = ser_lookup_codec(name);
+    if (!c) {
+	out->printf(out, "**Unknown codec: %s\n", name);
+	return EINVAL;
+    }
+    codec = *c;
+
+    sysinfo_init(&sys);
+    sys.bmc_ipmb = 0x20;
+
+    memset(&ser, 0, sizeof(ser));
+    ser.sysinfo = &sys;
+    ser.codec = &codec;
+    ser.connected = 1;
+    ser.con_fd = -1;
+    ser.channel.chan_info = &ser;
+    ser.channel.channel_num = 15;
+    ser.channel.smi_send = bench_smi_send;
+    ser.channel.alloc = bench_alloc;
+    ser.channel.free = bench_free;
+    ser.channel.log = bench_log;
+    ser.channel.oem.oem_handle_rsp = bench_oem_handle_rsp;
+    serserv_init(&ser);
+
+    /* Have the codec encode an Add SEL Entry, use it as input. */
+    memset(data, 0x11, sizeof(data));
+    memset(&msg, 0, sizeof(msg));
+    msg.rs_addr = 0x20;
+    msg.rq_addr = 0x81;
+    msg.netfn = IPMI_STORAGE_NETFN;
+    msg.cmd = IPMI_ADD_SEL_ENTRY_CMD;
+    msg.data = data;
+    msg.len = sizeof(data);
+    ser.send_out = capture_send;
+    codec.send(&msg, &ser);
+    ser.send_out = sink_send;
+
+    nmsgs = BENCH_STREAM_SIZE / frame_len;
+    stream = malloc(nmsgs * frame_len);
+    if (!stream) {
+	out->printf(out, "**Out of memory\n");
+	return ENOMEM;
+    }
+    for (len = 0; len < nmsgs * frame_len; len += frame_len)
+	memcpy(stream + len, frame, frame_len);
+
+    /* Make sure the stream actually decodes. */
+    msg_count = 0;
+    serserv_handle_data(&ser, stream, len);
+    if (msg_count != nmsgs) {
+	out->printf(out, "**%s: decoded %lu of %u messages\n", name,
+		    msg_count, nmsgs);
+	free(stream);
+	return EINVAL;
+    }
+
+    block_rate = run_codec(&ser, stream, len, secs);
+    codec.handle_data = NULL;
+    char_rate = run_codec(&ser, stream, len, secs);
+
+    out->printf(out, "%-14s %3u bytes/msg  block %10.0f msgs/s"
+		"  char %10.0f msgs/s\n",
+		name, frame_len, block_rate, char_rate);
+    free(stream);
+    return 0;
+}
+
+static const char *all_codecs[] = {
+    "VM", "Direct", "TerminalMode", "RadisysAscii", NULL
+};
+
+/*
+ * serial_bench [<codec>|all [<seconds>]]
+ */
+int
+serial_bench_cmd(emu_out_t *out, emu_data_t *emu, lmc_data_t *mc, char **toks)
+{
+    const char   *name = NULL;
+    const char   *tok;
+    char         *endp;
+    double       secs = 1.0;
+    unsigned int i;
+    int          rv = 0;
+
+    tok = mystrtok(NULL, " \t\n", toks);
+    if (tok && (strcmp(tok, "all") != 0))
+	name = tok;
+    if (tok)
+	tok = mystrtok(NULL, " \t\n", toks);
+    if (tok) {
+	secs = strtod(tok, &endp);
+	if ((*endp != '\0') || (secs <= 0)) {
+	    out->printf(out, "**Invalid time: %s\n", tok);
+	    return EINVAL;
+	}
+    }
+
+    if (name)
+	return bench_codec(out, name, secs);
+
+    for (i = 0; all_codecs[i]; i++) {
+	rv = bench_codec(out, all_codecs[i], secs);
+	if (rv)
+	    break;
+    }
+    return rv;
+}
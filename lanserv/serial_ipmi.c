@@ -58,6 +58,7 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <errno.h>
+#include <stddef.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <OpenIPMI/ipmi_mc.h>
@@ -69,12 +70,86 @@
 #define SUPPORTED_GLOBAL_ENABLES	(EVENT_BUFFER_GLOBAL_ENABLE | \
 					 EVENT_LOG_GLOBAL_ENABLE)
 
+/*
+ * Send a frame made of several pieces, so data can go out from
+ * where it is instead of being copied into a frame buffer first.
+ */
+static void
+raw_sendv(serserv_data_t *si, struct iovec *vec, unsigned int vecs)
+{
+    if (si->sysinfo->debug & DEBUG_RAW_MSG) {
+	unsigned char c[(IPMI_SIM_MAX_MSG_LENGTH + 7) * 3];
+	unsigned int  i, len = 0;
+
+	for (i = 0; i < vecs; i++) {
+	    if (vec[i].iov_len > sizeof(c) - len)
+		break;
+	    memcpy(c + len, vec[i].iov_base, vec[i].iov_len);
+	    len += vec[i].iov_len;
+	}
+	debug_log_raw_msg(si->sysinfo, c, len, "Raw serial send:");
+    }
+    si->send_out(si, vec, vecs);
+}
+
 static void
 raw_send(serserv_data_t *si, unsigned char *data, unsigned int len)
 {
-    if (si->sysinfo->debug & DEBUG_RAW_MSG)
-	debug_log_raw_msg(si->sysinfo, data, len, "Raw serial send:");
-    si->send_out(si, data, len);
+    struct iovec vec;
+
+    vec.iov_base = data;
+    vec.iov_len = len;
+    raw_sendv(si, &vec, 1);
+}
+
+/*
+ * Find the first byte in the range 0xa0-0xaa, where all the framing
+ * and escape characters of the binary codecs live.  Bytes without the
+ * top bit set can't match, so skip those a word at a time.
+ */
+#define SER_HIGH_BITS	(~0UL / 0xff * 0x80)
+
+static unsigned char *
+ser_find_special(unsigned char *data, unsigned char *end)
+{
+    unsigned long w;
+
+    while (data < end) {
+	if (end - data >= (ptrdiff_t) sizeof(w)) {
+	    memcpy(&w, data, sizeof(w));
+	    if (!(w & SER_HIGH_BITS)) {
+		data += sizeof(w);
+		continue;
+	    }
+	}
+	if ((*data >= 0xa0) && (*data <= 0xaa))
+	    return data;
+	data++;
+    }
+    return end;
+}
+
+/*
+ * Add a run of characters to the receive buffer of the ASCII codecs,
+ * dropping multiple spaces together like the character handlers do.
+ */
+static void
+ser_ascii_add(unsigned char *r, unsigned int size, unsigned int *r_len,
+	      int *too_many, unsigned char *data, unsigned int len)
+{
+    unsigned int i, l = *r_len;
+
+    for (i = 0; i < len; i++) {
+	if (l >= size) {
+	    *too_many = 1;
+	    break;
+	} else if ((l > 0) && isspace(r[l-1]) && isspace(data[i])) {
+	    /* Ignore multiple spaces together. */
+	} else {
+	    r[l++] = data[i];
+	}
+    }
+    *r_len = l;
 }
 
 static unsigned char hex2char[16] = {
@@ -292,6 +367,28 @@ ra_handle_char(unsigned char ch, serserv_data_t *si)
     }
 }
 
+static void
+ra_handle_data(unsigned char *data, unsigned int len, serserv_data_t *si)
+{
+    struct ra_data *info = si->codec_info;
+    unsigned char  *end = data + len;
+    unsigned char  *p;
+
+    while (data < end) {
+	p = memchr(data, 0x0d, end - data);
+	if (!p)
+	    p = end;
+	if (!info->recv_chars_too_many)
+	    ser_ascii_add(info->recv_chars, sizeof(info->recv_chars),
+			  &info->recv_chars_len, &info->recv_chars_too_many,
+			  data, p - data);
+	if (p == end)
+	    break;
+	ra_handle_char(*p, si);
+	data = p + 1;
+    }
+}
+
 static void
 ra_send(msg_t *omsg, serserv_data_t *si)
 {
@@ -435,52 +532,101 @@ dm_handle_char(unsigned char ch, serserv_data_t *si)
 }
 
 static void
-dm_send(msg_t *imsg, serserv_data_t *si)
+dm_handle_data(unsigned char *data, unsigned int len, serserv_data_t *si)
 {
-    unsigned int i;
-    unsigned int len = 0;
-    unsigned char c[(IPMI_SIM_MAX_MSG_LENGTH + 7) * 2];
-    unsigned char msg[IPMI_SIM_MAX_MSG_LENGTH + 7];
-    unsigned int msg_len;
-
-    format_ipmb_rsp(imsg, msg, &msg_len, si);
-
-    c[len++] = 0xA0;
-    for (i = 0; i < msg_len; i++) {
-	switch (msg[i]) {
-	case 0xA0:
-	    c[len++] = 0xAA;
-	    c[len++] = 0xB0;
-	    break;
+    struct dm_data *info = si->codec_info;
+    unsigned char  *end = data + len;
+    unsigned char  *p;
+    unsigned int   n;
 
-	case 0xA5:
-	    c[len++] = 0xAA;
-	    c[len++] = 0xB5;
-	    break;
+    while (data < end) {
+	if (info->in_escape) {
+	    dm_handle_char(*data++, si);
+	    continue;
+	}
 
-	case 0xA6:
-	    c[len++] = 0xAA;
-	    c[len++] = 0xB6;
+	p = ser_find_special(data, end);
+	n = p - data;
+	if (n && info->in_recv_msg && !info->recv_msg_too_many) {
+	    if (n > sizeof(info->recv_msg) - info->recv_msg_len) {
+		info->recv_msg_too_many = 1;
+	    } else {
+		memcpy(info->recv_msg + info->recv_msg_len, data, n);
+		info->recv_msg_len += n;
+	    }
+	}
+	if (p == end)
 	    break;
+	dm_handle_char(*p, si);
+	data = p + 1;
+    }
+}
 
-	case 0xAA:
-	    c[len++] = 0xAA;
-	    c[len++] = 0xBA;
-	    break;
+static int
+dm_escape_char(unsigned char ch, unsigned char *c)
+{
+    switch (ch) {
+    case 0xA0: ch = 0xB0; break;
+    case 0xA5: ch = 0xB5; break;
+    case 0xA6: ch = 0xB6; break;
+    case 0xAA: ch = 0xBA; break;
+    case 0x1B: ch = 0x3B; break;
+    default:
+	c[0] = ch;
+	return 1;
+    }
+    c[0] = 0xAA;
+    c[1] = ch;
+    return 2;
+}
 
-	case 0x1B:
-	    c[len++] = 0xAA;
-	    c[len++] = 0x3B;
+static void
+dm_send(msg_t *imsg, serserv_data_t *si)
+{
+    unsigned int  i;
+    unsigned char msg[6];
+    unsigned char hdr[13];
+    unsigned char trl[3];
+    unsigned char edata[(IPMI_SIM_MAX_MSG_LENGTH + 7) * 2];
+    unsigned int  hdr_len = 0, trl_len = 0, edata_len = 0;
+    unsigned char csum;
+    struct iovec  vec[3];
+
+    /* The same layout as format_ipmb_rsp(), data is sent in place. */
+    msg[0] = imsg->rs_addr;
+    msg[1] = (imsg->netfn << 2) | imsg->rs_lun;
+    msg[2] = -ipmb_checksum(msg, 2, 0);
+    msg[3] = imsg->rq_addr;
+    msg[4] = (imsg->rq_seq << 2) | imsg->rq_lun;
+    msg[5] = imsg->cmd;
+    csum = ipmb_checksum(msg + 3, 3, 0);
+    csum = -ipmb_checksum(imsg->data, imsg->len, csum);
+
+    hdr[hdr_len++] = 0xA0;
+    for (i = 0; i < 6; i++)
+	hdr_len += dm_escape_char(msg[i], hdr + hdr_len);
+    trl_len += dm_escape_char(csum, trl);
+    trl[trl_len++] = 0xA5;
+
+    vec[0].iov_base = hdr;
+    vec[0].iov_len = hdr_len;
+    vec[1].iov_base = imsg->data;
+    vec[1].iov_len = imsg->len;
+    for (i = 0; i < imsg->len; i++) {
+	if ((imsg->data[i] >= 0xA0) || (imsg->data[i] == 0x1B))
 	    break;
-
-	default:
-	    c[len++] = msg[i];
-	}
-
     }
-    c[len++] = 0xA5;
+    if (i < imsg->len) {
+	/* Something needs escaping, build an escaped copy. */
+	for (i = 0; i < imsg->len; i++)
+	    edata_len += dm_escape_char(imsg->data[i], edata + edata_len);
+	vec[1].iov_base = edata;
+	vec[1].iov_len = edata_len;
+    }
+    vec[2].iov_base = trl;
+    vec[2].iov_len = trl_len;
 
-    raw_send(si, c, len);
+    raw_sendv(si, vec, 3);
 }
 
 static int
@@ -686,6 +832,39 @@ tm_handle_char(unsigned char ch, serserv_data_t *si)
     }
 }
 
+static void
+tm_handle_data(unsigned char *data, unsigned int len, serserv_data_t *si)
+{
+    struct tm_data *info = si->codec_info;
+    unsigned char  *end = data + len;
+    unsigned char  *p, *q;
+
+    while (data < end) {
+	if (info->recv_chars_len == 0) {
+	    /* Ignore everything outside [ ]. */
+	    p = memchr(data, '[', end - data);
+	    if (!p)
+		break;
+	} else {
+	    p = memchr(data, ']', end - data);
+	    if (!p)
+		p = end;
+	    q = memchr(data, '[', p - data);
+	    if (q)
+		p = q;
+	    if (!info->recv_chars_too_many)
+		ser_ascii_add(info->recv_chars, sizeof(info->recv_chars),
+			      &info->recv_chars_len,
+			      &info->recv_chars_too_many,
+			      data, p - data);
+	    if (p == end)
+		break;
+	}
+	tm_handle_char(*p, si);
+	data = p + 1;
+    }
+}
+
 static int
 tm_setup(serserv_data_t *si)
 {
@@ -873,6 +1052,37 @@ vm_handle_char(unsigned char ch, serserv_data_t *si)
     }
 }
 
+static void
+vm_handle_data(unsigned char *data, unsigned int len, serserv_data_t *si)
+{
+    struct vm_data *info = si->codec_info;
+    unsigned char  *end = data + len;
+    unsigned char  *p;
+    unsigned int   n;
+
+    while (data < end) {
+	if (info->in_escape) {
+	    vm_handle_char(*data++, si);
+	    continue;
+	}
+
+	p = ser_find_special(data, end);
+	n = p - data;
+	if (n && !info->recv_msg_too_many) {
+	    if (n > sizeof(info->recv_msg) - info->recv_msg_len) {
+		info->recv_msg_too_many = 1;
+	    } else {
+		memcpy(info->recv_msg + info->recv_msg_len, data, n);
+		info->recv_msg_len += n;
+	    }
+	}
+	if (p == end)
+	    break;
+	vm_handle_char(*p, si);
+	data = p + 1;
+    }
+}
+
 static void
 vm_add_char(unsigned char ch, unsigned char *c, unsigned int *pos)
 {
@@ -892,30 +1102,45 @@ vm_add_char(unsigned char ch, unsigned char *c, unsigned int *pos)
 static void
 vm_send(msg_t *imsg, serserv_data_t *si)
 {
-    unsigned int i;
-    unsigned int len = 0;
-    unsigned char c[(IPMI_SIM_MAX_MSG_LENGTH + 7) * 2];
+    unsigned int  i;
+    unsigned int  hdr_len = 0, trl_len = 0, edata_len = 0;
+    unsigned char hdr[6];
+    unsigned char trl[3];
+    unsigned char edata[(IPMI_SIM_MAX_MSG_LENGTH + 7) * 2];
     unsigned char csum;
     unsigned char ch;
+    unsigned char *end = imsg->data + imsg->len;
+    struct iovec  vec[3];
 
     ch = imsg->rq_seq;
-    vm_add_char(ch, c, &len);
+    vm_add_char(ch, hdr, &hdr_len);
     csum = ipmb_checksum(&ch, 1, 0);
 
     ch = (imsg->netfn << 2) | imsg->rs_lun;
-    vm_add_char(ch, c, &len);
+    vm_add_char(ch, hdr, &hdr_len);
     csum = ipmb_checksum(&ch, 1, csum);
 
-    vm_add_char(imsg->cmd, c, &len);
+    vm_add_char(imsg->cmd, hdr, &hdr_len);
     csum = ipmb_checksum(&imsg->cmd, 1, csum);
 
-    for (i = 0; i < imsg->len; i++)
-	vm_add_char(imsg->data[i], c, &len);
-
-    vm_add_char(-ipmb_checksum(imsg->data, imsg->len, csum), c, &len);
-    c[len++] = VM_MSG_CHAR;
+    vm_add_char(-ipmb_checksum(imsg->data, imsg->len, csum), trl, &trl_len);
+    trl[trl_len++] = VM_MSG_CHAR;
+
+    vec[0].iov_base = hdr;
+    vec[0].iov_len = hdr_len;
+    vec[1].iov_base = imsg->data;
+    vec[1].iov_len = imsg->len;
+    if (ser_find_special(imsg->data, end) != end) {
+	/* Something needs escaping, build an escaped copy. */
+	for (i = 0; i < imsg->len; i++)
+	    vm_add_char(imsg->data[i], edata, &edata_len);
+	vec[1].iov_base = edata;
+	vec[1].iov_len = edata_len;
+    }
+    vec[2].iov_base = trl;
+    vec[2].iov_len = trl_len;
 
-    raw_send(si, c, len);
+    raw_sendv(si, vec, 3);
 }
 
 static void
@@ -1035,17 +1260,18 @@ vm_setup(serserv_data_t *si)
  ***********************************************************************/
 static ser_codec_t codecs[] = {
     { "TerminalMode",
-      tm_handle_char, tm_send, tm_setup },
+      tm_handle_char, tm_send, tm_setup, NULL, NULL, tm_handle_data },
     { "Direct",
-      dm_handle_char, dm_send, dm_setup },
+      dm_handle_char, dm_send, dm_setup, NULL, NULL, dm_handle_data },
     { "RadisysAscii",
-      ra_handle_char, ra_send, ra_setup },
+      ra_handle_char, ra_send, ra_setup, NULL, NULL, ra_handle_data },
     { "VM",
-      vm_handle_char, vm_send, vm_setup, vm_connected, vm_disconnected },
+      vm_handle_char, vm_send, vm_setup, vm_connected, vm_disconnected,
+      vm_handle_data },
     { NULL }
 };
 
-static ser_codec_t *
+ser_codec_t *
 ser_lookup_codec(const char *name)
 {
     unsigned int i;
@@ -1183,6 +1409,11 @@ serserv_handle_data(serserv_data_t *ser, uint8_t *data, unsigned int len)
 {
     unsigned int i;
 
+    if (ser->codec->handle_data) {
+	ser->codec->handle_data(data, len, ser);
+	return;
+    }
+
     for (i = 0; i < len; i++)
 	ser->codec->handle_char(data[i], ser);
 }
@@ -59,6 +59,7 @@
 #include <stdlib.h>
 #include <errno.h>
 #include <stdarg.h>
+#include <time.h>
 
 #include <OpenIPMI/ipmi_mc.h>
 #include <OpenIPMI/ipmi_msgbits.h>
@@ -306,3 +307,33 @@ ipmb_checksum(uint8_t *data, int size, uint8_t start)
 
 	return csum;
 }
+
+uint64_t
+stat_time_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t) ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+void
+stat_hist_add(stat_hist_t *hist, uint64_t ns)
+{
+    uint64_t us = ns / 1000;
+    unsigned int i = 0;
+
+    while (i < STAT_HIST_BUCKETS - 1 && us >= (1ULL << i))
+	i++;
+    hist->buckets[i]++;
+    hist->count++;
+    hist->sum_ns += ns;
+}
+
+uint64_t
+stat_hist_bucket_us(unsigned int i)
+{
+    if (i >= STAT_HIST_BUCKETS - 1)
+	return 0;
+    return 1ULL << i;
+}
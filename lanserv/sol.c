@@ -41,6 +41,8 @@
 #include <sys/ioctl.h>
 #include <termios.h>
 #include <unistd.h>
+#include <stdint.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
@@ -55,9 +57,15 @@
 /* FIXME - move to configure handling */
 #define USE_UUCP_LOCKING
 
-#define SOL_INBUF_SIZE 32
+#define SOL_INBUF_SIZE 255
 #define SOL_OUTBUF_SIZE 16384
 
+/* The accepted character count is a byte, so this is all a packet holds. */
+#define SOL_MAX_PAYLOAD 255
+
+/* Most to read from the port in one go before sending. */
+#define SOL_READ_BUDGET 4096
+
 #define SOL_TELNET_IAC		255
 #define SOL_TELNET_DONT		254
 #define SOL_TELNET_DO		253
@@ -70,6 +78,40 @@
 #define SOL_TELNETCODE_BINARY	0
 #define SOL_TELNETCODE_ECHO	1
 
+/*
+ * The history is kept in the ring, with a header that says where the
+ * data is and indexes it.  The ring is split into segments and the
+ * header holds the number of newlines in each, so finding where the
+ * last N lines start only needs to scan the segments at the ends.
+ * With a history file the header and the ring are mapped from the
+ * file, so the history survives the simulator dying and a large
+ * history does not need to be kept in anonymous memory.
+ */
+#define SOL_HIST_MAGIC		"IPMISOLH"
+#define SOL_HIST_VERSION	1
+#define SOL_HIST_BYTE_ORDER	0x01020304
+#define SOL_HIST_HDR_SIZE	4096
+#define SOL_HIST_MAX_SEGS	256
+#define SOL_HIST_MIN_SEG_SIZE	4096
+
+struct sol_hist_seg {
+    uint32_t base;	/* Ring position the segment currently starts at */
+    uint32_t lines;	/* Newlines written to it since then */
+};
+
+struct sol_hist_hdr {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t ring_size;
+    uint32_t seg_size;
+    uint32_t num_segs;
+    uint32_t ring_head;
+    uint32_t hist_start;
+    uint32_t reserved;
+    struct sol_hist_seg seg[SOL_HIST_MAX_SEGS];
+};
+
 enum sol_telnet_state {
     SOL_TELNETST_NORMAL = 0,
     SOL_TELNETST_IAC,
@@ -89,22 +131,42 @@ struct soldata_s {
     channel_t *logchan; /* Channel for logging errors. */
     msg_t dummy_send_msg;
 
-    /* Data from the remote to the serial port */
+    /* Data from the remote to the serial port, starting at inpos */
     unsigned char inbuf[SOL_INBUF_SIZE];
+    unsigned int inpos;
     unsigned int inlen;
 
-    /* Data from the serial port to the remote */
-    unsigned char outbuf[SOL_OUTBUF_SIZE];
-    unsigned int outlen;
+    /*
+     * Data from the serial port is read straight into one ring that
+     * holds both the data not yet acked by the remote and the
+     * history, so it is only copied again to build a packet.  The
+     * positions are free-running byte counts, ring_size is a power
+     * of two so they can wrap.  ring_head is where the next byte
+     * goes, out_start is the first byte not acked by the remote, and
+     * hist_start is the oldest byte that may be returned as history.
+     */
+    unsigned char *ring;
+    unsigned int ring_size;
+    unsigned int ring_head;
+    unsigned int out_start;
+    unsigned int hist_start;
+
+    /*
+     * The packet waiting for an ack, kept for resends, and the ring
+     * position of its first byte.
+     */
+    unsigned char pkt[SOL_MAX_PAYLOAD + 4];
+    unsigned int pkt_len;
+    unsigned int pkt_start;
 
     /*
-     * A circular history buffer.  Note that history_end points to the
-     * last byte (not one past the last byte) and history_start points
-     * to the first byte.
+     * History header, mapped from the history file along with the
+     * ring if there is one.  ring_head and hist_start are copied to
+     * it as they change.
      */
-    unsigned char *history;
-    int history_start;
-    int history_end;
+    struct sol_hist_hdr *hist;
+    void *hist_map;
+    size_t hist_map_size;
 
     /*
      * Used to register history file handler on a shutdown.
@@ -118,9 +180,16 @@ struct soldata_s {
      */
     unsigned int history_return_size;
 
-    /* A copy of the history, used for reliable streaming. */
-    unsigned char *history_copy;
-    unsigned int history_copy_size;
+    /* If non-zero, return at most this many lines of history. */
+    unsigned int history_return_lines;
+
+    /*
+     * The history being played back is play_len bytes in the ring
+     * starting at play_start, followed by end_history_msg.
+     * history_pos is the offset of the next packet in that.
+     */
+    unsigned int history_play_start;
+    unsigned int history_play_len;
     unsigned int history_pos;
     msg_t history_dummy_send_msg;
     channel_t *history_channel;
@@ -154,6 +223,152 @@ struct soldata_s {
     int (*initialize)(ipmi_sol_t *sol);
 };
 
+static unsigned int
+sol_out_pending(soldata_t *sd)
+{
+    return sd->ring_head - sd->out_start;
+}
+
+static unsigned int
+sol_hist_len(ipmi_sol_t *sol)
+{
+    soldata_t *sd = sol->soldata;
+    unsigned int len = sd->ring_head - sd->hist_start;
+
+    if (len > sol->history_size)
+	len = sol->history_size;
+    return len;
+}
+
+/* Copy len bytes starting at ring position pos out of the ring. */
+static void
+sol_ring_copy(soldata_t *sd, unsigned char *dest, unsigned int pos,
+	      unsigned int len)
+{
+    unsigned int off = pos & (sd->ring_size - 1);
+    unsigned int to_copy = sd->ring_size - off;
+
+    if (to_copy > len)
+	to_copy = len;
+    memcpy(dest, sd->ring + off, to_copy);
+    memcpy(dest + to_copy, sd->ring, len - to_copy);
+}
+
+/* Count the newlines in len bytes just added at ring position pos. */
+static void
+sol_hist_index(soldata_t *sd, unsigned int pos, unsigned int len)
+{
+    struct sol_hist_hdr *h = sd->hist;
+    struct sol_hist_seg *seg;
+    unsigned char *p, *end;
+    unsigned int base, n;
+
+    while (len) {
+	base = pos & ~(h->seg_size - 1);
+	seg = &h->seg[(pos & (sd->ring_size - 1)) / h->seg_size];
+	if (seg->base != base) {
+	    /* Starting a new lap of the ring in this segment. */
+	    seg->base = base;
+	    seg->lines = 0;
+	}
+	n = base + h->seg_size - pos;
+	if (n > len)
+	    n = len;
+	p = sd->ring + (pos & (sd->ring_size - 1));
+	end = p + n;
+	while ((p = memchr(p, '\n', end - p))) {
+	    seg->lines++;
+	    p++;
+	}
+	pos += n;
+	len -= n;
+    }
+}
+
+/*
+ * Return the ring position where the last "lines" lines of history
+ * start.  Segments that lie entirely in the history are skipped using
+ * their newline count, only the ones at the ends are scanned.
+ */
+static unsigned int
+sol_hist_find_lines(ipmi_sol_t *sol, unsigned int lines)
+{
+    soldata_t *sd = sol->soldata;
+    struct sol_hist_hdr *h = sd->hist;
+    unsigned int mask = sd->ring_size - 1;
+    unsigned int lo = sd->ring_head - sol_hist_len(sol);
+    unsigned int end = sd->ring_head;
+    unsigned int base, start;
+    struct sol_hist_seg *seg;
+
+    /* A newline at the very end finishes the last line. */
+    if (end != lo && sd->ring[(end - 1) & mask] == '\n')
+	end--;
+
+    while (end != lo) {
+	base = (end - 1) & ~(h->seg_size - 1);
+	seg = &h->seg[((end - 1) & mask) / h->seg_size];
+	start = base;
+	if (end - base > end - lo)
+	    start = lo;
+
+	if (start == base && end - base == h->seg_size
+		&& seg->base == base && seg->lines < lines) {
+	    lines -= seg->lines;
+	    end = start;
+	    continue;
+	}
+
+	while (end != start) {
+	    end--;
+	    if (sd->ring[end & mask] == '\n' && --lines == 0)
+		return end + 1;
+	}
+    }
+
+    return lo;
+}
+
+/*
+ * Work out the part of the history to return, honoring the return
+ * size and line limits.  Returns the length, *rstart is set to the
+ * ring position it starts at.
+ */
+static unsigned int
+sol_hist_range(ipmi_sol_t *sol, unsigned int *rstart)
+{
+    soldata_t *sd = sol->soldata;
+    unsigned int size, start;
+
+    size = sol_hist_len(sol);
+    if (sd->history_return_size && (size > sd->history_return_size))
+	size = sd->history_return_size;
+    if (sd->history_return_lines) {
+	start = sol_hist_find_lines(sol, sd->history_return_lines);
+	if (size > sd->ring_head - start)
+	    size = sd->ring_head - start;
+    }
+    *rstart = sd->ring_head - size;
+
+    if (sol->readclear && sd->hist) {
+	sd->hist_start = sd->ring_head;
+	sd->hist->hist_start = sd->hist_start;
+    }
+
+    return size;
+}
+
+/* Compact the input buffer and return how much can be added to it. */
+static unsigned int
+sol_inbuf_room(soldata_t *sd)
+{
+    if (sd->inpos) {
+	memmove(sd->inbuf, sd->inbuf + sd->inpos, sd->inlen);
+	sd->inpos = 0;
+    }
+    return sizeof(sd->inbuf) - sd->inlen;
+}
+
 #ifdef USE_UUCP_LOCKING
 static char *uucp_lck_dir = "/var/lock";
 static char *progname = "ipmisim";
@@ -505,9 +720,8 @@ static void
 sol_tcp_send_break(ipmi_sol_t *sol)
 {
     soldata_t *sd = sol->soldata;
-    int left = sizeof(sd->inbuf) - sd->inlen;
 
-     if (left < 2)
+    if (sol_inbuf_room(sd) < 2)
 	return;
 
     sd->inbuf[sd->inlen++] = SOL_TELNET_IAC;
@@ -625,7 +839,7 @@ sol_tcp_setup(ipmi_sol_t *sol)
 
 static char *end_history_msg = "\r\n<End Of History>\r\n";
 
-#define MAX_HISTORY_SEND 64
+#define MAX_HISTORY_SEND SOL_MAX_PAYLOAD
 #define MAX_SOL_RESENDS 4
 static void sol_timeout(void *cb_data);
 static void sol_history_timeout(void *cb_data);
@@ -684,6 +898,53 @@ static void sol_get_history_return_size(lmc_data_t    *mc,
     *rdata_len = 2;
 }
 
+static void sol_set_history_return_lines(lmc_data_t    *mc,
+					 msg_t         *msg,
+					 unsigned char *rdata,
+					 unsigned int  *rdata_len,
+					 void          *cb_data)
+{
+    ipmi_sol_t *sol = ipmi_mc_get_sol(mc);
+    soldata_t *sd = sol->soldata;
+
+    if (msg->len < 2) {
+	rdata[0] = IPMI_REQUEST_DATA_LENGTH_INVALID_CC;
+	*rdata_len = 1;
+	return;
+    }
+
+    if (!sd || !sol->history_size) {
+	rdata[0] = IPMI_NOT_PRESENT_CC;
+	*rdata_len = 1;
+	return;
+    }
+
+    sd->history_return_lines = ipmi_get_uint16(msg->data);
+
+    rdata[0] = 0;
+    *rdata_len = 1;
+}
+
+static void sol_get_history_return_lines(lmc_data_t    *mc,
+					 msg_t         *msg,
+					 unsigned char *rdata,
+					 unsigned int  *rdata_len,
+					 void          *cb_data)
+{
+    ipmi_sol_t *sol = ipmi_mc_get_sol(mc);
+    soldata_t *sd = sol->soldata;
+
+    if (!sd || !sol->history_size) {
+	rdata[0] = IPMI_NOT_PRESENT_CC;
+	*rdata_len = 1;
+	return;
+    }
+
+    rdata[0] = 0;
+    ipmi_set_uint16(rdata + 1, sd->history_return_lines);
+    *rdata_len = 3;
+}
+
 static void
 sol_session_closed(lmc_data_t *mc, uint32_t session_id, void *cb_data)
 {
@@ -705,10 +966,7 @@ sol_session_closed(lmc_data_t *mc, uint32_t session_id, void *cb_data)
 			   sol->soldata->history_dummy_send_msg.src_addr);
 	    sol->soldata->history_dummy_send_msg.src_addr = NULL;
 	}
-	if (sol->soldata->history_copy) {
-	    sd->sys->free(sd->sys, sol->soldata->history_copy);
-	    sol->soldata->history_copy = NULL;
-	}
+	sd->sys->stop_timer(sd->history_timer);
 	sol->history_active = 0;
 	sol->history_session_id = 0;
     }
@@ -718,50 +976,18 @@ static unsigned char *
 copy_history_buffer(ipmi_sol_t *sol, unsigned int *rsize)
 {
     soldata_t *sd = sol->soldata;
-    unsigned int to_copy;
     unsigned int endmsg_size = strlen(end_history_msg);
-    unsigned char *dest = sd->sys->alloc(sd->sys,
-					 sol->history_size + endmsg_size);
-    unsigned int size;
-    int start;
+    unsigned char *dest;
+    unsigned int size, start;
 
+    size = sol_hist_range(sol, &start);
+    dest = sd->sys->alloc(sd->sys, size + endmsg_size);
     if (!dest)
 	return NULL;
 
-    if (sd->history_start > sd->history_end)
-	/* Buffer is filled. */
-	size = sol->history_size;
-    else if (sd->history_start == sd->history_end)
-	size = 0; /* Nothing written yet. */
-    else
-	/* Buffer is not yet filled, just runs from start to end */
-	size = sd->history_end - sd->history_start + 1;
-
-    start = sd->history_start;
-    if (sd->history_return_size && (size > sd->history_return_size)) {
-	start += size - sd->history_return_size;
-	if (start >= (int) sol->history_size)
-	    start -= sol->history_size;
-	size = sd->history_return_size;
-    }
-
-    if (start > sd->history_end) {
-	/* Buffer spans end, copy in two chunks. */
-	to_copy = sol->history_size - start;
-	memcpy(dest + to_copy, sd->history, sd->history_end + 1);
-    } else {
-	/* Buffer is not yet filled, just runs from start to end */
-	to_copy = sd->history_end - start + 1;
-    }
-    memcpy(dest, sd->history + start, to_copy);
+    sol_ring_copy(sd, dest, start, size);
     memcpy(dest + size, end_history_msg, endmsg_size);
-    size += endmsg_size;
-    *rsize = size;
-
-    if (sol->readclear) {
-	sd->history_start = 0;
-	sd->history_end = -1;
-    }
+    *rsize = size + endmsg_size;
 
     return dest;
 }
@@ -870,18 +1096,16 @@ ipmi_sol_activate(lmc_data_t    *mc,
 	sol->active = 1;
 	sol->session_id = msg->sid;
 	sd->channel = channel;
-	sd->outlen = 0;
+	sd->out_start = sd->ring_head;
+	sd->pkt_start = sd->ring_head;
+	sd->pkt_len = 0;
 	ipmi_set_uint16(rdata + 5, sizeof(sd->inbuf));
-	ipmi_set_uint16(rdata + 7, sizeof(sd->outbuf));
+	ipmi_set_uint16(rdata + 7, SOL_MAX_PAYLOAD);
     } else if (instance == 2 && sol->history_size) {
 	struct timeval tv;
 
-	sd->history_copy = copy_history_buffer(sol, &sd->history_copy_size);
-	if (!sd->history_copy) {
-	    rdata[0] = IPMI_OUT_OF_SPACE_CC;
-	    *rdata_len = 1;
-	    return;
-	}
+	/* Played straight out of the ring, nothing is copied. */
+	sd->history_play_len = sol_hist_range(sol, &sd->history_play_start);
 	sd->history_pos = 0;
 	sol->history_active = 1;
 	sol->history_session_id = msg->sid;
@@ -951,14 +1175,16 @@ sol_update_bitrate(lmc_data_t *mc)
 }
 
 static void
-set_read_enable(soldata_t *sd)
+set_read_enable(ipmi_sol_t *sol)
 {
+    soldata_t *sd = sol->soldata;
     int val;
 
-    if (sd->history)
+    /* With history the port is always read, old data just gets dropped. */
+    if (sol->history_size || !sd->fd_id)
 	return;
 
-    if (sizeof(sd->outbuf) == sd->outlen)
+    if (sol_out_pending(sd) >= SOL_OUTBUF_SIZE)
        /* Read is always disabled if we have nothing to read into. */
        val = 0;
     else
@@ -975,7 +1201,7 @@ set_write_enable(soldata_t *sd)
 {
     int val = sd->inlen > 0;
 
-    if (sd->write_enabled == val)
+    if (!sd->fd_id || sd->write_enabled == val)
 	return;
 
     sd->write_enabled = val;
@@ -983,12 +1209,37 @@ set_write_enable(soldata_t *sd)
 }
 
 static void
-send_data(ipmi_sol_t *sol, int need_send_ack)
+send_pkt(ipmi_sol_t *sol)
 {
     soldata_t *sd = sol->soldata;
     rsp_msg_t msg;
-    unsigned char data[SOL_OUTBUF_SIZE + 4];
-    unsigned int size = sd->outlen;
+
+    msg.data = sd->pkt;
+    msg.data_len = sd->pkt_len;
+    sd->channel->return_rsp(sd->channel, &sd->dummy_send_msg, &msg);
+}
+
+/*
+ * Pack as much of the pending data as will fit into a new packet.
+ * It is kept in pkt until it is acked.
+ */
+static void
+send_data(ipmi_sol_t *sol, int need_send_ack)
+{
+    soldata_t *sd = sol->soldata;
+    unsigned char *data = sd->pkt;
+    unsigned int size;
+
+    /*
+     * With history the port is always read, so more may have come in
+     * than the remote can be sent; drop the oldest.
+     */
+    if (sol_out_pending(sd) > SOL_OUTBUF_SIZE)
+	sd->out_start = sd->ring_head - SOL_OUTBUF_SIZE;
+
+    size = sol_out_pending(sd);
+    if (size > SOL_MAX_PAYLOAD)
+	size = SOL_MAX_PAYLOAD;
 
     data[0] = sd->curr_packet_seq;
     if (need_send_ack) {
@@ -999,14 +1250,24 @@ send_data(ipmi_sol_t *sol, int need_send_ack)
 	data[2] = 0;
     }
     data[3] = (sd->inlen == sizeof(sd->inbuf)) << 6;
-    if (size > 255)
-	size = 255;
-    memcpy(data + 4, sd->outbuf, size);
-    msg.data = data;
-    msg.data_len = size + 4;
+    sol_ring_copy(sd, data + 4, sd->out_start, size);
+    sd->pkt_start = sd->out_start;
+    sd->pkt_len = size + 4;
     sd->waiting_ack = 1;
 
-    sd->channel->return_rsp(sd->channel, &sd->dummy_send_msg, &msg);
+    send_pkt(sol);
+}
+
+static void
+resend_data(ipmi_sol_t *sol)
+{
+    soldata_t *sd = sol->soldata;
+
+    /* Any ack has already gone out with the first send. */
+    sd->pkt[1] = 0;
+    sd->pkt[2] = 0;
+    sd->pkt[3] = (sd->inlen == sizeof(sd->inbuf)) << 6;
+    send_pkt(sol);
 }
 
 static void
@@ -1014,7 +1275,7 @@ send_ack(ipmi_sol_t *sol)
 {
     soldata_t *sd = sol->soldata;
     rsp_msg_t msg;
-    unsigned char data[SOL_OUTBUF_SIZE + 4];
+    unsigned char data[4];
 
     data[0] = 0;
     data[1] = sd->last_acked_packet;
@@ -1061,6 +1322,7 @@ sol_port_init(ipmi_sol_t *sol)
 	int len = sizeof(sol_telnet_initseq);
 
 	memcpy(sd->inbuf, sol_telnet_initseq, len);
+	sd->inpos = 0;
 	sd->inlen = len;
     }
 
@@ -1085,29 +1347,64 @@ sol_timeout(void *cb_data)
     soldata_t *sd = sol->soldata;
     struct timeval tv;
 
-    if (sd->fd == -1) {
-	sol_port_init(sol);
-    } else if (sol->active) {
+    if (sd->fd == -1 && sol_port_init(sol)) {
+	/* Attempt to reconnect every 10 seconds. */
+	tv.tv_sec = 10;
+    } else {
+	if (!sol->active || !sd->waiting_ack)
+	    return;
+
 	if (sd->num_sends > MAX_SOL_RESENDS) {
 	    sd->waiting_ack = 0;
 	    next_seq(sd);
-	    sd->outlen = 0;
+	    sd->out_start = sd->ring_head;
 	    return;
 	}
 
 	sd->num_sends++;
-	send_data(sol, 0);
-    }
-
-    if (sd->fd == -1)
-	/* Attempt to reconnect every 10 seconds. */
-	tv.tv_sec = 10;
-    else
+	resend_data(sol);
 	tv.tv_sec = 1;
+    }
     tv.tv_usec = 0;
     sd->sys->start_timer(sd->timer, &tv);
 }
 
+/*
+ * Copy data from the remote into dest, doubling any telnet IACs.  The
+ * IACs are found with memchr so the data between them is copied in
+ * one go.  Returns how much of the data was taken, *added is set to
+ * the number of bytes put in dest.
+ */
+static unsigned int
+sol_telnet_escape(unsigned char *dest, unsigned int room,
+		  const unsigned char *data, unsigned int len,
+		  unsigned int *added)
+{
+    unsigned int in = 0, out = 0;
+
+    while (in < len) {
+	const unsigned char *iac;
+	unsigned int run;
+
+	iac = memchr(data + in, SOL_TELNET_IAC, len - in);
+	run = (iac ? iac - data : len) - in;
+	if (run > room - out)
+	    run = room - out;
+	memcpy(dest + out, data + in, run);
+	in += run;
+	out += run;
+
+	if (in == len || data[in] != SOL_TELNET_IAC || room - out < 2)
+	    break;
+	dest[out++] = SOL_TELNET_IAC;
+	dest[out++] = SOL_TELNET_IAC;
+	in++;
+    }
+
+    *added = out;
+    return in;
+}
+
 static void
 handle_sol_port_payload(lanserv_data_t *lan, ipmi_sol_t *sol, msg_t *msg)
 {
@@ -1147,24 +1444,18 @@ handle_sol_port_payload(lanserv_data_t *lan, ipmi_sol_t *sol, msg_t *msg)
 		sd->last_acked_packet_len = len;
 	    }
 	} else if (len) {
+	    unsigned int room = sol_inbuf_room(sd);
+
 	    sd->last_acked_packet = seq;
 	    if (sol->do_telnet) {
-		unsigned int i;
-
-		for (i = 0; i < len; i++) {
-		    int left = sizeof(sd->inbuf) - sd->inlen;
-		    if (left < 1)
-			break;
-		    if (data[i] == SOL_TELNET_IAC) {
-			if (left < 2)
-			    break;
-			sd->inbuf[sd->inlen++] = SOL_TELNET_IAC;
-		    }
-		    sd->inbuf[sd->inlen++] = data[i];
-		}
+		unsigned int added;
+
+		len = sol_telnet_escape(sd->inbuf + sd->inlen, room,
+					data, len, &added);
+		sd->inlen += added;
 	    } else {
-		if (len > (sizeof(sd->inbuf) - sd->inlen))
-		    len = sizeof(sd->inbuf) - sd->inlen;
+		if (len > room)
+		    len = room;
 		memcpy(sd->inbuf + sd->inlen, data, len);
 		sd->inlen += len;
 	    }
@@ -1175,31 +1466,35 @@ handle_sol_port_payload(lanserv_data_t *lan, ipmi_sol_t *sol, msg_t *msg)
 	}
     }
 
-    if (ack == sd->curr_packet_seq) {
+    if (sd->waiting_ack && ack == sd->curr_packet_seq) {
 	next_seq(sd);
 	sd->sys->stop_timer(sd->timer);
 	if (isnack) {
 	    sd->in_nack = 1;
-	    set_read_enable(sd);
+	    set_read_enable(sol);
 	} else {
 	    sd->in_nack = 0;
-	    if (count < sd->outlen) {
-		unsigned int i;
-		len = sd->outlen - count;
-		for (i = 0; i < len; i++)
-		    sd->outbuf[i] = sd->outbuf[i + count];
-		sd->outlen = len;
-		
+	    if (count + 4 > sd->pkt_len)
+		count = sd->pkt_len - 4;
+	    /*
+	     * The ack is for the bytes of the packet.  If out_start was
+	     * moved past them when overflow data was dropped, leave it,
+	     * adding to it would skip data that was never sent.
+	     */
+	    if ((int) (sd->pkt_start + count - sd->out_start) > 0)
+		sd->out_start = sd->pkt_start + count;
+	    if (sol_out_pending(sd)) {
+		/* Send everything that came in while waiting. */
 		send_data(sol, need_send_ack);
 		need_send_ack = 0;
+		sd->num_sends = 0;
 		tv.tv_sec = 1;
 		tv.tv_usec = 0;
 		sd->sys->start_timer(sd->timer, &tv);
 	    } else {
 		sd->waiting_ack = 0;
-		sd->outlen = 0;
 	    }
-	    set_read_enable(sd);
+	    set_read_enable(sol);
 	}
     }
 
@@ -1209,11 +1504,13 @@ handle_sol_port_payload(lanserv_data_t *lan, ipmi_sol_t *sol, msg_t *msg)
     if (flush_out) {
 	sd->waiting_ack = 0;
 	next_seq(sd);
-	sd->outlen = 0;
+	sd->out_start = sd->ring_head;
     }
 
-    if (flush_in)
+    if (flush_in) {
+	sd->inpos = 0;
 	sd->inlen = 0;
+    }
 
     if (isbreak)
 	sd->send_break(sol);
@@ -1227,11 +1524,12 @@ send_history_data(ipmi_sol_t *sol, int need_send_ack)
     soldata_t *sd = sol->soldata;
     rsp_msg_t msg;
     unsigned char data[MAX_HISTORY_SEND + 4];
-    int to_send;
+    unsigned int total = sd->history_play_len + strlen(end_history_msg);
+    unsigned int to_send, n = 0;
 
-    to_send = sd->history_copy_size - sd->history_pos;
-    if (to_send <= 0)
+    if (sd->history_pos >= total)
 	return need_send_ack;
+    to_send = total - sd->history_pos;
     if (to_send > MAX_HISTORY_SEND)
 	to_send = MAX_HISTORY_SEND;
 
@@ -1245,7 +1543,17 @@ send_history_data(ipmi_sol_t *sol, int need_send_ack)
     }
     data[3] = 1 << 6; /* Always ready to get data, we just throw it away */
 
-    memcpy(data + 4, sd->history_copy + sd->history_pos, to_send);
+    if (sd->history_pos < sd->history_play_len) {
+	n = sd->history_play_len - sd->history_pos;
+	if (n > to_send)
+	    n = to_send;
+	sol_ring_copy(sd, data + 4,
+		      sd->history_play_start + sd->history_pos, n);
+    }
+    if (n < to_send)
+	memcpy(data + 4 + n,
+	       end_history_msg + sd->history_pos + n - sd->history_play_len,
+	       to_send - n);
     msg.data = data;
     msg.data_len = to_send + 4;
 
@@ -1259,7 +1567,7 @@ send_history_ack(ipmi_sol_t *sol)
 {
     soldata_t *sd = sol->soldata;
     rsp_msg_t msg;
-    unsigned char data[SOL_OUTBUF_SIZE + 4];
+    unsigned char data[4];
 
     data[0] = 0;
     data[1] = sd->history_last_acked_packet;
@@ -1275,8 +1583,18 @@ send_history_ack(ipmi_sol_t *sol)
 static void
 sol_history_next_packet(soldata_t *sd)
 {
+    unsigned int behind;
+
     /* Only send one size for history, no need to check msg's count */
     sd->history_pos += MAX_HISTORY_SEND;
+    if (sd->history_pos < sd->history_play_len) {
+	/* If new data has overwritten what is left to play, skip it. */
+	behind = sd->ring_head - (sd->history_play_start + sd->history_pos);
+	if (behind > sd->ring_size)
+	    sd->history_pos += behind - sd->ring_size;
+	if (sd->history_pos > sd->history_play_len)
+	    sd->history_pos = sd->history_play_len;
+    }
     sd->history_curr_packet_seq++;
     if (sd->history_curr_packet_seq >= 16)
 	sd->history_curr_packet_seq = 1;
@@ -1293,7 +1611,7 @@ sol_history_timeout(void *cb_data)
     if (sd->history_num_sends > MAX_SOL_RESENDS)
 	sol_history_next_packet(sd);
 
-    if (sd->history_pos >= sd->history_copy_size)
+    if (sd->history_pos >= sd->history_play_len + strlen(end_history_msg))
 	return;
 
     sd->history_num_sends++;
@@ -1374,7 +1692,10 @@ sol_port_error(ipmi_sol_t *sol)
     sd->sys->remove_io_hnd(sd->fd_id);
     sd->shutdown(sol);
 
+    sd->fd_id = NULL;
+
     /* Clear any data to send to the serial port. */
+    sd->inpos = 0;
     sd->inlen = 0;
 
     /* Retry in 10 seconds. */
@@ -1390,7 +1711,7 @@ sol_write_ready(int fd, void *cb_data)
     soldata_t *sd = sol->soldata;
     int rv;
 
-    rv = write(fd, sd->inbuf, sd->inlen);
+    rv = write(fd, sd->inbuf + sd->inpos, sd->inlen);
     if (rv < 0) {
 	sd->logchan->log(sd->logchan, OS_ERROR, NULL,
 			 "Error writing to serial port: %d, disabling\n",
@@ -1399,77 +1720,34 @@ sol_write_ready(int fd, void *cb_data)
 	return;
     }
 
-    if (((unsigned int) rv) < sd->inlen)
-	memcpy(sd->inbuf, sd->inbuf + rv, sd->inlen - rv);
     sd->inlen -= rv;
+    if (sd->inlen)
+	sd->inpos += rv;
+    else
+	sd->inpos = 0;
 
     set_write_enable(sd);
 }
 
-static void
-add_to_history(ipmi_sol_t *sol, unsigned char *buf, unsigned int len)
-{
-    soldata_t *sd = sol->soldata;
-    int to_copy;
-
-    if (!sd->history || len == 0)
-	return;
-
-    /*
-     * No point in handling more data than we can take, only take the
-     * last history size section.
-     */
-    if (len > sol->history_size) {
-	buf += len - sol->history_size;
-	len = sol->history_size;
-    }
-
-    if (sd->history_end + len + 1 > sol->history_size) {
-	/* Wrap case, copy to the end and wrap history_end. */
-	to_copy = sol->history_size - sd->history_end - 1;
-	memcpy(sd->history + sd->history_end + 1, buf, to_copy);
-	sd->history_end = -1;
-	len -= to_copy;
-	buf += to_copy;
-    }
-
-    /*
-     * At this point all the data should fit between history_end
-     * and the end of the buffer.
-     */
-    memcpy(sd->history + sd->history_end + 1, buf, len);
-    if (sd->history_start > sd->history_end) {
-	/*
-	 * Before we completely fill the buffer, history_start will
-	 * always be <= history_end.  After we fill the buffer,
-	 * history_end will always be < history_start.
-	 */
-	sd->history_start += len;
-	if (sd->history_start >= (int) sol->history_size)
-	    sd->history_start -= sol->history_size;
-    } else if (sd->history_start == sd->history_end) {
-	/*
-	 * First write to the buffer, it starts with start == end == 0,
-	 * so we need to fix things up on the first write.
-	 */
-	sd->history_start++;
-    }
-    sd->history_end += len;
-}
-
 static int
 sol_handle_telnet(ipmi_sol_t *sol, unsigned char *buf, int len)
 {
     soldata_t *sd = sol->soldata;
-    int i, j;
+    unsigned char *iac;
+    int i, j, run;
 
     for (i = 0, j = 0; i < len; i++) {
 	switch (sd->telnet_state) {
 	case SOL_TELNETST_NORMAL:
-	    if (buf[i] == SOL_TELNET_IAC)
+	    /* Move everything up to the next IAC in one go. */
+	    iac = memchr(buf + i, SOL_TELNET_IAC, len - i);
+	    run = (iac ? iac - buf : len) - i;
+	    if (j != i)
+		memmove(buf + j, buf + i, run);
+	    i += run;
+	    j += run;
+	    if (iac)
 		sd->telnet_state = SOL_TELNETST_IAC;
-	    else
-		buf[j++] = buf[i];
 	    break;
 
 	case SOL_TELNETST_IAC:
@@ -1521,54 +1799,72 @@ sol_data_ready(int fd, void *cb_data)
 {
     ipmi_sol_t *sol = cb_data;
     soldata_t *sd = sol->soldata;
-    int rv;
+    unsigned int total = 0, off, readsize;
+    int rv, len, err = 0;
     struct timeval tv;
-    unsigned char buf[128];
-    unsigned int readsize = sizeof(buf);
 
-    if (!sd->history && (readsize > (sizeof(sd->outbuf) - sd->outlen)))
-	readsize = sizeof(sd->outbuf) - sd->outlen;
-
-    rv = read(fd, buf, readsize);
-    if (rv < 0) {
-	sd->logchan->log(sd->logchan, OS_ERROR, NULL,
-			 "Error reading from serial port: %d, disabling\n",
-			 errno);
-	sol_port_error(sol);
-	return;
-    } else if (rv == 0) {
-	/* End of input, socket probably closed. */
-	sol_port_error(sol);
-	return;
-    }
-
-    if (sol->do_telnet)
-	rv = sol_handle_telnet(sol, buf, rv);
+    /*
+     * Read straight into the ring, and keep reading until the port
+     * is drained or the budget is used up so the data goes out in as
+     * few packets as possible.
+     */
+    while (total < SOL_READ_BUDGET) {
+	off = sd->ring_head & (sd->ring_size - 1);
+	readsize = sd->ring_size - off;
+	if (readsize > SOL_READ_BUDGET - total)
+	    readsize = SOL_READ_BUDGET - total;
+	if (!sol->history_size
+		&& (readsize > SOL_OUTBUF_SIZE - sol_out_pending(sd)))
+	    readsize = SOL_OUTBUF_SIZE - sol_out_pending(sd);
+	if (readsize == 0)
+	    break;
 
-    add_to_history(sol, buf, rv);
+	rv = read(fd, sd->ring + off, readsize);
+	if (rv < 0) {
+	    if (errno == EAGAIN || errno == EINTR)
+		break;
+	    sd->logchan->log(sd->logchan, OS_ERROR, NULL,
+			     "Error reading from serial port: %d, disabling\n",
+			     errno);
+	    err = 1;
+	    break;
+	} else if (rv == 0) {
+	    /* End of input, socket probably closed. */
+	    err = 1;
+	    break;
+	}
+	total += rv;
+
+	len = rv;
+	if (sol->do_telnet)
+	    len = sol_handle_telnet(sol, sd->ring + off, len);
+	if (sol->history_size) {
+	    sol_hist_index(sd, sd->ring_head, len);
+	    sd->hist->ring_head = sd->ring_head + len;
+	}
+	sd->ring_head += len;
 
-    if (((unsigned int) rv) > (sizeof(sd->outbuf) - sd->outlen)) {
-	/* Overflow happened. */
-	rv = sizeof(sd->outbuf) - sd->outlen;
+	if (((unsigned int) rv) < readsize)
+	    break;
     }
 
     if (!sol->active) {
-	sd->outlen = 0;
-	return;
+	sd->out_start = sd->ring_head;
+    } else {
+	/* Looks strange, but will turn off read if the buffer is full */
+	set_read_enable(sol);
+
+	if (!sd->waiting_ack && sol_out_pending(sd)) {
+	    send_data(sol, 0);
+	    sd->num_sends = 0;
+	    tv.tv_sec = 1;
+	    tv.tv_usec = 0;
+	    sd->sys->start_timer(sd->timer, &tv);
+	}
     }
-    memcpy(sd->outbuf + sd->outlen, buf, rv);
-    sd->outlen += rv;
-
-    /* Looks strange, but will turn off read if the buffer is full */
-    set_read_enable(sd);
 
-    if (!sd->waiting_ack) {
-	send_data(sol, 0);
-	sd->num_sends = 0;
-	tv.tv_sec = 1;
-	tv.tv_usec = 0;
-	sd->sys->start_timer(sd->timer, &tv);
-    }
+    if (err)
+	sol_port_error(sol);
 }
 
 int
@@ -1634,6 +1930,8 @@ sol_read_config(char **tokptr, sys_data_t *sys, const char **err)
 
 		if (strncmp(opt, "backupfile=", 11) == 0) {
 		    sol->backupfile = strdup(opt + 11);
+		} else if (strncmp(opt, "historyfile=", 12) == 0) {
+		    sol->historyfile = strdup(opt + 12);
 		} else {
 		    *err = "Unknown history option";
 		    return -1;
@@ -1749,6 +2047,413 @@ write_sol_config(lmc_data_t *mc)
     return 0;
 }
 
+static void
+sol_hist_init_hdr(struct sol_hist_hdr *h, unsigned int ring_size)
+{
+    memset(h, 0, sizeof(*h));
+    memcpy(h->magic, SOL_HIST_MAGIC, sizeof(h->magic));
+    h->version = SOL_HIST_VERSION;
+    h->byte_order = SOL_HIST_BYTE_ORDER;
+    h->ring_size = ring_size;
+    h->seg_size = ring_size / SOL_HIST_MAX_SEGS;
+    if (h->seg_size < SOL_HIST_MIN_SEG_SIZE)
+	h->seg_size = SOL_HIST_MIN_SEG_SIZE;
+    h->num_segs = ring_size / h->seg_size;
+}
+
+/*
+ * Map the history file, creating it if it does not exist or is not
+ * for this size of history.  A valid existing history is picked up
+ * where it left off.
+ */
+static int
+sol_hist_map(ipmi_sol_t *sol, soldata_t *sd, unsigned int ring_size)
+{
+    size_t size = SOL_HIST_HDR_SIZE + ring_size;
+    struct sol_hist_hdr *h, check;
+    struct stat st;
+    void *map;
+    int fd, rv = 0;
+
+    fd = open(sol->historyfile, O_RDWR | O_CREAT, 0600);
+    if (fd == -1) {
+	rv = errno;
+	goto out_err;
+    }
+
+    if (fstat(fd, &st) == -1) {
+	rv = errno;
+	goto out;
+    }
+    if (st.st_size != (off_t) size) {
+	/*
+	 * Start over.  Allocate the space now, running out of disk
+	 * when writing to the map would be fatal.
+	 */
+	if (ftruncate(fd, 0) == -1) {
+	    rv = errno;
+	    goto out;
+	}
+	rv = posix_fallocate(fd, 0, size);
+	if (rv)
+	    goto out;
+    }
+
+    map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+	rv = errno;
+	goto out;
+    }
+
+    h = map;
+    sol_hist_init_hdr(&check, ring_size);
+    if (memcmp(h->magic, check.magic, sizeof(h->magic)) != 0
+	|| h->version != check.version
+	|| h->byte_order != check.byte_order
+	|| h->ring_size != check.ring_size
+	|| h->seg_size != check.seg_size
+	|| h->num_segs != check.num_segs)
+	memcpy(h, &check, sizeof(check));
+
+    sd->hist = h;
+    sd->hist_map = map;
+    sd->hist_map_size = size;
+    sd->ring = ((unsigned char *) map) + SOL_HIST_HDR_SIZE;
+    sd->ring_head = h->ring_head;
+    sd->hist_start = h->hist_start;
+    sd->out_start = sd->ring_head;
+
+ out:
+    close(fd);
+ out_err:
+    if (rv)
+	fprintf(stderr, "Error setting up SOL history file %s: %s\n",
+		sol->historyfile, strerror(rv));
+    return rv;
+}
+
+static int
+sol_alloc_data(sys_data_t *sys, ipmi_sol_t *sol)
+{
+    soldata_t *sd;
+    unsigned int size;
+    int rv = ENOMEM;
+
+    sd = sys->alloc(sys, sizeof(*sd));
+    if (!sd)
+	return ENOMEM;
+    memset(sd, 0, sizeof(*sd));
+    sd->sys = sys;
+
+    if (sys->alloc_timer(sys, sol_timeout, sol, &sd->timer))
+	goto out_err;
+
+    if (sol->history_size) {
+	if (sys->alloc_timer(sys, sol_history_timeout, sol,
+			     &sd->history_timer))
+	    goto out_err;
+    }
+
+    /* The ring must hold all the history and a full output buffer. */
+    size = SOL_OUTBUF_SIZE;
+    while (size < sol->history_size)
+	size <<= 1;
+    sd->ring_size = size;
+
+    if (sol->history_size && sol->historyfile) {
+	rv = sol_hist_map(sol, sd, size);
+	if (rv)
+	    goto out_err;
+    } else {
+	sd->ring = sys->alloc(sys, size);
+	if (!sd->ring)
+	    goto out_err;
+	if (sol->history_size) {
+	    sd->hist = sys->alloc(sys, sizeof(*sd->hist));
+	    if (!sd->hist)
+		goto out_err;
+	    sol_hist_init_hdr(sd->hist, size);
+	}
+    }
+
+    sd->fd = -1;
+    sd->curr_packet_seq = 1;
+    sd->history_curr_packet_seq = 1;
+    sol->soldata = sd;
+    return 0;
+
+ out_err:
+    if (sd->ring && !sd->hist_map)
+	sys->free(sys, sd->ring);
+    if (sd->history_timer)
+	sys->free_timer(sd->history_timer);
+    if (sd->timer)
+	sys->free_timer(sd->timer);
+    sys->free(sys, sd);
+    return rv;
+}
+
+static void
+sol_free_data(ipmi_sol_t *sol)
+{
+    soldata_t *sd = sol->soldata;
+    sys_data_t *sys = sd->sys;
+
+    if (sd->history_timer) {
+	sys->stop_timer(sd->history_timer);
+	sys->free_timer(sd->history_timer);
+    }
+    sys->stop_timer(sd->timer);
+    sys->free_timer(sd->timer);
+    if (sd->hist_map) {
+	munmap(sd->hist_map, sd->hist_map_size);
+    } else {
+	sys->free(sys, sd->ring);
+	if (sd->hist)
+	    sys->free(sys, sd->hist);
+    }
+    sys->free(sys, sd);
+    sol->soldata = NULL;
+}
+
+/*
+ * A loopback benchmark of the SOL data path.  Data is written into a
+ * socket pair and taken through the normal read path, with every
+ * packet acked as soon as it is sent, then the same amount is sent
+ * from the "remote" and written out to the socket pair.  No LAN is
+ * involved, so this measures the SOL code itself.
+ */
+static sys_data_t *sol_bench_sys;
+
+struct sol_bench_info {
+    unsigned int pkts;
+    unsigned long long bytes;
+    unsigned char seq;
+    unsigned char len;
+    unsigned char acked;
+};
+
+static void
+sol_bench_return_rsp(channel_t *chan, msg_t *msg, rsp_msg_t *rsp)
+{
+    struct sol_bench_info *b = chan->chan_info;
+
+    if (rsp->data_len <= 4) {
+	b->acked = rsp->data[2];
+	return;
+    }
+    b->pkts++;
+    b->bytes += rsp->data_len - 4;
+    b->seq = rsp->data[0];
+    b->len = rsp->data_len - 4;
+}
+
+static void
+sol_bench_report(emu_out_t *out, const char *dir, struct sol_bench_info *b,
+		 struct timeval *start, struct timeval *end)
+{
+    double secs;
+
+    secs = (end->tv_sec - start->tv_sec)
+	+ (end->tv_usec - start->tv_usec) / 1000000.0;
+    if (secs <= 0)
+	secs = 0.000001;
+    out->printf(out, "%s: %llu bytes in %u packets, %.3f s, %.1f MB/s,"
+		" %.0f packets/s\n", dir, b->bytes, b->pkts, secs,
+		b->bytes / secs / 1000000.0, b->pkts / secs);
+}
+
+static int
+sol_bench(emu_out_t *out, emu_data_t *emu, lmc_data_t *mc, char **toks)
+{
+    sys_data_t *sys = sol_bench_sys;
+    ipmi_sol_t bsol;
+    soldata_t *sd;
+    channel_t bchan;
+    struct sol_bench_info b;
+    msg_t msg;
+    unsigned char pkt[SOL_INBUF_SIZE + 4];
+    unsigned char chunk[SOL_READ_BUDGET];
+    unsigned char sink[SOL_READ_BUDGET];
+    struct timeval start, end;
+    const char *tok;
+    char *endp;
+    unsigned long long size, done;
+    unsigned int i, n;
+    unsigned char seq;
+    int fds[2];
+    int avail;
+    int rv;
+
+    tok = mystrtok(NULL, " \t\n", toks);
+    if (!tok) {
+	out->printf(out, "**No size given\n");
+	return EINVAL;
+    }
+    size = strtoull(tok, &endp, 0);
+    if (*endp != '\0' || size == 0) {
+	out->printf(out, "**Invalid size given\n");
+	return EINVAL;
+    }
+
+    memset(&bsol, 0, sizeof(bsol));
+    bsol.history_size = 4 * SOL_OUTBUF_SIZE;
+    bsol.active = 1;
+    tok = mystrtok(NULL, " \t\n", toks);
+    if (tok) {
+	if (strcmp(tok, "telnet") != 0) {
+	    out->printf(out, "**Invalid option: %s\n", tok);
+	    return EINVAL;
+	}
+	bsol.do_telnet = 1;
+    }
+
+    rv = sol_alloc_data(sys, &bsol);
+    if (rv) {
+	out->printf(out, "**Out of memory\n");
+	return rv;
+    }
+    sd = bsol.soldata;
+    sol_tcp_setup(&bsol);
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == -1) {
+	rv = errno;
+	out->printf(out, "**Unable to create socket pair: %s\n",
+		    strerror(rv));
+	goto out_free;
+    }
+    fcntl(fds[0], F_SETFL, O_NONBLOCK);
+    fcntl(fds[1], F_SETFL, O_NONBLOCK);
+
+    memset(&bchan, 0, sizeof(bchan));
+    bchan.return_rsp = sol_bench_return_rsp;
+    bchan.chan_info = &b;
+    sd->fd = fds[0];
+    sd->channel = &bchan;
+    sd->logchan = ipmi_mc_get_channelset(mc)[0];
+
+    /* Console-like text, with escaped IACs to strip out for telnet. */
+    for (i = 0; i < sizeof(chunk); i++)
+	chunk[i] = (i % 80 == 79) ? '\n' : ' ' + (i % 95);
+    if (bsol.do_telnet) {
+	for (i = 0; i + 1 < sizeof(chunk); i += 512) {
+	    chunk[i] = SOL_TELNET_IAC;
+	    chunk[i + 1] = SOL_TELNET_IAC;
+	}
+    }
+
+    /* Serial port to the remote. */
+    memset(&b, 0, sizeof(b));
+    msg.data = pkt;
+    msg.len = 4;
+    sys->get_monotonic_time(sys, &start);
+    for (done = 0; done < size; done += n) {
+	n = sizeof(chunk);
+	if (n > size - done)
+	    n = size - done;
+	rv = write(fds[1], chunk, n);
+	if (rv <= 0)
+	    break;
+	n = rv;
+	do {
+	    sol_data_ready(fds[0], &bsol);
+	    while (sd->waiting_ack) {
+		pkt[0] = 0;
+		pkt[1] = b.seq;
+		pkt[2] = b.len;
+		pkt[3] = 0;
+		handle_sol_port_payload(NULL, &bsol, &msg);
+	    }
+	} while (ioctl(fds[0], FIONREAD, &avail) == 0 && avail > 0);
+    }
+    sys->get_monotonic_time(sys, &end);
+    sol_bench_report(out, "serial->remote", &b, &start, &end);
+
+    /* Remote to the serial port. */
+    memset(&b, 0, sizeof(b));
+    seq = 1;
+    sys->get_monotonic_time(sys, &start);
+    for (done = 0; done < size; done += b.acked) {
+	n = sizeof(bsol.soldata->inbuf);
+	if (n > size - done)
+	    n = size - done;
+	pkt[0] = seq;
+	pkt[1] = 0;
+	pkt[2] = 0;
+	pkt[3] = 0;
+	memcpy(pkt + 4, chunk + (done % (sizeof(chunk) - n)), n);
+	msg.len = n + 4;
+	b.acked = 0;
+	handle_sol_port_payload(NULL, &bsol, &msg);
+	if (b.acked == 0)
+	    break;
+	b.pkts++;
+	b.bytes += b.acked;
+	seq = (seq % 15) + 1;
+
+	while (sd->inlen) {
+	    sol_write_ready(fds[0], &bsol);
+	    while (read(fds[1], sink, sizeof(sink)) > 0)
+		;
+	}
+    }
+    sys->get_monotonic_time(sys, &end);
+    sol_bench_report(out, "remote->serial", &b, &start, &end);
+    rv = 0;
+
+    close(fds[0]);
+    close(fds[1]);
+ out_free:
+    sol_free_data(&bsol);
+    return rv;
+}
+
+/* Print the last lines of an MC's SOL history, 10 by default. */
+static int
+sol_history_cmd(emu_out_t *out, emu_data_t *emu, lmc_data_t *mc, char **toks)
+{
+    ipmi_sol_t *sol = ipmi_mc_get_sol(mc);
+    soldata_t *sd = sol->soldata;
+    unsigned int lines = 10, start, len, i, n;
+    const char *tok;
+    char *end;
+    char *buf;
+
+    if (!sd || !sol->history_size) {
+	out->printf(out, "**No SOL history on this MC\n");
+	return ENOENT;
+    }
+
+    tok = mystrtok(NULL, " \t\n", toks);
+    if (tok) {
+	lines = strtoul(tok, &end, 0);
+	if (*end != '\0' || lines == 0) {
+	    out->printf(out, "**Invalid line count: %s\n", tok);
+	    return EINVAL;
+	}
+    }
+
+    start = sol_hist_find_lines(sol, lines);
+    len = sd->ring_head - start;
+    buf = sd->sys->alloc(sd->sys, len);
+    if (!buf) {
+	out->printf(out, "**Out of memory\n");
+	return ENOMEM;
+    }
+    sol_ring_copy(sd, (unsigned char *) buf, start, len);
+    /* The console output is done in limited size pieces. */
+    for (i = 0; i < len; i += n) {
+	n = len - i;
+	if (n > 256)
+	    n = 256;
+	out->printf(out, "%.*s", n, buf + i);
+    }
+    if (len && buf[len - 1] != '\n')
+	out->printf(out, "\n");
+    sd->sys->free(sd->sys, buf);
+    return 0;
+}
+
 int
 sol_init(sys_data_t *sys)
 {
@@ -1766,6 +2471,27 @@ sol_init(sys_data_t *sys)
     if (rv)
 	return rv;
 
+    rv = ipmi_emu_register_oi_iana_handler(
+	OPENIPMI_IANA_CMD_SET_HISTORY_RETURN_LINES,
+	sol_set_history_return_lines, NULL);
+    if (rv)
+	return rv;
+
+    rv = ipmi_emu_register_oi_iana_handler(
+	OPENIPMI_IANA_CMD_GET_HISTORY_RETURN_LINES,
+	sol_get_history_return_lines, NULL);
+    if (rv)
+	return rv;
+
+    sol_bench_sys = sys;
+    rv = ipmi_emu_add_cmd("sol_bench", MC, sol_bench);
+    if (rv)
+	return rv;
+
+    rv = ipmi_emu_add_cmd("sol_history", MC, sol_history_cmd);
+    if (rv)
+	return rv;
+
     return ipmi_register_payload(IPMI_RMCPP_PAYLOAD_TYPE_SOL,
 				 handle_sol_payload);
 }
@@ -1775,6 +2501,7 @@ handle_sol_shutdown(void *info, int sig)
 {
     ipmi_sol_t *sol = info;
     soldata_t *sd = sol->soldata;
+    unsigned int len, off, to_copy;
     FILE *f;
 
     if (sol->configured < 2 || !sd)
@@ -1783,7 +2510,14 @@ handle_sol_shutdown(void *info, int sig)
     sol->configured--;
     sd->shutdown(sol);
 
-    if (!sol->backupfile || (sd->history_start == sd->history_end))
+    if (sd->hist_map) {
+	/* Everything is already in the file, just push it out. */
+	msync(sd->hist_map, sd->hist_map_size, MS_ASYNC);
+	return;
+    }
+
+    len = sol_hist_len(sol);
+    if (!sol->backupfile || len == 0)
 	return;
 
     /*
@@ -1792,16 +2526,13 @@ handle_sol_shutdown(void *info, int sig)
     f = fopen(sol->backupfile, "w");
     if (!f)
 	return;
-    if (sd->history_end >= sd->history_start) {
-	/* History is fully contained between start and end. */
-	fwrite(sd->history + sd->history_start, 1,
-	       sd->history_end - sd->history_start + 1, f);
-    } else {
-	/* History laps over end, need two writes. */
-	fwrite(sd->history + sd->history_start, 1,
-	       sol->history_size - sd->history_start, f);
-	fwrite(sd->history, 1, sd->history_end + 1, f);
-    }
+    /* History may lap over the end of the ring, so two writes. */
+    off = (sd->ring_head - len) & (sd->ring_size - 1);
+    to_copy = sd->ring_size - off;
+    if (to_copy > len)
+	to_copy = len;
+    fwrite(sd->ring + off, 1, to_copy, f);
+    fwrite(sd->ring, 1, len - to_copy, f);
     fclose(f);
 }
 
@@ -1810,49 +2541,28 @@ sol_init_mc(sys_data_t *sys, lmc_data_t *mc)
 {
     ipmi_sol_t *sol = ipmi_mc_get_sol(mc);
     soldata_t *sd;
+    int rv;
 
-    sd = sys->alloc(sys, sizeof(*sd));
-    if (!sd)
-	return ENOMEM;
-    memset(sd, 0, sizeof(*sd));
-    sd->sys = sys;
-    sol->soldata = sd;
+    rv = sol_alloc_data(sys, sol);
+    if (rv)
+	return rv;
+    sd = sol->soldata;
 
     if (sol->tcpdest)
 	sol_tcp_setup(sol);
     else
 	sol_serial_setup(sol);
-    
-    if (sys->alloc_timer(sys, sol_timeout, sol, &sd->timer)) {
-	sys->free(sys, sd);
-	return ENOMEM;
-    }
-
-    if (sol->history_size) {
-	if (sys->alloc_timer(sys, sol_history_timeout, sol,
-			     &sd->history_timer)) {
-	    sys->free_timer(sd->timer);
-	    sys->free(sys, sd);
-	    return ENOMEM;
-	}
 
-	sd->history = sys->alloc(sys, sol->history_size);
-	if (!sd->history) {
-	    sys->free_timer(sd->history_timer);
-	    sys->free_timer(sd->timer);
-	    sys->free(sys, sd);
-	    return ENOMEM;
-	}
-
-	if (sol->backupfile) {
-	    FILE *f = fopen(sol->backupfile, "r");
-	    if (f) {
-		/* Ignore errors, it doesn't really matter. */
-		fseek(f, -sol->history_size, SEEK_END);
-		sd->history_end = fread(sd->history, 1, sol->history_size, f);
-		sd->history_end--; /* end point to last, not one after. */
-		fclose(f);
-	    }
+    if (sol->history_size && sol->backupfile && !sd->hist_map) {
+	FILE *f = fopen(sol->backupfile, "r");
+	if (f) {
+	    /* Ignore errors, it doesn't really matter. */
+	    fseek(f, -sol->history_size, SEEK_END);
+	    sd->ring_head = fread(sd->ring, 1, sol->history_size, f);
+	    sd->out_start = sd->ring_head;
+	    sol_hist_index(sd, 0, sd->ring_head);
+	    sd->hist->ring_head = sd->ring_head;
+	    fclose(f);
 	}
     }
 
@@ -1860,9 +2570,6 @@ sol_init_mc(sys_data_t *sys, lmc_data_t *mc)
     sd->backupfilehandler.info = sol;
     ipmi_register_shutdown_handler(&sd->backupfilehandler);
 
-    sd->fd = -1;
-    sd->curr_packet_seq = 1;
-    sd->history_curr_packet_seq = 1;
     sd->logchan = ipmi_mc_get_channelset(mc)[0];
 
     if (sol_port_init(sol)) {
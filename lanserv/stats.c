@@ -0,0 +1,361 @@
+/*
+ * stats.c
+ *
+ * Command and LAN statistics for the IPMI simulator.
+ *
+ * Author: MontaVista Software, Inc.
+ *         Corey Minyard <minyard@mvista.com>
+ *         source@mvista.com
+ *
+ * Copyright 2012 MontaVista Software Inc.
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2 of
+ *  the License, or (at your option) any later version.
+ *
+ *
+ *  THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ *  WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ *  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ *  OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ *  TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ *  USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this program; if not, write to the Free
+ *  Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * Every command that goes through ipmi_emu_handle_msg() is counted
+ * here by netfn and command, with a histogram of how long the handler
+ * took.  The LAN interfaces keep their own counters and per-stage
+ * timings in their lanserv_data_t, this just reports them.  The same
+ * data can be printed on the console or in the Prometheus text format
+ * for the metrics port.
+ */
+
+#include "bmc.h"
+#include "emu.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+
+#include <OpenIPMI/ipmi_mc.h>
+#include <OpenIPMI/lanserv.h>
+
+typedef struct cmd_stat_s
+{
+    uint64_t count;
+    uint64_t errors;
+    stat_hist_t hist;
+} cmd_stat_t;
+
+/* Indexed like netfn_handlers, by netfn >> 1, allocated on first use. */
+static cmd_stat_t *cmd_stats[32];
+
+static const char *stage_names[LAN_STAT_NUM_STAGES] = {
+    "decode", "integrity", "decrypt", "handler", "encrypt", "send"
+};
+
+void
+ipmi_emu_stat_cmd(unsigned char netfn, unsigned char cmd, unsigned char cc,
+		  uint64_t ns)
+{
+    cmd_stat_t *s = cmd_stats[netfn >> 1];
+
+    if (!s) {
+	s = calloc(256, sizeof(*s));
+	if (!s)
+	    return;
+	cmd_stats[netfn >> 1] = s;
+    }
+    s += cmd;
+    s->count++;
+    if (cc)
+	s->errors++;
+    stat_hist_add(&s->hist, ns);
+}
+
+/*
+ * Return the upper bound of the bucket holding the given percentile,
+ * in microseconds, 0 if it is in the overflow bucket.
+ */
+static uint64_t
+hist_percentile(stat_hist_t *hist, unsigned int pct)
+{
+    uint64_t want = (hist->count * pct + 99) / 100;
+    uint64_t seen = 0;
+    unsigned int i;
+
+    for (i = 0; i < STAT_HIST_BUCKETS; i++) {
+	seen += hist->buckets[i];
+	if (seen >= want)
+	    return stat_hist_bucket_us(i);
+    }
+    return 0;
+}
+
+static void
+print_percentile(emu_out_t *out, stat_hist_t *hist, unsigned int pct)
+{
+    uint64_t p = hist_percentile(hist, pct);
+
+    if (p)
+	out->printf(out, " %9llu", (unsigned long long) p);
+    else
+	out->printf(out, " %9s", "inf");
+}
+
+static void
+print_hist(emu_out_t *out, stat_hist_t *hist)
+{
+    out->printf(out, " %10.1f", hist->sum_ns / 1000.0 / hist->count);
+    print_percentile(out, hist, 50);
+    print_percentile(out, hist, 99);
+    out->printf(out, "\n");
+}
+
+static lanserv_data_t *
+next_lan(emu_data_t *emu, unsigned int *idx)
+{
+    lmc_data_t *bmc = ipmi_emu_get_bmc_mc(emu);
+    channel_t **chans;
+
+    if (!bmc)
+	return NULL;
+    chans = ipmi_mc_get_channelset(bmc);
+    for (; *idx < IPMI_MAX_CHANNELS; (*idx)++) {
+	channel_t *chan = chans[*idx];
+
+	if (chan && chan->medium_type == IPMI_CHANNEL_MEDIUM_8023_LAN
+	    && chan->chan_info) {
+	    (*idx)++;
+	    return chan->chan_info;
+	}
+    }
+    return NULL;
+}
+
+static void
+clear_stats(emu_data_t *emu)
+{
+    lanserv_data_t *lan;
+    unsigned int i;
+
+    for (i = 0; i < 32; i++) {
+	if (cmd_stats[i])
+	    memset(cmd_stats[i], 0, 256 * sizeof(cmd_stat_t));
+    }
+    i = 0;
+    while ((lan = next_lan(emu, &i)))
+	ipmi_lan_clear_stats(lan);
+}
+
+int
+stats_cmd(emu_out_t *out, emu_data_t *emu, lmc_data_t *mc, char **toks)
+{
+    const char *str;
+    lanserv_data_t *lan;
+    unsigned int i, j;
+
+    str = mystrtok(NULL, " \t\n", toks);
+    if (str) {
+	if (strcmp(str, "clear") != 0) {
+	    out->printf(out, "**Invalid stats option: %s\n", str);
+	    return EINVAL;
+	}
+	clear_stats(emu);
+	return 0;
+    }
+
+    out->printf(out, "netfn  cmd      count   errors     avg_us    p50_us"
+		"    p99_us\n");
+    for (i = 0; i < 32; i++) {
+	if (!cmd_stats[i])
+	    continue;
+	for (j = 0; j < 256; j++) {
+	    cmd_stat_t *s = &cmd_stats[i][j];
+
+	    if (!s->count)
+		continue;
+	    out->printf(out, " 0x%2.2x 0x%2.2x %10llu %8llu", i << 1, j,
+			(unsigned long long) s->count,
+			(unsigned long long) s->errors);
+	    print_hist(out, &s->hist);
+	}
+    }
+
+    i = 0;
+    while ((lan = next_lan(emu, &i))) {
+	lan_stats_t *st = &lan->stats;
+
+	out->printf(out, "LAN channel %d:\n", lan->channel.channel_num);
+	out->printf(out, "  packets %llu, dropped %llu, auth failures %llu,"
+		    " decrypt failures %llu\n",
+		    (unsigned long long) st->packets,
+		    (unsigned long long) st->drops,
+		    (unsigned long long) st->auth_failures,
+		    (unsigned long long) st->decrypt_failures);
+	out->printf(out, "  rate limited, presession %llu, session %llu\n",
+		    (unsigned long long) st->presession_rate_drops,
+		    (unsigned long long) st->session_rate_drops);
+	out->printf(out, "  sessions active %d, opened %llu, closed %llu,"
+		    " timed out %llu, reclaimed %llu\n",
+		    lan->channel.active_sessions,
+		    (unsigned long long) st->sessions_opened,
+		    (unsigned long long) st->sessions_closed,
+		    (unsigned long long) st->sessions_timed_out,
+		    (unsigned long long) st->sessions_reclaimed);
+	out->printf(out, "  stage          count     avg_us    p50_us"
+		    "    p99_us\n");
+	for (j = 0; j < LAN_STAT_NUM_STAGES; j++) {
+	    if (!st->stage[j].count)
+		continue;
+	    out->printf(out, "  %-9s %10llu", stage_names[j],
+			(unsigned long long) st->stage[j].count);
+	    print_hist(out, &st->stage[j]);
+	}
+    }
+    return 0;
+}
+
+static void
+prom_hist(emu_out_t *out, const char *name, const char *labels,
+	  stat_hist_t *hist)
+{
+    uint64_t total = 0;
+    unsigned int i;
+
+    for (i = 0; i < STAT_HIST_BUCKETS - 1; i++) {
+	total += hist->buckets[i];
+	out->printf(out, "%s_bucket{%s,le=\"%g\"} %llu\n", name, labels,
+		    stat_hist_bucket_us(i) / 1000000.0,
+		    (unsigned long long) total);
+    }
+    out->printf(out, "%s_bucket{%s,le=\"+Inf\"} %llu\n", name, labels,
+		(unsigned long long) hist->count);
+    out->printf(out, "%s_sum{%s} %.9f\n", name, labels,
+		hist->sum_ns / 1000000000.0);
+    out->printf(out, "%s_count{%s} %llu\n", name, labels,
+		(unsigned long long) hist->count);
+}
+
+static void
+prom_lan_counter(emu_out_t *out, emu_data_t *emu, const char *name,
+		 const char *help, size_t offset)
+{
+    lanserv_data_t *lan;
+    unsigned int i = 0;
+
+    out->printf(out, "# HELP ipmi_sim_lan_%s %s\n", name, help);
+    out->printf(out, "# TYPE ipmi_sim_lan_%s counter\n", name);
+    while ((lan = next_lan(emu, &i)))
+	out->printf(out, "ipmi_sim_lan_%s{channel=\"%d\"} %llu\n", name,
+		    lan->channel.channel_num,
+		    (unsigned long long)
+		    *((uint64_t *) (((char *) &lan->stats) + offset)));
+}
+
+void
+ipmi_emu_stats_prometheus(emu_data_t *emu, emu_out_t *out)
+{
+    lanserv_data_t *lan;
+    char labels[64];
+    unsigned int i, j;
+
+    out->printf(out, "# HELP ipmi_sim_cmd_requests_total"
+		" Commands handled, by netfn and command.\n");
+    out->printf(out, "# TYPE ipmi_sim_cmd_requests_total counter\n");
+    for (i = 0; i < 32; i++) {
+	for (j = 0; cmd_stats[i] && j < 256; j++) {
+	    if (cmd_stats[i][j].count)
+		out->printf(out, "ipmi_sim_cmd_requests_total"
+			    "{netfn=\"0x%2.2x\",cmd=\"0x%2.2x\"} %llu\n",
+			    i << 1, j,
+			    (unsigned long long) cmd_stats[i][j].count);
+	}
+    }
+    out->printf(out, "# HELP ipmi_sim_cmd_errors_total"
+		" Commands that returned a non-zero completion code.\n");
+    out->printf(out, "# TYPE ipmi_sim_cmd_errors_total counter\n");
+    for (i = 0; i < 32; i++) {
+	for (j = 0; cmd_stats[i] && j < 256; j++) {
+	    if (cmd_stats[i][j].count)
+		out->printf(out, "ipmi_sim_cmd_errors_total"
+			    "{netfn=\"0x%2.2x\",cmd=\"0x%2.2x\"} %llu\n",
+			    i << 1, j,
+			    (unsigned long long) cmd_stats[i][j].errors);
+	}
+    }
+    out->printf(out, "# HELP ipmi_sim_cmd_handler_seconds"
+		" Time spent in the command handler.\n");
+    out->printf(out, "# TYPE ipmi_sim_cmd_handler_seconds histogram\n");
+    for (i = 0; i < 32; i++) {
+	for (j = 0; cmd_stats[i] && j < 256; j++) {
+	    if (!cmd_stats[i][j].count)
+		continue;
+	    snprintf(labels, sizeof(labels),
+		     "netfn=\"0x%2.2x\",cmd=\"0x%2.2x\"", i << 1, j);
+	    prom_hist(out, "ipmi_sim_cmd_handler_seconds", labels,
+		      &cmd_stats[i][j].hist);
+	}
+    }
+
+    prom_lan_counter(out, emu, "packets_total", "LAN messages received.",
+		     offsetof(lan_stats_t, packets));
+    prom_lan_counter(out, emu, "dropped_total",
+		     "LAN messages that got no response.",
+		     offsetof(lan_stats_t, drops));
+    prom_lan_counter(out, emu, "auth_failures_total",
+		     "LAN messages or sessions that failed authentication.",
+		     offsetof(lan_stats_t, auth_failures));
+    prom_lan_counter(out, emu, "decrypt_failures_total",
+		     "LAN messages that failed decryption.",
+		     offsetof(lan_stats_t, decrypt_failures));
+    prom_lan_counter(out, emu, "presession_rate_drops_total",
+		     "Messages outside a session dropped by the rate limit.",
+		     offsetof(lan_stats_t, presession_rate_drops));
+    prom_lan_counter(out, emu, "session_rate_drops_total",
+		     "Messages in a session dropped by the rate limit.",
+		     offsetof(lan_stats_t, session_rate_drops));
+    prom_lan_counter(out, emu, "sessions_opened_total", "Sessions opened.",
+		     offsetof(lan_stats_t, sessions_opened));
+    prom_lan_counter(out, emu, "sessions_closed_total", "Sessions closed.",
+		     offsetof(lan_stats_t, sessions_closed));
+    prom_lan_counter(out, emu, "sessions_timed_out_total",
+		     "Sessions closed because of inactivity.",
+		     offsetof(lan_stats_t, sessions_timed_out));
+    prom_lan_counter(out, emu, "sessions_reclaimed_total",
+		     "Idle unauthenticated sessions closed to make room.",
+		     offsetof(lan_stats_t, sessions_reclaimed));
+
+    out->printf(out, "# HELP ipmi_sim_lan_sessions_active"
+		" Currently active sessions.\n");
+    out->printf(out, "# TYPE ipmi_sim_lan_sessions_active gauge\n");
+    i = 0;
+    while ((lan = next_lan(emu, &i)))
+	out->printf(out, "ipmi_sim_lan_sessions_active{channel=\"%d\"} %d\n",
+		    lan->channel.channel_num, lan->channel.active_sessions);
+
+    out->printf(out, "# HELP ipmi_sim_lan_stage_seconds"
+		" Time per LAN message spent in each stage.\n");
+    out->printf(out, "# TYPE ipmi_sim_lan_stage_seconds histogram\n");
+    i = 0;
+    while ((lan = next_lan(emu, &i))) {
+	for (j = 0; j < LAN_STAT_NUM_STAGES; j++) {
+	    snprintf(labels, sizeof(labels), "channel=\"%d\",stage=\"%s\"",
+		     lan->channel.channel_num, stage_names[j]);
+	    prom_hist(out, "ipmi_sim_lan_stage_seconds", labels,
+		      &lan->stats.stage[j]);
+	}
+    }
+}
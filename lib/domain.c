@@ -118,6 +118,7 @@ typedef struct ll_msg_s
     long                         seq;
 
     int                          side_effects;
+    int                          priority;
 
     ilist_item_t link;
 } ll_msg_t;
@@ -209,6 +210,7 @@ struct ipmi_domain_s
 
     locked_list_t            *event_handlers;
     locked_list_t            *event_handlers_cl;
+    locked_list_t            *event_batch_handlers;
     ipmi_oem_event_handler_cb oem_event_handler;
     void                      *oem_event_cb_data;
 
@@ -346,6 +348,31 @@ struct ipmi_domain_s
     unsigned int option_local_only : 1;
     unsigned int option_local_only_set : 1;
     unsigned int option_use_cache : 1;
+    unsigned int option_topology_snapshot : 1;
+    unsigned int option_sensor_reading_ttl; /* in milliseconds */
+    unsigned int option_startup_budget; /* 0 means no limit */
+
+    /* Protects the shared reading state in the sensors, see
+       ipmi_sensor_get_reading_flags(). */
+    ipmi_lock_t *sensor_reading_lock;
+
+    /* Startup stage scheduling, see _ipmi_domain_stage_start(). */
+    ipmi_lock_t         *stage_lock;
+    unsigned int        stages_running;
+    ipmi_domain_stage_t *stage_q_head, *stage_q_tail;
+    int                 stages_cancelled;
+    struct {
+	unsigned int count;
+	ipmi_time_t  total_time;
+	ipmi_time_t  max_time;
+	ipmi_time_t  wait_time;
+    } stage_stats[IPMI_DOMAIN_NUM_STAGES];
+
+    /* The topology snapshot, see topology_save(). */
+    char          topo_key[16*2+6];
+    int           topo_key_set;
+    unsigned char *topo_saved;
+    unsigned int  topo_saved_len;
 };
 
 /* A list of all domains in the system. */
@@ -361,6 +388,10 @@ static void real_close_connection(ipmi_domain_t *domain);
 
 static void free_domain_cruft(ipmi_domain_t *domain);
 
+static void topology_save(ipmi_domain_t *domain);
+
+static void topology_restore_start(ipmi_domain_t *domain);
+
 static void ll_con_changed(ipmi_con_t   *ipmi,
 			   int          err,
 			   unsigned int port_num,
@@ -438,6 +469,185 @@ deliver_rsp(ipmi_domain_t                *domain,
 	ipmi_free_msg_item(rspi);
 }
 
+/***********************************************************************
+ *
+ * Scheduling of the startup stages of MCs and FRUs.
+ *
+ **********************************************************************/
+
+static const char *stage_names[IPMI_DOMAIN_NUM_STAGES] =
+{
+    "guid", "sdrs", "sel", "fru"
+};
+
+const char *
+ipmi_domain_stage_name(unsigned int stage)
+{
+    if (stage >= IPMI_DOMAIN_NUM_STAGES)
+	return "invalid";
+    return stage_names[stage];
+}
+
+static ipmi_time_t
+stage_time_diff(struct timeval *end, struct timeval *start)
+{
+    return ((((ipmi_time_t) end->tv_sec - start->tv_sec) * 1000000)
+	    + (end->tv_usec - start->tv_usec)) * 1000;
+}
+
+/* Called with the stage lock held. */
+static void
+stage_set_running(ipmi_domain_t *domain, ipmi_domain_stage_t *stage)
+{
+    domain->stages_running++;
+    domain->os_hnd->get_monotonic_time(domain->os_hnd, &stage->started);
+    domain->stage_stats[stage->type].wait_time
+	+= stage_time_diff(&stage->started, &stage->queued);
+}
+
+void
+_ipmi_domain_stage_start(ipmi_domain_t        *domain,
+			 ipmi_domain_stage_t  *stage,
+			 unsigned int         type,
+			 ipmi_domain_stage_cb start,
+			 void                 *cb_data)
+{
+    stage->type = type;
+    stage->start = start;
+    stage->cb_data = cb_data;
+    stage->cancelled = 0;
+    stage->next = NULL;
+    domain->os_hnd->get_monotonic_time(domain->os_hnd, &stage->queued);
+
+    ipmi_lock(domain->stage_lock);
+    if (domain->stages_cancelled) {
+	/* The domain is going away, don't bother waiting. */
+	stage->cancelled = 1;
+    } else if (domain->option_startup_budget
+	&& (domain->stages_running >= domain->option_startup_budget))
+    {
+	/* Out of budget, wait for a running stage to finish. */
+	if (domain->stage_q_tail)
+	    domain->stage_q_tail->next = stage;
+	else
+	    domain->stage_q_head = stage;
+	domain->stage_q_tail = stage;
+	ipmi_unlock(domain->stage_lock);
+	return;
+    }
+    stage_set_running(domain, stage);
+    ipmi_unlock(domain->stage_lock);
+
+    start(domain, stage);
+}
+
+void
+_ipmi_domain_stage_done(ipmi_domain_t       *domain,
+			ipmi_domain_stage_t *stage)
+{
+    struct timeval      now;
+    ipmi_time_t         diff;
+    ipmi_domain_stage_t *next = NULL;
+
+    domain->os_hnd->get_monotonic_time(domain->os_hnd, &now);
+    diff = stage_time_diff(&now, &stage->started);
+
+    ipmi_lock(domain->stage_lock);
+    domain->stage_stats[stage->type].count++;
+    domain->stage_stats[stage->type].total_time += diff;
+    if (diff > domain->stage_stats[stage->type].max_time)
+	domain->stage_stats[stage->type].max_time = diff;
+    domain->stages_running--;
+
+    if (domain->stage_q_head) {
+	next = domain->stage_q_head;
+	domain->stage_q_head = next->next;
+	if (!domain->stage_q_head)
+	    domain->stage_q_tail = NULL;
+	next->next = NULL;
+	stage_set_running(domain, next);
+    }
+    ipmi_unlock(domain->stage_lock);
+
+    if (next)
+	next->start(domain, next);
+}
+
+/* Finish all the stages still waiting to run, they are cancelled. */
+static void
+stage_cancel_all(ipmi_domain_t *domain)
+{
+    ipmi_domain_stage_t *stage;
+
+    if (!domain->stage_lock)
+	return;
+
+    ipmi_lock(domain->stage_lock);
+    domain->stages_cancelled = 1;
+    while (domain->stage_q_head) {
+	stage = domain->stage_q_head;
+	domain->stage_q_head = stage->next;
+	if (!domain->stage_q_head)
+	    domain->stage_q_tail = NULL;
+	stage->next = NULL;
+	stage->cancelled = 1;
+	stage_set_running(domain, stage);
+	ipmi_unlock(domain->stage_lock);
+	stage->start(domain, stage);
+	ipmi_lock(domain->stage_lock);
+    }
+    ipmi_unlock(domain->stage_lock);
+}
+
+int
+ipmi_domain_get_stage_stats(ipmi_domain_t *domain,
+			    unsigned int  stage,
+			    unsigned int  *count,
+			    ipmi_time_t   *total_time,
+			    ipmi_time_t   *max_time,
+			    ipmi_time_t   *wait_time)
+{
+    CHECK_DOMAIN_LOCK(domain);
+
+    if (stage >= IPMI_DOMAIN_NUM_STAGES)
+	return EINVAL;
+
+    ipmi_lock(domain->stage_lock);
+    if (count)
+	*count = domain->stage_stats[stage].count;
+    if (total_time)
+	*total_time = domain->stage_stats[stage].total_time;
+    if (max_time)
+	*max_time = domain->stage_stats[stage].max_time;
+    if (wait_time)
+	*wait_time = domain->stage_stats[stage].wait_time;
+    ipmi_unlock(domain->stage_lock);
+    return 0;
+}
+
+/* Report where the startup time went once the domain is fully up. */
+static void
+log_stage_stats(ipmi_domain_t *domain)
+{
+    unsigned int i;
+
+    ipmi_lock(domain->stage_lock);
+    for (i=0; i<IPMI_DOMAIN_NUM_STAGES; i++) {
+	if (domain->stage_stats[i].count == 0)
+	    continue;
+	ipmi_log(IPMI_LOG_INFO,
+		 "%sdomain.c(log_stage_stats): "
+		 "Startup stage %s: %u done, %lld ms total, %lld ms max,"
+		 " %lld ms waiting for budget",
+		 DOMAIN_NAME(domain), stage_names[i],
+		 domain->stage_stats[i].count,
+		 (long long) domain->stage_stats[i].total_time / 1000000,
+		 (long long) domain->stage_stats[i].max_time / 1000000,
+		 (long long) domain->stage_stats[i].wait_time / 1000000);
+    }
+    ipmi_unlock(domain->stage_lock);
+}
+
 /***********************************************************************
  *
  * Used for handling detecting when the domain is fully up.
@@ -468,6 +678,7 @@ _ipmi_put_domain_fully_up(ipmi_domain_t *domain, char *name)
 	domain_fully_up_cb_data = domain->domain_fully_up_cb_data;
 	domain->domain_fully_up = NULL;
 	ipmi_unlock(domain->domain_lock);
+	log_stage_stats(domain);
 	domain_fully_up(domain, domain_fully_up_cb_data);
 	return;
     }
@@ -594,6 +805,10 @@ cleanup_domain(ipmi_domain_t *domain)
        cause the right thing to happen. */
     cancel_domain_oem_check(domain);
 
+    /* Queued startup stages hold MC and FRU fetch state, finish them
+       before the MCs and entities are cleaned up. */
+    stage_cancel_all(domain);
+
     if (domain->attr) {
 	locked_list_iterate(domain->attr, destroy_attr, domain);
 	locked_list_destroy(domain->attr);
@@ -750,6 +965,8 @@ cleanup_domain(ipmi_domain_t *domain)
     }
     if (domain->event_handlers_cl)
 	locked_list_destroy(domain->event_handlers_cl);
+    if (domain->event_batch_handlers)
+	locked_list_destroy(domain->event_batch_handlers);
 
     if (domain->con_change_handlers) {
 	locked_list_iterate(domain->con_change_handlers, con_change_cleanup,
@@ -824,6 +1041,9 @@ cleanup_domain(ipmi_domain_t *domain)
     if (domain->con_stat_info)
 	ipmi_ll_con_free_stat_info(domain->con_stat_info);
 
+    if (domain->topo_saved)
+	ipmi_mem_free(domain->topo_saved);
+
     /* Locks must be last, because they can be used by many things. */
     if (domain->ipmb_ignores_lock)
 	ipmi_destroy_lock(domain->ipmb_ignores_lock);
@@ -833,6 +1053,10 @@ cleanup_domain(ipmi_domain_t *domain)
 	ipmi_destroy_lock(domain->con_lock);
     if (domain->domain_lock)
 	ipmi_destroy_lock(domain->domain_lock);
+    if (domain->sensor_reading_lock)
+	ipmi_destroy_lock(domain->sensor_reading_lock);
+    if (domain->stage_lock)
+	ipmi_destroy_lock(domain->stage_lock);
 
     /* Cruft */
     free_domain_cruft(domain);
@@ -912,6 +1136,19 @@ process_options(ipmi_domain_t      *domain,
 	    domain->option_local_only = options[i].ival != 0;
 	    domain->option_local_only_set = 1;
 	    break;
+	case IPMI_OPEN_OPTION_SENSOR_READING_TTL:
+	    if (options[i].ival < 0)
+		return EINVAL;
+	    domain->option_sensor_reading_ttl = options[i].ival;
+	    break;
+	case IPMI_OPEN_OPTION_STARTUP_BUDGET:
+	    if (options[i].ival < 0)
+		return EINVAL;
+	    domain->option_startup_budget = options[i].ival;
+	    break;
+	case IPMI_OPEN_OPTION_TOPOLOGY_SNAPSHOT:
+	    domain->option_topology_snapshot = options[i].ival != 0;
+	    break;
 	default:
 	    return EINVAL;
 	}
@@ -1045,6 +1282,14 @@ setup_domain(const char         *name,
     if (rv)
 	goto out_err;
 
+    rv = ipmi_create_lock(domain, &domain->sensor_reading_lock);
+    if (rv)
+	goto out_err;
+
+    rv = ipmi_create_lock(domain, &domain->stage_lock);
+    if (rv)
+	goto out_err;
+
     domain->activate_timer_info = ipmi_mem_alloc(sizeof(activate_timer_info_t));
     if (!domain->activate_timer_info) {
 	rv = ENOMEM;
@@ -1078,6 +1323,12 @@ setup_domain(const char         *name,
 	goto out_err;
     }
 
+    domain->event_batch_handlers = locked_list_alloc(domain->os_hnd);
+    if (!domain->event_batch_handlers) {
+	rv = ENOMEM;
+	goto out_err;
+    }
+
     domain->attr = locked_list_alloc(domain->os_hnd);
     if (!domain->attr) {
 	rv = ENOMEM;
@@ -1244,6 +1495,18 @@ _ipmi_domain_entity_unlock(ipmi_domain_t *domain)
     ipmi_unlock(domain->entities_lock);
 }
 
+void
+_ipmi_domain_sensor_reading_lock(ipmi_domain_t *domain)
+{
+    ipmi_lock(domain->sensor_reading_lock);
+}
+
+void
+_ipmi_domain_sensor_reading_unlock(ipmi_domain_t *domain)
+{
+    ipmi_unlock(domain->sensor_reading_lock);
+}
+
 void
 _ipmi_domain_mc_lock(ipmi_domain_t *domain)
 {
@@ -2164,6 +2427,29 @@ send_command_option(ipmi_domain_t           *domain,
 						handler_data);
 }
 
+/* Fill in the connection options for a message, returns NULL if
+   none are needed.  opt must have room for three options. */
+static ipmi_con_option_t *
+msg_con_options(ipmi_con_option_t *opt, int side_effects, int priority)
+{
+    int i = 0;
+
+    if (side_effects) {
+	opt[i].option = IPMI_CON_MSG_OPTION_SIDE_EFFECTS;
+	opt[i].ival = 1;
+	i++;
+    }
+    if (priority >= 0) {
+	opt[i].option = IPMI_CON_MSG_OPTION_PRIORITY;
+	opt[i].ival = priority;
+	i++;
+    }
+    if (i == 0)
+	return NULL;
+    opt[i].option = IPMI_CON_OPTION_LIST_END;
+    return opt;
+}
+
 static int
 send_command_addr(ipmi_domain_t                *domain,
 		  const ipmi_addr_t            *addr,
@@ -2172,7 +2458,8 @@ send_command_addr(ipmi_domain_t                *domain,
 		  ipmi_addr_response_handler_t rsp_handler,
 		  void                         *rsp_data1,
 		  void                         *rsp_data2,
-		  int			       side_effects)
+		  int			       side_effects,
+		  int			       priority)
 {
     int                          rv;
     int                          u;
@@ -2182,8 +2469,8 @@ send_command_addr(ipmi_domain_t                *domain,
     void                         *data4 = NULL;
     int                          is_ipmb = 0;
     ipmi_msgi_t                  *rspi;
-    ipmi_con_option_t            opt_data[2];
-    ipmi_con_option_t		 *options = NULL;
+    ipmi_con_option_t            opt_data[3];
+    ipmi_con_option_t		 *options;
 
     if (addr_len > sizeof(ipmi_addr_t))
 	return EINVAL;
@@ -2194,12 +2481,7 @@ send_command_addr(ipmi_domain_t                *domain,
     if (domain->in_shutdown)
 	return EINVAL;
 
-    if (side_effects) {
-	options = opt_data;
-	options[0].option = IPMI_CON_MSG_OPTION_SIDE_EFFECTS;
-	options[0].ival = 1;
-	options[1].option = IPMI_CON_OPTION_LIST_END;
-    }
+    options = msg_con_options(opt_data, side_effects, priority);
 
     CHECK_DOMAIN_LOCK(domain);
 
@@ -2271,6 +2553,7 @@ send_command_addr(ipmi_domain_t                *domain,
     nmsg->rsp_item->data2 = rsp_data2;
 
     nmsg->side_effects = side_effects;
+    nmsg->priority = priority;
 
     ipmi_lock(domain->cmds_lock);
     nmsg->seq = domain->cmds_seq;
@@ -2323,7 +2606,7 @@ ipmi_send_command_addr(ipmi_domain_t                *domain,
 		       void                         *rsp_data2)
 {
     return send_command_addr(domain, addr, addr_len, msg, rsp_handler,
-			     rsp_data1, rsp_data2, 0);
+			     rsp_data1, rsp_data2, 0, -1);
 }
 
 int
@@ -2336,7 +2619,21 @@ ipmi_send_command_addr_sideeff(ipmi_domain_t                *domain,
 			       void                         *rsp_data2)
 {
     return send_command_addr(domain, addr, addr_len, msg, rsp_handler,
-			     rsp_data1, rsp_data2, 1);
+			     rsp_data1, rsp_data2, 1, -1);
+}
+
+int
+ipmi_send_command_addr_prio(ipmi_domain_t                *domain,
+			    const ipmi_addr_t	         *addr,
+			    unsigned int                 addr_len,
+			    const ipmi_msg_t             *msg,
+			    int                          priority,
+			    ipmi_addr_response_handler_t rsp_handler,
+			    void                         *rsp_data1,
+			    void                         *rsp_data2)
+{
+    return send_command_addr(domain, addr, addr_len, msg, rsp_handler,
+			     rsp_data1, rsp_data2, 0, priority);
 }
 
 /* Take all the commands for any inactive or down connection and
@@ -2356,8 +2653,8 @@ reroute_cmds(ipmi_domain_t *domain, int old_con, int new_con)
 	nmsg = ilist_get(&iter);
 	if (nmsg->con == old_con) {
 	    ipmi_msgi_t       *rspi;
-	    ipmi_con_option_t opt_data[2];
-	    ipmi_con_option_t *options = NULL;
+	    ipmi_con_option_t opt_data[3];
+	    ipmi_con_option_t *options;
 
 	    nmsg->seq = domain->cmds_seq;
 	    domain->cmds_seq++; /* Make the message unique so a
@@ -2369,12 +2666,8 @@ reroute_cmds(ipmi_domain_t *domain, int old_con, int new_con)
 	    if (!rspi)
 		goto send_err;
 
-	    if (nmsg->side_effects) {
-		options = opt_data;
-		options[0].option = IPMI_CON_MSG_OPTION_SIDE_EFFECTS;
-		options[0].ival = 1;
-		options[1].option = IPMI_CON_OPTION_LIST_END;
-	    }
+	    options = msg_con_options(opt_data, nmsg->side_effects,
+				      nmsg->priority);
 
 	    rspi->data1 = domain;
 	    rspi->data2 = nmsg;
@@ -2890,6 +3183,8 @@ mc_scan_done(ipmi_domain_t *domain, int err, void *cb_data)
     bus_scan_handler = domain->bus_scan_handler;
     bus_scan_handler_cb_data = domain->bus_scan_handler_cb_data;
     ipmi_unlock(domain->mc_lock);
+    if (domain->option_topology_snapshot)
+	topology_save(domain);
     if (bus_scan_handler)
 	bus_scan_handler(domain, 0,
 			 bus_scan_handler_cb_data);
@@ -3095,6 +3390,297 @@ domain_audit(void *cb_data, os_hnd_timer_id_t *id)
     ipmi_unlock(info->lock);
 }
 
+/***********************************************************************
+ *
+ * Topology snapshot.  The MCs found on the IPMB are saved in the
+ * local database under the system GUID and, on the next connection,
+ * added back before the bus scan starts, so they (and their cached
+ * SDRs) are available right away.  The bus scan then checks each one
+ * like it would any other MC it already knew about: an MC whose
+ * device id has changed is replaced and one that does not answer is
+ * removed.
+ *
+ * The format is a version byte followed by one record per MC: the
+ * channel, the IPMB address and the 16 bytes of its get device id
+ * response (starting with the completion code).
+ *
+ **********************************************************************/
+
+#define TOPO_FORMAT	1
+#define TOPO_REC_LEN	18
+
+typedef struct topo_save_s
+{
+    unsigned char *data;
+    unsigned int  len;
+    unsigned int  size;
+} topo_save_t;
+
+static void
+topology_save_mc(ipmi_domain_t *domain, ipmi_mc_t *mc, void *cb_data)
+{
+    topo_save_t   *info = cb_data;
+    char          addr_data[sizeof(ipmi_addr_t)];
+    ipmi_addr_t   *addr = (ipmi_addr_t *) addr_data;
+    unsigned int  addr_len;
+    unsigned char *d;
+
+    if (!info->data || !ipmi_mc_is_active(mc))
+	return;
+    ipmi_mc_get_ipmi_address(mc, addr, &addr_len);
+    if (addr->addr_type != IPMI_IPMB_ADDR_TYPE)
+	return;
+
+    if (info->len + TOPO_REC_LEN > info->size) {
+	d = ipmi_mem_alloc(info->size * 2);
+	if (d)
+	    memcpy(d, info->data, info->len);
+	ipmi_mem_free(info->data);
+	info->data = d;
+	info->size *= 2;
+	if (!d)
+	    return;
+    }
+
+    d = info->data + info->len;
+    d[0] = addr->channel;
+    d[1] = ((ipmi_ipmb_addr_t *) addr)->slave_addr;
+    _ipmi_mc_get_device_id_rsp(mc, d + 2);
+    info->len += TOPO_REC_LEN;
+}
+
+static void
+topology_save(ipmi_domain_t *domain)
+{
+    topo_save_t info;
+
+    if (!domain->topo_key_set || !domain->os_hnd->database_store)
+	return;
+
+    info.size = 1 + (TOPO_REC_LEN * 16);
+    info.data = ipmi_mem_alloc(info.size);
+    if (!info.data)
+	return;
+    info.data[0] = TOPO_FORMAT;
+    info.len = 1;
+    ipmi_domain_iterate_mcs(domain, topology_save_mc, &info);
+    if (!info.data)
+	return;
+
+    /* The bus gets rescanned periodically, don't rewrite the database
+       if nothing has changed. */
+    if (domain->topo_saved && (domain->topo_saved_len == info.len)
+	&& (memcmp(domain->topo_saved, info.data, info.len) == 0))
+    {
+	ipmi_mem_free(info.data);
+	return;
+    }
+
+    domain->os_hnd->database_store(domain->os_hnd, domain->topo_key,
+				   info.data, info.len);
+    if (domain->topo_saved)
+	ipmi_mem_free(domain->topo_saved);
+    domain->topo_saved = info.data;
+    domain->topo_saved_len = info.len;
+}
+
+static int
+topology_add_mc(ipmi_domain_t *domain, unsigned char *d)
+{
+    ipmi_ipmb_addr_t addr;
+    ipmi_msg_t       msg;
+    ipmi_mc_t        *mc;
+    int              rv;
+
+    if ((d[0] >= MAX_IPMI_USED_CHANNELS)
+	|| (domain->chan[d[0]].medium != IPMI_CHANNEL_MEDIUM_IPMB)
+	|| in_ipmb_ignores(domain, d[0], d[1]))
+	return 0;
+
+    addr.addr_type = IPMI_IPMB_ADDR_TYPE;
+    addr.channel = d[0];
+    addr.slave_addr = d[1];
+    addr.lun = 0;
+
+    mc = _ipmi_find_mc_by_addr(domain, (ipmi_addr_t *) &addr, sizeof(addr));
+    if (mc) {
+	/* Already found by somebody else. */
+	_ipmi_mc_put(mc);
+	return 0;
+    }
+
+    rv = _ipmi_create_mc(domain, (ipmi_addr_t *) &addr, sizeof(addr), &mc);
+    if (rv)
+	return rv;
+
+    rv = add_mc_to_domain(domain, mc);
+    if (rv) {
+	_ipmi_cleanup_mc(mc);
+	goto out;
+    }
+
+    msg.netfn = IPMI_APP_NETFN | 1;
+    msg.cmd = IPMI_GET_DEVICE_ID_CMD;
+    msg.data = d + 2;
+    msg.data_len = TOPO_REC_LEN - 2;
+    rv = _ipmi_mc_get_device_id_data_from_rsp(mc, &msg);
+    if (rv) {
+	_ipmi_cleanup_mc(mc);
+	goto out;
+    }
+
+    _ipmi_mc_handle_new(mc);
+    call_mc_upd_handlers(domain, mc, IPMI_ADDED);
+
+ out:
+    _ipmi_mc_put(mc);
+    return rv;
+}
+
+static void
+topology_restore(ipmi_domain_t *domain, unsigned char *data, unsigned int len)
+{
+    unsigned int count = 0;
+    unsigned int i;
+
+    if ((len < 1) || (data[0] != TOPO_FORMAT)
+	|| (((len - 1) % TOPO_REC_LEN) != 0))
+    {
+	ipmi_log(IPMI_LOG_WARNING,
+		 "%sdomain.c(topology_restore): "
+		 "Invalid topology snapshot, ignoring it",
+		 DOMAIN_NAME(domain));
+	return;
+    }
+
+    for (i=1; i<len; i+=TOPO_REC_LEN) {
+	if (topology_add_mc(domain, data + i) == 0)
+	    count++;
+    }
+
+    /* Remember what was saved, so the scan won't rewrite it if
+       nothing changed. */
+    if (domain->topo_saved)
+	ipmi_mem_free(domain->topo_saved);
+    domain->topo_saved_len = 0;
+    domain->topo_saved = ipmi_mem_alloc(len);
+    if (domain->topo_saved) {
+	memcpy(domain->topo_saved, data, len);
+	domain->topo_saved_len = len;
+    }
+
+    ipmi_log(IPMI_LOG_INFO,
+	     "%sdomain.c(topology_restore): "
+	     "Restored %d of %d MCs from the topology snapshot",
+	     DOMAIN_NAME(domain), count, (len - 1) / TOPO_REC_LEN);
+}
+
+static void
+topology_restore_done(ipmi_domain_t *domain)
+{
+    ipmi_domain_start_full_ipmb_scan(domain);
+    _ipmi_put_domain_fully_up(domain, "topology_restore_done");
+}
+
+typedef struct topo_fetch_s
+{
+    ipmi_domain_id_t domain_id;
+    os_handler_t     *os_hnd;
+    int              err;
+    unsigned char    *data;
+    unsigned int     len;
+} topo_fetch_t;
+
+static void
+topology_fetched_cb(ipmi_domain_t *domain, void *cb_data)
+{
+    topo_fetch_t *info = cb_data;
+
+    if (!info->err && !domain->in_shutdown)
+	topology_restore(domain, info->data, info->len);
+    topology_restore_done(domain);
+}
+
+static void
+topology_fetched(void          *cb_data,
+		 int           err,
+		 unsigned char *data,
+		 unsigned int  len)
+{
+    topo_fetch_t *info = cb_data;
+
+    info->err = err;
+    info->data = data;
+    info->len = len;
+    /* If the domain has gone away, there is nothing to do. */
+    ipmi_domain_pointer_cb(info->domain_id, topology_fetched_cb, info);
+    if (!err)
+	info->os_hnd->database_free(info->os_hnd, data);
+    ipmi_mem_free(info);
+}
+
+static void
+topology_restore_start(ipmi_domain_t *domain)
+{
+    os_handler_t  *os_hnd = domain->os_hnd;
+    topo_fetch_t  *info;
+    unsigned char guid[16];
+    unsigned char *data;
+    unsigned int  len;
+    unsigned int  fetched = 0;
+    char          *s;
+    int           i;
+    int           rv;
+
+    /* The scan is started when the snapshot has been handled, keep
+       the domain from being reported fully up until then. */
+    _ipmi_get_domain_fully_up(domain, "topology_restore_start");
+
+    if (ipmi_domain_get_guid(domain, guid)) {
+	ipmi_log(IPMI_LOG_WARNING,
+		 "%sdomain.c(topology_restore_start): "
+		 "The BMC has no system GUID, not using the topology"
+		 " snapshot",
+		 DOMAIN_NAME(domain));
+	goto out_done;
+    }
+
+    s = domain->topo_key;
+    s += sprintf(s, "topo-");
+    for (i=0; i<16; i++)
+	s += sprintf(s, "%2.2x", guid[i]);
+    domain->topo_key_set = 1;
+
+    if (!ipmi_option_IPMB_scan(domain) || !domain->do_bus_scan
+	|| !os_hnd->database_find)
+	/* Nothing would check the restored MCs, just keep saving. */
+	goto out_done;
+
+    info = ipmi_mem_alloc(sizeof(*info));
+    if (!info)
+	goto out_done;
+    info->domain_id = ipmi_domain_convert_to_id(domain);
+    info->os_hnd = os_hnd;
+
+    rv = os_hnd->database_find(os_hnd, domain->topo_key, &fetched,
+			       &data, &len, topology_fetched, info);
+    if (rv) {
+	/* Nothing saved yet. */
+	ipmi_mem_free(info);
+	goto out_done;
+    }
+    if (!fetched)
+	/* topology_fetched() will finish up. */
+	return;
+
+    ipmi_mem_free(info);
+    topology_restore(domain, data, len);
+    os_hnd->database_free(os_hnd, data);
+
+ out_done:
+    topology_restore_done(domain);
+}
+
 /***********************************************************************
  *
  * Incoming event handling.
@@ -3116,7 +3702,7 @@ event_sensor_cb(ipmi_sensor_t *sensor, void *cb_data)
     info->err = ipmi_sensor_event(sensor, info->event);
 }
 
-void
+int
 _ipmi_domain_system_event_handler(ipmi_domain_t *domain,
 				  ipmi_mc_t     *ev_mc,
 				  ipmi_event_t  *event)
@@ -3151,7 +3737,7 @@ _ipmi_domain_system_event_handler(ipmi_domain_t *domain,
        a go at it first.  Note that OEM handlers must look at the time
        themselves. */
     if (_ipmi_mc_check_sel_oem_event_handler(ev_mc, event))
-	return;
+	return 0;
 
     /* It's a system event record from an MC, and the timestamp is
        later than our startup timestamp. */
@@ -3170,7 +3756,7 @@ _ipmi_domain_system_event_handler(ipmi_domain_t *domain,
 	   next. */
 	if (_ipmi_mc_check_oem_event_handler(mc, event)) {
 	    _ipmi_mc_put(mc);
-	    return;
+	    return 0;
 	}
 
 	/* The OEM code didn't handle it. */
@@ -3190,8 +3776,11 @@ _ipmi_domain_system_event_handler(ipmi_domain_t *domain,
 
  out:
     /* It's an event from system software, or the info couldn't be found. */
-    if (rv)
+    if (rv) {
 	ipmi_handle_unhandled_event(domain, event);
+	return 1;
+    }
+    return 0;
 }
 
 static void
@@ -3242,9 +3831,15 @@ ll_event_handler(ipmi_con_t        *ipmi,
 	/* Add it to the mc's event log. */
 	rv = _ipmi_mc_sel_event_add(mc, event);
 
-	if (rv != EEXIST)
+	if ((rv != EEXIST)
 	    /* Call the handler on it if it wasn't already in there. */
-	    _ipmi_domain_system_event_handler(domain, mc, event);
+	    && _ipmi_domain_system_event_handler(domain, mc, event)
+	    && _ipmi_domain_has_event_batch_handlers(domain))
+	{
+	    /* Async events are not part of a fetch, they are a batch
+	       of their own. */
+	    _ipmi_domain_event_batch(domain, &event, 1);
+	}
     }
     _ipmi_mc_put(mc);
 
@@ -3278,6 +3873,69 @@ ipmi_handle_unhandled_event(ipmi_domain_t *domain, ipmi_event_t *event)
     locked_list_iterate(domain->event_handlers, call_event_handler, &info);
 }
 
+typedef struct call_event_batch_handler_s
+{
+    ipmi_domain_t *domain;
+    ipmi_event_t  **events;
+    unsigned int  count;
+} call_event_batch_handler_t;
+
+static int
+call_event_batch_handler(void *cb_data, void *item1, void *item2)
+{
+    call_event_batch_handler_t  *info = cb_data;
+    ipmi_event_batch_handler_cb handler = item1;
+
+    handler(info->domain, info->events, info->count, item2);
+    return LOCKED_LIST_ITER_CONTINUE;
+}
+
+int
+_ipmi_domain_has_event_batch_handlers(ipmi_domain_t *domain)
+{
+    return locked_list_num_entries(domain->event_batch_handlers) != 0;
+}
+
+void
+_ipmi_domain_event_batch(ipmi_domain_t *domain,
+			 ipmi_event_t  **events,
+			 unsigned int  count)
+{
+    call_event_batch_handler_t info;
+
+    info.domain = domain;
+    info.events = events;
+    info.count = count;
+    locked_list_iterate(domain->event_batch_handlers,
+			call_event_batch_handler, &info);
+}
+
+int
+ipmi_domain_add_event_batch_handler(ipmi_domain_t               *domain,
+				    ipmi_event_batch_handler_cb handler,
+				    void                        *cb_data)
+{
+    CHECK_DOMAIN_LOCK(domain);
+
+    if (locked_list_add(domain->event_batch_handlers, handler, cb_data))
+	return 0;
+    else
+	return ENOMEM;
+}
+
+int
+ipmi_domain_remove_event_batch_handler(ipmi_domain_t               *domain,
+				       ipmi_event_batch_handler_cb handler,
+				       void                        *cb_data)
+{
+    CHECK_DOMAIN_LOCK(domain);
+
+    if (locked_list_remove(domain->event_batch_handlers, handler, cb_data))
+	return 0;
+    else
+	return EINVAL;
+}
+
 int
 ipmi_domain_add_event_handler(ipmi_domain_t           *domain,
 			      ipmi_event_handler_cb   handler,
@@ -4567,7 +5225,10 @@ con_up_complete(ipmi_domain_t *domain)
     if (con_up_handler)
 	con_up_handler(domain, con_up_handler_cb_data);
 
-    ipmi_domain_start_full_ipmb_scan(domain);
+    if (domain->option_topology_snapshot)
+	topology_restore_start(domain);
+    else
+	ipmi_domain_start_full_ipmb_scan(domain);
 
     ipmi_detect_ents_presence_changes(domain->entities, 1);
 
@@ -5510,6 +6171,24 @@ ipmi_option_use_cache(ipmi_domain_t *domain)
     return domain->option_use_cache;
 }
 
+unsigned int
+ipmi_option_sensor_reading_ttl(ipmi_domain_t *domain)
+{
+    return domain->option_sensor_reading_ttl;
+}
+
+unsigned int
+ipmi_option_startup_budget(ipmi_domain_t *domain)
+{
+    return domain->option_startup_budget;
+}
+
+int
+ipmi_option_topology_snapshot(ipmi_domain_t *domain)
+{
+    return domain->option_topology_snapshot;
+}
+
 int
 ipmi_option_activate_if_possible(ipmi_domain_t *domain)
 {
@@ -5564,6 +5564,24 @@ typedef struct fru_ent_info_s
     void               *cb_data;
     ipmi_fru_t         *fru;
     int                err;
+
+    /* One reference for ipmi_entity_fetch_frus_cb() and one for the
+       fetch.  While the former holds its reference start_rv points to
+       its return value, so an error starting the fetch right away can
+       be returned from it. */
+    ipmi_lock_t        *lock;
+    unsigned int       refs;
+    int                *start_rv;
+
+    /* Where to fetch the FRU from, saved in case the fetch has to
+       wait for the domain's startup budget. */
+    ipmi_domain_stage_t stage;
+    unsigned char      is_logical_fru;
+    unsigned char      access_address;
+    unsigned char      fru_device_id;
+    unsigned char      lun;
+    unsigned char      private_bus_id;
+    unsigned char      channel;
 } fru_ent_info_t;
 
 static void
@@ -5590,13 +5608,13 @@ fru_fetched_ent_cb(ipmi_entity_t *ent, void *cb_data)
 		 "Error fetching entity %d.%d FRU: %x",
 		 ENTITY_NAME(ent),
 		 ent->key.entity_id, ent->key.entity_instance, info->err);
-	if ((ent->fru) && (info->fru))
-	    /* Keep the old FRU on errors. */
-	    ipmi_fru_destroy_internal(info->fru, NULL, NULL);
-	else
+	if (!ent->fru)
 	    /* Keep it if we got it, it might have some useful
 	       information. */
 	    ent->fru = info->fru;
+	else if (info->fru)
+	    /* Keep the old FRU on errors. */
+	    ipmi_fru_destroy_internal(info->fru, NULL, NULL);
 	_ipmi_entity_call_fru_handlers(ent, IPMI_CHANGED);
     }
 
@@ -5604,6 +5622,20 @@ fru_fetched_ent_cb(ipmi_entity_t *ent, void *cb_data)
 	info->done(ent, info->cb_data);
 }
 
+static void
+fru_info_put(fru_ent_info_t *info)
+{
+    unsigned int refs;
+
+    ipmi_lock(info->lock);
+    refs = --info->refs;
+    ipmi_unlock(info->lock);
+    if (refs == 0) {
+	ipmi_destroy_lock(info->lock);
+	ipmi_mem_free(info);
+    }
+}
+
 static void
 fru_fetched_handler(ipmi_domain_t *domain, ipmi_fru_t *fru,
 		    int err, void *cb_data)
@@ -5614,19 +5646,71 @@ fru_fetched_handler(ipmi_domain_t *domain, ipmi_fru_t *fru,
     info->fru = fru;
     info->err = err;
 
+    if (domain)
+	_ipmi_domain_stage_done(domain, &info->stage);
+
     rv = ipmi_entity_pointer_cb(info->ent_id, fru_fetched_ent_cb, info);
     if (rv) {
 	/* If we can't put the fru someplace, just destroy it. */
-	ipmi_fru_destroy_internal(fru, NULL, NULL);
+	if (fru)
+	    ipmi_fru_destroy_internal(fru, NULL, NULL);
 	if (info->done)
 	    info->done(NULL, info->cb_data);
     }
 
-    ipmi_mem_free(info);
+    fru_info_put(info);
     if (domain)
 	_ipmi_put_domain_fully_up(domain, "fru_fetched_handler");
 }
 
+static void
+fru_stage_start(ipmi_domain_t *domain, ipmi_domain_stage_t *stage)
+{
+    fru_ent_info_t *info = stage->cb_data;
+    int            rv;
+
+    if (stage->cancelled) {
+	rv = ECANCELED;
+	goto out_err;
+    }
+
+    rv = ipmi_fru_alloc_notrack(domain,
+				info->is_logical_fru,
+				info->access_address,
+				info->fru_device_id,
+				info->lun,
+				info->private_bus_id,
+				info->channel,
+				IPMI_FRU_ALL_AREA_MASK, 
+				fru_fetched_handler,
+				info,
+				NULL);
+    if (!rv)
+	return;
+
+    ipmi_log(IPMI_LOG_WARNING,
+	     "%sentity.c(fru_stage_start):"
+	     " Unable to allocate the FRU: %x",
+	     DOMAIN_NAME(domain), rv);
+
+ out_err:
+    ipmi_lock(info->lock);
+    if (info->start_rv) {
+	/* Still in ipmi_entity_fetch_frus_cb(), return the error
+	   from there like before the fetch was staged. */
+	*info->start_rv = rv;
+	ipmi_unlock(info->lock);
+	_ipmi_domain_stage_done(domain, stage);
+	fru_info_put(info);
+	_ipmi_put_domain_fully_up(domain, "fru_stage_start");
+	return;
+    }
+    ipmi_unlock(info->lock);
+
+    /* Report it like any other fetch error. */
+    fru_fetched_handler(domain, NULL, rv, info);
+}
+
 int
 ipmi_entity_fetch_frus_cb(ipmi_entity_t      *ent,
 			  ipmi_entity_ptr_cb done,
@@ -5641,32 +5725,35 @@ ipmi_entity_fetch_frus_cb(ipmi_entity_t      *ent,
     info = ipmi_mem_alloc(sizeof(*info));
     if (!info)
 	return ENOMEM;
+    memset(info, 0, sizeof(*info));
+
+    rv = ipmi_create_lock(ent->domain, &info->lock);
+    if (rv) {
+	ipmi_mem_free(info);
+	return rv;
+    }
+    info->refs = 2;
+    info->start_rv = &rv;
 
     info->ent_id = ipmi_entity_convert_to_id(ent);
     info->done = done;
     info->cb_data = cb_data;
+    info->is_logical_fru = ent->info.is_logical_fru;
+    info->access_address = ent->info.access_address;
+    info->fru_device_id = ent->info.fru_device_id;
+    info->lun = ent->info.lun;
+    info->private_bus_id = ent->info.private_bus_id;
+    info->channel = ent->info.channel;
 
     /* fetch the FRU information. */
     _ipmi_get_domain_fully_up(ent->domain, "ipmi_entity_fetch_frus_cb");
-    rv = ipmi_fru_alloc_notrack(ent->domain,
-				ent->info.is_logical_fru,
-				ent->info.access_address,
-				ent->info.fru_device_id,
-				ent->info.lun,
-				ent->info.private_bus_id,
-				ent->info.channel,
-				IPMI_FRU_ALL_AREA_MASK, 
-				fru_fetched_handler,
-				info,
-				NULL);
-    if (rv) {
-	ipmi_mem_free(info);
-	ipmi_log(IPMI_LOG_WARNING,
-		 "%sentity.c(ipmi_entity_fetch_frus_cb):"
-		 " Unable to allocate the FRU: %x",
-		 ENTITY_NAME(ent), rv);
-	_ipmi_put_domain_fully_up(ent->domain, "ipmi_entity_fetch_frus_cb");
-    }
+    _ipmi_domain_stage_start(ent->domain, &info->stage, IPMI_DOMAIN_STAGE_FRU,
+			     fru_stage_start, info);
+
+    ipmi_lock(info->lock);
+    info->start_rv = NULL;
+    ipmi_unlock(info->lock);
+    fru_info_put(info);
 
     return rv;
 }
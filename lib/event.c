@@ -479,3 +479,201 @@ ipmi_event_call_handler(ipmi_domain_t         *domain,
 	rv = info.rv;
     return rv;
 }
+
+/* Events in a batch usually come from a few sensors on a few MCs, so
+   remember the generating MCs we have already looked up. */
+#define BATCH_MC_CACHE_SIZE 16
+
+typedef struct batch_mc_cache_s
+{
+    unsigned int gen;
+    ipmi_mcid_t  mcid;
+    int          valid;
+} batch_mc_cache_t;
+
+typedef struct event_batch_call_s
+{
+    ipmi_domain_t         *domain;
+    ipmi_event_handlers_t *handlers;
+    ipmi_event_t          **events;
+    unsigned int          count;
+    unsigned int          curr;
+    ipmi_sensor_id_t      *ids;
+    int                   *results;
+    unsigned char         *done;
+    void                  *cb_data;
+} event_batch_call_t;
+
+/* Find the sensor ids for the events starting at info->curr that are
+   in the same SEL, and leave info->curr at the first one that
+   isn't. */
+static void
+batch_resolve_sensors(event_batch_call_t *info, ipmi_mc_t *sel_mc)
+{
+    batch_mc_cache_t    cache[BATCH_MC_CACHE_SIZE];
+    unsigned int        cache_len = 0;
+    ipmi_mcid_t         sel_mcid;
+    unsigned int        i, j;
+    ipmi_event_t        *event;
+    const unsigned char *data;
+    unsigned int        gen;
+    ipmi_sensor_id_t    *id;
+    ipmi_mc_t           *mc;
+
+    sel_mcid = ipmi_event_get_mcid(info->events[info->curr]);
+    for (i=info->curr; i<info->count; i++) {
+	event = info->events[i];
+	if (ipmi_cmp_mc_id(ipmi_event_get_mcid(event), sel_mcid) != 0)
+	    break;
+
+	id = &info->ids[i];
+	if (ipmi_event_get_type(event) != 0x02) {
+	    ipmi_sensor_id_set_invalid(id);
+	    continue;
+	}
+
+	/* These are all the bits _ipmi_event_get_generating_mc() uses
+	   to find the MC, with the SEL's MC being the same. */
+	data = ipmi_event_get_data_ptr(event);
+	gen = data[4] | ((data[5] & 0xf0) << 4) | ((data[6] == 0x03) << 12);
+	for (j=0; j<cache_len; j++) {
+	    if (cache[j].gen == gen)
+		break;
+	}
+	if (j == cache_len) {
+	    mc = _ipmi_event_get_generating_mc(info->domain, sel_mc, event);
+	    if (j == BATCH_MC_CACHE_SIZE)
+		/* Full, just replace the last one. */
+		j--;
+	    else
+		cache_len++;
+	    cache[j].gen = gen;
+	    cache[j].valid = (mc != NULL);
+	    if (mc) {
+		cache[j].mcid = ipmi_mc_convert_to_id(mc);
+		_ipmi_mc_put(mc);
+	    }
+	}
+
+	if (!cache[j].valid) {
+	    ipmi_sensor_id_set_invalid(id);
+	    continue;
+	}
+	id->mcid = cache[j].mcid;
+	id->lun = data[5] & 0x3;
+	id->sensor_num = data[8];
+    }
+    info->curr = i;
+}
+
+static void
+batch_sel_mc_handler(ipmi_mc_t *mc, void *cb_data)
+{
+    batch_resolve_sensors(cb_data, mc);
+}
+
+/* Deliver all the events for this sensor, starting with info->curr. */
+static void
+batch_sensor_event_call(ipmi_sensor_t *sensor, void *cb_data)
+{
+    event_batch_call_t    *info = cb_data;
+    event_call_handlers_t einfo;
+    unsigned int          i;
+
+    einfo.domain = info->domain;
+    einfo.handlers = info->handlers;
+    einfo.cb_data = info->cb_data;
+    for (i=info->curr; i<info->count; i++) {
+	if (info->done[i])
+	    continue;
+	if (ipmi_cmp_sensor_id(info->ids[i], info->ids[info->curr]) != 0)
+	    continue;
+	einfo.event = info->events[i];
+	einfo.rv = 0;
+	sensor_event_call(sensor, &einfo);
+	info->results[i] = einfo.rv;
+	info->done[i] = 1;
+    }
+}
+
+int
+ipmi_event_call_handler_batch(ipmi_domain_t         *domain,
+			      ipmi_event_handlers_t *handlers,
+			      ipmi_event_t          **events,
+			      unsigned int          count,
+			      int                   *results,
+			      void                  *cb_data)
+{
+    event_batch_call_t info;
+    unsigned char      *mem;
+    unsigned int       i, j;
+    int                rv;
+
+    if (count == 0)
+	return 0;
+
+    mem = ipmi_mem_alloc(count * (sizeof(ipmi_sensor_id_t)
+				  + sizeof(int) + 1));
+    if (!mem) {
+	/* Do it the slow way. */
+	int first_rv = 0;
+
+	for (i=0; i<count; i++) {
+	    rv = ipmi_event_call_handler(domain, handlers, events[i], cb_data);
+	    if (results)
+		results[i] = rv;
+	    if (rv && !first_rv)
+		first_rv = rv;
+	}
+	return first_rv;
+    }
+
+    info.domain = domain;
+    info.handlers = handlers;
+    info.events = events;
+    info.count = count;
+    info.cb_data = cb_data;
+    info.ids = (ipmi_sensor_id_t *) mem;
+    info.results = (int *) (mem + count * sizeof(ipmi_sensor_id_t));
+    info.done = mem + count * (sizeof(ipmi_sensor_id_t) + sizeof(int));
+    memset(info.done, 0, count);
+
+    /* Look up the sensors first, one SEL at a time.  As with a single
+       event, if the MC the event is stored in is gone, try without
+       it. */
+    info.curr = 0;
+    while (info.curr < count) {
+	if (ipmi_mc_pointer_cb(ipmi_event_get_mcid(events[info.curr]),
+			       batch_sel_mc_handler, &info) != 0)
+	    batch_resolve_sensors(&info, NULL);
+    }
+
+    /* Now take each sensor once and handle all its events. */
+    for (i=0; i<count; i++) {
+	if (info.done[i])
+	    continue;
+	info.curr = i;
+	rv = ipmi_sensor_pointer_cb(info.ids[i], batch_sensor_event_call,
+				    &info);
+	if (rv) {
+	    for (j=i; j<count; j++) {
+		if (!info.done[j]
+		    && (ipmi_cmp_sensor_id(info.ids[j], info.ids[i]) == 0))
+		{
+		    info.results[j] = rv;
+		    info.done[j] = 1;
+		}
+	    }
+	}
+    }
+
+    rv = 0;
+    for (i=0; i<count; i++) {
+	if (info.results[i] && !rv)
+	    rv = info.results[i];
+    }
+    if (results)
+	memcpy(results, info.results, count * sizeof(int));
+    ipmi_mem_free(mem);
+    return rv;
+}
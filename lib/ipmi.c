@@ -579,6 +579,8 @@ ipmi_shutdown(void)
 
     ipmi_os_handler = NULL;
 
+    ipmi_mem_pool_release();
+
     ipmi_initialized = 0;
 }
 
@@ -1040,6 +1042,12 @@ ipmi_parse_options(ipmi_open_option_t *option,
     } else if (strcmp(arg, "-cache") == 0) {
 	option->option = IPMI_OPEN_OPTION_USE_CACHE;
 	option->ival = 1;
+    } else if (strcmp(arg, "-nosnapshot") == 0) {
+	option->option = IPMI_OPEN_OPTION_TOPOLOGY_SNAPSHOT;
+	option->ival = 0;
+    } else if (strcmp(arg, "-snapshot") == 0) {
+	option->option = IPMI_OPEN_OPTION_TOPOLOGY_SNAPSHOT;
+	option->ival = 1;
     } else
 	return EINVAL;
 
@@ -1060,7 +1068,8 @@ ipmi_parse_options_help(void)
 	"-[no]setseltime - setting the SEL clock\n"
 	"-[no]activate - connection activation\n"
 	"-[no]localonly - Just talk to the local BMC, (ATCA-only, for blades)\n"
-        "-[no]cache - use the local cache for SDRs.  On by default."
+        "-[no]cache - use the local cache for SDRs.  On by default.\n"
+	"-[no]snapshot - use the local cache for the list of MCs.\n"
 	"-wait_til_up - wait until the domain is up before returning";
 }
 
@@ -79,6 +79,20 @@ dump_hex(void *vdata, int len)
 #define LAN_RSP_TIMEOUT 1000000
 #define LAN_RSP_TIMEOUT_SIDEEFF 5000000
 
+/* Once round trip times to an IP address have been measured, messages
+   to the system interface use a timeout computed from them instead
+   (smoothed RTT plus four times the variance, as in RFC 6298).  It is
+   kept between this and LAN_RSP_TIMEOUT, and is doubled on each
+   retransmit of a message.  Commands with side effects use the
+   timeout scaled up by the same ratio as the fixed timeouts. */
+#define LAN_RSP_TIMEOUT_MIN 100000
+
+/* For hedged requests, the number of recent round trip times kept to
+   compute the percentile from, and how many are needed before
+   hedging starts. */
+#define LAN_HEDGE_SAMPLES 64
+#define LAN_HEDGE_MIN_SAMPLES 16
+
 /* # of times to try a message before we fail it. */
 #define LAN_RSP_RETRIES 6
 
@@ -121,12 +135,28 @@ typedef struct lan_wait_queue_s
     ipmi_ll_rsp_handler_t rsp_handler;
     ipmi_msgi_t           *rsp_item;
     int                   side_effects;
+    int                   priority;
+    struct timeval        queued_time;
 
     struct lan_wait_queue_s *next;
 } lan_wait_queue_t;
 
+/* If a message waiting to be sent has been passed over for higher
+   priority messages this many times, it goes next. */
+#define LAN_WAIT_Q_MAX_SKIPS 8
+
 #define MAX_IP_ADDR 2
 
+/* The most sessions that may be opened to each address.  The session
+   data is kept in slots, slot n (n < num_ip_addr) is the primary
+   session for address n and slot n + (k * num_ip_addr) is the k'th
+   extra session to that address. */
+#define MAX_LAN_SESSIONS 4
+#define MAX_LAN_SLOTS (MAX_IP_ADDR * MAX_LAN_SESSIONS)
+#define LAN_SLOT_ADDR(lan, slot) ((slot) % (lan)->cparm.num_ip_addr)
+#define LAN_NUM_SLOTS(lan) ((lan)->cparm.num_ip_addr \
+			    * (lan)->cparm.num_sessions)
+
 /* We must keep this number small, if it's too big and a failure
    occurs, we will be outside the sequence number before we switch. */
 #define SENDS_BETWEEN_IP_SWITCHES 3
@@ -185,6 +215,7 @@ typedef struct lan_conn_parms_s
     unsigned int  name_lookup_only;
     unsigned char bmc_key[IPMI_PASSWORD_MAX];
     unsigned int  bmc_key_len;
+    unsigned int  num_sessions;
 } lan_conn_parms_t;
 
 typedef struct lan_link_s lan_link_t;
@@ -217,7 +248,27 @@ typedef struct lan_stat_info_s
 #define STAT_INVALID_PAYLOAD	16
 #define STAT_SEQ_ERR		17
 #define STAT_RSP_NO_CMD		18
-#define NUM_STATS 19
+#define STAT_HEDGE_THRESHOLD	19
+    /* Per priority class statistics for the send wait queue.  The
+       depth is a value, the others are counts.  The wait time is the
+       total time messages of the class spent in the queue. */
+#define STAT_WAIT_Q		20
+#define   STAT_WAIT_Q_DEPTH	  0
+#define   STAT_WAIT_Q_QUEUED	  1
+#define   STAT_WAIT_Q_WAIT_USEC	  2
+#define   NUM_WAIT_Q_STATS	  3
+    /* Per IP address statistics.  The first three and the hedge
+       threshold above are values, not counts.  They are set on
+       registration and the change is added whenever they change. */
+#define STAT_IP			(STAT_WAIT_Q + (IPMI_CON_MSG_NUM_PRIORITIES \
+						* NUM_WAIT_Q_STATS))
+#define   STAT_IP_SRTT		  0
+#define   STAT_IP_RTTVAR	  1
+#define   STAT_IP_RTO		  2
+#define   STAT_IP_HEDGES	  3
+#define   STAT_IP_HEDGE_WINS	  4
+#define   NUM_IP_STATS		  5
+#define NUM_STATS (STAT_IP + (MAX_IP_ADDR * NUM_IP_STATS))
     /* Statistics */
     void *stats[NUM_STATS];
 } lan_stat_info_t;
@@ -242,7 +293,27 @@ static const char *lan_stat_names[NUM_STATS] =
     "lan_decrypt_fail",
     "lan_invalid_payload",
     "lan_seq_err",
-    "lan_rsp_no_cmd"
+    "lan_rsp_no_cmd",
+    "lan_hedge_threshold_usec",
+    "lan_waitq_interactive_depth",
+    "lan_waitq_interactive_queued",
+    "lan_waitq_interactive_wait_usec",
+    "lan_waitq_normal_depth",
+    "lan_waitq_normal_queued",
+    "lan_waitq_normal_wait_usec",
+    "lan_waitq_bulk_depth",
+    "lan_waitq_bulk_queued",
+    "lan_waitq_bulk_wait_usec",
+    "lan_ip0_srtt_usec",
+    "lan_ip0_rttvar_usec",
+    "lan_ip0_rto_usec",
+    "lan_ip0_hedges",
+    "lan_ip0_hedge_wins",
+    "lan_ip1_srtt_usec",
+    "lan_ip1_rttvar_usec",
+    "lan_ip1_rto_usec",
+    "lan_ip1_hedges",
+    "lan_ip1_hedge_wins"
 };
 
 
@@ -281,6 +352,13 @@ typedef struct lan_ip_data_s
     ipmi_rmcpp_integrity_t       *integ_info;
     void                         *integ_data;
 
+    /* Round trip time estimates for messages to the system interface,
+       all in microseconds.  Protected by seq_num_lock. */
+    unsigned int               rtt_samples;
+    int                        srtt;
+    int                        rttvar;
+    int                        rto;
+
     /* Use for linked-lists of IP addresses. */
     lan_link_t                 ip_link;
 } lan_ip_data_t;
@@ -331,8 +409,14 @@ struct lan_data_s
     /* The IP address we are currently using. */
     unsigned int               curr_ip_addr;
 
-    /* Data about each IP address */
-    lan_ip_data_t              ip[MAX_IP_ADDR];
+    /* Data about each session, see MAX_LAN_SESSIONS for the layout.
+       The round trip time estimates are kept for each address, in
+       the primary session's slot. */
+    lan_ip_data_t              ip[MAX_LAN_SLOTS];
+
+    /* The next session to try when spreading messages over the
+       sessions to each address. */
+    unsigned int               next_session[MAX_IP_ADDR];
 
     /* We keep a session on each LAN connection.  I don't think all
        systems require that, but it's safer. */
@@ -369,6 +453,18 @@ struct lan_data_s
 	int                   retries_left;
 	int                   side_effects;
 
+	/* When the message was first sent, for the RTT estimate. */
+	struct timeval        send_time;
+
+	/* For hedged requests.  If hedge_pending is set, the timer is
+	   running for the hedge threshold and hedge_rest is how long
+	   to wait after that.  hedge_ip is the address the copy was
+	   sent on, -1 if none was sent. */
+	int                   hedge_pending;
+	int                   hedge_rest;
+	int                   hedge_ip;
+	struct timeval        hedge_time;
+
 	/* If -1, just use the normal algorithm.  If not -1, force to
            this address. */
 	int                   addr_num;
@@ -391,8 +487,25 @@ struct lan_data_s
        sequence zero. */
     unsigned int max_outstanding_msg_count;
 
-    /* List of messages waiting to be sent. */
-    lan_wait_queue_t *wait_q, *wait_q_tail;
+    /* Lists of messages waiting to be sent, one per priority class.
+       wait_q_skips counts how many times a class with messages
+       waiting was passed over for a higher priority one. */
+    lan_wait_queue_t *wait_q[IPMI_CON_MSG_NUM_PRIORITIES];
+    lan_wait_queue_t *wait_q_tail[IPMI_CON_MSG_NUM_PRIORITIES];
+    unsigned int     wait_q_len[IPMI_CON_MSG_NUM_PRIORITIES];
+    unsigned int     wait_q_skips[IPMI_CON_MSG_NUM_PRIORITIES];
+
+    /* If not zero, reads without side effects to the system interface
+       are sent again on the other IP address if no response has come
+       by this percentile of recent round trip times.  The samples are
+       kept both in arrival order and sorted.  Protected by
+       seq_num_lock. */
+    unsigned int hedge_percentile;
+    unsigned int num_hedge_samples;
+    unsigned int next_hedge_sample;
+    int          hedge_samples[LAN_HEDGE_SAMPLES];
+    int          hedge_sorted[LAN_HEDGE_SAMPLES];
+    int          hedge_threshold;
 
     locked_list_t              *event_handlers;
 
@@ -1535,6 +1648,145 @@ diff_timeval(struct timeval *dest,
     }
 }
 
+/* The statistics are kept per address, addr_num may be any session
+   slot. */
+static inline void
+add_ip_stat(lan_data_t *lan, int addr_num, int stat, int count)
+{
+    if (count)
+	add_stat(lan->ipmi,
+		 STAT_IP + (LAN_SLOT_ADDR(lan, addr_num) * NUM_IP_STATS) + stat,
+		 count);
+}
+
+/* Add a round trip time to the hedge samples and recompute the hedge
+   threshold.  Must be called with the seq_num_lock held. */
+static void
+lan_hedge_sample(lan_data_t *lan, int rtt)
+{
+    int          *sorted = lan->hedge_sorted;
+    unsigned int n = lan->num_hedge_samples;
+    unsigned int i;
+    int          old_threshold = lan->hedge_threshold;
+
+    if (n == LAN_HEDGE_SAMPLES) {
+	/* Full, take the oldest sample out of the sorted list. */
+	int old = lan->hedge_samples[lan->next_hedge_sample];
+
+	for (i=0; sorted[i] != old; i++)
+	    ;
+	n--;
+	memmove(sorted + i, sorted + i + 1, (n - i) * sizeof(int));
+    }
+    lan->hedge_samples[lan->next_hedge_sample] = rtt;
+    lan->next_hedge_sample = (lan->next_hedge_sample + 1) % LAN_HEDGE_SAMPLES;
+
+    for (i=n; (i > 0) && (sorted[i-1] > rtt); i--)
+	sorted[i] = sorted[i-1];
+    sorted[i] = rtt;
+    n++;
+    lan->num_hedge_samples = n;
+
+    if (n >= LAN_HEDGE_MIN_SAMPLES)
+	lan->hedge_threshold = sorted[(n * lan->hedge_percentile) / 100];
+    add_stat(lan->ipmi, STAT_HEDGE_THRESHOLD,
+	     lan->hedge_threshold - old_threshold);
+}
+
+/* Add a round trip time measurement for the address of the given
+   session slot.  Must be called with the seq_num_lock held. */
+static void
+lan_rtt_sample(lan_data_t *lan, int addr_num, struct timeval *send_time)
+{
+    lan_ip_data_t  *ip = &lan->ip[LAN_SLOT_ADDR(lan, addr_num)];
+    struct timeval now, diff;
+    int            rtt, err;
+    int            old_srtt = ip->srtt;
+    int            old_rttvar = ip->rttvar;
+    int            old_rto = ip->rto;
+
+    lan->ipmi->os_hnd->get_monotonic_time(lan->ipmi->os_hnd, &now);
+    diff_timeval(&diff, &now, send_time);
+    if (diff.tv_sec >= LAN_RSP_TIMEOUT_SIDEEFF / 1000000)
+	rtt = LAN_RSP_TIMEOUT_SIDEEFF;
+    else
+	rtt = (diff.tv_sec * 1000000) + diff.tv_usec;
+
+    if (ip->rtt_samples == 0) {
+	ip->srtt = rtt;
+	ip->rttvar = rtt / 2;
+    } else {
+	err = rtt - ip->srtt;
+	if (err < 0)
+	    err = -err;
+	ip->rttvar += (err - ip->rttvar) / 4;
+	ip->srtt += (rtt - ip->srtt) / 8;
+    }
+    ip->rtt_samples++;
+
+    ip->rto = ip->srtt + (4 * ip->rttvar);
+    if (ip->rto < LAN_RSP_TIMEOUT_MIN)
+	ip->rto = LAN_RSP_TIMEOUT_MIN;
+    else if (ip->rto > LAN_RSP_TIMEOUT)
+	ip->rto = LAN_RSP_TIMEOUT;
+
+    add_ip_stat(lan, addr_num, STAT_IP_SRTT, ip->srtt - old_srtt);
+    add_ip_stat(lan, addr_num, STAT_IP_RTTVAR, ip->rttvar - old_rttvar);
+    add_ip_stat(lan, addr_num, STAT_IP_RTO, ip->rto - old_rto);
+
+    if (lan->hedge_percentile)
+	lan_hedge_sample(lan, rtt);
+}
+
+/* Get the time to wait for a response to the message in the given
+   sequence table entry.  Must be called with the seq_num_lock held. */
+static void
+lan_get_rsp_timeout(lan_data_t *lan, int seq, struct timeval *timeout)
+{
+    int          usec, max;
+    unsigned int i, xmits;
+
+    if (lan->seq_table[seq].side_effects)
+	max = LAN_RSP_TIMEOUT_SIDEEFF;
+    else
+	max = LAN_RSP_TIMEOUT;
+
+    if (lan->seq_table[seq].addr.addr_type
+	!= IPMI_SYSTEM_INTERFACE_ADDR_TYPE)
+    {
+	/* Messages that are routed on by the BMC take however long
+	   the other end takes, so the estimate does not apply. */
+	usec = max;
+    } else {
+	/* The IP address is not picked until the message is sent, so
+	   unless it is forced use the largest timeout. */
+	if (lan->seq_table[seq].addr_num >= 0)
+	    usec = lan->ip[LAN_SLOT_ADDR(lan,
+					 lan->seq_table[seq].addr_num)].rto;
+	else {
+	    usec = 0;
+	    for (i=0; i<lan->cparm.num_ip_addr; i++) {
+		if (lan->ip[i].rto > usec)
+		    usec = lan->ip[i].rto;
+	    }
+	}
+	if (lan->seq_table[seq].side_effects)
+	    usec *= LAN_RSP_TIMEOUT_SIDEEFF / LAN_RSP_TIMEOUT;
+
+	/* Back off for each retransmit. */
+	xmits = LAN_RSP_RETRIES - lan->seq_table[seq].retries_left;
+	while ((xmits > 0) && (usec < max)) {
+	    usec *= 2;
+	    xmits--;
+	}
+	if (usec > max)
+	    usec = max;
+    }
+
+    timeout->tv_sec = usec / 1000000;
+    timeout->tv_usec = usec % 1000000;
+}
+
 /* Must be called with the ipmi read or write lock. */
 static int lan_valid_ipmi(ipmi_con_t *ipmi)
 {
@@ -1814,6 +2066,7 @@ lan_send_addr(lan_data_t              *lan,
     ipmi_payload_t *payload = NULL;
     unsigned char  oem_iana[3] = {0, 0, 0};
     unsigned int   oem_payload_id = 0;
+    sockaddr_ip_t  *ip_addr;
 
     if ((addr->addr_type >= IPMI_RMCPP_ADDR_START)
 	&& (addr->addr_type <= IPMI_RMCPP_ADDR_END))
@@ -1903,7 +2156,8 @@ lan_send_addr(lan_data_t              *lan,
 	char buf1[32], buf2[32];
 	ipmi_log(IPMI_LOG_DEBUG_START, "%soutgoing seq %d\n addr =",
 		 IPMI_CONN_NAME(lan->ipmi), seq);
-	dump_hex((unsigned char *) &(lan->cparm.ip_addr[addr_num]),
+	dump_hex((unsigned char *)
+		 &(lan->cparm.ip_addr[LAN_SLOT_ADDR(lan, addr_num)]),
 		 sizeof(sockaddr_ip_t));
         ipmi_log(IPMI_LOG_DEBUG_CONT,
                  "\n msg  = netfn=%s cmd=%s data_len=%d.",
@@ -1919,9 +2173,10 @@ lan_send_addr(lan_data_t              *lan,
 
     add_stat(lan->ipmi, STAT_XMIT_PACKETS, 1);
 
+    ip_addr = &(lan->cparm.ip_addr[LAN_SLOT_ADDR(lan, addr_num)]);
     rv = sendto(lan->fd->fd, tmsg, pos, 0,
-		(struct sockaddr *) &(lan->cparm.ip_addr[addr_num].s_ipsock),
-		lan->cparm.ip_addr[addr_num].ip_addr_len);
+		(struct sockaddr *) &(ip_addr->s_ipsock),
+		ip_addr->ip_addr_len);
     if (rv == -1)
 	rv = errno;
     else
@@ -1930,6 +2185,83 @@ lan_send_addr(lan_data_t              *lan,
     return rv;
 }
 
+/* Is any session to the given address working?  Must be called with
+   the ip_lock held. */
+static int
+lan_addr_working(lan_data_t *lan, unsigned int addr_num)
+{
+    unsigned int i;
+
+    for (i=addr_num; i<LAN_NUM_SLOTS(lan); i+=lan->cparm.num_ip_addr) {
+	if (lan->ip[i].working)
+	    return 1;
+    }
+    return 0;
+}
+
+/* Messages that have to go on the primary session.  Other payloads
+   (like SoL) and the session commands are tied to the session they
+   were set up on, and events and received messages are kept on one
+   session so they are not spread around. */
+static int
+lan_primary_only(const ipmi_addr_t *addr, const ipmi_msg_t *msg)
+{
+    if ((addr->addr_type >= IPMI_RMCPP_ADDR_START)
+	&& (addr->addr_type <= IPMI_RMCPP_ADDR_END))
+	return 1;
+
+    if (msg->netfn != IPMI_APP_NETFN)
+	return 0;
+
+    switch (msg->cmd) {
+    case IPMI_GET_MSG_FLAGS_CMD:
+    case IPMI_GET_MSG_CMD:
+    case IPMI_READ_EVENT_MSG_BUFFER_CMD:
+    case IPMI_SET_SESSION_PRIVILEGE_CMD:
+    case IPMI_CLOSE_SESSION_CMD:
+    case IPMI_GET_SESSION_INFO_CMD:
+    case IPMI_ACTIVATE_PAYLOAD_CMD:
+    case IPMI_DEACTIVATE_PAYLOAD_CMD:
+    case IPMI_GET_PAYLOAD_ACTIVATION_STATUS_CMD:
+    case IPMI_SUSPEND_RESUME_PAYLOAD_ENCRYPTION_CMD:
+	return 1;
+    }
+    return 0;
+}
+
+/* Pick the session slot to send a message to the given address on.
+   Messages that must stay on one session use the first working one,
+   normally the primary, the rest take the working sessions in turn.
+   Must be called with the ip_lock held. */
+static int
+lan_pick_session(lan_data_t        *lan,
+		 unsigned int      addr_num,
+		 const ipmi_addr_t *addr,
+		 const ipmi_msg_t  *msg)
+{
+    unsigned int num_sessions = lan->cparm.num_sessions;
+    unsigned int i, k, slot;
+    int          primary;
+
+    if (num_sessions == 1)
+	return addr_num;
+
+    primary = lan_primary_only(addr, msg);
+    for (i=0; i<num_sessions; i++) {
+	if (primary)
+	    k = i;
+	else
+	    k = (lan->next_session[addr_num] + i) % num_sessions;
+	slot = addr_num + (k * lan->cparm.num_ip_addr);
+	if (lan->ip[slot].working) {
+	    if (!primary)
+		lan->next_session[addr_num] = k + 1;
+	    return slot;
+	}
+    }
+    return addr_num;
+}
+
 static int
 lan_send(lan_data_t              *lan,
 	 const ipmi_addr_t       *addr,
@@ -1956,7 +2288,7 @@ lan_send(lan_data_t              *lan,
 	    if (addr_num >= lan->cparm.num_ip_addr)
 		addr_num = 0;
 	    while (addr_num != lan->curr_ip_addr) {
-		if (lan->ip[addr_num].working)
+		if (lan_addr_working(lan, addr_num))
 		    break;
 		addr_num++;
 		if (addr_num >= lan->cparm.num_ip_addr)
@@ -1972,6 +2304,8 @@ lan_send(lan_data_t              *lan,
 	lan->curr_ip_addr = addr_num;
     }
     curr_ip_addr = lan->curr_ip_addr;
+    if (lan->connected && !(msg->netfn & 1))
+	curr_ip_addr = lan_pick_session(lan, curr_ip_addr, addr, msg);
     ipmi_unlock(lan->ip_lock);
 
     *send_ip_num = curr_ip_addr;
@@ -2090,7 +2424,7 @@ audit_timeout_handler(void              *cb_data,
     ipmi_msg_t                   msg;
     unsigned int                 i;
     ipmi_system_interface_addr_t si;
-    int                          start_up[MAX_IP_ADDR];
+    int                          start_up[MAX_LAN_SLOTS];
 
 
     /* If we were cancelled, just free the data and ignore the call. */
@@ -2106,11 +2440,11 @@ audit_timeout_handler(void              *cb_data,
        connection is down, this will bring it up, otherwise it
        will keep it alive. */
     ipmi_lock(lan->ip_lock);
-    for (i=0; i<lan->cparm.num_ip_addr; i++)
+    for (i=0; i<LAN_NUM_SLOTS(lan); i++)
 	    start_up[i] = ! lan->ip[i].working;
     ipmi_unlock(lan->ip_lock);
 
-    for (i=0; i<lan->cparm.num_ip_addr; i++) {
+    for (i=0; i<LAN_NUM_SLOTS(lan); i++) {
 	if (start_up[i])
 	    send_auth_cap(ipmi, lan, i, 0);
     }
@@ -2241,16 +2575,29 @@ lan_remove_con_change_handler(ipmi_con_t             *ipmi,
 static void
 connection_up(lan_data_t *lan, int addr_num, int new_con)
 {
+    unsigned int port = LAN_SLOT_ADDR(lan, addr_num);
+    int          extra = addr_num != (int) port;
+
     add_stat(lan->ipmi, STAT_CONN_UP, 1);
 
     ipmi_lock(lan->ip_lock);
     if ((! lan->ip[addr_num].working) && new_con) {
+	if (extra && lan_addr_working(lan, port))
+	    /* Just another session to an address that was up. */
+	    new_con = 0;
 	lan->ip[addr_num].working = 1;
 
-	ipmi_log(IPMI_LOG_INFO,
-		 "%sipmi_lan.c(connection_up): "
-		 "Connection %d to the BMC is up",
-		 IPMI_CONN_NAME(lan->ipmi), addr_num);
+	if (extra)
+	    ipmi_log(IPMI_LOG_INFO,
+		     "%sipmi_lan.c(connection_up): "
+		     "Session %d on connection %d to the BMC is up",
+		     IPMI_CONN_NAME(lan->ipmi),
+		     addr_num / lan->cparm.num_ip_addr, port);
+	else
+	    ipmi_log(IPMI_LOG_INFO,
+		     "%sipmi_lan.c(connection_up): "
+		     "Connection %d to the BMC is up",
+		     IPMI_CONN_NAME(lan->ipmi), addr_num);
     }
 
     if (new_con) {
@@ -2258,13 +2605,13 @@ connection_up(lan_data_t *lan, int addr_num, int new_con)
 		 "%sipmi_lan.c(connection_up): "
 		 "Connection to the BMC restored",
 		 IPMI_CONN_NAME(lan->ipmi));
-	lan->curr_ip_addr = addr_num;
+	lan->curr_ip_addr = port;
     }
 
-    if (lan->connected) {
+    if (lan->connected && (new_con || !extra)) {
 	ipmi_lock(lan->con_change_lock);
 	ipmi_unlock(lan->ip_lock);
-	call_con_change_handlers(lan, 0, addr_num, 1);
+	call_con_change_handlers(lan, 0, port, 1);
 	ipmi_unlock(lan->con_change_lock);
     } else {
 	ipmi_unlock(lan->ip_lock);
@@ -2305,6 +2652,7 @@ static void
 lost_connection(lan_data_t *lan, unsigned int addr_num)
 {
     unsigned int i;
+    unsigned int port = LAN_SLOT_ADDR(lan, addr_num);
 
     ipmi_lock(lan->ip_lock);
     if (! lan->ip[addr_num].working) {
@@ -2318,15 +2666,30 @@ lost_connection(lan_data_t *lan, unsigned int addr_num)
 
     reset_session_data(lan, addr_num);
 
-    ipmi_log(IPMI_LOG_WARNING,
-	     "%sipmi_lan.c(lost_connection): "
-	     "Connection %d to the BMC is down",
-	     IPMI_CONN_NAME(lan->ipmi), addr_num);
+    if (addr_num != port)
+	ipmi_log(IPMI_LOG_WARNING,
+		 "%sipmi_lan.c(lost_connection): "
+		 "Session %d on connection %d to the BMC is down",
+		 IPMI_CONN_NAME(lan->ipmi),
+		 addr_num / lan->cparm.num_ip_addr, port);
+    else
+	ipmi_log(IPMI_LOG_WARNING,
+		 "%sipmi_lan.c(lost_connection): "
+		 "Connection %d to the BMC is down",
+		 IPMI_CONN_NAME(lan->ipmi), addr_num);
+
+    if (lan_addr_working(lan, port)) {
+	/* Other sessions to the address still work, so as far as the
+	   users are concerned it is still up.  The audit timer will
+	   bring this session back. */
+	ipmi_unlock(lan->ip_lock);
+	return;
+    }
 
-    if (lan->curr_ip_addr == addr_num) {
+    if (lan->curr_ip_addr == port) {
 	/* Scan to see if any address is operational. */
 	for (i=0; i<lan->cparm.num_ip_addr; i++) {
-	    if (lan->ip[i].working) {
+	    if (lan_addr_working(lan, i)) {
 		lan->curr_ip_addr = i;
 		break;
 	    }
@@ -2348,11 +2711,73 @@ lost_connection(lan_data_t *lan, unsigned int addr_num)
 	
 	ipmi_lock(lan->con_change_lock);
 	ipmi_unlock(lan->ip_lock);
-	call_con_change_handlers(lan, ETIMEDOUT, addr_num, connected);
+	call_con_change_handlers(lan, ETIMEDOUT, port, connected);
 	ipmi_unlock(lan->con_change_lock);
     }
 }
 
+static void rsp_timeout_handler(void              *cb_data,
+				os_hnd_timer_id_t *id);
+
+/* Should a copy of the message be sent on the other IP address if it
+   takes too long?  Must be called with the seq_num_lock held. */
+static int
+lan_can_hedge(lan_data_t *lan, int seq)
+{
+    return (lan->hedge_percentile
+	    && (lan->cparm.num_ip_addr > 1)
+	    && (lan->num_hedge_samples >= LAN_HEDGE_MIN_SAMPLES)
+	    && !lan->seq_table[seq].side_effects
+	    && (lan->seq_table[seq].addr_num < 0)
+	    && (lan->seq_table[seq].addr.addr_type
+		== IPMI_SYSTEM_INTERFACE_ADDR_TYPE));
+}
+
+/* The hedge threshold passed on a message, send a copy on the other
+   IP address if it is working and wait out the rest of the response
+   timeout.  Whichever response comes first is used.  Must be called
+   with the seq_num_lock held. */
+static void
+lan_send_hedge(lan_data_t *lan, int seq)
+{
+    ipmi_con_t     *ipmi = lan->ipmi;
+    int            ip_num = lan->seq_table[seq].last_ip_num;
+    int            hedge_ip;
+    int            working;
+    struct timeval timeout;
+    int            rv;
+
+    lan->seq_table[seq].hedge_pending = 0;
+
+    hedge_ip = (LAN_SLOT_ADDR(lan, ip_num) + 1) % lan->cparm.num_ip_addr;
+    ipmi_lock(lan->ip_lock);
+    hedge_ip = lan_pick_session(lan, hedge_ip, &(lan->seq_table[seq].addr),
+				&(lan->seq_table[seq].msg));
+    working = lan->ip[hedge_ip].working;
+    ipmi_unlock(lan->ip_lock);
+    if (working) {
+	ipmi->os_hnd->get_monotonic_time(ipmi->os_hnd,
+					 &lan->seq_table[seq].hedge_time);
+	rv = lan_send_addr(lan,
+			   &(lan->seq_table[seq].addr),
+			   lan->seq_table[seq].addr_len,
+			   &(lan->seq_table[seq].msg),
+			   seq, hedge_ip, NULL);
+	if (!rv) {
+	    lan->seq_table[seq].hedge_ip = hedge_ip;
+	    add_ip_stat(lan, ip_num, STAT_IP_HEDGES, 1);
+	}
+    }
+
+    timeout.tv_sec = lan->seq_table[seq].hedge_rest / 1000000;
+    timeout.tv_usec = lan->seq_table[seq].hedge_rest % 1000000;
+    ipmi->os_hnd->start_timer(ipmi->os_hnd,
+			      lan->seq_table[seq].timer,
+			      &timeout,
+			      rsp_timeout_handler,
+			      lan->seq_table[seq].timer_info);
+}
+
 static void
 rsp_timeout_handler(void              *cb_data,
 		    os_hnd_timer_id_t *id)
@@ -2389,6 +2814,13 @@ rsp_timeout_handler(void              *cb_data,
 	goto out;
     }
 
+    if (lan->seq_table[seq].hedge_pending) {
+	lan_send_hedge(lan, seq);
+	ipmi_unlock(lan->seq_num_lock);
+	lan_put(ipmi);
+	return;
+    }
+
     if (DEBUG_RAWMSG) {
 	ip_num = lan->seq_table[seq].last_ip_num;
 	ipmi_log(IPMI_LOG_DEBUG,
@@ -2481,13 +2913,7 @@ rsp_timeout_handler(void              *cb_data,
 	       error. */
 	    rspi->data[0] = IPMI_UNKNOWN_ERR_CC;
 	} else {
-	    if (!lan->seq_table[seq].side_effects) {
-		timeout.tv_sec = LAN_RSP_TIMEOUT / 1000000;
-		timeout.tv_usec = LAN_RSP_TIMEOUT % 1000000;
-	    } else {
-		timeout.tv_sec = LAN_RSP_TIMEOUT_SIDEEFF / 1000000;
-		timeout.tv_usec = LAN_RSP_TIMEOUT_SIDEEFF % 1000000;
-	    }
+	    lan_get_rsp_timeout(lan, seq, &timeout);
 	    ipmi->os_hnd->start_timer(ipmi->os_hnd,
 				      id,
 				      &timeout,
@@ -2747,12 +3173,18 @@ handle_msg_send(lan_timer_info_t      *info,
 	lan->seq_table[seq].use_orig_addr = 0;
     }
 
-    if (!side_effects) {
-	timeout.tv_sec = LAN_RSP_TIMEOUT / 1000000;
-	timeout.tv_usec = LAN_RSP_TIMEOUT % 1000000;
-    } else {
-	timeout.tv_sec = LAN_RSP_TIMEOUT_SIDEEFF / 1000000;
-	timeout.tv_usec = LAN_RSP_TIMEOUT_SIDEEFF % 1000000;
+    lan_get_rsp_timeout(lan, seq, &timeout);
+    lan->seq_table[seq].hedge_ip = -1;
+    lan->seq_table[seq].hedge_pending = 0;
+    if (lan_can_hedge(lan, seq)) {
+	int usec = (timeout.tv_sec * 1000000) + timeout.tv_usec;
+
+	if (lan->hedge_threshold < usec) {
+	    lan->seq_table[seq].hedge_pending = 1;
+	    lan->seq_table[seq].hedge_rest = usec - lan->hedge_threshold;
+	    timeout.tv_sec = lan->hedge_threshold / 1000000;
+	    timeout.tv_usec = lan->hedge_threshold % 1000000;
+	}
     }
     lan->seq_table[seq].timer = info->timer;
     rv = ipmi->os_hnd->start_timer(ipmi->os_hnd,
@@ -2771,6 +3203,8 @@ handle_msg_send(lan_timer_info_t      *info,
 
     lan->last_seq = seq;
 
+    ipmi->os_hnd->get_monotonic_time(ipmi->os_hnd,
+				     &lan->seq_table[seq].send_time);
     if (addr_num >= 0) {
 	rv = lan_send_addr(lan, addr, addr_len, msg, seq, addr_num, NULL);
 	lan->seq_table[seq].last_ip_num = addr_num;
@@ -2801,6 +3235,120 @@ handle_msg_send(lan_timer_info_t      *info,
     return rv;
 }
 
+/* Pick the priority class a message goes in if the user did not
+   give one.  Things a person is waiting on go first, the big reads
+   done while scanning a domain go last. */
+static int
+lan_default_priority(const ipmi_msg_t *msg)
+{
+    switch (msg->netfn) {
+    case IPMI_CHASSIS_NETFN:
+	switch (msg->cmd) {
+	case IPMI_GET_CHASSIS_STATUS_CMD:
+	case IPMI_CHASSIS_CONTROL_CMD:
+	case IPMI_CHASSIS_IDENTIFY_CMD:
+	    return IPMI_CON_MSG_PRIORITY_INTERACTIVE;
+	}
+	break;
+
+    case IPMI_APP_NETFN:
+	switch (msg->cmd) {
+	case IPMI_RESET_WATCHDOG_TIMER_CMD:
+	case IPMI_SET_WATCHDOG_TIMER_CMD:
+	    return IPMI_CON_MSG_PRIORITY_INTERACTIVE;
+	}
+	break;
+
+    case IPMI_SENSOR_EVENT_NETFN:
+	if (msg->cmd == IPMI_GET_DEVICE_SDR_CMD)
+	    return IPMI_CON_MSG_PRIORITY_BULK;
+	break;
+
+    case IPMI_STORAGE_NETFN:
+	switch (msg->cmd) {
+	case IPMI_GET_SDR_CMD:
+	case IPMI_READ_FRU_DATA_CMD:
+	case IPMI_GET_SEL_ENTRY_CMD:
+	    return IPMI_CON_MSG_PRIORITY_BULK;
+	}
+	break;
+    }
+
+    return IPMI_CON_MSG_PRIORITY_NORMAL;
+}
+
+/* Must be called with the seq_num_lock held. */
+static void
+lan_wait_q_add(lan_data_t *lan, lan_wait_queue_t *q_item)
+{
+    int p = q_item->priority;
+
+    lan->ipmi->os_hnd->get_monotonic_time(lan->ipmi->os_hnd,
+					  &q_item->queued_time);
+    q_item->next = NULL;
+    if (lan->wait_q_tail[p] == NULL)
+	lan->wait_q[p] = q_item;
+    else
+	lan->wait_q_tail[p]->next = q_item;
+    lan->wait_q_tail[p] = q_item;
+    lan->wait_q_len[p]++;
+    add_stat(lan->ipmi, STAT_WAIT_Q + (p * NUM_WAIT_Q_STATS)
+	     + STAT_WAIT_Q_DEPTH, 1);
+    add_stat(lan->ipmi, STAT_WAIT_Q + (p * NUM_WAIT_Q_STATS)
+	     + STAT_WAIT_Q_QUEUED, 1);
+}
+
+/* Take the next message to send off the wait queues.  This is the
+   oldest message of the highest priority class, unless a lower class
+   has been passed over too many times, then it gets a turn.  Must be
+   called with the seq_num_lock held. */
+static lan_wait_queue_t *
+lan_wait_q_next(lan_data_t *lan)
+{
+    lan_wait_queue_t *q_item;
+    int              p, pick = -1;
+    struct timeval   now, diff;
+
+    for (p=IPMI_CON_MSG_NUM_PRIORITIES-1; p>0; p--) {
+	if (lan->wait_q[p] && (lan->wait_q_skips[p] >= LAN_WAIT_Q_MAX_SKIPS)) {
+	    pick = p;
+	    break;
+	}
+    }
+    if (pick < 0) {
+	for (p=0; p<IPMI_CON_MSG_NUM_PRIORITIES; p++) {
+	    if (lan->wait_q[p]) {
+		pick = p;
+		break;
+	    }
+	}
+	if (pick < 0)
+	    return NULL;
+    }
+
+    lan->wait_q_skips[pick] = 0;
+    for (p=pick+1; p<IPMI_CON_MSG_NUM_PRIORITIES; p++) {
+	if (lan->wait_q[p])
+	    lan->wait_q_skips[p]++;
+    }
+
+    q_item = lan->wait_q[pick];
+    lan->wait_q[pick] = q_item->next;
+    if (lan->wait_q[pick] == NULL)
+	lan->wait_q_tail[pick] = NULL;
+    lan->wait_q_len[pick]--;
+
+    lan->ipmi->os_hnd->get_monotonic_time(lan->ipmi->os_hnd, &now);
+    diff_timeval(&diff, &now, &q_item->queued_time);
+    add_stat(lan->ipmi, STAT_WAIT_Q + (pick * NUM_WAIT_Q_STATS)
+	     + STAT_WAIT_Q_DEPTH, -1);
+    add_stat(lan->ipmi, STAT_WAIT_Q + (pick * NUM_WAIT_Q_STATS)
+	     + STAT_WAIT_Q_WAIT_USEC,
+	     (diff.tv_sec * 1000000) + diff.tv_usec);
+
+    return q_item;
+}
+
 static void
 check_command_queue(ipmi_con_t *ipmi, lan_data_t *lan)
 {
@@ -2808,14 +3356,8 @@ check_command_queue(ipmi_con_t *ipmi, lan_data_t *lan)
     lan_wait_queue_t *q_item;
     int              started = 0;
 
-    while (!started && (lan->wait_q != NULL)) {
-	/* Commands are waiting to be started, remove the queue item
-           and start it. */
-	q_item = lan->wait_q;
-	lan->wait_q = q_item->next;
-	if (lan->wait_q == NULL)
-	    lan->wait_q_tail = NULL;
-
+    while (!started && ((q_item = lan_wait_q_next(lan)) != NULL)) {
+	/* Commands are waiting to be started, start the next one. */
 	rv = handle_msg_send(q_item->info, -1, &q_item->addr, q_item->addr_len,
 			     &(q_item->msg), q_item->rsp_handler,
 			     q_item->rsp_item, q_item->side_effects);
@@ -2986,6 +3528,21 @@ handle_payload(ipmi_con_t    *ipmi,
        count. */
     lan->ip[addr_num].consecutive_failures = 0;
 
+    /* Only time messages that were sent once (Karn's rule), a
+       response to a retransmitted message can't be matched to the
+       send it answers.  A hedged copy went to the other address, so
+       the address the response came from tells which one it is. */
+    if ((lan->seq_table[seq].addr.addr_type == IPMI_SYSTEM_INTERFACE_ADDR_TYPE)
+	&& (lan->seq_table[seq].retries_left == LAN_RSP_RETRIES))
+    {
+	if (lan->seq_table[seq].hedge_ip == addr_num) {
+	    add_ip_stat(lan, addr_num, STAT_IP_HEDGE_WINS, 1);
+	    lan_rtt_sample(lan, addr_num, &lan->seq_table[seq].hedge_time);
+	} else if (lan->seq_table[seq].last_ip_num == addr_num) {
+	    lan_rtt_sample(lan, addr_num, &lan->seq_table[seq].send_time);
+	}
+    }
+
     /* The command matches up, cancel the timer and deliver it */
     rv = ipmi->os_hnd->stop_timer(ipmi->os_hnd,
 				  lan->seq_table[seq].timer);
@@ -3349,16 +3906,26 @@ addr_match_lan(lan_data_t *lan, uint32_t sid, sockaddr_ip_t *addr,
 	       int *raddr_num)
 {
     unsigned int addr_num;
+    int          any = -1;
 
     /* Make sure the source address matches one we expect from
-       this system. */
-    for (addr_num = 0; addr_num < lan->cparm.num_ip_addr; addr_num++) {
-	if ((!sid || (lan->ip[addr_num].session_id == sid))
-	    && lan_addr_same(&(lan->cparm.ip_addr[addr_num]), addr))
-	{
+       this system.  A message outside a session goes to a session
+       being set up if there is one. */
+    for (addr_num = 0; addr_num < LAN_NUM_SLOTS(lan); addr_num++) {
+	if (! lan_addr_same(&(lan->cparm.ip_addr[LAN_SLOT_ADDR(lan,
+							       addr_num)]),
+			    addr))
+	    continue;
+	if (lan->ip[addr_num].session_id == sid) {
 	    *raddr_num = addr_num;
 	    return 1;
 	}
+	if (!sid && (any < 0))
+	    any = addr_num;
+    }
+    if (any >= 0) {
+	*raddr_num = any;
+	return 1;
     }
     return 0;
 }
@@ -3370,8 +3937,8 @@ rmcpp_find_ipmi(lan_fd_t      *item,
 		sockaddr_ip_t *addr,
 		int           *addr_num)
 {
-    /* This is easy, the session id is our slot in the fd or is a
-       message tag. */
+    /* This is easy, the low byte of the session id is our slot in
+       the fd or is a message tag. */
     unsigned char payload;
     uint32_t      tag;
     uint32_t      sid;
@@ -3418,7 +3985,7 @@ rmcpp_find_ipmi(lan_fd_t      *item,
 	}
 	tag = ctag;
     } else
-	tag = sid - 1;
+	tag = (sid - 1) & 0xff;
 
     if (tag >= MAX_CONS_PER_FD) {
 	if (DEBUG_RAWMSG || DEBUG_MSG_ERR)
@@ -3559,7 +4126,7 @@ ipmi_lan_send_command_forceip(ipmi_con_t            *ipmi,
     int              rv;
     /* We store the address number in data4. */
 
-    if (addr_num >= MAX_IP_ADDR)
+    if (addr_num >= MAX_LAN_SLOTS)
 	return EINVAL;
 
     if (addr_len > sizeof(ipmi_addr_t))
@@ -3636,6 +4203,7 @@ lan_send_command_option(ipmi_con_t              *ipmi,
     int              rv;
     ipmi_msgi_t      *rspi = trspi;
     int              side_effects = 0;
+    int              priority = -1;
     int              i;
 
 
@@ -3658,8 +4226,16 @@ lan_send_command_option(ipmi_con_t              *ipmi,
 	for (i=0; options[i].option != IPMI_CON_OPTION_LIST_END; i++) {
 	    if (options[i].option == IPMI_CON_MSG_OPTION_SIDE_EFFECTS)
 		side_effects = options[i].ival;
+	    else if (options[i].option == IPMI_CON_MSG_OPTION_PRIORITY) {
+		if ((options[i].ival < 0)
+		    || (options[i].ival >= IPMI_CON_MSG_NUM_PRIORITIES))
+		    return EINVAL;
+		priority = options[i].ival;
+	    }
 	}
     }
+    if (priority < 0)
+	priority = lan_default_priority(msg);
 
     if (!rspi) {
 	rspi = ipmi_mem_alloc(sizeof(*rspi));
@@ -3703,16 +4279,9 @@ lan_send_command_option(ipmi_con_t              *ipmi,
 	q_item->rsp_handler = rsp_handler;
 	q_item->rsp_item = rspi;
 	q_item->side_effects = side_effects;
+	q_item->priority = priority;
 
-	/* Add it to the end of the queue. */
-	q_item->next = NULL;
-	if (lan->wait_q_tail == NULL) {
-	    lan->wait_q_tail = q_item;
-	    lan->wait_q = q_item;
-	} else {
-	    lan->wait_q_tail->next = q_item;
-	    lan->wait_q_tail = q_item;
-	}
+	lan_wait_q_add(lan, q_item);
 	goto out_unlock;
     }
 
@@ -3964,7 +4533,7 @@ cleanup_con(ipmi_con_t *ipmi)
 	    release_lan_fd(lan->fd, lan->fd_slot);
 	if (lan->authdata)
 	    ipmi_auths[lan->chosen_authtype].authcode_cleanup(lan->authdata);
-	for (i=0; i<MAX_IP_ADDR; i++) {
+	for (i=0; i<MAX_LAN_SLOTS; i++) {
 	    if (lan->ip[i].conf_data)
 		lan->ip[i].conf_info->conf_free(ipmi, lan->ip[i].conf_data);
 	    if (lan->ip[i].integ_data)
@@ -3987,7 +4556,7 @@ lan_cleanup(ipmi_con_t *ipmi)
     /* After this point no other operations can occur on this ipmi
        interface, so it's safe. */
 
-    for (i=0; i<lan->cparm.num_ip_addr; i++)
+    for (i=0; i<LAN_NUM_SLOTS(lan); i++)
 	send_close_session(ipmi, lan, i);
 
     lan->in_cleanup = 1;
@@ -4046,11 +4615,12 @@ lan_cleanup(ipmi_con_t *ipmi)
 	    ipmi_lock(lan->seq_num_lock);
 	}
     }
-    while (lan->wait_q != NULL) {
+    for (;;) {
 	lan_wait_queue_t *q_item;
 
-	q_item = lan->wait_q;
-	lan->wait_q = q_item->next;
+	q_item = lan_wait_q_next(lan);
+	if (!q_item)
+	    break;
 
 	ipmi->os_hnd->free_timer(ipmi->os_hnd, q_item->info->timer);
 
@@ -4151,10 +4721,17 @@ handle_connected(ipmi_con_t *ipmi, int err, int addr_num)
     if (err)
 	reset_session_data(lan, addr_num);
 
+    if (err && (addr_num >= (int) lan->cparm.num_ip_addr))
+	/* An extra session could not be set up (the BMC may be out of
+	   sessions), that doesn't change the state of the address.
+	   The audit timer will try it again. */
+	return;
+
     ipmi_lock(lan->ip_lock);
     ipmi_lock(lan->con_change_lock);
     ipmi_unlock(lan->ip_lock);
-    call_con_change_handlers(lan, err, addr_num, lan->connected);
+    call_con_change_handlers(lan, err, LAN_SLOT_ADDR(lan, addr_num),
+			     lan->connected);
     ipmi_unlock(lan->con_change_lock);
 }
 
@@ -4677,6 +5254,7 @@ got_rmcpp_open_session_rsp(ipmi_con_t *ipmi, ipmi_msgi_t  *rspi)
     lan->ip[addr_num].integ_info = integp;
 
     lan->ip[addr_num].ainfo.lan = lan;
+    lan->ip[addr_num].ainfo.addr_num = addr_num;
     lan->ip[addr_num].ainfo.role = ((lan->cparm.name_lookup_only << 4)
 				    | lan->cparm.privilege);
 
@@ -4761,8 +5339,10 @@ start_rmcpp(ipmi_con_t *ipmi, lan_data_t *lan, ipmi_msgi_t *rspi, int addr_num)
     lan->ip[addr_num].inbound_seq_num = 0;
     lan->ip[addr_num].unauth_in_seq_num = 0;
     /* Use our fd_slot in the fd for the session id, so we can look it
-       up quickly. */
-    lan->ip[addr_num].precon_session_id = lan->fd_slot + 1;
+       up quickly.  The session slot goes above it to keep the
+       sessions to one address apart. */
+    lan->ip[addr_num].precon_session_id = ((lan->fd_slot + 1)
+					   | (addr_num << 8));
     lan->ip[addr_num].working_conf = IPMI_LANP_CONFIDENTIALITY_ALGORITHM_NONE;
     lan->ip[addr_num].working_integ = IPMI_LANP_INTEGRITY_ALGORITHM_NONE;
 
@@ -5178,7 +5758,7 @@ lan_start_con(ipmi_con_t *ipmi)
 	    int          port_err[MAX_IP_ADDR];
 
 	    for (i=0; i<lan->cparm.num_ip_addr; i++)
-		port_err[i] = lan->ip[i].working ? 0 : EINVAL;
+		port_err[i] = lan_addr_working(lan, i) ? 0 : EINVAL;
 
 	    ipmi_lock(lan->con_change_lock);
 	    ipmi_unlock(lan->ip_lock);
@@ -5221,7 +5801,7 @@ lan_start_con(ipmi_con_t *ipmi)
     lan->started = 1;
     ipmi_unlock(lan->ip_lock);
 
-    for (i=0; i<lan->cparm.num_ip_addr; i++)
+    for (i=0; i<LAN_NUM_SLOTS(lan); i++)
 	/* Ignore failures, this gets retried. */
 	send_auth_cap(ipmi, lan, i, 0);
 
@@ -5360,11 +5940,40 @@ lan_register_stat_handler(ipmi_con_t          *ipmi,
 	return ENOMEM;
     memset(nstat, 0, sizeof(*nstat));
 
-    for (i=0; i<NUM_STATS; i++)
+    for (i=0; i<NUM_STATS; i++) {
+	if ((i >= STAT_IP) && (((i - STAT_IP) / NUM_IP_STATS)
+			       >= (int) lan->cparm.num_ip_addr))
+	    continue;
 	ipmi_ll_con_stat_call_register(info, lan_stat_names[i],
 				       ipmi->name, &(nstat->stats[i]));
+    }
+
+    /* Start the values at their current value. */
+    ipmi_lock(lan->seq_num_lock);
+    if (nstat->stats[STAT_HEDGE_THRESHOLD] && lan->hedge_threshold)
+	ipmi_ll_con_stat_call_adder(info, nstat->stats[STAT_HEDGE_THRESHOLD],
+				    lan->hedge_threshold);
+    for (i=0; i<IPMI_CON_MSG_NUM_PRIORITIES; i++) {
+	void *stat = nstat->stats[STAT_WAIT_Q + (i * NUM_WAIT_Q_STATS)
+				  + STAT_WAIT_Q_DEPTH];
+	if (stat && lan->wait_q_len[i])
+	    ipmi_ll_con_stat_call_adder(info, stat, lan->wait_q_len[i]);
+    }
+    for (i=0; i<(int) lan->cparm.num_ip_addr; i++) {
+	int vals[3], j;
+
+	vals[STAT_IP_SRTT] = lan->ip[i].srtt;
+	vals[STAT_IP_RTTVAR] = lan->ip[i].rttvar;
+	vals[STAT_IP_RTO] = lan->ip[i].rto;
+	for (j=0; j<3; j++) {
+	    void *stat = nstat->stats[STAT_IP + (i * NUM_IP_STATS) + j];
+	    if (stat && vals[j])
+		ipmi_ll_con_stat_call_adder(info, stat, vals[j]);
+	}
+    }
 
     if (!locked_list_add(lan->lan_stat_list, nstat, info)) {
+	ipmi_unlock(lan->seq_num_lock);
 	for (i=0; i<NUM_STATS; i++)
 	    if (nstat->stats[i]) {
 		ipmi_ll_con_stat_call_unregister(info, nstat->stats[i]);
@@ -5373,6 +5982,7 @@ lan_register_stat_handler(ipmi_con_t          *ipmi,
 	ipmi_mem_free(nstat);
 	return ENOMEM;
     }
+    ipmi_unlock(lan->seq_num_lock);
 
     return 0;
 }
@@ -5469,7 +6079,8 @@ ipmi_lanp_setup_con(ipmi_lanp_parm_t *parms,
     char               *tports[MAX_IP_ADDR];
     char               **ports = NULL;
     lan_conn_parms_t   cparm;
-    int max_outstanding_msg_count = DEFAULT_MAX_OUTSTANDING_MSG_COUNT;
+    int max_outstanding_msg_count = 0;
+    unsigned int hedge_percentile = 0;
 
     memset(&cparm, 0, sizeof(cparm));
 
@@ -5480,6 +6091,7 @@ ipmi_lanp_setup_con(ipmi_lanp_parm_t *parms,
     cparm.integ = most_secure_lanp_integ();
     cparm.auth = most_secure_lanp_auth();
     cparm.name_lookup_only = 1;
+    cparm.num_sessions = 1;
 
     for (i=0; i<num_parms; i++) {
 	switch (parms[i].parm_id) {
@@ -5577,6 +6189,19 @@ ipmi_lanp_setup_con(ipmi_lanp_parm_t *parms,
 		return EINVAL;
 	    max_outstanding_msg_count = parms[i].parm_val;
 	    break;
+
+	case IPMI_LANP_HEDGE_PERCENTILE:
+	    if (parms[i].parm_val > 99)
+		return EINVAL;
+	    hedge_percentile = parms[i].parm_val;
+	    break;
+
+	case IPMI_LANP_NUM_SESSIONS:
+	    if ((parms[i].parm_val < 1)
+		|| (parms[i].parm_val > MAX_LAN_SESSIONS))
+		return EINVAL;
+	    cparm.num_sessions = parms[i].parm_val;
+	    break;
 		
 	default:
 	    return EINVAL;
@@ -5585,6 +6210,14 @@ ipmi_lanp_setup_con(ipmi_lanp_parm_t *parms,
 
     if ((cparm.num_ip_addr == 0) || (ip_addrs == NULL))
 	return EINVAL;
+
+    if (!max_outstanding_msg_count) {
+	/* Give each session the default.  All the sessions share the
+	   one sequence number table, so this can never go over 63,
+	   MAX_LAN_SESSIONS keeps it well under that. */
+	max_outstanding_msg_count = (DEFAULT_MAX_OUTSTANDING_MSG_COUNT
+				     * cparm.num_sessions);
+    }
     if (((int) cparm.authtype != IPMI_AUTHTYPE_DEFAULT)
 	&& (cparm.authtype != IPMI_AUTHTYPE_RMCP_PLUS)
 	&& ((cparm.authtype >= MAX_IPMI_AUTHS)
@@ -5718,11 +6351,18 @@ ipmi_lanp_setup_con(ipmi_lanp_parm_t *parms,
     lan->num_sends = 0;
     lan->connected = 0;
     lan->initialized = 0;
+    for (i=0; i<MAX_LAN_SLOTS; i++)
+	lan->ip[i].rto = LAN_RSP_TIMEOUT;
 
     lan->outstanding_msg_count = 0;
     lan->max_outstanding_msg_count = max_outstanding_msg_count;
-    lan->wait_q = NULL;
-    lan->wait_q_tail = NULL;
+    lan->hedge_percentile = hedge_percentile;
+    for (i=0; i<IPMI_CON_MSG_NUM_PRIORITIES; i++) {
+	lan->wait_q[i] = NULL;
+	lan->wait_q_tail[i] = NULL;
+	lan->wait_q_len[i] = 0;
+	lan->wait_q_skips[i] = 0;
+    }
 
     pa = (struct sockaddr_in *)&(lan->cparm.ip_addr[0]);
     lan->fd = find_free_lan_fd(pa->sin_family, lan, &lan->fd_slot);
@@ -5945,6 +6585,8 @@ typedef struct lan_args_s
 
     unsigned int    hacks;		/* parms 13, 14 */
     unsigned int    max_outstanding_msgs;/* parm 15 */
+    unsigned int    hedge_percentile;	/* parm 16 */
+    unsigned int    num_sessions;	/* parm 17 */
 } lan_args_t;
 
 static const char *auth_range[] = { "default", "none", "md2", "md5",
@@ -5995,7 +6637,7 @@ static struct lan_argnum_info_s
     const char *help;
     const char **range;
     const int  *values;
-} lan_argnum_info[17] =
+} lan_argnum_info[19] =
 {
     { "Address",	"str",
       "*IP name or address of the MC",
@@ -6043,7 +6685,15 @@ static struct lan_argnum_info_s
       "The IPMI 2.0 Spec was unclear which integrity key to use",
       NULL, NULL },
     { "Max_Outstanding_Msgs",	"int",
-      "How many outstanding messages on the connection, range 1-63",
+      "How many outstanding messages on the connection, range 1-63,"
+      " 0 for 2 per session",
+      NULL, NULL },
+    { "Hedge_Percentile",	"int",
+      "Resend reads on the second address after this percentile of the"
+      " response time, range 1-99, 0 to disable",
+      NULL, NULL },
+    { "Num_Sessions",	"int",
+      "How many sessions to open to each address, range 1-4",
       NULL, NULL },
 
     { NULL },
@@ -6121,6 +6771,8 @@ get_startup_args(ipmi_con_t *ipmi)
 	largs->bmc_key_set = 1;
     }
     largs->max_outstanding_msgs = lan->max_outstanding_msg_count;
+    largs->hedge_percentile = lan->hedge_percentile;
+    largs->num_sessions = cparm->num_sessions;
     return args;
 
  out_err:
@@ -6136,7 +6788,7 @@ lan_connect_args(ipmi_args_t  *args,
 {
     lan_args_t       *largs = _ipmi_args_get_extra_data(args);
     int              i;
-    ipmi_lanp_parm_t parms[12];
+    ipmi_lanp_parm_t parms[14];
     int              rv;
 
     i = 0;
@@ -6184,8 +6836,17 @@ lan_connect_args(ipmi_args_t  *args,
 	parms[i].parm_data_len = largs->bmc_key_len;
 	i++;
     }
-    parms[i].parm_id = IPMI_LANP_MAX_OUTSTANDING_MSG_COUNT;
-    parms[i].parm_val = largs->max_outstanding_msgs;
+    if (largs->max_outstanding_msgs) {
+	/* Otherwise let the setup derive it from the session count. */
+	parms[i].parm_id = IPMI_LANP_MAX_OUTSTANDING_MSG_COUNT;
+	parms[i].parm_val = largs->max_outstanding_msgs;
+	i++;
+    }
+    parms[i].parm_id = IPMI_LANP_HEDGE_PERCENTILE;
+    parms[i].parm_val = largs->hedge_percentile;
+    i++;
+    parms[i].parm_id = IPMI_LANP_NUM_SESSIONS;
+    parms[i].parm_val = largs->num_sessions;
     i++;
     rv = ipmi_lanp_setup_con(parms, i, handlers, user_data, con);
     if (!rv)
@@ -6372,6 +7033,14 @@ lan_args_get_val(ipmi_args_t  *args,
 	rv = get_int_val(value, largs->max_outstanding_msgs);
 	break;
 
+    case 16:
+	rv = get_int_val(value, largs->hedge_percentile);
+	break;
+
+    case 17:
+	rv = get_int_val(value, largs->num_sessions);
+	break;
+
     default:
 	return E2BIG;
     }
@@ -6582,6 +7251,14 @@ lan_args_set_val(ipmi_args_t  *args,
 	rv = set_uint_val(&largs->max_outstanding_msgs, value);
 	break;
 
+    case 16:
+	rv = set_uint_val(&largs->hedge_percentile, value);
+	break;
+
+    case 17:
+	rv = set_uint_val(&largs->num_sessions, value);
+	break;
+
     default:
 	rv = E2BIG;
     }
@@ -6820,6 +7497,34 @@ lan_parse_args(int         *curr_arg,
 		goto out_err;
 	    }
 	    largs->max_outstanding_msgs = val;
+	} else if (strcmp(args[*curr_arg], "-D") == 0) {
+	    char *end;
+	    int val;
+	    (*curr_arg)++; CHECK_ARG;
+	    if (args[*curr_arg][0] == '\0') {
+		rv = EINVAL;
+		goto out_err;
+	    }
+	    val = strtol(args[*curr_arg], &end, 0);
+	    if ((*end != '\0') || (val < 0) || (val > 99)) {
+		rv = EINVAL;
+		goto out_err;
+	    }
+	    largs->hedge_percentile = val;
+	} else if (strcmp(args[*curr_arg], "-N") == 0) {
+	    char *end;
+	    int val;
+	    (*curr_arg)++; CHECK_ARG;
+	    if (args[*curr_arg][0] == '\0') {
+		rv = EINVAL;
+		goto out_err;
+	    }
+	    val = strtol(args[*curr_arg], &end, 0);
+	    if ((*end != '\0') || (val < 1) || (val > MAX_LAN_SESSIONS)) {
+		rv = EINVAL;
+		goto out_err;
+	    }
+	    largs->num_sessions = val;
 	}
 	(*curr_arg)++;
     }
@@ -6858,7 +7563,8 @@ lan_parse_help(void)
 	" lan [-U <username>] [-P <password>] [-p[2] port] [-A <authtype>]\n"
 	"     [-L <privilege>] [-s] [-Ra <auth alg>] [-Ri <integ alg>]\n"
 	"     [-Rc <conf algo>] [-Rl] [-Rk <bmc key>] [-H <hackname>]\n"
-	"     [-M <max outstanding msgs>] <host1> [<host2>]\n"
+	"     [-M <max outstanding msgs>] [-D <hedge percentile>]\n"
+	"     [-N <sessions>] <host1> [<host2>]\n"
 	"If -s is supplied, then two host names are taken (the second port\n"
 	"may be specified with -p2).  Otherwise, only one hostname is\n"
 	"taken.  The defaults are an empty username and password (anonymous),\n"
@@ -6882,7 +7588,12 @@ lan_parse_help(void)
 	"different privileges and different passwords), the default is straight\n"
 	"name lookup.  -Rk sets the BMC key, needed if the system does two-key\n"
 	"lookups.  The -M option sets the maximum outstanding messages.\n"
-	"The default is 2, ranges 1-63.\n"
+	"The default is 2 for each session (see -N), ranges 1-63.\n"
+	"With two hosts, -D turns on hedged requests: a read that has not\n"
+	"been answered by the given percentile (1-99) of recent response\n"
+	"times is also sent to the other host, the first answer wins.\n"
+	"-N opens that many sessions (1-4) to each host and spreads the\n"
+	"commands over them, raise -M along with it.\n"
 	"The -H option enables certain hacks for broken platforms.  This may\n"
 	"be listed multiple times to enable multiple hacks.  The currently\n"
 	"available hacks are:\n"
@@ -6915,7 +7626,8 @@ lan_con_alloc_args(void)
     largs->integ_alg = most_secure_lanp_integ();
     largs->auth_alg = most_secure_lanp_auth();
     largs->name_lookup_only = 1;
-    largs->max_outstanding_msgs = DEFAULT_MAX_OUTSTANDING_MSG_COUNT;
+    largs->max_outstanding_msgs = 0; /* The default for each session */
+    largs->num_sessions = 1;
     /* largs->hacks = IPMI_CONN_HACK_RAKP3_WRONG_ROLEM; */
     return args;
 }
@@ -66,6 +66,10 @@ static ipmi_args_t *smi_con_alloc_args(void);
 #define SMI_TIMEOUT 60000
 
 #define SMI_AUDIT_TIMEOUT 10000000
+
+/* The most messages pulled from the driver on one wakeup, so a flood
+   of messages on one interface does not starve the other fds. */
+#define SMI_MAX_DRAIN_MSGS 32
 #if !defined(MIN)
 #define MIN(x,y) ((x)<(y)?(x):(y))
 #endif
@@ -894,6 +898,20 @@ gen_recv_msg(ipmi_con_t *ipmi, struct ipmi_recv *recv)
     }
 }
 
+/* Returns true if the connection has been closed out from under a
+   handler that is holding a reference. */
+static int
+smi_closing(ipmi_con_t *ipmi)
+{
+    smi_data_t *smi = ipmi->con_data;
+    int        rv;
+
+    ipmi_lock(smi_list_lock);
+    rv = smi->refcount <= 1;
+    ipmi_unlock(smi_list_lock);
+    return rv;
+}
+
 static void
 ipmi_dev_data_handler(int            fd,
 		      void           *cb_data,
@@ -904,6 +922,7 @@ ipmi_dev_data_handler(int            fd,
     ipmi_addr_t      addr;
     struct ipmi_recv recv;
     int              rv;
+    int              count;
 
     if (!smi_valid_ipmi(ipmi)) {
 	/* We can have due to a race condition, just return and
@@ -911,23 +930,36 @@ ipmi_dev_data_handler(int            fd,
 	return;
     }
 
-    recv.msg.data = data;
-    recv.msg.data_len = sizeof(data);
-    recv.addr = (unsigned char *) &addr;
-    recv.addr_len = sizeof(addr);
-    rv = ioctl(fd, IPMICTL_RECEIVE_MSG_TRUNC, &recv);
-    if (rv == -1) {
-	if (errno == EMSGSIZE) {
-	    /* The message was truncated, handle it as such. */
-	    data[0] = IPMI_REQUESTED_DATA_LENGTH_EXCEEDED_CC;
-	    rv = 0;
-	} else
-	    goto out;
-    }
+    /*
+     * The driver never blocks on a receive, it returns EAGAIN when
+     * the queue is empty.  So pull everything that is waiting, up to
+     * a limit.  If there is more the fd is still readable and we get
+     * called again after the other fds have had their turn.
+     */
+    for (count = 0; count < SMI_MAX_DRAIN_MSGS; count++) {
+	recv.msg.data = data;
+	recv.msg.data_len = sizeof(data);
+	recv.addr = (unsigned char *) &addr;
+	recv.addr_len = sizeof(addr);
+	rv = ioctl(fd, IPMICTL_RECEIVE_MSG_TRUNC, &recv);
+	if (rv == -1) {
+	    if (errno == EMSGSIZE) {
+		/* The message was truncated, handle it as such. */
+		data[0] = IPMI_REQUESTED_DATA_LENGTH_EXCEEDED_CC;
+		rv = 0;
+	    } else if (errno == EINTR)
+		continue;
+	    else
+		/* EAGAIN, nothing left to get. */
+		break;
+	}
+
+	gen_recv_msg(ipmi, &recv);
 
-    gen_recv_msg(ipmi, &recv);
+	if (smi_closing(ipmi))
+	    break;
+    }
 
- out:
     smi_put(ipmi);
 }
 
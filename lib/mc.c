@@ -290,6 +290,16 @@ struct ipmi_mc_s
     unsigned int startup_count;
     int startup_reported;
 
+    /* The startup work is run through the domain's stage scheduler.
+       The GUID fetch runs alongside the SDR fetch unless the SDR
+       cache is in use, it is keyed by the GUID.  The SEL is fetched
+       once the sensors are set up. */
+    ipmi_domain_stage_t guid_stage;
+    ipmi_domain_stage_t sdrs_stage;
+    ipmi_domain_stage_t sel_stage;
+    int                 sel_stage_running;
+    int                 sdrs_wait_guid;
+
     /* If we have any external users that do not have direct
        references, we increment the usercount.  This is primarily the
        internal uses in the active_handlers list, but we cannot use
@@ -336,6 +346,13 @@ struct ipmi_mc_s
     ipmi_mc_add_event_cb sel_add_event_handler;
     ipmi_mc_del_event_cb sel_clear_handler;
 
+    /* Unhandled events found by the current SEL fetch, held to be
+       delivered to the domain's batch event handlers as one batch
+       when the fetch completes. */
+    ipmi_event_t **event_batch;
+    unsigned int event_batch_len;
+    unsigned int event_batch_size;
+
     /* Timer for rescanning the sel periodically. */
     mc_reread_sel_t   *sel_timer_info;
     unsigned int      sel_scan_interval; /* seconds between SEL scans */
@@ -411,12 +428,14 @@ static void mc_sel_new_event_handler(ipmi_sel_info_t *sel,
 				     ipmi_mc_t       *mc,
 				     ipmi_event_t    *event,
 				     void            *cb_data);
+static void mc_sel_new_events_done(ipmi_sel_info_t *sel, void *cb_data);
 
 static void sels_start_timer(mc_reread_sel_t *info);
 static void start_sel_time_set(ipmi_mc_t *mc, mc_reread_sel_t *info);
 
 static void call_active_handlers(ipmi_mc_t *mc);
 static void call_fully_up_handlers(ipmi_mc_t *mc);
+static void mc_sel_stage_done(ipmi_mc_t *mc);
 
 /***********************************************************************
  *
@@ -619,6 +638,12 @@ check_mc_destroy(ipmi_mc_t *mc)
 	    ipmi_sdr_info_destroy(mc->sdrs, NULL, NULL);
 	if (mc->sel)
 	    ipmi_sel_destroy(mc->sel, NULL, NULL);
+	if (mc->event_batch) {
+	    /* A fetch that never completed. */
+	    while (mc->event_batch_len > 0)
+		ipmi_event_free(mc->event_batch[--mc->event_batch_len]);
+	    ipmi_mem_free(mc->event_batch);
+	}
 	if (mc->lock)
 	    ipmi_destroy_lock(mc->lock);
 
@@ -744,6 +769,9 @@ _ipmi_create_mc(ipmi_domain_t *domain,
     ipmi_sel_set_new_event_handler(mc->sel,
 				   mc_sel_new_event_handler,
 				   domain);
+    ipmi_sel_set_new_events_done_handler(mc->sel,
+					 mc_sel_new_events_done,
+					 mc);
 
  out_err:
     if (rv)
@@ -765,12 +793,16 @@ call_removed_handler(void *cb_data, void *item1, void *item2)
     return LOCKED_LIST_ITER_CONTINUE;
 }
 
-/* Must be called with the mc lock held. */
-static void
+/* Must be called with the mc lock held.  Returns true if this ended
+   the MC's startup, in which case the caller must release the
+   domain's fully up count once it has dropped the locks, since
+   _ipmi_mc_startup_put() will never get to do it. */
+static int
 mc_stop_timer(ipmi_mc_t *mc)
 {
     os_handler_t *os_hnd = mc_get_os_hnd(mc);
     int          rv;
+    int          startup_done = 0;
 
     /* Make sure the timer stops. */
     ipmi_lock(mc->sel_timer_info->lock);
@@ -782,14 +814,20 @@ mc_stop_timer(ipmi_mc_t *mc)
 	    mc->sel_timer_info->processing = 0;
 	}
     }
-    if ((mc->startup_count > 0) && !mc->sel_timer_info->processing)
+    if ((mc->startup_count > 0) && !mc->sel_timer_info->processing) {
 	/* Hack: If we are processing, we will fail the processing or
 	   it will complete later and finish.  If we were not
 	   processing, then we were just waiting on the timer that was
 	   just cancelled.  We decrement if we were waiting on the
 	   timer. */
 	mc->startup_count--;
+	if ((mc->startup_count == 0) && !mc->startup_reported) {
+	    mc->startup_reported = 1;
+	    startup_done = 1;
+	}
+    }
     ipmi_unlock(mc->sel_timer_info->lock);
+    return startup_done;
 }
 
 static void
@@ -910,7 +948,64 @@ mc_sel_new_event_handler(ipmi_sel_info_t *sel,
 			 ipmi_event_t    *event,
 			 void            *cb_data)
 {
-    _ipmi_domain_system_event_handler(cb_data, mc, event);
+    ipmi_domain_t *domain = cb_data;
+    ipmi_event_t  **batch;
+    unsigned int  size;
+
+    if (!_ipmi_domain_system_event_handler(domain, mc, event))
+	return;
+    if (!_ipmi_domain_has_event_batch_handlers(domain))
+	return;
+
+    /* Nobody else took the event, hold it for the batch handlers. */
+    ipmi_lock(mc->lock);
+    if (mc->event_batch_len >= mc->event_batch_size) {
+	size = mc->event_batch_size * 2;
+	if (size == 0)
+	    size = 16;
+	batch = ipmi_mem_alloc(size * sizeof(*batch));
+	if (!batch) {
+	    ipmi_unlock(mc->lock);
+	    /* Better late than never, just send this one by itself. */
+	    _ipmi_domain_event_batch(domain, &event, 1);
+	    return;
+	}
+	if (mc->event_batch) {
+	    memcpy(batch, mc->event_batch,
+		   mc->event_batch_len * sizeof(*batch));
+	    ipmi_mem_free(mc->event_batch);
+	}
+	mc->event_batch = batch;
+	mc->event_batch_size = size;
+    }
+    mc->event_batch[mc->event_batch_len++] = ipmi_event_dup(event);
+    ipmi_unlock(mc->lock);
+}
+
+/* The SEL fetch is done, send the events it found. */
+static void
+mc_sel_new_events_done(ipmi_sel_info_t *sel, void *cb_data)
+{
+    ipmi_mc_t     *mc = cb_data;
+    ipmi_event_t  **batch;
+    unsigned int  len, i;
+
+    ipmi_lock(mc->lock);
+    batch = mc->event_batch;
+    len = mc->event_batch_len;
+    mc->event_batch = NULL;
+    mc->event_batch_len = 0;
+    mc->event_batch_size = 0;
+    ipmi_unlock(mc->lock);
+
+    if (!batch)
+	return;
+
+    if (len > 0)
+	_ipmi_domain_event_batch(mc->domain, batch, len);
+    for (i=0; i<len; i++)
+	ipmi_event_free(batch[i]);
+    ipmi_mem_free(batch);
 }
 
 int
@@ -2183,12 +2278,16 @@ _ipmi_mc_startup_get(ipmi_mc_t *mc, char *name)
     ipmi_unlock(mc->lock);
 }
 
-void
-_ipmi_mc_startup_put(ipmi_mc_t *mc, char *name)
+/* The GUID fetch runs in parallel with the SDR and SEL work, so it
+   must not touch the SEL processing flag when it finishes, see
+   mc_stop_timer(). */
+static void
+mc_startup_put(ipmi_mc_t *mc, int sel_done)
 {
     ipmi_lock(mc->lock);
     DEBUG_INFO(mc->sel_timer_info);
-    mc->sel_timer_info->processing = 0;
+    if (sel_done)
+	mc->sel_timer_info->processing = 0;
     mc->startup_count--;
     if (mc->startup_reported || (mc->startup_count > 0)) {
 	ipmi_unlock(mc->lock);
@@ -2198,9 +2297,54 @@ _ipmi_mc_startup_put(ipmi_mc_t *mc, char *name)
     if (mc->state == MC_ACTIVE_IN_STARTUP)
 	mc->state = MC_ACTIVE_PEND_FULLY_UP;
     ipmi_unlock(mc->lock);
+    /* If the SEL timer was stopped, the SEL stage never finished. */
+    mc_sel_stage_done(mc);
     _ipmi_put_domain_fully_up(mc->domain, "_ipmi_mc_startup_put");
 }
 
+void
+_ipmi_mc_startup_put(ipmi_mc_t *mc, char *name)
+{
+    mc_startup_put(mc, 1);
+}
+
+/* Keep the MC from being cleaned up while a stage that was queued
+   in the domain runs. */
+static void
+mc_stage_hold(ipmi_mc_t *mc)
+{
+    _ipmi_domain_mc_lock(mc->domain);
+    _ipmi_mc_get(mc);
+    _ipmi_domain_mc_unlock(mc->domain);
+}
+
+/* If the MC went away while a stage was waiting to start, the stage
+   should just finish. */
+static int
+mc_startup_cancelled(ipmi_mc_t *mc)
+{
+    int rv;
+
+    ipmi_lock(mc->lock);
+    rv = ((mc->state == MC_ACTIVE_PEND_CLEANUP)
+	  || (mc->state == MC_ACTIVE_PEND_CLEANUP_PEND_STARTUP));
+    ipmi_unlock(mc->lock);
+    return rv;
+}
+
+static void
+mc_sel_stage_done(ipmi_mc_t *mc)
+{
+    int running;
+
+    ipmi_lock(mc->lock);
+    running = mc->sel_stage_running;
+    mc->sel_stage_running = 0;
+    ipmi_unlock(mc->lock);
+    if (running)
+	_ipmi_domain_stage_done(mc->domain, &mc->sel_stage);
+}
+
 static void
 mc_first_sels_read(ipmi_sel_info_t *sel,
 		   int             err,
@@ -2210,9 +2354,47 @@ mc_first_sels_read(ipmi_sel_info_t *sel,
 {
     ipmi_mc_t *mc = cb_data;
 
+    mc_sel_stage_done(mc);
     _ipmi_mc_startup_put(mc, "mc_first_sels_read");
 }
 
+static void
+mc_sel_stage_start(ipmi_domain_t *domain, ipmi_domain_stage_t *stage)
+{
+    ipmi_mc_t *mc = stage->cb_data;
+    int       rv;
+    int       con_up;
+
+    mc_stage_hold(mc);
+    if (stage->cancelled || mc_startup_cancelled(mc)) {
+	_ipmi_domain_stage_done(domain, stage);
+	_ipmi_mc_startup_put(mc, "mc_sel_stage_start");
+	goto out;
+    }
+
+    con_up = ipmi_domain_con_up(domain);
+    ipmi_lock(mc->lock);
+    mc->sel_stage_running = 1;
+    rv = start_sel_ops(mc, 0, mc_first_sels_read, mc);
+    if (!rv && !con_up) {
+	/* The domain is not up yet, so no fetch was started, the SEL
+	   timer will do it later.  Don't hold a slot while waiting
+	   for that. */
+	mc->sel_stage_running = 0;
+	ipmi_unlock(mc->lock);
+	_ipmi_domain_stage_done(domain, stage);
+	goto out;
+    }
+    ipmi_unlock(mc->lock);
+    if (rv) {
+	DEBUG_INFO(mc->sel_timer_info);
+	mc_sel_stage_done(mc);
+	_ipmi_mc_startup_put(mc, "mc_sel_stage_start(2)");
+    }
+ out:
+    _ipmi_mc_put(mc);
+}
+
 /* This is called after the first sensor scan for the MC, we start up
    timers and things like that here. */
 static void
@@ -2225,11 +2407,14 @@ sensors_reread(ipmi_mc_t *mc, int err, void *cb_data)
 	   We saved it in rsp_data. */
         mc = cb_data;
 	DEBUG_INFO(mc->sel_timer_info);
+	_ipmi_domain_stage_done(mc->domain, &mc->sdrs_stage);
 	_ipmi_mc_startup_put(mc, "sensors_reread(3)");
 	return; /* domain went away while processing. */
     }
 
     DEBUG_INFO(mc->sel_timer_info);
+    _ipmi_domain_stage_done(mc->domain, &mc->sdrs_stage);
+
     /* See if any presence has changed with the new sensors. */ 
     ipmi_detect_domain_presence_changes(mc->domain, 0);
 
@@ -2256,20 +2441,54 @@ sensors_reread(ipmi_mc_t *mc, int err, void *cb_data)
 	ipmi_unlock(mc->lock);
 
     if (mc->devid.SEL_device_support && ipmi_option_SEL(mc->domain)) {
-	int rv;
 	/* If the MC supports an SEL, start scanning its SEL. */
 	DEBUG_INFO(mc->sel_timer_info);
-	ipmi_lock(mc->lock);
-	rv = start_sel_ops(mc, 0, mc_first_sels_read, mc);
-	ipmi_unlock(mc->lock);
+	_ipmi_domain_stage_start(mc->domain, &mc->sel_stage,
+				 IPMI_DOMAIN_STAGE_SEL, mc_sel_stage_start, mc);
+    } else {
+	DEBUG_INFO(mc->sel_timer_info);
+	_ipmi_mc_startup_put(mc, "sensors_reread");
+    }
+}
+
+static void
+mc_sdrs_stage_start(ipmi_domain_t *domain, ipmi_domain_stage_t *stage)
+{
+    ipmi_mc_t *mc = stage->cb_data;
+    int       rv;
+
+    mc_stage_hold(mc);
+    DEBUG_INFO(mc->sel_timer_info);
+    if (stage->cancelled || mc_startup_cancelled(mc)) {
+	_ipmi_domain_stage_done(domain, stage);
+	_ipmi_mc_startup_put(mc, "mc_sdrs_stage_start");
+    } else if (((mc->devid.provides_device_sdrs)
+		|| (mc->treat_main_as_device_sdrs))
+	       && ipmi_option_SDRs(domain))
+    {
+	DEBUG_INFO(mc->sel_timer_info);
+	rv = ipmi_mc_reread_sensors(mc, sensors_reread, mc);
 	if (rv) {
 	    DEBUG_INFO(mc->sel_timer_info);
-	    _ipmi_mc_startup_put(mc, "sensors_reread(2)");
+	    sensors_reread(mc, 0, NULL);
 	}
     } else {
 	DEBUG_INFO(mc->sel_timer_info);
-	_ipmi_mc_startup_put(mc, "sensors_reread");
+	sensors_reread(mc, 0, NULL);
     }
+    _ipmi_mc_put(mc);
+}
+
+static void
+mc_guid_done(ipmi_mc_t *mc)
+{
+    _ipmi_domain_stage_done(mc->domain, &mc->guid_stage);
+    if (mc->sdrs_wait_guid)
+	_ipmi_domain_stage_start(mc->domain, &mc->sdrs_stage,
+				 IPMI_DOMAIN_STAGE_SDRS, mc_sdrs_stage_start,
+				 mc);
+    else
+	mc_startup_put(mc, 0);
 }
 
 static void
@@ -2277,42 +2496,54 @@ got_guid(ipmi_mc_t  *mc,
 	 ipmi_msg_t *rsp,
 	 void       *rsp_data)
 {
-    int rv;
-
     if (!mc) {
 	/* MC data is still valid, but the MC is not good any more.
 	   We saved it in rsp_data. */
         mc = rsp_data;
-	_ipmi_mc_startup_put(mc, "got_guid");
+	mc_guid_done(mc);
 	return; /* domain went away while processing. */
     }
 
-    DEBUG_INFO(mc->sel_timer_info);
     if ((rsp->data[0] == 0) && (rsp->data_len >= 17)) {
 	/* We have a GUID, save it */
 	ipmi_mc_set_guid(mc, rsp->data+1);
     }
 
-    if (((mc->devid.provides_device_sdrs) || (mc->treat_main_as_device_sdrs))
-	&& ipmi_option_SDRs(ipmi_mc_get_domain(mc)))
-    {
-	DEBUG_INFO(mc->sel_timer_info);
-	rv = ipmi_mc_reread_sensors(mc, sensors_reread, mc);
-	if (rv) {
-	    DEBUG_INFO(mc->sel_timer_info);
-	    sensors_reread(mc, 0, NULL);
-	}
+    mc_guid_done(mc);
+}
+
+static void
+mc_guid_stage_start(ipmi_domain_t *domain, ipmi_domain_stage_t *stage)
+{
+    ipmi_mc_t  *mc = stage->cb_data;
+    ipmi_msg_t msg;
+    int        rv;
+
+    mc_stage_hold(mc);
+    if (stage->cancelled || mc_startup_cancelled(mc)) {
+	rv = ECANCELED;
     } else {
-	DEBUG_INFO(mc->sel_timer_info);
-	sensors_reread(mc, 0, NULL);
+	msg.netfn = IPMI_APP_NETFN;
+	msg.cmd = IPMI_GET_DEVICE_GUID_CMD;
+	msg.data_len = 0;
+	msg.data = NULL;
+
+	rv = ipmi_mc_send_command(mc, 0, &msg, got_guid, mc);
+	if (rv)
+	    ipmi_log(IPMI_LOG_SEVERE,
+		     "%smc.c(mc_guid_stage_start): "
+		     "Unable to send get guid command.",
+		     mc->name);
     }
+    if (rv)
+	mc_guid_done(mc);
+    _ipmi_mc_put(mc);
 }
 
 static void
 mc_startup(ipmi_mc_t *mc)
 {
-    ipmi_msg_t msg;
-    int        rv = 0;
+    int rv = 0;
 
     DEBUG_INFO(mc->sel_timer_info);
     mc->sel_timer_info->processing = 1;
@@ -2337,20 +2568,19 @@ mc_startup(ipmi_mc_t *mc)
     /* FIXME - handle errors setting up OEM comain information.
        Handle errors so they get retried. */
 
-    msg.netfn = IPMI_APP_NETFN;
-    msg.cmd = IPMI_GET_DEVICE_GUID_CMD;
-    msg.data_len = 0;
-    msg.data = NULL;
-
-    rv = ipmi_mc_send_command(mc, 0, &msg, got_guid, mc);
-    if (rv) {
-	DEBUG_INFO(mc->sel_timer_info);
-	ipmi_log(IPMI_LOG_SEVERE,
-		 "%smc.c(ipmi_mc_setup_new): "
-		 "Unable to send get guid command.",
-		 mc->name);
-	_ipmi_mc_startup_put(mc, "mc_startup");
-    }
+    /* The SDR cache is found by the GUID, so if it is in use the
+       SDRs have to wait for the GUID.  Otherwise fetch them at the
+       same time.  The startup count we start with covers the SDRs
+       and the SEL, take one for the GUID if it runs on its own. */
+    mc->sdrs_wait_guid = ipmi_option_use_cache(mc->domain);
+    if (!mc->sdrs_wait_guid)
+	_ipmi_mc_startup_get(mc, "mc_startup");
+    _ipmi_domain_stage_start(mc->domain, &mc->guid_stage,
+			     IPMI_DOMAIN_STAGE_GUID, mc_guid_stage_start, mc);
+    if (!mc->sdrs_wait_guid)
+	_ipmi_domain_stage_start(mc->domain, &mc->sdrs_stage,
+				 IPMI_DOMAIN_STAGE_SDRS, mc_sdrs_stage_start,
+				 mc);
 }
 
 /***********************************************************************
@@ -2397,6 +2627,8 @@ mc_apply_pending(ipmi_mc_t *mc)
 void
 _ipmi_mc_put(ipmi_mc_t *mc)
 {
+    int startup_done;
+
     _ipmi_domain_mc_lock(mc->domain);
     if (mc->usecount == 1) {
 	/* Make sure this code cannot run when we release the lock. */
@@ -2423,7 +2655,7 @@ _ipmi_mc_put(ipmi_mc_t *mc)
 	    break;
 
 	case MC_ACTIVE_PEND_CLEANUP:
-	    mc_stop_timer(mc);
+	    startup_done = mc_stop_timer(mc);
 	    if (mc->startup_count > 0) {
 		ipmi_unlock(mc->lock);
 		goto still_in_startup;
@@ -2432,13 +2664,17 @@ _ipmi_mc_put(ipmi_mc_t *mc)
 	    mc->active = 0;
 	    ipmi_unlock(mc->lock);
 	    _ipmi_domain_mc_unlock(mc->domain);
+	    if (startup_done) {
+		mc_sel_stage_done(mc);
+		_ipmi_put_domain_fully_up(mc->domain, "mc_stop_timer");
+	    }
 	    mc_cleanup(mc);
 	    call_active_handlers(mc);
 	    _ipmi_domain_mc_lock(mc->domain);
 	    break;
 
 	case MC_ACTIVE_PEND_CLEANUP_PEND_STARTUP:
-	    mc_stop_timer(mc);
+	    startup_done = mc_stop_timer(mc);
 	    if (mc->startup_count > 0) {
 		ipmi_unlock(mc->lock);
 		goto still_in_startup;
@@ -2447,6 +2683,10 @@ _ipmi_mc_put(ipmi_mc_t *mc)
 	    mc->active = 0;
 	    ipmi_unlock(mc->lock);
 	    _ipmi_domain_mc_unlock(mc->domain);
+	    if (startup_done) {
+		mc_sel_stage_done(mc);
+		_ipmi_put_domain_fully_up(mc->domain, "mc_stop_timer");
+	    }
 	    mc_cleanup(mc);
 	    call_active_handlers(mc);
 	    _ipmi_domain_mc_lock(mc->domain);
@@ -2763,6 +3003,35 @@ ipmi_mc_send_command_sideeff(ipmi_mc_t                  *mc,
     return rv;
 }
 
+int
+ipmi_mc_send_command_prio(ipmi_mc_t                  *mc,
+			  unsigned int               lun,
+			  const ipmi_msg_t           *msg,
+			  int                        priority,
+			  ipmi_mc_response_handler_t rsp_handler,
+			  void                       *rsp_data)
+{
+    int           rv;
+    ipmi_addr_t   addr = mc->addr;
+    ipmi_domain_t *domain;
+
+    CHECK_MC_LOCK(mc);
+
+    rv = ipmi_addr_set_lun(&addr, lun);
+    if (rv)
+	return rv;
+
+    domain = ipmi_mc_get_domain(mc);
+
+    rv = ipmi_send_command_addr_prio(domain,
+				     &addr, mc->addr_len,
+				     msg, priority,
+				     addr_rsp_handler,
+				     rsp_data,
+				     rsp_handler);
+    return rv;
+}
+
 /***********************************************************************
  *
  * Handle global OEM callbacks for new MCs.
@@ -3257,6 +3526,35 @@ _ipmi_mc_device_data_compares(ipmi_mc_t  *mc,
     return 1;
 }
 
+void
+_ipmi_mc_get_device_id_rsp(ipmi_mc_t *mc, unsigned char data[16])
+{
+    mc_devid_data_t *d = &mc->real_devid;
+
+    ipmi_lock(mc->lock);
+    data[0] = 0;
+    data[1] = d->device_id;
+    data[2] = d->device_revision | (d->provides_device_sdrs << 7);
+    data[3] = d->major_fw_revision | (d->device_available << 7);
+    data[4] = d->minor_fw_revision;
+    data[5] = d->major_version | (d->minor_version << 4);
+    data[6] = ((d->chassis_support << 7)
+	       | (d->bridge_support << 6)
+	       | (d->IPMB_event_generator_support << 5)
+	       | (d->IPMB_event_receiver_support << 4)
+	       | (d->FRU_inventory_support << 3)
+	       | (d->SEL_device_support << 2)
+	       | (d->SDR_repository_support << 1)
+	       | d->sensor_device_support);
+    data[7] = d->manufacturer_id & 0xff;
+    data[8] = (d->manufacturer_id >> 8) & 0xff;
+    data[9] = (d->manufacturer_id >> 16) & 0xff;
+    data[10] = d->product_id & 0xff;
+    data[11] = (d->product_id >> 8) & 0xff;
+    memcpy(data + 12, d->aux_fw_revision, 4);
+    ipmi_unlock(mc->lock);
+}
+
 /***********************************************************************
  *
  * Get/set the information for an MC.
@@ -185,6 +185,8 @@ struct ipmi_sel_info_s
 
     ipmi_sel_new_event_handler_cb new_event_handler;
     void                          *new_event_cb_data;
+    ipmi_sel_new_events_done_cb   new_events_done_handler;
+    void                          *new_events_done_cb_data;
 
     char name[SEL_NAME_LEN];
 
@@ -325,6 +327,7 @@ ipmi_sel_alloc(ipmi_mc_t       *mc,
     sel->lun = lun;
     sel->fetch_handlers = NULL;
     sel->new_event_handler = NULL;
+    sel->new_events_done_handler = NULL;
 
     sel->opq = opq_alloc(sel->os_hnd);
     if (!sel->opq) {
@@ -477,9 +480,11 @@ ipmi_sel_destroy(ipmi_sel_info_t      *sel,
 static void
 fetch_complete(ipmi_sel_info_t *sel, int err, int do_opq_done)
 {
-    sel_fetch_handler_t *elem, *next;
-    int                 sels_changed;
-    unsigned int        num_sels;
+    sel_fetch_handler_t         *elem, *next;
+    int                         sels_changed;
+    unsigned int                num_sels;
+    ipmi_sel_new_events_done_cb done_handler;
+    void                        *done_cb_data;
 
     if (sel->in_destroy)
 	goto out;
@@ -491,8 +496,15 @@ fetch_complete(ipmi_sel_info_t *sel, int err, int do_opq_done)
     sel->fetch_handlers = NULL;
     sel->fetched = 1;
     sel->in_fetch = 0;
+    done_handler = sel->new_events_done_handler;
+    done_cb_data = sel->new_events_done_cb_data;
     sel_unlock(sel);
 
+    /* Like the events themselves, the end of the batch of new events
+       goes out before fetch complete. */
+    if (done_handler)
+	done_handler(sel, done_cb_data);
+
     while (elem) {
 	next = elem->next;
 	elem->next = NULL;
@@ -2386,6 +2398,18 @@ ipmi_sel_set_new_event_handler(ipmi_sel_info_t               *sel,
     return 0;
 }
 
+int
+ipmi_sel_set_new_events_done_handler(ipmi_sel_info_t             *sel,
+				     ipmi_sel_new_events_done_cb handler,
+				     void                        *cb_data)
+{
+    sel_lock(sel);
+    sel->new_events_done_handler = handler;
+    sel->new_events_done_cb_data = cb_data;
+    sel_unlock(sel);
+    return 0;
+}
+
 int
 ipmi_sel_event_add(ipmi_sel_info_t *sel,
 		   ipmi_event_t    *new_event)
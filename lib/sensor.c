@@ -67,6 +67,15 @@ struct ipmi_sensor_info_s
 };
 
 #define SENSOR_ID_LEN 32 /* 16 bytes are allowed for a sensor. */
+/* A caller waiting for a reading that is shared with other callers. */
+typedef struct sensor_reading_wait_s sensor_reading_wait_t;
+struct sensor_reading_wait_s
+{
+    ipmi_sensor_reading_cb done;
+    void                   *cb_data;
+    sensor_reading_wait_t  *next;
+};
+
 struct ipmi_sensor_s
 {
     unsigned int  usecount;
@@ -204,6 +213,19 @@ struct ipmi_sensor_s
     /* Polymorphic functions. */
     ipmi_sensor_cbs_t cbs;
 
+    /* Readings requested while a read of the sensor is outstanding
+       wait here for that read instead of sending their own.  The last
+       successful reading is kept for callers that accept a cached
+       value.  Protected by the domain's sensor reading lock. */
+    int                       reading_in_progress;
+    sensor_reading_wait_t     *reading_waiters, *reading_waiters_tail;
+    int                       last_reading_valid;
+    struct timeval            last_reading_time;
+    enum ipmi_value_present_e last_value_present;
+    unsigned int              last_raw_val;
+    double                    last_cooked_val;
+    ipmi_states_t             last_states;
+
     /* OEM info */
     void                            *oem_info;
     ipmi_sensor_cleanup_oem_info_cb oem_info_cleanup_handler;
@@ -225,6 +247,7 @@ struct ipmi_sensor_s
 };
 
 static void sensor_final_destroy(ipmi_sensor_t *sensor);
+static void sensor_reading_invalidate(ipmi_sensor_t *sensor);
 
 /***********************************************************************
  *
@@ -3677,6 +3700,8 @@ ipmi_sensor_event(ipmi_sensor_t *sensor, ipmi_event_t *event)
 
     CHECK_SENSOR_LOCK(sensor);
 
+    sensor_reading_invalidate(sensor);
+
     handled = IPMI_EVENT_NOT_HANDLED;
 
     if (sensor->event_reading_type == IPMI_EVENT_READING_TYPE_THRESHOLD) {
@@ -5456,15 +5481,107 @@ ipmi_sensor_set_thresholds(ipmi_sensor_t       *sensor,
 
     if (!sensor->cbs.ipmi_sensor_set_thresholds)
 	return ENOSYS;
+    sensor_reading_invalidate(sensor);
     return sensor->cbs.ipmi_sensor_set_thresholds(sensor, thresholds,
 						  done, cb_data);
 }
 
+/* Throw away the cached reading, the thresholds changed or an event
+   says the state of the sensor did. */
+static void
+sensor_reading_invalidate(ipmi_sensor_t *sensor)
+{
+    _ipmi_domain_sensor_reading_lock(sensor->domain);
+    sensor->last_reading_valid = 0;
+    _ipmi_domain_sensor_reading_unlock(sensor->domain);
+}
+
+static void
+call_reading_waiters(ipmi_sensor_t             *sensor,
+		     sensor_reading_wait_t     *w,
+		     int                       err,
+		     enum ipmi_value_present_e value_present,
+		     unsigned int              raw_value,
+		     double                    val,
+		     ipmi_states_t             *states)
+{
+    sensor_reading_wait_t *next;
+
+    while (w) {
+	next = w->next;
+	if (w->done)
+	    w->done(sensor, err, value_present, raw_value, val, states,
+		    w->cb_data);
+	ipmi_mem_free(w);
+	w = next;
+    }
+}
+
+/* The shared read is done, hand the result to everyone waiting on it. */
+static void
+shared_reading_done(ipmi_sensor_t             *rsensor,
+		    int                       err,
+		    enum ipmi_value_present_e value_present,
+		    unsigned int              raw_value,
+		    double                    val,
+		    ipmi_states_t             *states,
+		    void                      *cb_data)
+{
+    ipmi_sensor_t         *sensor = cb_data;
+    sensor_reading_wait_t *w;
+
+    _ipmi_domain_sensor_reading_lock(sensor->domain);
+    w = sensor->reading_waiters;
+    sensor->reading_waiters = NULL;
+    sensor->reading_waiters_tail = NULL;
+    sensor->reading_in_progress = 0;
+    if (!err) {
+	os_handler_t *os_hnd = ipmi_domain_get_os_hnd(sensor->domain);
+
+	sensor->last_reading_valid = 1;
+	os_hnd->get_monotonic_time(os_hnd, &sensor->last_reading_time);
+	sensor->last_value_present = value_present;
+	sensor->last_raw_val = raw_value;
+	sensor->last_cooked_val = val;
+	sensor->last_states = *states;
+    }
+    _ipmi_domain_sensor_reading_unlock(sensor->domain);
+
+    call_reading_waiters(rsensor, w, err, value_present, raw_value, val,
+			 states);
+}
+
+/* Must be called with the sensor reading lock held. */
+static int
+cached_reading_ok(ipmi_sensor_t *sensor)
+{
+    unsigned int   ttl = ipmi_option_sensor_reading_ttl(sensor->domain);
+    os_handler_t   *os_hnd = ipmi_domain_get_os_hnd(sensor->domain);
+    struct timeval now;
+    long           age;
+
+    if (!ttl || !sensor->last_reading_valid)
+	return 0;
+
+    os_hnd->get_monotonic_time(os_hnd, &now);
+    age = ((now.tv_sec - sensor->last_reading_time.tv_sec) * 1000
+	   + (now.tv_usec - sensor->last_reading_time.tv_usec) / 1000);
+    return (age >= 0) && (age < (long) ttl);
+}
+
 int
-ipmi_sensor_get_reading(ipmi_sensor_t          *sensor,
-			ipmi_sensor_reading_cb done,
-			void                   *cb_data)
+ipmi_sensor_get_reading_flags(ipmi_sensor_t          *sensor,
+			      unsigned int           flags,
+			      ipmi_sensor_reading_cb done,
+			      void                   *cb_data)
 {
+    sensor_reading_wait_t     *w;
+    int                       rv;
+    enum ipmi_value_present_e value_present;
+    unsigned int              raw_val;
+    double                    cooked_val;
+    ipmi_states_t             states;
+
     if (!sensor_ok_to_use(sensor))
 	return ECANCELED;
       
@@ -5472,7 +5589,76 @@ ipmi_sensor_get_reading(ipmi_sensor_t          *sensor,
 
     if (!sensor->cbs.ipmi_sensor_get_reading)
 	return ENOSYS;
-    return sensor->cbs.ipmi_sensor_get_reading(sensor, done, cb_data);
+
+    _ipmi_domain_sensor_reading_lock(sensor->domain);
+    if ((flags & IPMI_SENSOR_READING_ACCEPT_CACHED)
+	&& cached_reading_ok(sensor))
+    {
+	value_present = sensor->last_value_present;
+	raw_val = sensor->last_raw_val;
+	cooked_val = sensor->last_cooked_val;
+	states = sensor->last_states;
+	_ipmi_domain_sensor_reading_unlock(sensor->domain);
+	if (done)
+	    done(sensor, 0, value_present, raw_val, cooked_val, &states,
+		 cb_data);
+	return 0;
+    }
+
+    w = ipmi_mem_alloc(sizeof(*w));
+    if (!w) {
+	_ipmi_domain_sensor_reading_unlock(sensor->domain);
+	return ENOMEM;
+    }
+    w->done = done;
+    w->cb_data = cb_data;
+    w->next = NULL;
+    if (sensor->reading_waiters_tail)
+	sensor->reading_waiters_tail->next = w;
+    else
+	sensor->reading_waiters = w;
+    sensor->reading_waiters_tail = w;
+
+    if (sensor->reading_in_progress) {
+	/* Ride along on the read that is already outstanding. */
+	_ipmi_domain_sensor_reading_unlock(sensor->domain);
+	return 0;
+    }
+    sensor->reading_in_progress = 1;
+    _ipmi_domain_sensor_reading_unlock(sensor->domain);
+
+    rv = sensor->cbs.ipmi_sensor_get_reading(sensor, shared_reading_done,
+					     sensor);
+    if (rv) {
+	/* The read was never started.  This caller gets the error
+	   return, anyone that joined in the meantime gets the error in
+	   their callback. */
+	_ipmi_domain_sensor_reading_lock(sensor->domain);
+	w = sensor->reading_waiters;
+	sensor->reading_waiters = NULL;
+	sensor->reading_waiters_tail = NULL;
+	sensor->reading_in_progress = 0;
+	_ipmi_domain_sensor_reading_unlock(sensor->domain);
+
+	/* The first waiter is this caller. */
+	if (w) {
+	    sensor_reading_wait_t *next = w->next;
+
+	    ipmi_mem_free(w);
+	    ipmi_init_states(&states);
+	    call_reading_waiters(sensor, next, rv, IPMI_NO_VALUES_PRESENT,
+				 0, 0.0, &states);
+	}
+    }
+    return rv;
+}
+
+int
+ipmi_sensor_get_reading(ipmi_sensor_t          *sensor,
+			ipmi_sensor_reading_cb done,
+			void                   *cb_data)
+{
+    return ipmi_sensor_get_reading_flags(sensor, 0, done, cb_data);
 }
 
 int
@@ -5887,6 +6073,7 @@ ipmi_sensor_id_get_thresholds(ipmi_sensor_id_t          sensor_id,
 
 typedef struct sensor_id_reading_get_s
 {
+    unsigned int           flags;
     ipmi_sensor_reading_cb done;
     void                   *cb_data;
     int                    rv;
@@ -5897,19 +6084,30 @@ sensor_id_get_reading_cb(ipmi_sensor_t *sensor, void *cb_data)
 {
     sensor_id_reading_get_t *info = cb_data;
     
-    info->rv = ipmi_sensor_get_reading(sensor,
-				       info->done,
-				       info->cb_data);
+    info->rv = ipmi_sensor_get_reading_flags(sensor,
+					     info->flags,
+					     info->done,
+					     info->cb_data);
 }
 
 int
 ipmi_sensor_id_get_reading(ipmi_sensor_id_t       sensor_id,
 			   ipmi_sensor_reading_cb done,
 			   void                   *cb_data)
+{
+    return ipmi_sensor_id_get_reading_flags(sensor_id, 0, done, cb_data);
+}
+
+int
+ipmi_sensor_id_get_reading_flags(ipmi_sensor_id_t       sensor_id,
+				 unsigned int           flags,
+				 ipmi_sensor_reading_cb done,
+				 void                   *cb_data)
 {
     sensor_id_reading_get_t info;
     int                     rv;
 
+    info.flags = flags;
     info.done = done;
     info.cb_data = cb_data;
     rv = ipmi_sensor_pointer_cb(sensor_id, sensor_id_get_reading_cb, &info);
@@ -0,0 +1,720 @@
+/*
+ * lan_bench.c
+ *
+ * Open a number of IPMI LAN sessions to a BMC, like the one provided
+ * by ipmi_sim, and measure the session setup and command rates.
+ *
+ * Author: MontaVista Software, Inc.
+ *         Corey Minyard <minyard@mvista.com>
+ *         source@mvista.com
+ *
+ * Copyright 2012 MontaVista Software Inc.
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2 of
+ *  the License, or (at your option) any later version.
+ *
+ *
+ *  THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ *  WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ *  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ *  OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ *  TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ *  USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this program; if not, write to the Free
+ *  Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * All the sessions are started at once through the normal OpenIPMI
+ * LAN code, and the time until they are all up gives the session
+ * setup rate.  Then each session keeps a window of commands
+ * outstanding, taken in turn from a weighted mix, for the given time.
+ * SDR and SEL reads walk through the repository, wrapping at the end.
+ * The response time of every answered command, including ones with an
+ * error completion code, is kept to print percentiles.
+ * With -j the results are printed as a single JSON object so they
+ * can be saved and compared between runs.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/time.h>
+
+#include <OpenIPMI/ipmiif.h>
+#include <OpenIPMI/ipmi_conn.h>
+#include <OpenIPMI/ipmi_msgbits.h>
+#include <OpenIPMI/ipmi_err.h>
+#include <OpenIPMI/ipmi_posix.h>
+
+#define MAX_SESSIONS	63
+#define MAX_WINDOW	16
+
+#define CMD_DEVID	0
+#define CMD_SENSOR	1
+#define CMD_SDR		2
+#define CMD_SEL		3
+#define CMD_SOL		4
+#define NUM_CMDS	5
+
+static const char *cmd_names[NUM_CMDS] = {
+    "devid", "sensor", "sdr", "sel", "sol"
+};
+
+/* Authentication, integrity and confidentiality for a cipher suite. */
+static struct {
+    int        id;
+    const char *auth, *integ, *conf;
+} cipher_suites[] = {
+    {  0, "rakp_none", "none", "none" },
+    {  1, "rakp_hmac_sha1", "none", "none" },
+    {  2, "rakp_hmac_sha1", "hmac_sha1", "none" },
+    {  3, "rakp_hmac_sha1", "hmac_sha1", "aes_cbc_128" },
+    {  6, "rakp_hmac_md5", "none", "none" },
+    {  7, "rakp_hmac_md5", "hmac_md5", "none" },
+    {  8, "rakp_hmac_md5", "hmac_md5", "aes_cbc_128" },
+    { 11, "rakp_hmac_md5", "md5", "none" },
+    { 12, "rakp_hmac_md5", "md5", "aes_cbc_128" },
+    { -1 }
+};
+
+typedef struct lat_s
+{
+    double        *v;
+    unsigned long n;
+    unsigned long size;
+} lat_t;
+
+typedef struct session_s session_t;
+
+typedef struct slot_s
+{
+    session_t     *s;
+    int           cmd;
+    double        start;
+    ipmi_msg_t    msg;
+    unsigned char data[8];
+} slot_t;
+
+struct session_s
+{
+    ipmi_con_t    *con;
+    int           suite;
+    int           up;
+    int           failed;
+    double        setup_time;
+    unsigned int  outstanding;
+    unsigned int  next_sdr;
+    unsigned int  next_sel;
+    slot_t        slots[MAX_WINDOW];
+};
+
+static char         *progname;
+static os_handler_t *os_hnd;
+static selector_t   *sel;
+
+static session_t     sessions[MAX_SESSIONS];
+static int           num_sessions = 1;
+static int           window = 1;
+static double        run_time = 5.0;
+static int           sensor_num = 1;
+static int           json = 0;
+static int           mix[64];
+static unsigned int  mix_len;
+static unsigned int  mix_pos;
+static int           suites[MAX_SESSIONS];
+static unsigned int  num_suites;
+
+static int           running;
+static double        start_time;
+static unsigned int  sessions_up, sessions_failed;
+static double        setup_end;
+static unsigned long counts[NUM_CMDS], errors[NUM_CMDS];
+static unsigned long drained;
+static lat_t         lats[NUM_CMDS];
+static lat_t         all_lats;
+
+static void
+usage(void)
+{
+    fprintf(stderr,
+	    "Open sessions to a BMC, run a mix of commands on them and\n"
+	    "print the setup rate, command rate and latencies\n");
+    fprintf(stderr,
+	    "Usage:\n");
+    fprintf(stderr,
+	    "  %s [-n <sessions>] [-w <window>] [-t <seconds>] [-m <mix>]\n"
+	    "     [-c <suite>[,<suite>...]] [-s <sensor>] [-j] <con_parms>\n",
+	    progname);
+    fprintf(stderr,
+	    "    -n - Number of sessions, 1-%d (default 1)\n", MAX_SESSIONS);
+    fprintf(stderr,
+	    "    -w - Commands outstanding per session, 1-%d (default 1)\n",
+	    MAX_WINDOW);
+    fprintf(stderr,
+	    "    -t - Number of seconds to run (default 5)\n");
+    fprintf(stderr,
+	    "    -m - Command mix as <cmd>[:<weight>],... from devid, sensor,\n"
+	    "         sdr, sel and sol (default devid)\n");
+    fprintf(stderr,
+	    "    -c - RMCP+ cipher suites, given to the sessions in turn\n");
+    fprintf(stderr,
+	    "    -s - Sensor number for sensor reads (default 1)\n");
+    fprintf(stderr,
+	    "    -j - Print the results as JSON\n");
+    fprintf(stderr,
+	    "  <con_parms> are as for openipmicmd, usually\n"
+	    "    lan -U <user> -P <password> -p <port> <host>\n");
+    exit(1);
+}
+
+static double
+now(void)
+{
+    struct timeval tv;
+
+    os_hnd->get_monotonic_time(os_hnd, &tv);
+    return tv.tv_sec + (tv.tv_usec / 1000000.0);
+}
+
+static void
+lat_add(lat_t *l, double v)
+{
+    if (l->n >= l->size) {
+	double *nv;
+
+	l->size = l->size ? l->size * 2 : 4096;
+	nv = realloc(l->v, l->size * sizeof(double));
+	if (!nv) {
+	    fprintf(stderr, "Out of memory\n");
+	    exit(1);
+	}
+	l->v = nv;
+    }
+    l->v[l->n++] = v;
+}
+
+static int
+cmp_double(const void *a, const void *b)
+{
+    double da = *(const double *) a, db = *(const double *) b;
+
+    return da < db ? -1 : da > db;
+}
+
+static double
+percentile(lat_t *l, double p)
+{
+    unsigned long i = p * l->n / 100;
+
+    if (l->n == 0)
+	return 0;
+    if (i >= l->n)
+	i = l->n - 1;
+    return l->v[i] * 1000000;
+}
+
+static int
+parse_mix(char *str)
+{
+    char         *tok, *save, *w, *end;
+    unsigned int weight, i, j;
+
+    mix_len = 0;
+    for (tok = strtok_r(str, ",", &save); tok;
+	 tok = strtok_r(NULL, ",", &save))
+    {
+	weight = 1;
+	w = strchr(tok, ':');
+	if (w) {
+	    *w++ = '\0';
+	    weight = strtoul(w, &end, 0);
+	    if (*end != '\0' || weight < 1)
+		return EINVAL;
+	}
+	for (i = 0; i < NUM_CMDS; i++) {
+	    if (strcmp(tok, cmd_names[i]) == 0)
+		break;
+	}
+	if (i == NUM_CMDS || mix_len + weight > 64)
+	    return EINVAL;
+	for (j = 0; j < weight; j++)
+	    mix[mix_len++] = i;
+    }
+    return mix_len ? 0 : EINVAL;
+}
+
+static int
+parse_suites(char *str)
+{
+    char *tok, *save, *end;
+    int  id, i;
+
+    num_suites = 0;
+    for (tok = strtok_r(str, ",", &save); tok;
+	 tok = strtok_r(NULL, ",", &save))
+    {
+	id = strtol(tok, &end, 0);
+	if (*end != '\0' || num_suites >= MAX_SESSIONS)
+	    return EINVAL;
+	for (i = 0; cipher_suites[i].id >= 0; i++) {
+	    if (cipher_suites[i].id == id)
+		break;
+	}
+	if (cipher_suites[i].id < 0)
+	    return EINVAL;
+	suites[num_suites++] = i;
+    }
+    return num_suites ? 0 : EINVAL;
+}
+
+static void
+fill_msg(session_t *s, slot_t *slot)
+{
+    slot->cmd = mix[mix_pos];
+    mix_pos = (mix_pos + 1) % mix_len;
+
+    slot->msg.data = slot->data;
+    switch (slot->cmd) {
+    case CMD_DEVID:
+	slot->msg.netfn = IPMI_APP_NETFN;
+	slot->msg.cmd = IPMI_GET_DEVICE_ID_CMD;
+	slot->msg.data_len = 0;
+	break;
+
+    case CMD_SENSOR:
+	slot->msg.netfn = IPMI_SENSOR_EVENT_NETFN;
+	slot->msg.cmd = IPMI_GET_SENSOR_READING_CMD;
+	slot->data[0] = sensor_num;
+	slot->msg.data_len = 1;
+	break;
+
+    case CMD_SDR:
+	slot->msg.netfn = IPMI_STORAGE_NETFN;
+	slot->msg.cmd = IPMI_GET_SDR_CMD;
+	slot->data[0] = 0; /* No reservation */
+	slot->data[1] = 0;
+	slot->data[2] = s->next_sdr & 0xff;
+	slot->data[3] = s->next_sdr >> 8;
+	slot->data[4] = 0;
+	slot->data[5] = 0xff;
+	slot->msg.data_len = 6;
+	break;
+
+    case CMD_SEL:
+	slot->msg.netfn = IPMI_STORAGE_NETFN;
+	slot->msg.cmd = IPMI_GET_SEL_ENTRY_CMD;
+	slot->data[0] = 0;
+	slot->data[1] = 0;
+	slot->data[2] = s->next_sel & 0xff;
+	slot->data[3] = s->next_sel >> 8;
+	slot->data[4] = 0;
+	slot->data[5] = 0xff;
+	slot->msg.data_len = 6;
+	break;
+
+    case CMD_SOL:
+	/* SOL enable parameter of the current channel. */
+	slot->msg.netfn = IPMI_TRANSPORT_NETFN;
+	slot->msg.cmd = IPMI_GET_SOL_CONFIGURATION_PARAMETERS;
+	slot->data[0] = 0x0e;
+	slot->data[1] = 1;
+	slot->data[2] = 0;
+	slot->data[3] = 0;
+	slot->msg.data_len = 4;
+	break;
+    }
+}
+
+static int send_cmd(session_t *s, slot_t *slot, ipmi_msgi_t *rspi);
+
+static int
+rsp_handler(ipmi_con_t *con, ipmi_msgi_t *rspi)
+{
+    slot_t      *slot = rspi->data1;
+    session_t   *s = slot->s;
+    ipmi_msg_t  *msg = &rspi->msg;
+    double      lat = now() - slot->start;
+
+    s->outstanding--;
+    counts[slot->cmd]++;
+    if (!running)
+	/* Finished after the run ended, not part of the rate. */
+	drained++;
+    if (msg->data_len >= 1 && msg->data[0] != IPMI_TIMEOUT_CC) {
+	lat_add(&lats[slot->cmd], lat);
+	lat_add(&all_lats, lat);
+    }
+    if (msg->data_len < 1 || msg->data[0] != 0) {
+	errors[slot->cmd]++;
+	/* Start the walk over if we ran off the end. */
+	if (slot->cmd == CMD_SDR)
+	    s->next_sdr = 0;
+	else if (slot->cmd == CMD_SEL)
+	    s->next_sel = 0;
+    } else {
+	if ((slot->cmd == CMD_SDR || slot->cmd == CMD_SEL)
+	    && msg->data_len >= 3)
+	{
+	    unsigned int next = msg->data[1] | (msg->data[2] << 8);
+
+	    if (next == 0xffff)
+		next = 0;
+	    if (slot->cmd == CMD_SDR)
+		s->next_sdr = next;
+	    else
+		s->next_sel = next;
+	}
+    }
+
+    if (!running)
+	return IPMI_MSG_ITEM_NOT_USED;
+
+    fill_msg(s, slot);
+    if (send_cmd(s, slot, rspi))
+	return IPMI_MSG_ITEM_NOT_USED;
+    return IPMI_MSG_ITEM_USED;
+}
+
+static int
+send_cmd(session_t *s, slot_t *slot, ipmi_msgi_t *rspi)
+{
+    ipmi_system_interface_addr_t si;
+    int                          rv;
+
+    si.addr_type = IPMI_SYSTEM_INTERFACE_ADDR_TYPE;
+    si.channel = IPMI_BMC_CHANNEL;
+    si.lun = 0;
+
+    rspi->data1 = slot;
+    slot->s = s;
+    slot->start = now();
+    rv = s->con->send_command(s->con, (ipmi_addr_t *) &si, sizeof(si),
+			      &slot->msg, rsp_handler, rspi);
+    if (rv) {
+	errors[slot->cmd]++;
+	return rv;
+    }
+    s->outstanding++;
+    return 0;
+}
+
+static void
+start_cmds(session_t *s)
+{
+    ipmi_msgi_t *rspi;
+    int         i;
+
+    for (i = 0; i < window; i++) {
+	rspi = ipmi_alloc_msg_item();
+	if (!rspi) {
+	    fprintf(stderr, "Out of memory\n");
+	    exit(1);
+	}
+	fill_msg(s, &s->slots[i]);
+	if (send_cmd(s, &s->slots[i], rspi))
+	    ipmi_free_msg_item(rspi);
+    }
+}
+
+static void
+con_changed(ipmi_con_t   *con,
+	    int          err,
+	    unsigned int port_num,
+	    int          still_connected,
+	    void         *cb_data)
+{
+    session_t *s = cb_data;
+
+    if (s->up || s->failed)
+	return;
+    if (err || !still_connected) {
+	s->failed = 1;
+	sessions_failed++;
+	fprintf(stderr, "Session %d failed: 0x%x\n", (int) (s - sessions),
+		err);
+    } else {
+	s->up = 1;
+	s->setup_time = now() - start_time;
+	sessions_up++;
+    }
+    if (sessions_up + sessions_failed == (unsigned int) num_sessions)
+	setup_end = now();
+}
+
+static void
+run_until(double end, int (*done)(void))
+{
+    struct timeval tv;
+    double         left;
+
+    while (!done()) {
+	left = end - now();
+	if (left <= 0)
+	    break;
+	if (left > 0.1)
+	    left = 0.1;
+	tv.tv_sec = 0;
+	tv.tv_usec = left * 1000000;
+	os_hnd->perform_one_op(os_hnd, &tv);
+    }
+}
+
+static int
+setup_done(void)
+{
+    return sessions_up + sessions_failed == (unsigned int) num_sessions;
+}
+
+static int
+never_done(void)
+{
+    return 0;
+}
+
+static int
+all_answered(void)
+{
+    int i;
+
+    for (i = 0; i < num_sessions; i++) {
+	if (sessions[i].outstanding)
+	    return 0;
+    }
+    return 1;
+}
+
+static void
+print_results(double setup_secs, double run_secs)
+{
+    unsigned long total = 0, total_err = 0;
+    int           i, first = 1;
+
+    for (i = 0; i < NUM_CMDS; i++) {
+	total += counts[i];
+	total_err += errors[i];
+	qsort(lats[i].v, lats[i].n, sizeof(double), cmp_double);
+    }
+    qsort(all_lats.v, all_lats.n, sizeof(double), cmp_double);
+
+    if (json) {
+	printf("{\"sessions\": %d, \"sessions_up\": %u, \"window\": %d,"
+	       " \"setup_secs\": %.6f, \"setups_per_sec\": %.1f,"
+	       " \"run_secs\": %.6f, \"requests\": %lu, \"errors\": %lu,"
+	       " \"drained\": %lu, \"requests_per_sec\": %.1f,"
+	       " \"p50_usec\": %.0f, \"p99_usec\": %.0f, \"p999_usec\": %.0f,"
+	       " \"commands\": {",
+	       num_sessions, sessions_up, window,
+	       setup_secs, setup_secs > 0 ? sessions_up / setup_secs : 0.0,
+	       run_secs, total - drained, total_err, drained,
+	       (total - drained) / run_secs,
+	       percentile(&all_lats, 50), percentile(&all_lats, 99),
+	       percentile(&all_lats, 99.9));
+	for (i = 0; i < NUM_CMDS; i++) {
+	    if (!counts[i])
+		continue;
+	    printf("%s\"%s\": {\"requests\": %lu, \"errors\": %lu,"
+		   " \"p50_usec\": %.0f, \"p99_usec\": %.0f,"
+		   " \"p999_usec\": %.0f}",
+		   first ? "" : ", ",
+		   cmd_names[i], counts[i], errors[i],
+		   percentile(&lats[i], 50), percentile(&lats[i], 99),
+		   percentile(&lats[i], 99.9));
+	    first = 0;
+	}
+	printf("}}\n");
+	return;
+    }
+
+    printf("%u of %d sessions up in %.3f seconds, %.1f sessions/s\n",
+	   sessions_up, num_sessions, setup_secs,
+	   setup_secs > 0 ? sessions_up / setup_secs : 0.0);
+    printf("%lu requests in %.2f seconds, %.0f reqs/s, %lu errors,"
+	   " window %d\n", total - drained, run_secs,
+	   (total - drained) / run_secs, total_err, window);
+    if (drained)
+	printf("%lu more finished after the run\n", drained);
+    printf("latency usec: p50 %.0f p99 %.0f p99.9 %.0f\n",
+	   percentile(&all_lats, 50), percentile(&all_lats, 99),
+	   percentile(&all_lats, 99.9));
+    for (i = 0; i < NUM_CMDS; i++) {
+	if (!counts[i])
+	    continue;
+	printf("  %-6s %8lu requests, %lu errors, p50 %.0f p99 %.0f"
+	       " p99.9 %.0f\n", cmd_names[i], counts[i], errors[i],
+	       percentile(&lats[i], 50), percentile(&lats[i], 99),
+	       percentile(&lats[i], 99.9));
+    }
+}
+
+int
+main(int argc, char *argv[])
+{
+    int          rv;
+    int          curr_arg;
+    ipmi_args_t  *args;
+    int          i;
+    char         *end;
+    double       setup_secs, run_start, run_secs;
+    char         default_mix[] = "devid";
+
+    progname = argv[0];
+
+    os_hnd = ipmi_posix_get_os_handler();
+    if (!os_hnd) {
+	fprintf(stderr, "Unable to allocate os handler\n");
+	exit(1);
+    }
+    sel_alloc_selector(os_hnd, &sel);
+    ipmi_posix_os_handler_set_sel(os_hnd, sel);
+    rv = ipmi_init(os_hnd);
+    if (rv) {
+	fprintf(stderr, "Error initializing connections: 0x%x\n", rv);
+	exit(1);
+    }
+
+    parse_mix(default_mix);
+
+    for (i=1; i<argc; i++) {
+	if (argv[i][0] != '-')
+	    break;
+	if (strcmp(argv[i], "--") == 0) {
+	    i++;
+	    break;
+	} else if (strcmp(argv[i], "-j") == 0) {
+	    json = 1;
+	} else if (i + 1 >= argc) {
+	    fprintf(stderr, "No parameter given for %s\n\n", argv[i]);
+	    usage();
+	} else if (strcmp(argv[i], "-n") == 0) {
+	    num_sessions = strtoul(argv[++i], &end, 0);
+	    if (num_sessions < 1 || num_sessions > MAX_SESSIONS
+		|| *end != '\0')
+	    {
+		fprintf(stderr, "Invalid number of sessions for -n\n\n");
+		usage();
+	    }
+	} else if (strcmp(argv[i], "-w") == 0) {
+	    window = strtoul(argv[++i], &end, 0);
+	    if (window < 1 || window > MAX_WINDOW || *end != '\0') {
+		fprintf(stderr, "Invalid window specified for -w\n\n");
+		usage();
+	    }
+	} else if (strcmp(argv[i], "-t") == 0) {
+	    run_time = strtod(argv[++i], &end);
+	    if (run_time <= 0 || *end != '\0') {
+		fprintf(stderr, "Invalid time specified for -t\n\n");
+		usage();
+	    }
+	} else if (strcmp(argv[i], "-s") == 0) {
+	    sensor_num = strtoul(argv[++i], &end, 0);
+	    if (sensor_num < 0 || sensor_num > 254 || *end != '\0') {
+		fprintf(stderr, "Invalid sensor specified for -s\n\n");
+		usage();
+	    }
+	} else if (strcmp(argv[i], "-m") == 0) {
+	    if (parse_mix(argv[++i])) {
+		fprintf(stderr, "Invalid command mix for -m\n\n");
+		usage();
+	    }
+	} else if (strcmp(argv[i], "-c") == 0) {
+	    if (parse_suites(argv[++i])) {
+		fprintf(stderr, "Invalid cipher suite for -c\n\n");
+		usage();
+	    }
+	} else
+	    usage();
+    }
+    if (i >= argc)
+	usage();
+
+    curr_arg = i;
+    rv = ipmi_parse_args2(&curr_arg, argc, argv, &args);
+    if (rv) {
+	fprintf(stderr, "Error parsing connection arguments, argument %d:"
+		" %s\n", curr_arg, strerror(rv));
+	exit(1);
+    }
+
+    start_time = now();
+    for (i = 0; i < num_sessions; i++) {
+	session_t *s = &sessions[i];
+
+	if (num_suites) {
+	    int cs = suites[i % num_suites];
+
+	    rv = ipmi_args_set_val(args, 0, "Authtype", "rmcp+");
+	    if (!rv)
+		rv = ipmi_args_set_val(args, 0, "Authentication_Algorithm",
+				       cipher_suites[cs].auth);
+	    if (!rv)
+		rv = ipmi_args_set_val(args, 0, "Integrity_Algorithm",
+				       cipher_suites[cs].integ);
+	    if (!rv)
+		rv = ipmi_args_set_val(args, 0, "Confidentiality_Algorithm",
+				       cipher_suites[cs].conf);
+	    if (rv) {
+		fprintf(stderr, "Unable to set the cipher suite: %s\n",
+			strerror(rv));
+		exit(1);
+	    }
+	    s->suite = cipher_suites[cs].id;
+	}
+
+	rv = ipmi_args_setup_con(args, os_hnd, sel, &s->con);
+	if (rv) {
+	    fprintf(stderr, "Unable to set up connection: %s\n",
+		    strerror(rv));
+	    exit(1);
+	}
+	s->con->add_con_change_handler(s->con, con_changed, s);
+	rv = s->con->start_con(s->con);
+	if (rv) {
+	    fprintf(stderr, "Could not start connection: %x\n", rv);
+	    exit(1);
+	}
+    }
+    ipmi_free_args(args);
+
+    run_until(start_time + 30, setup_done);
+    if (!setup_done())
+	setup_end = now();
+    setup_secs = setup_end - start_time;
+    if (sessions_up == 0) {
+	fprintf(stderr, "No sessions came up\n");
+	exit(1);
+    }
+
+    running = 1;
+    run_start = now();
+    for (i = 0; i < num_sessions; i++) {
+	if (sessions[i].up)
+	    start_cmds(&sessions[i]);
+    }
+    run_until(run_start + run_time, never_done);
+    running = 0;
+    run_secs = now() - run_start;
+
+    /*
+     * Let the outstanding commands finish so their latencies are
+     * counted.  Waiting for retries here says nothing about the
+     * server, so this is not part of the run time or the rate.
+     */
+    run_until(now() + 5, all_answered);
+
+    print_results(setup_secs, run_secs);
+
+    for (i = 0; i < num_sessions; i++)
+	sessions[i].con->close_connection(sessions[i].con);
+    sel_free_selector(sel);
+    return 0;
+}
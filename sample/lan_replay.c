@@ -0,0 +1,579 @@
+/*
+ * lan_replay.c
+ *
+ * Send the requests in a pcap capture of IPMI LAN traffic to a BMC
+ * or simulator and measure the response times.
+ *
+ * Author: MontaVista Software, Inc.
+ *         Corey Minyard <minyard@mvista.com>
+ *         source@mvista.com
+ *
+ * Copyright 2012 MontaVista Software Inc.
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2 of
+ *  the License, or (at your option) any later version.
+ *
+ *
+ *  THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ *  WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ *  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ *  OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ *  TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ *  USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this program; if not, write to the Free
+ *  Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * The capture may come from "ipmi_sim -p", from "lan_capture" in the
+ * simulator, or from tcpdump.  Every UDP datagram sent to the server
+ * port in the capture is a request, everything else is ignored.  The
+ * requests are sent with the original spacing, the spacing divided by
+ * a speedup, or as fast as possible with a number of them outstanding.
+ * Each response is matched to the oldest outstanding request with the
+ * same key: the ASF message tag for pings, the message tag for RMCP+
+ * session setup, and the netfn, command and rqSeq for IPMI messages.
+ * Encrypted payloads have no usable key, they are matched in order
+ * among themselves.  A request not answered within the timeout is
+ * counted as lost, a response that matches nothing is counted as
+ * unmatched.
+ *
+ * Session IDs, sequence numbers and authentication codes are sent as
+ * captured, so only requests outside a session, or sessions that the
+ * target will still accept, get real answers.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netdb.h>
+
+#define PCAP_MAGIC		0xa1b2c3d4
+#define PCAP_MAGIC_NSEC		0xa1b23c4d
+#define LINKTYPE_ETHERNET	1
+#define LINKTYPE_RAW		101
+#define LINKTYPE_LINUX_SLL	113
+
+#define MAX_WINDOW	64
+
+typedef struct req_s
+{
+    double        time;		/* Seconds from the first request */
+    unsigned int  len;
+    unsigned char *data;
+    uint32_t      key;
+} req_t;
+
+typedef struct pend_s
+{
+    double   time;
+    uint32_t key;
+} pend_t;
+
+static char *progname;
+
+static void
+usage(void)
+{
+    fprintf(stderr,
+	    "Send the IPMI LAN requests in a pcap capture and print the\n");
+    fprintf(stderr,
+	    "response time percentiles\n");
+    fprintf(stderr,
+	    "Usage:\n");
+    fprintf(stderr,
+	    "  %s [-p <port>] [-P <port>] [-s <speedup>] [-f] [-w <window>]\n"
+	    "       [-l <loops>] [-t <timeout>] <capture> [host]\n",
+	    progname);
+    fprintf(stderr,
+	    "    -p - Destination port, defaults to 623\n");
+    fprintf(stderr,
+	    "    -P - Server port in the capture, defaults to the destination\n"
+	    "         port of the first packet\n");
+    fprintf(stderr,
+	    "    -s - Send this many times faster than captured (default 1)\n");
+    fprintf(stderr,
+	    "    -f - Send as fast as possible, ignoring the capture times\n");
+    fprintf(stderr,
+	    "    -w - With -f, number of requests kept outstanding, 1-%d"
+	    " (default 1)\n", MAX_WINDOW);
+    fprintf(stderr,
+	    "    -l - Number of times to send the capture (default 1)\n");
+    fprintf(stderr,
+	    "    -t - Milliseconds to wait for a response (default 1000)\n");
+    fprintf(stderr,
+	    "    host - the host to send to, default localhost\n");
+    exit(1);
+}
+
+static uint32_t
+get32(const unsigned char *d, int swap)
+{
+    uint32_t v;
+
+    memcpy(&v, d, 4);
+    if (swap)
+	v = ((v >> 24) | ((v >> 8) & 0xff00) | ((v << 8) & 0xff0000)
+	     | (v << 24));
+    return v;
+}
+
+/*
+ * Find the UDP header in a packet, return its offset or -1 if it is
+ * not UDP.
+ */
+static int
+find_udp(unsigned int linktype, const unsigned char *d, unsigned int len)
+{
+    unsigned int off = 0, ethertype;
+
+    switch (linktype) {
+    case LINKTYPE_ETHERNET:
+	if (len < 14)
+	    return -1;
+	ethertype = (d[12] << 8) | d[13];
+	off = 14;
+	if (ethertype == 0x8100 && len >= 18) {
+	    ethertype = (d[16] << 8) | d[17];
+	    off = 18;
+	}
+	break;
+
+    case LINKTYPE_LINUX_SLL:
+	if (len < 16)
+	    return -1;
+	ethertype = (d[14] << 8) | d[15];
+	off = 16;
+	break;
+
+    case LINKTYPE_RAW:
+	if (len < 1)
+	    return -1;
+	ethertype = (d[0] >> 4) == 6 ? 0x86dd : 0x0800;
+	break;
+
+    default:
+	return -1;
+    }
+
+    if (ethertype == 0x0800) {
+	if (len < off + 20 || (d[off] >> 4) != 4 || d[off + 9] != 17)
+	    return -1;
+	off += (d[off] & 0xf) * 4;
+    } else if (ethertype == 0x86dd) {
+	if (len < off + 40 || d[off + 6] != 17)
+	    return -1;
+	off += 40;
+    } else
+	return -1;
+
+    if (len < off + 8)
+	return -1;
+    return off;
+}
+
+/*
+ * Return the key used to match a response to its request.  Requests
+ * and responses give the same key, 0 means there is nothing in the
+ * packet to match on.
+ */
+static uint32_t
+msg_key(const unsigned char *d, unsigned int len)
+{
+    unsigned int off, ptype;
+
+    if (len < 4 || d[0] != 6 || (d[3] & 0x80))
+	return 0;
+
+    if ((d[3] & 0x1f) == 6) {
+	/* ASF, the tag follows the IANA number and message type. */
+	if (len < 10)
+	    return 0;
+	return (1 << 24) | d[9];
+    }
+    if ((d[3] & 0x1f) != 7 || len < 5)
+	return 0;
+
+    if ((d[4] & 0x0f) == 6) {
+	/* RMCP+ */
+	if (len < 6)
+	    return 0;
+	ptype = d[5] & 0x3f;
+	off = 6;
+	if (ptype == 2)
+	    off += 6; /* OEM IANA and payload ID */
+	off += 10; /* Session ID, sequence and length */
+	if (len <= off)
+	    return 0;
+	if (ptype >= 0x10 && ptype <= 0x15)
+	    return (3 << 24) | ((ptype & ~1) << 8) | d[off];
+	if (ptype != 0 || (d[5] & 0x80))
+	    return 0;
+    } else {
+	off = 4 + 1 + 4 + 4;
+	if (d[4] & 0x0f)
+	    off += 16;
+	off++; /* Message length */
+    }
+
+    /* The netfn, rqSeq and cmd are in the same place both ways. */
+    if (len < off + 6)
+	return 0;
+    return ((2 << 24) | ((d[off + 1] & 0xf8) << 14) | (d[off + 5] << 8)
+	    | (d[off + 4] >> 2));
+}
+
+static int
+read_capture(const char *filename, int server_port,
+	     req_t **rreqs, unsigned int *rnum_reqs)
+{
+    FILE          *f;
+    unsigned char fh[24], ph[16], *d = NULL;
+    unsigned int  linktype, caplen, size = 0, dlen;
+    int           swap, nsec, off;
+    double        ts, first = -1;
+    req_t         *reqs = NULL, *nr;
+    unsigned int  num_reqs = 0, reqs_size = 0;
+    uint32_t      magic;
+
+    f = fopen(filename, "r");
+    if (!f) {
+	fprintf(stderr, "Unable to open %s: %s\n", filename, strerror(errno));
+	return -1;
+    }
+
+    if (fread(fh, sizeof(fh), 1, f) != 1)
+	goto bad_file;
+    magic = get32(fh, 0);
+    if (magic == PCAP_MAGIC || magic == PCAP_MAGIC_NSEC)
+	swap = 0;
+    else if (get32(fh, 1) == PCAP_MAGIC || get32(fh, 1) == PCAP_MAGIC_NSEC)
+	swap = 1;
+    else
+	goto bad_file;
+    nsec = get32(fh, swap) == PCAP_MAGIC_NSEC;
+    linktype = get32(fh + 20, swap);
+    if (linktype != LINKTYPE_ETHERNET && linktype != LINKTYPE_RAW
+	&& linktype != LINKTYPE_LINUX_SLL)
+    {
+	fprintf(stderr, "%s: unsupported link type %u\n", filename, linktype);
+	fclose(f);
+	return -1;
+    }
+
+    while (fread(ph, sizeof(ph), 1, f) == 1) {
+	caplen = get32(ph + 8, swap);
+	if (caplen > 262144)
+	    goto bad_file;
+	if (caplen > size) {
+	    free(d);
+	    size = caplen;
+	    d = malloc(size);
+	    if (!d)
+		goto out_nomem;
+	}
+	if (caplen && fread(d, caplen, 1, f) != 1)
+	    goto bad_file;
+
+	off = find_udp(linktype, d, caplen);
+	if (off < 0)
+	    continue;
+	if (server_port == 0)
+	    server_port = (d[off + 2] << 8) | d[off + 3];
+	if (((d[off + 2] << 8) | d[off + 3]) != server_port)
+	    continue;
+	dlen = ((d[off + 4] << 8) | d[off + 5]);
+	if (dlen < 8 || off + dlen > caplen)
+	    continue; /* Truncated */
+	dlen -= 8;
+
+	ts = get32(ph, swap) + get32(ph + 4, swap) / (nsec ? 1e9 : 1e6);
+	if (first < 0)
+	    first = ts;
+
+	if (num_reqs >= reqs_size) {
+	    reqs_size = reqs_size ? reqs_size * 2 : 256;
+	    nr = realloc(reqs, reqs_size * sizeof(*reqs));
+	    if (!nr)
+		goto out_nomem;
+	    reqs = nr;
+	}
+	reqs[num_reqs].time = ts - first;
+	reqs[num_reqs].len = dlen;
+	reqs[num_reqs].data = malloc(dlen ? dlen : 1);
+	if (!reqs[num_reqs].data)
+	    goto out_nomem;
+	memcpy(reqs[num_reqs].data, d + off + 8, dlen);
+	reqs[num_reqs].key = msg_key(reqs[num_reqs].data, dlen);
+	num_reqs++;
+    }
+
+    free(d);
+    fclose(f);
+    *rreqs = reqs;
+    *rnum_reqs = num_reqs;
+    return 0;
+
+ bad_file:
+    fprintf(stderr, "%s: not a valid pcap file\n", filename);
+    goto out_err;
+ out_nomem:
+    fprintf(stderr, "Out of memory\n");
+ out_err:
+    free(d);
+    fclose(f);
+    return -1;
+}
+
+static double
+now(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + (tv.tv_usec / 1000000.0);
+}
+
+static int
+cmp_double(const void *a, const void *b)
+{
+    double da = *(const double *) a, db = *(const double *) b;
+
+    return da < db ? -1 : da > db;
+}
+
+static double
+percentile(double *v, unsigned long n, double p)
+{
+    unsigned long i = p * n / 100;
+
+    if (i >= n)
+	i = n - 1;
+    return v[i] * 1000000;
+}
+
+int
+main(int argc, char *argv[])
+{
+    char            *host = "localhost";
+    char            *port = "623";
+    int             server_port = 0;
+    double          speedup = 1.0;
+    int             fast = 0;
+    int             window = 1;
+    unsigned long   loops = 1;
+    double          timeout = 1.0;
+    struct addrinfo hints, *res0;
+    int             sock;
+    int             i, rv;
+    char            *end;
+    req_t           *reqs;
+    unsigned int    num_reqs;
+    double          *lat;
+    unsigned long   total, sent = 0, nlat = 0, lost = 0, unmatched = 0;
+    pend_t          pending[MAX_WINDOW];
+    unsigned int    pend_count = 0, j;
+    uint32_t        key;
+    unsigned char   buf[1024];
+    double          start, t, next, elapsed, tmo;
+    struct pollfd   pfd;
+
+    progname = argv[0];
+
+    for (i=1; i<argc; i++) {
+	if (argv[i][0] != '-')
+	    break;
+	if (strcmp(argv[i], "--") == 0) {
+	    i++;
+	    break;
+	} else if (strcmp(argv[i], "-f") == 0) {
+	    fast = 1;
+	} else if (i + 1 >= argc) {
+	    fprintf(stderr, "No parameter given for %s\n\n", argv[i]);
+	    usage();
+	} else if (strcmp(argv[i], "-p") == 0) {
+	    port = argv[++i];
+	} else if (strcmp(argv[i], "-P") == 0) {
+	    server_port = strtoul(argv[++i], &end, 0);
+	    if (server_port <= 0 || server_port > 65535 || *end != '\0') {
+		fprintf(stderr, "Invalid port specified for -P\n\n");
+		usage();
+	    }
+	} else if (strcmp(argv[i], "-s") == 0) {
+	    speedup = strtod(argv[++i], &end);
+	    if (speedup <= 0 || *end != '\0') {
+		fprintf(stderr, "Invalid speedup specified for -s\n\n");
+		usage();
+	    }
+	} else if (strcmp(argv[i], "-w") == 0) {
+	    window = strtoul(argv[++i], &end, 0);
+	    if (window < 1 || window > MAX_WINDOW || *end != '\0') {
+		fprintf(stderr, "Invalid window specified for -w\n\n");
+		usage();
+	    }
+	} else if (strcmp(argv[i], "-l") == 0) {
+	    loops = strtoul(argv[++i], &end, 0);
+	    if (loops < 1 || *end != '\0') {
+		fprintf(stderr, "Invalid count specified for -l\n\n");
+		usage();
+	    }
+	} else if (strcmp(argv[i], "-t") == 0) {
+	    timeout = strtoul(argv[++i], &end, 0) / 1000.0;
+	    if (timeout <= 0 || *end != '\0') {
+		fprintf(stderr, "Invalid timeout specified for -t\n\n");
+		usage();
+	    }
+	} else
+	    usage();
+    }
+    if (i >= argc)
+	usage();
+    if (read_capture(argv[i], server_port, &reqs, &num_reqs))
+	exit(1);
+    if (num_reqs == 0) {
+	fprintf(stderr, "No requests found in %s\n", argv[i]);
+	exit(1);
+    }
+    i++;
+    if (i < argc)
+	host = argv[i];
+    if (!fast)
+	window = MAX_WINDOW;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = PF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+    rv = getaddrinfo(host, port, &hints, &res0);
+    if (rv) {
+	fprintf(stderr, "Invalid address %s:%s: %s\n", host, port,
+		gai_strerror(rv));
+	exit(1);
+    }
+    sock = socket(res0->ai_family, SOCK_DGRAM, 0);
+    if (sock == -1) {
+	perror("socket");
+	exit(1);
+    }
+    if (connect(sock, res0->ai_addr, res0->ai_addrlen) == -1) {
+	perror("connect");
+	exit(1);
+    }
+    freeaddrinfo(res0);
+
+    total = num_reqs * loops;
+    lat = malloc(total * sizeof(*lat));
+    if (!lat) {
+	fprintf(stderr, "Out of memory\n");
+	exit(1);
+    }
+
+    pfd.fd = sock;
+    pfd.events = POLLIN;
+    start = now();
+    while (sent < total || pend_count) {
+	t = now();
+
+	/*
+	 * Give up on requests that have waited too long.  pending is
+	 * kept in send order, so the expired ones are at the front.
+	 */
+	for (j = 0; j < pend_count && t - pending[j].time >= timeout; j++)
+	    lost++;
+	if (j) {
+	    pend_count -= j;
+	    memmove(pending, pending + j, pend_count * sizeof(*pending));
+	}
+
+	next = t;
+	while (sent < total && pend_count < (unsigned int) window) {
+	    req_t *r = &reqs[sent % num_reqs];
+
+	    if (!fast) {
+		next = start + ((sent / num_reqs) * reqs[num_reqs - 1].time
+				+ r->time) / speedup;
+		if (next > t)
+		    break;
+	    }
+	    if (send(sock, r->data, r->len, 0) == -1
+		&& errno != ECONNREFUSED)
+	    {
+		perror("send");
+		exit(1);
+	    }
+	    pending[pend_count].time = t;
+	    pending[pend_count].key = r->key;
+	    pend_count++;
+	    sent++;
+	}
+
+	/* Wait for a response, the next send, or the oldest timeout. */
+	tmo = 1.0;
+	if (pend_count)
+	    tmo = pending[0].time + timeout - t;
+	if (sent < total && pend_count < (unsigned int) window
+	    && next - t < tmo)
+	    tmo = next - t;
+	if (tmo < 0)
+	    tmo = 0;
+	rv = poll(&pfd, 1, (int) (tmo * 1000) + (tmo > 0));
+	if (rv == -1) {
+	    if (errno == EINTR)
+		continue;
+	    perror("poll");
+	    exit(1);
+	}
+	if (rv == 0)
+	    continue;
+
+	for (;;) {
+	    rv = recv(sock, buf, sizeof(buf), MSG_DONTWAIT);
+	    if (rv == -1)
+		break;
+	    t = now();
+	    key = msg_key(buf, rv);
+	    for (j = 0; j < pend_count; j++) {
+		if (pending[j].key == key)
+		    break;
+	    }
+	    if (j == pend_count) {
+		unmatched++;
+		continue;
+	    }
+	    lat[nlat++] = t - pending[j].time;
+	    pend_count--;
+	    memmove(pending + j, pending + j + 1,
+		    (pend_count - j) * sizeof(*pending));
+	}
+    }
+    elapsed = now() - start;
+
+    printf("%lu requests in %.2f seconds, %.0f reqs/s, %lu responses, "
+	   "%lu lost, %lu unmatched\n", sent, elapsed, sent / elapsed, nlat,
+	   lost, unmatched);
+    if (nlat) {
+	qsort(lat, nlat, sizeof(*lat), cmp_double);
+	printf("latency usec: min %.0f p50 %.0f p90 %.0f p99 %.0f"
+	       " p99.9 %.0f max %.0f\n",
+	       lat[0] * 1000000, percentile(lat, nlat, 50),
+	       percentile(lat, nlat, 90), percentile(lat, nlat, 99),
+	       percentile(lat, nlat, 99.9), lat[nlat - 1] * 1000000);
+    }
+
+    close(sock);
+    return 0;
+}
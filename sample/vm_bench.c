@@ -0,0 +1,295 @@
+/*
+ * vm_bench.c
+ *
+ * Measure the message rate of a VM serial interface, like the one
+ * provided by ipmi_sim for virtual machines.
+ *
+ * Author: MontaVista Software, Inc.
+ *         Corey Minyard <minyard@mvista.com>
+ *         source@mvista.com
+ *
+ * Copyright 2012 MontaVista Software Inc.
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2 of
+ *  the License, or (at your option) any later version.
+ *
+ *
+ *  THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ *  WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ *  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ *  OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ *  TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ *  USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this program; if not, write to the Free
+ *  Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * This is the same thing the driver in a VM sees: messages framed
+ * with the VM serial codec, a sequence number, netfn/lun, command,
+ * data and a checksum.  A window of Get Device ID requests is kept
+ * outstanding and the responses are counted, so this shows how fast
+ * the simulator can feed a guest that is pulling messages as fast
+ * as it can.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+
+#define VM_MSG_CHAR	0xA0 /* Marks end of message */
+#define VM_CMD_CHAR	0xA1 /* Marks end of a command */
+#define VM_ESCAPE_CHAR	0xAA /* Set bit 4 from the next byte to 0 */
+
+#define APP_NETFN		0x06
+#define GET_DEVICE_ID_CMD	0x01
+
+#define MAX_WINDOW	64
+
+static char *progname;
+
+static void
+usage(void)
+{
+    fprintf(stderr,
+	    "Send Get Device ID requests to a VM serial interface as fast\n");
+    fprintf(stderr,
+	    "as possible and print the number of messages per second\n");
+    fprintf(stderr,
+	    "Usage:\n");
+    fprintf(stderr,
+	    "  %s [-p <port>] [-t <seconds>] [-w <window>] [host]\n",
+	    progname);
+    fprintf(stderr,
+	    "    -p - Destination port, defaults to 9002\n");
+    fprintf(stderr,
+	    "    -t - Number of seconds to run (default 5)\n");
+    fprintf(stderr,
+	    "    -w - Number of requests kept outstanding, 1-%d"
+	    " (default 1)\n", MAX_WINDOW);
+    fprintf(stderr,
+	    "    host - the host running the simulator, default localhost\n");
+    exit(1);
+}
+
+static unsigned char
+checksum(unsigned char *data, int size, unsigned char csum)
+{
+    int i;
+
+    for (i = 0; i < size; i++)
+	csum += data[i];
+    return csum;
+}
+
+static void
+add_char(unsigned char ch, unsigned char *c, unsigned int *pos)
+{
+    switch (ch) {
+    case VM_MSG_CHAR:
+    case VM_CMD_CHAR:
+    case VM_ESCAPE_CHAR:
+	c[(*pos)++] = VM_ESCAPE_CHAR;
+	c[(*pos)++] = ch | 0x10;
+	break;
+
+    default:
+	c[(*pos)++] = ch;
+    }
+}
+
+static int
+send_request(int sock, unsigned char seq)
+{
+    unsigned char msg[3];
+    unsigned char out[10];
+    unsigned int  len = 0;
+    unsigned int  i;
+
+    msg[0] = seq;
+    msg[1] = APP_NETFN << 2;
+    msg[2] = GET_DEVICE_ID_CMD;
+    for (i = 0; i < sizeof(msg); i++)
+	add_char(msg[i], out, &len);
+    add_char(-checksum(msg, sizeof(msg), 0), out, &len);
+    out[len++] = VM_MSG_CHAR;
+
+    if (write(sock, out, len) != (ssize_t) len)
+	return -1;
+    return 0;
+}
+
+static double
+now(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + (tv.tv_usec / 1000000.0);
+}
+
+int
+main(int argc, char *argv[])
+{
+    char            *host = "localhost";
+    char            *port = "9002";
+    double          secs = 5.0;
+    int             window = 1;
+    struct addrinfo hints, *res0;
+    int             sock;
+    int             i, rv;
+    char            *end;
+    unsigned char   buf[4096];
+    unsigned char   msg[300];
+    unsigned int    msg_len = 0;
+    int             in_escape = 0;
+    unsigned char   seq = 0;
+    unsigned long   count = 0, errors = 0;
+    double          start, elapsed;
+    int             val = 1;
+
+    progname = argv[0];
+
+    for (i=1; i<argc; i++) {
+	if (argv[i][0] != '-')
+	    break;
+	if (strcmp(argv[i], "--") == 0) {
+	    i++;
+	    break;
+	} else if (strcmp(argv[i], "-p") == 0) {
+	    i++;
+	    if (i >= argc) {
+		fprintf(stderr, "No parameter given for -p\n\n");
+		usage();
+	    }
+	    port = argv[i];
+	} else if (strcmp(argv[i], "-t") == 0) {
+	    i++;
+	    if (i >= argc) {
+		fprintf(stderr, "No parameter given for -t\n\n");
+		usage();
+	    }
+	    secs = strtod(argv[i], &end);
+	    if (secs <= 0 || *end != '\0') {
+		fprintf(stderr, "Invalid time specified for -t\n\n");
+		usage();
+	    }
+	} else if (strcmp(argv[i], "-w") == 0) {
+	    i++;
+	    if (i >= argc) {
+		fprintf(stderr, "No parameter given for -w\n\n");
+		usage();
+	    }
+	    window = strtoul(argv[i], &end, 0);
+	    if (window < 1 || window > MAX_WINDOW || *end != '\0') {
+		fprintf(stderr, "Invalid window specified for -w\n\n");
+		usage();
+	    }
+	} else
+	    usage();
+    }
+    if (i < argc)
+	host = argv[i];
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = PF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    rv = getaddrinfo(host, port, &hints, &res0);
+    if (rv) {
+	fprintf(stderr, "Invalid address %s:%s: %s\n", host, port,
+		gai_strerror(rv));
+	exit(1);
+    }
+
+    sock = socket(res0->ai_family, SOCK_STREAM, 0);
+    if (sock == -1) {
+	perror("socket");
+	exit(1);
+    }
+    if (connect(sock, res0->ai_addr, res0->ai_addrlen) == -1) {
+	perror("connect");
+	exit(1);
+    }
+    freeaddrinfo(res0);
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &val, sizeof(val));
+
+    for (i = 0; i < window; i++) {
+	if (send_request(sock, seq++) == -1) {
+	    perror("write");
+	    exit(1);
+	}
+    }
+
+    start = now();
+    for (;;) {
+	rv = read(sock, buf, sizeof(buf));
+	if (rv <= 0) {
+	    if (rv == -1 && errno == EINTR)
+		continue;
+	    fprintf(stderr, "Connection closed\n");
+	    exit(1);
+	}
+
+	for (i = 0; i < rv; i++) {
+	    unsigned char ch = buf[i];
+
+	    if (ch == VM_CMD_CHAR) {
+		/* Version, capabilities, attention; nothing to do. */
+		msg_len = 0;
+		in_escape = 0;
+		continue;
+	    } else if (ch == VM_ESCAPE_CHAR) {
+		in_escape = 1;
+		continue;
+	    } else if (ch != VM_MSG_CHAR) {
+		if (in_escape) {
+		    ch &= ~0x10;
+		    in_escape = 0;
+		}
+		if (msg_len < sizeof(msg))
+		    msg[msg_len++] = ch;
+		continue;
+	    }
+
+	    if (msg_len < 5 || checksum(msg, msg_len, 0) != 0
+		|| (msg[1] >> 2) != (APP_NETFN | 1) || msg[3] != 0)
+		errors++;
+	    else
+		count++;
+	    msg_len = 0;
+
+	    if (send_request(sock, seq++) == -1) {
+		perror("write");
+		exit(1);
+	    }
+	}
+
+	elapsed = now() - start;
+	if (elapsed >= secs)
+	    break;
+    }
+
+    printf("%lu messages in %.2f seconds, %.0f msgs/s, window %d",
+	   count, elapsed, count / elapsed, window);
+    if (errors)
+	printf(", %lu bad responses", errors);
+    printf("\n");
+
+    close(sock);
+    return 0;
+}
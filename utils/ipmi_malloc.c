@@ -55,6 +55,7 @@
 
 #include <config.h>
 #include <string.h>
+#include <errno.h>
 
 #ifdef HAVE_EXECINFO_H
 #include <execinfo.h> /* For backtrace() */
@@ -376,6 +377,310 @@ ipmi_debug_malloc_cleanup(void)
     }
 }
 
+/*
+ * Object pools.  The library allocates and frees a lot of small
+ * objects of a few sizes: message items, events, list items and the
+ * callback information for every request.  When pools are enabled,
+ * these are served from fixed-size pools and are kept for reuse when
+ * freed instead of going back to the OS handler every time.
+ *
+ * Each object has a small header telling which pool it came from.
+ * Freed objects go to a small per-thread cache and are moved to and
+ * from the pool's shared free list in batches, so the pool lock is
+ * only taken once every few operations.  If a shared free list grows
+ * past POOL_MAX_FREE, the extra objects are given back to the OS.
+ * Objects sitting in the cache of a thread that exits are lost.
+ * ipmi_mem_pool_release() gives all the free objects back, so leak
+ * checkers only see what is really still allocated, and destroys the
+ * pool lock.  It is created again if the library is initialized again.
+ */
+
+#define POOL_HDR_SIZE	16
+#define NUM_POOLS	5
+#define POOL_BATCH	8
+#define POOL_CACHE_MAX	(POOL_BATCH * 2)
+#define POOL_MAX_FREE	1024
+#define POOL_NONE	0xffffffff
+
+typedef struct pool_hdr_s
+{
+    unsigned int      pool;
+    struct pool_hdr_s *next; /* Only used while on a free list. */
+} pool_hdr_t;
+
+/* Sizes include the header. */
+static const unsigned int pool_sizes[NUM_POOLS] = { 32, 64, 128, 256, 512 };
+
+static struct
+{
+    pool_hdr_t    *free;
+    unsigned int  free_count;
+    unsigned long total;
+    unsigned long hits;
+    unsigned long misses;
+} pools[NUM_POOLS];
+
+int __ipmi_malloc_pools = 0;
+static int pools_enabled;
+static os_hnd_lock_t *pool_lock;
+
+#ifdef __GNUC__
+#define POOL_THREAD_CACHE
+
+struct pool_cache
+{
+    pool_hdr_t    *free;
+    unsigned int  count;
+    unsigned long hits; /* Added to the pool's count in pool_flush_hits() */
+};
+
+static __thread struct pool_cache pool_caches[NUM_POOLS];
+#endif
+
+static void
+pool_lock_get(void)
+{
+    if (pool_lock)
+	malloc_os_hnd->lock(malloc_os_hnd, pool_lock);
+}
+
+static void
+pool_unlock(void)
+{
+    if (pool_lock)
+	malloc_os_hnd->unlock(malloc_os_hnd, pool_lock);
+}
+
+#ifdef POOL_THREAD_CACHE
+/* Must be called with the pool lock held. */
+static void
+pool_flush_hits(unsigned int idx, struct pool_cache *c)
+{
+    pools[idx].hits += c->hits;
+    c->hits = 0;
+}
+
+static void
+pool_refill(unsigned int idx, struct pool_cache *c)
+{
+    pool_hdr_t *o;
+
+    pool_lock_get();
+    pool_flush_hits(idx, c);
+    while (pools[idx].free && (c->count < POOL_BATCH)) {
+	o = pools[idx].free;
+	pools[idx].free = o->next;
+	pools[idx].free_count--;
+	o->next = c->free;
+	c->free = o;
+	c->count++;
+    }
+    pool_unlock();
+}
+
+static void
+pool_drain(unsigned int idx, struct pool_cache *c)
+{
+    pool_hdr_t *o, *to_free = NULL;
+
+    pool_lock_get();
+    pool_flush_hits(idx, c);
+    while (c->count > POOL_BATCH) {
+	o = c->free;
+	c->free = o->next;
+	c->count--;
+	if (pools[idx].free_count >= POOL_MAX_FREE) {
+	    pools[idx].total--;
+	    o->next = to_free;
+	    to_free = o;
+	} else {
+	    o->next = pools[idx].free;
+	    pools[idx].free = o;
+	    pools[idx].free_count++;
+	}
+    }
+    pool_unlock();
+
+    while (to_free) {
+	o = to_free;
+	to_free = o->next;
+	malloc_os_hnd->mem_free(o);
+    }
+
+    if (pool_lock) {
+	malloc_os_hnd->destroy_lock(malloc_os_hnd, pool_lock);
+	pool_lock = NULL;
+    }
+}
+#endif
+
+static void *
+pool_alloc(size_t size)
+{
+    unsigned int idx;
+    pool_hdr_t   *o = NULL;
+
+    for (idx=0; idx<NUM_POOLS; idx++) {
+	if (size + POOL_HDR_SIZE <= pool_sizes[idx])
+	    break;
+    }
+    if (idx == NUM_POOLS) {
+	/* Too big for a pool, still needs the header. */
+	o = malloc_os_hnd->mem_alloc(size + POOL_HDR_SIZE);
+	if (!o)
+	    return NULL;
+	o->pool = POOL_NONE;
+	return ((char *) o) + POOL_HDR_SIZE;
+    }
+
+#ifdef POOL_THREAD_CACHE
+    {
+	struct pool_cache *c = &pool_caches[idx];
+
+	if (!c->free)
+	    pool_refill(idx, c);
+	if (c->free) {
+	    o = c->free;
+	    c->free = o->next;
+	    c->count--;
+	    c->hits++;
+	}
+    }
+#else
+    pool_lock_get();
+    if (pools[idx].free) {
+	o = pools[idx].free;
+	pools[idx].free = o->next;
+	pools[idx].free_count--;
+	pools[idx].hits++;
+    }
+    pool_unlock();
+#endif
+
+    if (!o) {
+	o = malloc_os_hnd->mem_alloc(pool_sizes[idx]);
+	if (!o)
+	    return NULL;
+	o->pool = idx;
+	pool_lock_get();
+	pools[idx].total++;
+	pools[idx].misses++;
+	pool_unlock();
+    }
+
+    return ((char *) o) + POOL_HDR_SIZE;
+}
+
+static void
+pool_free(void *data)
+{
+    pool_hdr_t   *o;
+    unsigned int idx;
+
+    if (!data)
+	return;
+
+    o = (pool_hdr_t *) (((char *) data) - POOL_HDR_SIZE);
+    idx = o->pool;
+    if (idx == POOL_NONE) {
+	malloc_os_hnd->mem_free(o);
+	return;
+    }
+
+#ifdef POOL_THREAD_CACHE
+    {
+	struct pool_cache *c = &pool_caches[idx];
+
+	o->next = c->free;
+	c->free = o;
+	c->count++;
+	if (c->count > POOL_CACHE_MAX)
+	    pool_drain(idx, c);
+    }
+#else
+    pool_lock_get();
+    if (pools[idx].free_count >= POOL_MAX_FREE) {
+	pools[idx].total--;
+	pool_unlock();
+	malloc_os_hnd->mem_free(o);
+	return;
+    }
+    o->next = pools[idx].free;
+    pools[idx].free = o;
+    pools[idx].free_count++;
+    pool_unlock();
+#endif
+}
+
+void
+ipmi_mem_pool_release(void)
+{
+    pool_hdr_t   *o, *to_free = NULL;
+    unsigned int idx;
+
+    if (!pools_enabled)
+	return;
+
+    pool_lock_get();
+    for (idx=0; idx<NUM_POOLS; idx++) {
+#ifdef POOL_THREAD_CACHE
+	struct pool_cache *c = &pool_caches[idx];
+
+	pool_flush_hits(idx, c);
+	while (c->free) {
+	    o = c->free;
+	    c->free = o->next;
+	    c->count--;
+	    pools[idx].total--;
+	    o->next = to_free;
+	    to_free = o;
+	}
+#endif
+	while (pools[idx].free) {
+	    o = pools[idx].free;
+	    pools[idx].free = o->next;
+	    pools[idx].free_count--;
+	    pools[idx].total--;
+	    o->next = to_free;
+	    to_free = o;
+	}
+    }
+    pool_unlock();
+
+    while (to_free) {
+	o = to_free;
+	to_free = o->next;
+	malloc_os_hnd->mem_free(o);
+    }
+}
+
+unsigned int
+ipmi_mem_pool_count(void)
+{
+    if (!pools_enabled)
+	return 0;
+    return NUM_POOLS;
+}
+
+int
+ipmi_mem_pool_get_stats(unsigned int pool, ipmi_mem_pool_stats_t *stats)
+{
+    if (!pools_enabled || (pool >= NUM_POOLS))
+	return EINVAL;
+
+    pool_lock_get();
+#ifdef POOL_THREAD_CACHE
+    pool_flush_hits(pool, &pool_caches[pool]);
+#endif
+    stats->size = pool_sizes[pool] - POOL_HDR_SIZE;
+    stats->total = pools[pool].total;
+    stats->free = pools[pool].free_count;
+    stats->hits = pools[pool].hits;
+    stats->misses = pools[pool].misses;
+    pool_unlock();
+    return 0;
+}
+
 void *
 ipmi_mem_alloc(int size)
 {
@@ -384,6 +689,12 @@ ipmi_mem_alloc(int size)
     static int    seed;
     int           i;
 
+    if (pools_enabled) {
+	if (size < 0)
+	    return NULL;
+	return pool_alloc(size);
+    }
+
     if (DEBUG_MALLOC) {
 #ifdef HAVE_EXECINFO_H
 	void *tb[TB_SIZE+1];
@@ -408,6 +719,11 @@ ipmi_mem_alloc(int size)
 void
 ipmi_mem_free(void *data)
 {
+    if (pools_enabled) {
+	pool_free(data);
+	return;
+    }
+
     if (DEBUG_MALLOC) {
 #ifdef HAVE_EXECINFO_H
 	void *tb[TB_SIZE+1];
@@ -468,7 +784,23 @@ ipmi_strndup(const char *str, int n)
 int
 ipmi_malloc_init(os_handler_t *os_hnd)
 {
-    if (!malloc_os_hnd)
-	malloc_os_hnd = os_hnd;
+    if (malloc_os_hnd) {
+	/* The pool lock goes away in ipmi_mem_pool_release(). */
+	if (pools_enabled && !pool_lock && malloc_os_hnd->create_lock)
+	    malloc_os_hnd->create_lock(malloc_os_hnd, &pool_lock);
+	return 0;
+    }
+
+    malloc_os_hnd = os_hnd;
+
+    /* Whether pools are used can't change once something has been
+       allocated, so it is decided here.  Debugging needs to see
+       every allocation, so it wins. */
+    if (__ipmi_malloc_pools && !DEBUG_MALLOC) {
+	if (os_hnd->create_lock
+	    && os_hnd->create_lock(os_hnd, &pool_lock))
+	    return 0;
+	pools_enabled = 1;
+    }
     return 0;
 }